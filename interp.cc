@@ -0,0 +1,421 @@
+// interp.cc -- tier-0 execution engine (IR interpreter)
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "interp.hh"
+
+# include <algorithm> // copy, find_if, max, none_of
+# include <cstring>   // memcpy
+# include <limits>    // numeric_limits
+
+# include "opt.hh"
+
+namespace rsn::opt {
+   namespace { // handlers (the order of binops, selects, and vector binops follows insn_binop::op and insn_select::op)
+      enum { _mov, _load, _store, _binop, _select = _binop + 16, _vload = _select + 3, _vstore, _vbinop, _jmp = _vbinop + 16,
+         _beq, _bult, _bslt, _switch_br, _call, _call_ind, _ret, _oops };
+   }
+   static constexpr unsigned max_depth = 10000; // maximum nesting of calls
+
+   union interpreter::cell {
+      const void *handler;
+      std::size_t slot;   // frame slot (or number of operands that follow)
+      const cell *target; // jump target
+      code *callee;       // call target
+   };
+
+   struct interpreter::code { // decoded procedure
+      lib::smart_ptr<proc> pc;
+      std::vector<cell> cells;
+      /* Frame layout: VRs (by vreg::sn), a scratch slot for cyclic phi copies, vector VRs (as many slots as each one needs), constants, the
+         number of results, and the results (which insn_ret stores there for the caller) */
+      std::size_t const_base, results_base, frame_size;
+      std::vector<unsigned long long> consts; // initial values of constant slots
+      std::vector<std::size_t> params;        // slots of the parameters of insn_entry
+   };
+
+   const void *const *interpreter::handlers;
+}
+
+rsn::opt::interpreter::interpreter(std::function<void *(const rel_base *)> resolver, std::size_t stack_size)
+   : resolver(std::move(resolver)), stack(new unsigned long long[stack_size]), stack_end(stack.get() + stack_size) {
+   if (RSN_UNLIKELY(!handlers)) execute({}, {});
+}
+
+rsn::opt::interpreter::~interpreter() = default;
+
+void rsn::opt::interpreter::reset() noexcept {
+   procs.clear(), blocks.clear(), addresses.clear(), pending.clear();
+}
+
+bool rsn::opt::interpreter::run(proc *pc, const std::vector<unsigned long long> &args, std::vector<unsigned long long> &results) {
+   const auto cd = get(pc);
+   while (RSN_UNLIKELY(!pending.empty())) { const auto next = pending.back(); pending.pop_back(), decode(*next); }
+   if (RSN_UNLIKELY(args.size() != cd->params.size()) || RSN_UNLIKELY(stack_end - stack.get() < (long)cd->frame_size)) return false;
+   for (std::size_t sn = 0; sn < args.size(); ++sn) stack[cd->params[sn]] = args[sn];
+   if (RSN_UNLIKELY(!execute(cd, stack.get()))) return false;
+   const auto res = stack.get() + cd->results_base;
+   return results.assign(res + 1, res + 1 + res[0]), true;
+}
+
+auto rsn::opt::interpreter::get(proc *pc)->code * {
+   auto &res = procs[pc->id];
+   if (RSN_UNLIKELY(!res)) {
+      res.reset(new code{pc, {}, 0, 0, 0, {}, {}}), pending.push_back(res.get());
+      addresses.insert({reinterpret_cast<unsigned long long>(res.get()), res.get()});
+   }
+   return res.get();
+}
+
+bool rsn::opt::interpreter::resolve(operand *op, unsigned long long &res) {
+   if (is<abs>(op)) return res = as<abs>(op)->val, true;
+   if (is<rel_disp>(op)) return resolve(as<rel_disp>(op)->base, res) && (res += as<rel_disp>(op)->add, true);
+   if (is<proc>(op)) return res = reinterpret_cast<unsigned long long>(get(as<proc>(op))), true;
+   if (is<data>(op)) {
+      auto &block = blocks[as<data>(op)->id];
+      if (RSN_UNLIKELY(!block)) { // materialize (after registering the block, in case it refers to itself)
+         const auto &values = as<data>(op)->values;
+         block.reset(new unsigned long long[std::max<std::size_t>(values.size(), 1)]{});
+         for (std::size_t sn = 0; sn < values.size(); ++sn) if (RSN_UNLIKELY(!resolve(values[sn], block[sn]))) block[sn] = 0;
+      }
+      return res = reinterpret_cast<unsigned long long>(block.get()), true;
+   }
+   const auto addr = resolver ? resolver(as<rel_base>(op)) : nullptr;
+   return res = reinterpret_cast<unsigned long long>(addr), addr;
+}
+
+void rsn::opt::interpreter::decode(code &cd) {
+   const cfg_info cfg(cd.pc);
+   const auto vr_count = number_vregs(cd.pc);
+   const auto scratch = vr_count;
+   std::vector<std::size_t> vector_slots(vr_count), vector_sizes(vr_count); // of vector VRs (in slots)
+   for (auto bb: cfg.bblocks) if (RSN_LIKELY(cfg.reachable(bb))) for (auto in = bb->head(); in; in = in->next()) {
+      if (is<insn_vload>(in))
+         vector_sizes[as<insn_vload>(in)->dest()->sn] = std::max<std::size_t>(vector_sizes[as<insn_vload>(in)->dest()->sn],
+            (as<insn_vload>(in)->lanes * as<insn_vload>(in)->width + 7) / 8);
+      else
+      if (is<insn_vbinop>(in))
+         vector_sizes[as<insn_vbinop>(in)->dest()->sn] = std::max<std::size_t>(vector_sizes[as<insn_vbinop>(in)->dest()->sn],
+            (as<insn_vbinop>(in)->lanes * as<insn_vbinop>(in)->width + 7) / 8);
+   }
+   cd.const_base = scratch + 1;
+   for (std::size_t sn = 0; sn < vr_count; ++sn) if (RSN_UNLIKELY(vector_sizes[sn])) vector_slots[sn] = cd.const_base, cd.const_base += vector_sizes[sn];
+   std::map<unsigned long long, std::size_t> consts;
+   std::size_t max_results = 0;
+
+   auto &cells = cd.cells;
+   std::vector<std::size_t> starts(cfg.bblocks.size());          // positions of BBs in cells (indexed by bblock::sn)
+   std::vector<std::pair<std::size_t, bblock *>> bb_fixups;      // jump targets to patch (positions in cells and BBs)
+   std::map<std::pair<bblock *, bblock *>, std::size_t> edges;   // edges that need phi copies (and their indexes in edge_list)
+   std::vector<std::pair<bblock *, bblock *>> edge_list;
+   std::vector<std::pair<std::size_t, std::size_t>> edge_fixups; // jump targets to patch (positions in cells and indexes in edge_list)
+
+   // the (first) slot for a VR, and for an operand (false if it refers to an unresolved symbol)
+   const auto reg = [&](vreg *vr) noexcept{ return RSN_UNLIKELY(vector_sizes[vr->sn]) ? vector_slots[vr->sn] : vr->sn; };
+   const auto slot = [&](operand *op, std::size_t &res){
+      if (is<vreg>(op)) return res = reg(as<vreg>(op)), true;
+      unsigned long long val;
+      if (RSN_UNLIKELY(!resolve(op, val))) return false;
+      return res = consts.insert({val, cd.const_base + consts.size()}).first->second, true;
+   };
+   const auto push = [&](std::size_t slot){ cell res; res.slot = slot, cells.push_back(res); };
+   // the number of slots to copy for an assignment to dest (a vector VR is copied slot by slot, but a scalar source only to the first slot)
+   const auto size = [&](vreg *dest, operand *src){ return is<vreg>(src) ? std::max<std::size_t>(vector_sizes[dest->sn], 1) : 1; };
+   const auto emit = [&](auto handler, std::initializer_list<std::size_t> slots = {}){
+      cells.push_back({handlers[handler]});
+      for (auto it: slots) push(it);
+   };
+   // a jump target for the edge pred->bb (through phi copies, if any)
+   const auto target = [&](bblock *pred, bblock *bb){
+      if (RSN_LIKELY(!is<insn_phi>(bb->head()))) return bb_fixups.push_back({cells.size(), bb}), cells.push_back({});
+      const auto it = edges.insert({{pred, bb}, edges.size()});
+      if (it.second) edge_list.push_back({pred, bb});
+      edge_fixups.push_back({cells.size(), it.first->second}), cells.push_back({});
+   };
+   // sequentialized parallel copies for phi insns in bb on entry from pred
+   const auto copies = [&](bblock *pred, bblock *bb){
+      std::vector<std::pair<std::size_t, std::size_t>> copies; // destination and source slots
+      for (auto in = bb->head(); is<insn_phi>(in); in = in->next()) {
+         const auto &arg = as<insn_phi>(in)->args()[cfg.pred_index(bb, pred)];
+         std::size_t src;
+         if (RSN_UNLIKELY(!slot(arg, src))) return emit(_oops);
+         if (const auto dest = reg(as<insn_phi>(in)->dest()); RSN_LIKELY(src != dest))
+            for (std::size_t sn = 0; sn < size(as<insn_phi>(in)->dest(), arg); ++sn) copies.push_back({dest + sn, src + sn});
+      }
+      while (!copies.empty()) {
+         const auto it = std::find_if(copies.begin(), copies.end(), [&](const auto &it) noexcept{
+            return std::none_of(copies.begin(), copies.end(), [&](const auto &_it) noexcept{ return _it.second == it.first; });
+         });
+         if (RSN_LIKELY(it != copies.end())) { emit(_mov, {it->second, it->first}), copies.erase(it); continue; }
+         // only cycles remain: break one by saving a destination
+         const auto dest = copies.front().first;
+         emit(_mov, {dest, scratch});
+         for (auto &it: copies) if (it.second == dest) it.second = scratch;
+      }
+   };
+
+   // Decode Reachable BBs /////////////////////////////////////////////////////////////////////////
+   std::vector<bblock *> order;
+   for (auto bb: cfg.bblocks) if (RSN_LIKELY(cfg.reachable(bb))) order.push_back(bb);
+   for (std::size_t bb_sn = 0; bb_sn < order.size(); ++bb_sn) {
+      const auto bb = order[bb_sn];
+      starts[bb->sn] = cells.size();
+      for (auto in = bb->head(); in; in = in->next()) {
+         std::vector<std::size_t> inputs(in->inputs().size());
+         bool resolved = true;
+         for (std::size_t sn = 0; sn < inputs.size(); ++sn) resolved &= slot(in->inputs()[sn], inputs[sn]);
+         if (RSN_UNLIKELY(!resolved)) {
+            emit(_oops); // traps if ever executed
+            break;
+         }
+         if (is<insn_phi>(in) || is<insn_entry>(in)) {
+            if (is<insn_entry>(in) && bb == order.front())
+               for (const auto &param: as<insn_entry>(in)->params()) cd.params.push_back(reg(param));
+         } else
+         if (is<insn_mov>(in))
+            for (std::size_t sn = 0; sn < size(as<insn_mov>(in)->dest(), as<insn_mov>(in)->src()); ++sn)
+               emit(_mov, {inputs[0] + sn, reg(as<insn_mov>(in)->dest()) + sn});
+         else
+         if (is<insn_load>(in))
+            emit(_load, {inputs[0], reg(as<insn_load>(in)->dest())});
+         else
+         if (is<insn_store>(in))
+            emit(_store, {inputs[0], inputs[1]});
+         else
+         if (is<insn_binop>(in))
+            emit(_binop + as<insn_binop>(in)->op, {inputs[0], inputs[1], reg(as<insn_binop>(in)->dest())});
+         else
+         if (is<insn_select>(in))
+            emit(_select + as<insn_select>(in)->op, {inputs[0], inputs[1], inputs[2], inputs[3], reg(as<insn_select>(in)->dest())});
+         else
+         if (is<insn_vload>(in))
+            emit(_vload, {inputs[0], reg(as<insn_vload>(in)->dest()), as<insn_vload>(in)->lanes * as<insn_vload>(in)->width});
+         else
+         if (is<insn_vstore>(in))
+            emit(_vstore, {inputs[0], inputs[1], as<insn_vstore>(in)->lanes * as<insn_vstore>(in)->width});
+         else
+         if (is<insn_vbinop>(in)) {
+            const auto vbinop = as<insn_vbinop>(in);
+            const auto stride = [&](operand *op) noexcept{ return is<vreg>(op) && vector_sizes[as<vreg>(op)->sn] ? vbinop->width : 0; };
+            emit(_vbinop + vbinop->op, {inputs[0], stride(vbinop->lhs()), inputs[1], stride(vbinop->rhs()), reg(vbinop->dest()), vbinop->lanes, vbinop->width});
+         } else
+         if (is<insn_jmp>(in)) {
+            const auto dest = as<insn_jmp>(in)->dest();
+            copies(bb, dest); // the only successor
+            if (RSN_LIKELY(bb_sn + 1 == order.size() || order[bb_sn + 1] != dest)) emit(_jmp), bb_fixups.push_back({cells.size(), dest}), cells.push_back({});
+         } else
+         if (is<insn_br>(in)) {
+            emit(as<insn_br>(in)->op == insn_br::_beq ? _beq : as<insn_br>(in)->op == insn_br::_bult ? _bult : _bslt, {inputs[0], inputs[1]});
+            target(bb, as<insn_br>(in)->dest1()), target(bb, as<insn_br>(in)->dest2());
+         } else
+         if (is<insn_switch_br>(in)) {
+            emit(_switch_br, {inputs[0], as<insn_switch_br>(in)->dests().size()});
+            for (auto dest: as<insn_switch_br>(in)->dests()) target(bb, dest);
+         } else
+         if (is<insn_call>(in)) {
+            const auto &callee = as<insn_call>(in)->dest();
+            if (is<proc>(callee)) emit(_call), cells.emplace_back(), cells.back().callee = get(as<proc>(callee)); else emit(_call_ind, {inputs.back()});
+            push(inputs.size() - 1);
+            for (std::size_t sn = 0; sn < inputs.size() - 1; ++sn) push(inputs[sn]);
+            push(as<insn_call>(in)->results().size());
+            for (const auto &result: as<insn_call>(in)->results()) push(reg(result));
+         } else
+         if (is<insn_ret>(in)) {
+            emit(_ret, {inputs.size()});
+            for (auto it: inputs) push(it);
+            max_results = std::max(max_results, inputs.size());
+         } else
+            emit(_oops);
+      }
+   }
+
+   // Emit Phi Copies on Edges /////////////////////////////////////////////////////////////////////
+   std::vector<std::size_t> edge_starts;
+   for (const auto &[pred, bb]: edge_list) {
+      edge_starts.push_back(cells.size());
+      copies(pred, bb);
+      emit(_jmp), bb_fixups.push_back({cells.size(), bb}), cells.push_back({});
+   }
+
+   // Patch Jump Targets ///////////////////////////////////////////////////////////////////////////
+   cells.shrink_to_fit();
+   for (const auto &[pos, bb]: bb_fixups) cells[pos].target = cells.data() + starts[bb->sn];
+   for (const auto &[pos, sn]: edge_fixups) cells[pos].target = cells.data() + edge_starts[sn];
+
+   cd.consts.resize(consts.size());
+   for (const auto &[val, sn]: consts) cd.consts[sn - cd.const_base] = val;
+   cd.results_base = cd.const_base + consts.size(), cd.frame_size = cd.results_base + 1 + max_results;
+}
+
+/* References:
+   - The Structure and Performance of Efficient Interpreters by M. Anton Ertl and David Gregg
+   - Threaded Code by James R. Bell
+
+   Dispatch is direct-threaded via computed gotos (a GNU extension): each handler jumps straight to the handler of the next insn. When called
+   w/o code, publishes the addresses of the handlers (for decoding). */
+bool rsn::opt::interpreter::execute(const code *cd, unsigned long long *frame) {
+   static const void *const _handlers[] = {
+      &&mov, &&load, &&store,
+      &&add, &&sub, &&umul, &&udiv, &&urem, &&smul, &&sdiv, &&srem, &&and_, &&or_, &&xor_, &&shl, &&ushr, &&sshr, &&umulh_, &&smulh_,
+      &&seleq, &&selult, &&selslt,
+      &&vload, &&vstore,
+      &&vadd, &&vsub, &&vumul, &&oops, &&oops, &&vsmul, &&oops, &&oops, &&vand, &&vor, &&vxor, &&vshl, &&vushr, &&vsshr, &&oops, &&oops,
+      &&jmp, &&beq, &&bult, &&bslt, &&switch_br, &&call, &&call_ind, &&ret, &&oops };
+   static_assert(sizeof _handlers / sizeof *_handlers == _oops + 1);
+   if (RSN_UNLIKELY(!cd)) return handlers = _handlers, true;
+
+   std::copy(cd->consts.begin(), cd->consts.end(), frame + cd->const_base);
+   const cell *ip = cd->cells.data();
+   const code *callee;
+# define RSN_SLOT(SN) frame[ip[SN].slot]
+# define RSN_NEXT(LEN) goto *(ip += (LEN))->handler
+# define RSN_BINOP(LABEL, ...) LABEL: { const auto lhs = RSN_SLOT(1), rhs = RSN_SLOT(2); RSN_SLOT(3) = (__VA_ARGS__); } RSN_NEXT(4);
+# define RSN_SELECT(LABEL, ...) LABEL: { const auto lhs = RSN_SLOT(1), rhs = RSN_SLOT(2); RSN_SLOT(5) = RSN_SLOT((__VA_ARGS__) ? 3 : 4); } RSN_NEXT(6);
+# define RSN_VBINOP(LABEL, ...) LABEL: { \
+      const auto lhs_at = reinterpret_cast<const char *>(&RSN_SLOT(1)), rhs_at = reinterpret_cast<const char *>(&RSN_SLOT(3)); \
+      const auto dest_at = reinterpret_cast<char *>(&RSN_SLOT(5)); \
+      const std::size_t lhs_stride = ip[2].slot, rhs_stride = ip[4].slot, lanes = ip[6].slot, width = ip[7].slot; \
+      const unsigned long long lhs_bcast = RSN_SLOT(1), rhs_bcast = RSN_SLOT(3); /* before the dest may overwrite them */ \
+      if (RSN_LIKELY(width == 8)) RSN_LANES(8, __VA_ARGS__) else RSN_LANES(width, __VA_ARGS__) \
+   } RSN_NEXT(8);
+# define RSN_LANES(WIDTH, ...) \
+   for (std::size_t sn = 0, bits = (WIDTH) * 8; sn < lanes; ++sn) { \
+      unsigned long long lhs = lhs_bcast & ~0ull >> (64 - bits), rhs = rhs_bcast & ~0ull >> (64 - bits); \
+      if (lhs_stride) lhs = 0, std::memcpy(&lhs, lhs_at + sn * (WIDTH), (WIDTH)); \
+      if (rhs_stride) rhs = 0, std::memcpy(&rhs, rhs_at + sn * (WIDTH), (WIDTH)); \
+      const unsigned long long res = (__VA_ARGS__); \
+      std::memcpy(dest_at + sn * (WIDTH), &res, (WIDTH)); \
+   }
+# define RSN_BR(LABEL, ...) LABEL: { const auto lhs = RSN_SLOT(1), rhs = RSN_SLOT(2); ip = (__VA_ARGS__) ? ip[3].target : ip[4].target; } goto *ip->handler;
+   goto *ip->handler;
+
+   // Data Movement ////////////////////////////////////////////////////////////////////////////////
+mov:
+   RSN_SLOT(2) = RSN_SLOT(1);
+   RSN_NEXT(3);
+load:
+   std::memcpy(&RSN_SLOT(2), reinterpret_cast<const void *>(RSN_SLOT(1)), sizeof(unsigned long long));
+   RSN_NEXT(3);
+store:
+   std::memcpy(reinterpret_cast<void *>(RSN_SLOT(2)), &RSN_SLOT(1), sizeof(unsigned long long));
+   RSN_NEXT(3);
+
+   // Arithmetic and Logic (x86 semantics) /////////////////////////////////////////////////////////
+   RSN_BINOP(add,    lhs + rhs)
+   RSN_BINOP(sub,    lhs - rhs)
+   RSN_BINOP(umul,   lhs * rhs)
+   RSN_BINOP(smul,   lhs * rhs)
+   RSN_BINOP(and_,   lhs & rhs)
+   RSN_BINOP(or_,    lhs | rhs)
+   RSN_BINOP(xor_,   lhs ^ rhs)
+   RSN_BINOP(shl,    lhs << (rhs & 0x3F))
+   RSN_BINOP(ushr,   lhs >> (rhs & 0x3F))
+   RSN_BINOP(sshr,   (long long)lhs >> (rhs & 0x3F))
+   RSN_BINOP(umulh_, umulh(lhs, rhs))
+   RSN_BINOP(smulh_, smulh(lhs, rhs))
+udiv:
+   if (RSN_UNLIKELY(!RSN_SLOT(2))) return false;
+   RSN_SLOT(3) = RSN_SLOT(1) / RSN_SLOT(2);
+   RSN_NEXT(4);
+urem:
+   if (RSN_UNLIKELY(!RSN_SLOT(2))) return false;
+   RSN_SLOT(3) = RSN_SLOT(1) % RSN_SLOT(2);
+   RSN_NEXT(4);
+sdiv:
+   if (RSN_UNLIKELY(!RSN_SLOT(2)) || RSN_UNLIKELY(RSN_SLOT(1) == (unsigned long long)std::numeric_limits<long long>::min() && RSN_SLOT(2) == -1ull))
+      return false;
+   RSN_SLOT(3) = (long long)RSN_SLOT(1) / (long long)RSN_SLOT(2);
+   RSN_NEXT(4);
+srem:
+   if (RSN_UNLIKELY(!RSN_SLOT(2)) || RSN_UNLIKELY(RSN_SLOT(1) == (unsigned long long)std::numeric_limits<long long>::min() && RSN_SLOT(2) == -1ull))
+      return false;
+   RSN_SLOT(3) = (long long)RSN_SLOT(1) % (long long)RSN_SLOT(2);
+   RSN_NEXT(4);
+
+   // Conditional Moves ////////////////////////////////////////////////////////////////////////////
+   RSN_SELECT(seleq,  lhs == rhs)
+   RSN_SELECT(selult, lhs < rhs)
+   RSN_SELECT(selslt, (long long)lhs < (long long)rhs)
+
+   // Vector Operations ////////////////////////////////////////////////////////////////////////////
+vload: // (with fast paths for 128- and 256-bit vectors)
+   if (RSN_LIKELY(ip[3].slot == 16)) std::memcpy(&RSN_SLOT(2), reinterpret_cast<const void *>(RSN_SLOT(1)), 16); else
+   if (RSN_LIKELY(ip[3].slot == 32)) std::memcpy(&RSN_SLOT(2), reinterpret_cast<const void *>(RSN_SLOT(1)), 32); else
+      std::memcpy(&RSN_SLOT(2), reinterpret_cast<const void *>(RSN_SLOT(1)), ip[3].slot);
+   RSN_NEXT(4);
+vstore:
+   if (RSN_LIKELY(ip[3].slot == 16)) std::memcpy(reinterpret_cast<void *>(RSN_SLOT(2)), &RSN_SLOT(1), 16); else
+   if (RSN_LIKELY(ip[3].slot == 32)) std::memcpy(reinterpret_cast<void *>(RSN_SLOT(2)), &RSN_SLOT(1), 32); else
+      std::memcpy(reinterpret_cast<void *>(RSN_SLOT(2)), &RSN_SLOT(1), ip[3].slot);
+   RSN_NEXT(4);
+   RSN_VBINOP(vadd,  lhs + rhs)
+   RSN_VBINOP(vsub,  lhs - rhs)
+   RSN_VBINOP(vumul, lhs * rhs)
+   RSN_VBINOP(vsmul, lhs * rhs)
+   RSN_VBINOP(vand,  lhs & rhs)
+   RSN_VBINOP(vor,   lhs | rhs)
+   RSN_VBINOP(vxor,  lhs ^ rhs)
+   RSN_VBINOP(vshl,  lhs << (rhs & (bits - 1)))
+   RSN_VBINOP(vushr, lhs >> (rhs & (bits - 1)))
+   RSN_VBINOP(vsshr, (long long)(lhs << (64 - bits)) >> (64 - bits) >> (rhs & (bits - 1)))
+
+   // Control Transfer /////////////////////////////////////////////////////////////////////////////
+jmp:
+   ip = ip[1].target;
+   goto *ip->handler;
+   RSN_BR(beq,  lhs == rhs)
+   RSN_BR(bult, lhs < rhs)
+   RSN_BR(bslt, (long long)lhs < (long long)rhs)
+switch_br:
+   if (RSN_UNLIKELY(RSN_SLOT(1) >= ip[2].slot)) return false;
+   ip = ip[3 + RSN_SLOT(1)].target;
+   goto *ip->handler;
+call_ind:
+   {  const auto it = addresses.find(RSN_SLOT(1));
+      if (RSN_UNLIKELY(it == addresses.end())) return false;
+      callee = it->second;
+   }
+   goto call_common;
+call:
+   callee = ip[1].callee;
+call_common:
+   {  const auto next = frame + cd->frame_size;
+      const auto args = ip + 2;
+      if (RSN_UNLIKELY(args->slot != callee->params.size()) || RSN_UNLIKELY(stack_end - next < (long)callee->frame_size) || RSN_UNLIKELY(depth == max_depth))
+         return false;
+      for (std::size_t sn = 0; sn < args->slot; ++sn) next[callee->params[sn]] = frame[args[1 + sn].slot];
+      ++depth;
+      const bool ok = execute(callee, next);
+      --depth;
+      if (RSN_UNLIKELY(!ok)) return false;
+      ip = args + 1 + args->slot;
+      const auto results = next + callee->results_base;
+      if (RSN_UNLIKELY(results[0] != ip->slot)) return false;
+      for (std::size_t sn = 0; sn < ip->slot; ++sn) RSN_SLOT(1 + sn) = results[1 + sn];
+   }
+   RSN_NEXT(1 + ip->slot);
+ret:
+   {  const auto results = frame + cd->results_base;
+      results[0] = ip[1].slot;
+      for (std::size_t sn = 0; sn < ip[1].slot; ++sn) results[1 + sn] = RSN_SLOT(2 + sn);
+   }
+   return true;
+oops:
+   return false;
+# undef RSN_SLOT
+# undef RSN_NEXT
+# undef RSN_BINOP
+# undef RSN_SELECT
+# undef RSN_VBINOP
+# undef RSN_LANES
+# undef RSN_BR
+}
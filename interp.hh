@@ -0,0 +1,70 @@
+// interp.hh -- tier-0 execution engine (IR interpreter)
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# ifndef RSN_INCLUDED_INTERP
+# define RSN_INCLUDED_INTERP
+
+# include <functional>
+# include <map>
+# include <memory>
+# include <unordered_map>
+
+# include "ir.hh"
+
+namespace rsn::opt {
+
+   /* Procedures are executed w/o a backend: on the first run, a procedure (and each one it refers to) is pre-decoded into flat direct-threaded
+      code (each insn is represented by the address of its handler followed by its operands), where VRs and constants are assigned dense slots
+      in a stack frame, phi insns become sequentialized copies on incoming edges, and jumps to the next BB are omitted.
+
+      Execution semantics
+      - memory is the host memory, accessed in 8-byte words (or vectors) at byte addresses (data blocks are materialized by the interpreter, and extern
+        symbols are resolved by the client, if ever)
+      - the address of a procedure is opaque and is only good for calling it
+      - a scalar insn that refers to a vector VR sees its first 8 bytes (i.e., its first lane of 64-bit elements; bytes past the end of a
+        shorter vector are unspecified)
+      - insn_oops traps, and so do division by zero, signed division overflow, unsupported lanewise binops, out-of-range switch_br indices,
+        calls with mismatched numbers of arguments or results, insns that refer to unresolved symbols, and stack overflow (words of data
+        blocks that refer to unresolved symbols are null)
+      - the decoded form is a snapshot: procedures are not to be changed after their first run, unless reset is called
+   */
+   class interpreter {
+   public: // construction/destruction
+      explicit interpreter(std::function<void *(const rel_base *)> resolver = {}, std::size_t stack_size = 1 << 20 /*words*/);
+      ~interpreter();
+   public: // execution
+      // run the procedure, return whether it has completed w/o trapping, and produce the results of insn_ret if so
+      bool run(proc *, const std::vector<unsigned long long> &args, std::vector<unsigned long long> &results);
+      void reset() noexcept; // drop decoded procedures and materialized data blocks
+   private: // internal representation
+      union cell;
+      struct code;
+      const std::function<void *(const rel_base *)> resolver;
+      const std::unique_ptr<unsigned long long []> stack;
+      unsigned long long *const stack_end;
+      unsigned depth = 0; // nesting of execute (bounded to protect the host stack)
+      std::map<decltype(rel_base::id), std::unique_ptr<code>> procs;                      // by link-time symbol
+      std::map<decltype(rel_base::id), std::unique_ptr<unsigned long long []>> blocks;   // ditto
+      std::unordered_map<unsigned long long, code *> addresses;                           // procedures by their addresses
+      std::vector<code *> pending;                                                        // procedures yet to decode
+   private: // implementation helpers
+      code *get(proc *);
+      bool resolve(operand *, unsigned long long &);
+      void decode(code &);
+      bool execute(const code *, unsigned long long *frame);
+      static const void *const *handlers;
+   };
+
+} // namespace rsn::opt
+
+# endif // # ifndef RSN_INCLUDED_INTERP
@@ -21,7 +21,8 @@
 namespace rsn::opt {
 
    enum insn::kind: int
-      { _entry = -1, _ret = -2, _call = -3, _mov = +4, _load = +5, _store = -6, _binop = +7, _jmp = -8, _br = -9, _switch_br = -10, _oops = -11, _phi = +12 };
+      { _entry = -1, _ret = -2, _call = -3, _mov = +4, _load = +5, _store = -6, _binop = +7, _jmp = -8, _br = -9, _switch_br = -10, _oops = -11, _phi = +12,
+        _select = +13, _vload = +14, _vstore = -15, _vbinop = +16 };
 
    class insn_entry final: public impure_insn {
    public: // construction/destruction
@@ -189,6 +190,8 @@ namespace rsn::opt {
       RSN_INLINE auto &src() const noexcept  { return _inputs [0]; }
       RSN_INLINE auto &dest() noexcept       { return _outputs[0]; }
       RSN_INLINE auto &dest() const noexcept { return _outputs[0]; }
+   public: // miscellaneous
+      bool simplify() override;
    private: // internal representation
       std::array<lib::smart_ptr<operand>, 1> _inputs;
       std::array<lib::smart_ptr<vreg>, 1> _outputs;
@@ -248,7 +251,7 @@ namespace rsn::opt {
 
    class insn_binop final: public pure_insn {
    public: // public data members
-      const enum { _add, _sub, _umul, _udiv, _urem, _smul, _sdiv, _srem, _and, _or, _xor, _shl, _ushr, _sshr } op;
+      const enum { _add, _sub, _umul, _udiv, _urem, _smul, _sdiv, _srem, _and, _or, _xor, _shl, _ushr, _sshr, _umulh, _smulh } op;
    public: // construction/destruction
       RSN_INLINE static auto make( bblock *owner, decltype(op) op,
          lib::smart_ptr<operand> lhs, lib::smart_ptr<operand> rhs, lib::smart_ptr<vreg> dest )
@@ -265,7 +268,7 @@ namespace rsn::opt {
          { return new insn_binop(next, OP,  std::move(lhs), std::move(rhs), std::move(dest)); } \
    // end # define RSN_M1(OP)
       RSN_M1(_add) RSN_M1(_sub) RSN_M1(_umul) RSN_M1(_udiv) RSN_M1(_urem) RSN_M1(_smul) RSN_M1(_sdiv) RSN_M1(_srem)
-      RSN_M1(_and) RSN_M1(_or) RSN_M1(_xor) RSN_M1(_shl) RSN_M1(_ushr) RSN_M1(_sshr)
+      RSN_M1(_and) RSN_M1(_or) RSN_M1(_xor) RSN_M1(_shl) RSN_M1(_ushr) RSN_M1(_sshr) RSN_M1(_umulh) RSN_M1(_smulh)
    # undef RSN_M1
    public:
       insn_binop *clone(bblock *owner) const override { return new insn_binop(owner, op, _inputs, _outputs); }
@@ -297,13 +300,206 @@ namespace rsn::opt {
    public: // debugging
       void dump() const noexcept override {
          static constexpr const char *mnemo[]
-            {"add", "sub", "umul", "udiv", "urem", "smul", "sdiv", "srem", "and", "or", "xor", "shl", "ushr", "sshr"};
+            {"add", "sub", "umul", "udiv", "urem", "smul", "sdiv", "srem", "and", "or", "xor", "shl", "ushr", "sshr", "umulh", "smulh"};
          log << mnemo[op] << ' ' << lhs() << ", " << rhs() << " -> "<< dest();
       }
    # endif // # if RSN_USE_DEBUG
    };
    template<> RSN_INLINE inline bool insn::type_check<insn_binop>() const noexcept { return kind == _binop; }
 
+   class insn_select final: public pure_insn { // conditional move (val1 if the condition holds, val2 otherwise)
+   public: // public data members
+      const enum { _eq, _ult, _slt } op;
+   public: // construction/destruction
+      RSN_INLINE static auto make( bblock *owner, decltype(op) op,
+         lib::smart_ptr<operand> lhs, lib::smart_ptr<operand> rhs, lib::smart_ptr<operand> val1, lib::smart_ptr<operand> val2, lib::smart_ptr<vreg> dest )
+         { return new insn_select(owner, op, std::move(lhs), std::move(rhs), std::move(val1), std::move(val2), std::move(dest)); }
+      RSN_INLINE static auto make( insn *next, decltype(op) op,
+         lib::smart_ptr<operand> lhs, lib::smart_ptr<operand> rhs, lib::smart_ptr<operand> val1, lib::smart_ptr<operand> val2, lib::smart_ptr<vreg> dest )
+         { return new insn_select(next, op,  std::move(lhs), std::move(rhs), std::move(val1), std::move(val2), std::move(dest)); }
+   # define RSN_M1(OP, OP_, LHS, RHS, VAL1, VAL2) \
+      RSN_INLINE static auto make##OP(bblock *owner, \
+         lib::smart_ptr<operand> lhs, lib::smart_ptr<operand> rhs, lib::smart_ptr<operand> val1, lib::smart_ptr<operand> val2, lib::smart_ptr<vreg> dest ) \
+         { return new insn_select(owner, OP_, std::move(LHS), std::move(RHS), std::move(VAL1), std::move(VAL2), std::move(dest)); } \
+      RSN_INLINE static auto make##OP(insn *next, \
+         lib::smart_ptr<operand> lhs, lib::smart_ptr<operand> rhs, lib::smart_ptr<operand> val1, lib::smart_ptr<operand> val2, lib::smart_ptr<vreg> dest ) \
+         { return new insn_select(next, OP_,  std::move(LHS), std::move(RHS), std::move(VAL1), std::move(VAL2), std::move(dest)); } \
+   // end # define RSN_M1(OP)
+      RSN_M1(_eq, _eq, lhs, rhs, val1, val2)
+      RSN_M1(_ne, _eq, lhs, rhs, val2, val1)
+      RSN_M1(_ult, _ult, lhs, rhs, val1, val2) RSN_M1(_slt, _slt, lhs, rhs, val1, val2)
+      RSN_M1(_ule, _ult, rhs, lhs, val2, val1) RSN_M1(_sle, _slt, rhs, lhs, val2, val1)
+      RSN_M1(_ugt, _ult, rhs, lhs, val1, val2) RSN_M1(_sgt, _slt, rhs, lhs, val1, val2)
+      RSN_M1(_uge, _ult, lhs, rhs, val2, val1) RSN_M1(_sge, _slt, lhs, rhs, val2, val1)
+   # undef RSN_M1
+   public:
+      insn_select *clone(bblock *owner) const override { return new insn_select(owner, op, _inputs, _outputs); }
+      insn_select *clone(insn *next) const override { return new insn_select(next, op, _inputs, _outputs); }
+   public: // data operands and jump targets
+      RSN_INLINE auto &lhs() noexcept        { return _inputs [0]; }
+      RSN_INLINE auto &lhs() const noexcept  { return _inputs [0]; }
+      RSN_INLINE auto &rhs() noexcept        { return _inputs [1]; }
+      RSN_INLINE auto &rhs() const noexcept  { return _inputs [1]; }
+      RSN_INLINE auto &val1() noexcept       { return _inputs [2]; }
+      RSN_INLINE auto &val1() const noexcept { return _inputs [2]; }
+      RSN_INLINE auto &val2() noexcept       { return _inputs [3]; }
+      RSN_INLINE auto &val2() const noexcept { return _inputs [3]; }
+      RSN_INLINE auto &dest() noexcept       { return _outputs[0]; }
+      RSN_INLINE auto &dest() const noexcept { return _outputs[0]; }
+   public: // miscellaneous
+      bool simplify() override;
+   private: // internal representation
+      std::array<lib::smart_ptr<operand>, 4> _inputs;
+      std::array<lib::smart_ptr<vreg>, 1> _outputs;
+   private: // implementation helpers
+      template<typename Loc> RSN_INLINE explicit insn_select( Loc loc, decltype(op) op,
+         lib::smart_ptr<operand> &&lhs, lib::smart_ptr<operand> &&rhs, lib::smart_ptr<operand> &&val1, lib::smart_ptr<operand> &&val2,
+         lib::smart_ptr<vreg> &&dest ) noexcept
+         : pure_insn(_select, loc), op(op), _inputs{std::move(lhs), std::move(rhs), std::move(val1), std::move(val2)}, _outputs{std::move(dest)} {
+         insn::_inputs = lib::range_ref{&*_inputs.begin(), &*_inputs.end()}, insn::_outputs = lib::range_ref{&*_outputs.begin(), &*_outputs.end()};
+      }
+      template<typename Loc> RSN_INLINE explicit insn_select( Loc loc, decltype(op) op,
+         const decltype(_inputs) &inputs, const decltype(_outputs) &outputs ) noexcept
+         : pure_insn(_select, loc), op(op), _inputs(inputs), _outputs(outputs) {
+         insn::_inputs = lib::range_ref{&*_inputs.begin(), &*_inputs.end()}, insn::_outputs = lib::range_ref{&*_outputs.begin(), &*_outputs.end()};
+      }
+   # if RSN_USE_DEBUG
+   public: // debugging
+      void dump() const noexcept override {
+         static constexpr const char *mnemo[]
+            {"seleq", "selult", "selslt"};
+         log << mnemo[op] << ' ' << lhs() << ", " << rhs() << ", " << val1() << ", " << val2() << " -> " << dest();
+      }
+   # endif // # if RSN_USE_DEBUG
+   };
+   template<> RSN_INLINE inline bool insn::type_check<insn_select>() const noexcept { return kind == _select; }
+
+   /* Vector insns operate on several lanes of elements (each of 1, 2, 4, or 8 bytes) packed together into a single VR. In memory, the
+      elements are consecutive in the order of lanes (and little-endian). An operand of insn_vbinop that is not a vector VR (i.e., defined by
+      a vector insn) is broadcast to all lanes (truncated for narrow elements). */
+   class insn_vload final: public pure_insn {
+   public: // public data members
+      const unsigned lanes, width; // number of lanes and element width (in bytes)
+   public: // construction/destruction
+      RSN_INLINE static auto make( bblock *owner, unsigned lanes, unsigned width,
+         lib::smart_ptr<operand> src, lib::smart_ptr<vreg> dest )
+         { return new insn_vload(owner, lanes, width, std::move(src), std::move(dest)); }
+      RSN_INLINE static auto make( insn *next, unsigned lanes, unsigned width,
+         lib::smart_ptr<operand> src, lib::smart_ptr<vreg> dest )
+         { return new insn_vload(next,  lanes, width, std::move(src), std::move(dest)); }
+   public:
+      insn_vload *clone(bblock *owner) const override { return new insn_vload(owner, lanes, width, _inputs, _outputs); }
+      insn_vload *clone(insn *next) const override { return new insn_vload(next, lanes, width, _inputs, _outputs); }
+   public: // data operands and jump targets
+      RSN_INLINE auto &src() noexcept        { return _inputs [0]; }
+      RSN_INLINE auto &src() const noexcept  { return _inputs [0]; }
+      RSN_INLINE auto &dest() noexcept       { return _outputs[0]; }
+      RSN_INLINE auto &dest() const noexcept { return _outputs[0]; }
+   private: // internal representation
+      std::array<lib::smart_ptr<operand>, 1> _inputs;
+      std::array<lib::smart_ptr<vreg>, 1> _outputs;
+   private: // implementation helpers
+      template<typename Loc> RSN_INLINE explicit insn_vload( Loc loc, unsigned lanes, unsigned width,
+         lib::smart_ptr<operand> &&src, lib::smart_ptr<vreg> &&dest ) noexcept
+         : pure_insn(_vload, loc), lanes(lanes), width(width), _inputs{std::move(src)}, _outputs{std::move(dest)} {
+         insn::_inputs = lib::range_ref{&*_inputs.begin(), &*_inputs.end()}, insn::_outputs = lib::range_ref{&*_outputs.begin(), &*_outputs.end()};
+      }
+      template<typename Loc> RSN_INLINE explicit insn_vload( Loc loc, unsigned lanes, unsigned width,
+         const decltype(_inputs) &inputs, const decltype(_outputs) &outputs ) noexcept
+         : pure_insn(_vload, loc), lanes(lanes), width(width), _inputs(inputs), _outputs(outputs) {
+         insn::_inputs = lib::range_ref{&*_inputs.begin(), &*_inputs.end()}, insn::_outputs = lib::range_ref{&*_outputs.begin(), &*_outputs.end()};
+      }
+   # if RSN_USE_DEBUG
+   public: // debugging
+      void dump() const noexcept override { log << "vload", std::fprintf(stderr, ".%ux%u ", lanes, width * 8), log << src() << " -> " << dest(); }
+   # endif
+   };
+   template<> RSN_INLINE inline bool insn::type_check<insn_vload>() const noexcept { return kind == _vload; }
+
+   class insn_vstore final: public impure_insn {
+   public: // public data members
+      const unsigned lanes, width; // number of lanes and element width (in bytes)
+   public: // construction/destruction
+      RSN_INLINE static auto make( bblock *owner, unsigned lanes, unsigned width,
+         lib::smart_ptr<operand> src, lib::smart_ptr<operand> dest )
+         { return new insn_vstore(owner, lanes, width, std::move(src), std::move(dest)); }
+      RSN_INLINE static auto make( insn *next, unsigned lanes, unsigned width,
+         lib::smart_ptr<operand> src, lib::smart_ptr<operand> dest )
+         { return new insn_vstore(next,  lanes, width, std::move(src), std::move(dest)); }
+   public:
+      insn_vstore *clone(bblock *owner) const override { return new insn_vstore(owner, lanes, width, _inputs); }
+      insn_vstore *clone(insn *next) const override { return new insn_vstore(next, lanes, width, _inputs); }
+   public: // data operands and jump targets
+      RSN_INLINE auto &src() noexcept        { return _inputs[0]; }
+      RSN_INLINE auto &src() const noexcept  { return _inputs[0]; }
+      RSN_INLINE auto &dest() noexcept       { return _inputs[1]; }
+      RSN_INLINE auto &dest() const noexcept { return _inputs[1]; }
+   private: // internal representation
+      std::array<lib::smart_ptr<operand>, 2> _inputs;
+   private: // implementation helpers
+      template<typename Loc> RSN_INLINE explicit insn_vstore( Loc loc, unsigned lanes, unsigned width,
+         lib::smart_ptr<operand> &&src, lib::smart_ptr<operand> &&dest ) noexcept
+         : impure_insn(_vstore, loc), lanes(lanes), width(width), _inputs{std::move(src), std::move(dest)} {
+         insn::_inputs = lib::range_ref{&*_inputs.begin(), &*_inputs.end()};
+      }
+      template<typename Loc> RSN_INLINE explicit insn_vstore( Loc loc, unsigned lanes, unsigned width,
+         const decltype(_inputs) &inputs ) noexcept
+         : impure_insn(_vstore, loc), lanes(lanes), width(width), _inputs(inputs) {
+         insn::_inputs = lib::range_ref{&*_inputs.begin(), &*_inputs.end()};
+      }
+   # if RSN_USE_DEBUG
+   public: // debugging
+      void dump() const noexcept override { log << "vstore", std::fprintf(stderr, ".%ux%u ", lanes, width * 8), log << src() << ", " << dest(); }
+   # endif
+   };
+   template<> RSN_INLINE inline bool insn::type_check<insn_vstore>() const noexcept { return kind == _vstore; }
+
+   class insn_vbinop final: public pure_insn { // lanewise binop (division and high multiplication are unsupported; shift counts are masked per lane)
+   public: // public data members
+      const decltype(insn_binop::op) op;
+      const unsigned lanes, width; // number of lanes and element width (in bytes)
+   public: // construction/destruction
+      RSN_INLINE static auto make( bblock *owner, decltype(op) op, unsigned lanes, unsigned width,
+         lib::smart_ptr<operand> lhs, lib::smart_ptr<operand> rhs, lib::smart_ptr<vreg> dest )
+         { return new insn_vbinop(owner, op, lanes, width, std::move(lhs), std::move(rhs), std::move(dest)); }
+      RSN_INLINE static auto make( insn *next, decltype(op) op, unsigned lanes, unsigned width,
+         lib::smart_ptr<operand> lhs, lib::smart_ptr<operand> rhs, lib::smart_ptr<vreg> dest )
+         { return new insn_vbinop(next, op,  lanes, width, std::move(lhs), std::move(rhs), std::move(dest)); }
+   public:
+      insn_vbinop *clone(bblock *owner) const override { return new insn_vbinop(owner, op, lanes, width, _inputs, _outputs); }
+      insn_vbinop *clone(insn *next) const override { return new insn_vbinop(next, op, lanes, width, _inputs, _outputs); }
+   public: // data operands and jump targets
+      RSN_INLINE auto &lhs() noexcept        { return _inputs [0]; }
+      RSN_INLINE auto &lhs() const noexcept  { return _inputs [0]; }
+      RSN_INLINE auto &rhs() noexcept        { return _inputs [1]; }
+      RSN_INLINE auto &rhs() const noexcept  { return _inputs [1]; }
+      RSN_INLINE auto &dest() noexcept       { return _outputs[0]; }
+      RSN_INLINE auto &dest() const noexcept { return _outputs[0]; }
+   private: // internal representation
+      std::array<lib::smart_ptr<operand>, 2> _inputs;
+      std::array<lib::smart_ptr<vreg>, 1> _outputs;
+   private: // implementation helpers
+      template<typename Loc> RSN_INLINE explicit insn_vbinop( Loc loc, decltype(op) op, unsigned lanes, unsigned width,
+         lib::smart_ptr<operand> &&lhs, lib::smart_ptr<operand> &&rhs, lib::smart_ptr<vreg> &&dest ) noexcept
+         : pure_insn(_vbinop, loc), op(op), lanes(lanes), width(width), _inputs{std::move(lhs), std::move(rhs)}, _outputs{std::move(dest)} {
+         insn::_inputs = lib::range_ref{&*_inputs.begin(), &*_inputs.end()}, insn::_outputs = lib::range_ref{&*_outputs.begin(), &*_outputs.end()};
+      }
+      template<typename Loc> RSN_INLINE explicit insn_vbinop( Loc loc, decltype(op) op, unsigned lanes, unsigned width,
+         const decltype(_inputs) &inputs, const decltype(_outputs) &outputs ) noexcept
+         : pure_insn(_vbinop, loc), op(op), lanes(lanes), width(width), _inputs(inputs), _outputs(outputs) {
+         insn::_inputs = lib::range_ref{&*_inputs.begin(), &*_inputs.end()}, insn::_outputs = lib::range_ref{&*_outputs.begin(), &*_outputs.end()};
+      }
+   # if RSN_USE_DEBUG
+   public: // debugging
+      void dump() const noexcept override {
+         static constexpr const char *mnemo[]
+            {"vadd", "vsub", "vumul", "vudiv", "vurem", "vsmul", "vsdiv", "vsrem", "vand", "vor", "vxor", "vshl", "vushr", "vsshr", "vumulh", "vsmulh"};
+         log << mnemo[op], std::fprintf(stderr, ".%ux%u ", lanes, width * 8), log << lhs() << ", " << rhs() << " -> " << dest();
+      }
+   # endif // # if RSN_USE_DEBUG
+   };
+   template<> RSN_INLINE inline bool insn::type_check<insn_vbinop>() const noexcept { return kind == _vbinop; }
+
    class insn_jmp final: public impure_insn {
    public: // construction/destruction
       RSN_INLINE static auto make( bblock *owner,
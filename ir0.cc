@@ -30,7 +30,7 @@ void rsn::opt::proc::dump() const noexcept {
 }
 
 void rsn::opt::bblock::dump() const noexcept {
-   std::fprintf(stderr, "L%u:\n", node::sn);
+   std::fprintf(stderr, cold ? "L%u: ; cold\n" : "L%u:\n", node::sn);
    for (auto in = head(); in; in = in->next())
       std::fputs("    ", stderr), in->dump(), std::fputc('\n', stderr);
 }
@@ -87,6 +87,9 @@ namespace rsn::opt {
    private: // fast (and trivial) RTTI
       template<typename> bool type_check() const noexcept = delete;
       template<typename, typename Src> friend std::enable_if_t<std::is_base_of_v<noncopyable<>, Src>, bool> lib::is(Src *) noexcept;
+   public: // table-driven dispatch
+      static constexpr unsigned kind_count = 6;
+      RSN_INLINE unsigned kind_sn() const noexcept { return kind; } // 0 (vreg), 1 (abs), 2 (rel_disp), 3 (rel_base), 4 (proc), or 5 (data)
    # if RSN_USE_DEBUG
    public: // debugging
       virtual void dump() const noexcept = 0;
@@ -244,6 +247,7 @@ namespace rsn::opt {
       static auto make(bblock *next) { return new bblock(next); } // construct and attach to the owner procedure before the specified sibling basic block
    public: // miscellaneous
       std::size_t sn;
+      bool cold{}; // to be emitted into a separate section (away from hot code)
    private: // implementation helpers
       RSN_INLINE explicit bblock(proc *owner) noexcept: collection_item_mixin(owner) {}
       RSN_INLINE explicit bblock(bblock *next) noexcept: collection_item_mixin(next) {}
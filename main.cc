@@ -1,8 +1,7 @@
 // main.cc
 
-# include "ir.hh"
-
-namespace rsn::opt { bool transform_to_ssa(proc *); }
+# include "opt.hh"
+# include "interp.hh"
 
 int main() {
    namespace opt = rsn::opt;
@@ -26,6 +25,12 @@ int main() {
    pc->dump();
    transform_to_ssa(pc);
    pc->dump();
+   transform_out_of_ssa(pc);
+   pc->dump();
+
+   opt::interpreter interp;
+   std::vector<unsigned long long> results;
+   if (interp.run(pc, {10}, results)) std::printf("10! = %llu\n", results.front());
 
    return {};
 }
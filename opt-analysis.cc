@@ -0,0 +1,323 @@
+// opt-analysis.cc -- control-flow analyses
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "opt.hh"
+
+# include <algorithm> // find, reverse, sort, stable_sort
+
+# if RSN_USE_DEBUG
+void rsn::opt::dump_stats() noexcept {
+# define RSN_M1(NAME, DESCR) if (stats.NAME) std::fprintf(stderr, "%12llu  %s\n", stats.NAME, DESCR);
+   RSN_OPT_STATS(RSN_M1)
+# undef RSN_M1
+}
+# endif // # if RSN_USE_DEBUG
+
+std::size_t rsn::opt::number_vregs(proc *pc) {
+   for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) {
+      for (const auto &input: in->inputs()) if (is<vreg>(input)) as<vreg>(input)->sn = -1;
+      for (const auto &output: in->outputs()) output->sn = -1;
+   }
+   std::size_t count = 0;
+   for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) {
+      for (const auto &input: in->inputs()) if (is<vreg>(input) && RSN_UNLIKELY(as<vreg>(input)->sn == (std::size_t)-1)) as<vreg>(input)->sn = count++;
+      for (const auto &output: in->outputs()) if (RSN_UNLIKELY(output->sn == (std::size_t)-1)) output->sn = count++;
+   }
+   return count;
+}
+
+bool rsn::opt::speculatable(insn *in) noexcept {
+   if (is<insn_mov>(in) || is<insn_select>(in)) return true;
+   if (is<insn_vbinop>(in)) switch (as<insn_vbinop>(in)->op) { // (divisors are not known per lane)
+   case insn_binop::_udiv: case insn_binop::_urem: case insn_binop::_sdiv: case insn_binop::_srem:
+      return false;
+   default:
+      return true;
+   }
+   if (is<insn_binop>(in)) switch (as<insn_binop>(in)->op) {
+   case insn_binop::_udiv: case insn_binop::_urem:
+      return is<abs>(as<insn_binop>(in)->rhs()) && as<abs>(as<insn_binop>(in)->rhs())->val != 0;
+   case insn_binop::_sdiv: case insn_binop::_srem:
+      return is<abs>(as<insn_binop>(in)->rhs()) && as<abs>(as<insn_binop>(in)->rhs())->val != 0 && as<abs>(as<insn_binop>(in)->rhs())->val != -1ull;
+   default:
+      return true;
+   }
+   if (is<insn_load>(in)) { // only from immutable data blocks (and within bounds)
+      const auto &src = as<insn_load>(in)->src();
+      if (is<data>(src)) return !as<data>(src)->values.empty();
+      return is<rel_disp>(src) && is<data>(as<rel_disp>(src)->base) && as<rel_disp>(src)->add % 8 == 0 &&
+         as<rel_disp>(src)->add / 8 < as<data>(as<rel_disp>(src)->base)->values.size();
+   }
+   return false;
+}
+
+void rsn::opt::reorder_phi_args(bblock *bb, const std::vector<bblock *> &old_preds, const std::vector<bblock *> &new_preds) {
+   if (RSN_LIKELY(old_preds == new_preds)) return;
+   for (auto in: all(bb)) {
+      if (RSN_LIKELY(!is<insn_phi>(in))) break;
+      std::vector<lib::smart_ptr<operand>> args; args.reserve(new_preds.size());
+      for (auto pred: new_preds)
+         args.push_back(as<insn_phi>(in)->args()[std::find(old_preds.begin(), old_preds.end(), pred) - old_preds.begin()]);
+      insn_phi::make(in, std::move(args), std::move(as<insn_phi>(in)->dest())), in->eliminate();
+   }
+}
+
+/* References:
+   - Simple and Efficient Construction of Static Single Assignment Form by Matthias Braun et al.
+   - SSAUpdater in LLVM
+
+   A query for the value on entry to a join places a phi insn there first (to terminate the recursion around cycles) and then queries the
+   predecessors. A completed phi insn with only one distinct argument (other than its own result) is removed, its result replaced in the
+   other phi insns placed so far (which may become trivial in turn), and the replacement is recorded for the queries still in progress. */
+rsn::opt::ssa_updater::ssa_updater(proc *pc): entry(pc->head()) {
+   std::unordered_map<bblock *, std::vector<bblock *>> succs;
+   std::vector<bblock *> stack{entry}; preds[entry];
+   while (!stack.empty()) {
+      const auto bb = stack.back(); stack.pop_back();
+      auto &res = succs[bb];
+      for (const auto &target: bb->rear()->targets()) if (RSN_LIKELY(std::find(res.begin(), res.end(), target) == res.end())) {
+         res.push_back(target);
+         if (preds.emplace(target, std::vector<bblock *>{}).second) stack.push_back(target);
+      }
+   }
+   for (auto bb = pc->head(); bb; bb = bb->next())
+      if (const auto it = succs.find(bb); it != succs.end()) { order.push_back(bb); for (auto succ: it->second) preds[succ].push_back(bb); }
+}
+
+void rsn::opt::ssa_updater::reset() {
+   defs.clear(), entry_vals.clear(), vals.clear(), phis.clear(), pending.clear(), forward.clear(), retired.clear(), undef = {};
+}
+
+void rsn::opt::ssa_updater::add_def(bblock *bb, vreg *val) {
+   defs[bb] = val, vals.push_back(val);
+}
+
+auto rsn::opt::ssa_updater::value_on_exit(bblock *bb)->vreg * {
+   if (const auto it = defs.find(bb); it != defs.end()) return it->second;
+   return value_on_entry(bb);
+}
+
+auto rsn::opt::ssa_updater::value_on_entry(bblock *bb)->vreg * {
+   if (const auto it = entry_vals.find(bb); it != entry_vals.end()) return it->second;
+   const auto it = preds.find(bb);
+   if (RSN_UNLIKELY(bb == entry) || RSN_UNLIKELY(it == preds.end()) || RSN_UNLIKELY(it->second.empty())) {
+      if (!undef) undef = vreg::make();
+      return undef;
+   }
+   if (it->second.size() == 1) {
+      const auto res = value_on_exit(it->second.front());
+      return entry_vals[bb] = res;
+   }
+   lib::smart_ptr<vreg> dest = vreg::make();
+   const auto phi = insn_phi::make(bb->head(), std::vector<lib::smart_ptr<operand>>(it->second.size(), dest), dest);
+   entry_vals[bb] = dest, phis.push_back(phi), pending.push_back(phi);
+   for (std::size_t sn = 0; sn < it->second.size(); ++sn) phi->args()[sn] = value_on_exit(it->second[sn]);
+   pending.pop_back();
+   return try_remove(phi);
+}
+
+auto rsn::opt::ssa_updater::value_before(insn *in)->vreg * {
+   for (auto _in = in->prev(); _in; _in = _in->prev()) for (const auto &output: _in->outputs())
+      if (RSN_UNLIKELY(std::find(vals.begin(), vals.end(), output) != vals.end())) return output;
+   return value_on_entry(in->owner());
+}
+
+void rsn::opt::ssa_updater::rewrite_use(insn *in, lib::smart_ptr<operand> &use) {
+   if (RSN_LIKELY(!is<insn_phi>(in))) { use = value_before(in); return; }
+   const auto it = preds.find(in->owner());
+   if (RSN_LIKELY(it != preds.end())) use = value_on_exit(it->second[&use - &*as<insn_phi>(in)->args().begin()]);
+}
+
+void rsn::opt::ssa_updater::rewrite_uses(vreg *vr) {
+   std::vector<std::pair<insn *, lib::smart_ptr<operand> *>> uses;
+   for (auto bb: order) for (auto in = bb->head(); in; in = in->next())
+      for (auto &input: in->inputs()) if (RSN_UNLIKELY(input == vr)) uses.emplace_back(in, &input);
+   rewrite_uses(uses);
+}
+
+void rsn::opt::ssa_updater::rewrite_uses(const std::vector<std::pair<insn *, lib::smart_ptr<operand> *>> &uses) {
+   for (const auto &[in, use]: uses) {
+      if (RSN_UNLIKELY(is<insn_phi>(in)) && RSN_UNLIKELY(std::find(phis.begin(), phis.end(), in) != phis.end())) continue;
+      rewrite_use(in, *use);
+   }
+}
+
+auto rsn::opt::ssa_updater::resolve(vreg *vr) const noexcept->vreg * {
+   for (;;) if (const auto it = forward.find(vr); RSN_LIKELY(it == forward.end())) return vr; else vr = it->second;
+}
+
+auto rsn::opt::ssa_updater::try_remove(insn_phi *phi)->vreg * {
+   const lib::smart_ptr<vreg> dest = phi->dest();
+   vreg *val = {};
+   for (const auto &arg: phi->args()) if (arg != dest) {
+      if (val && arg != val) return dest;
+      val = as<vreg>(arg);
+   }
+   if (RSN_UNLIKELY(!val)) { // unreachable from the entry BB in fact
+      if (!undef) undef = vreg::make();
+      val = undef;
+   }
+   forward[dest] = val, retired.push_back(dest), phis.erase(std::find(phis.begin(), phis.end(), phi)), phi->eliminate();
+   for (auto &[_, res]: entry_vals) if (res == dest) res = val;
+   std::vector<insn_phi *> users;
+   for (auto _phi: phis) for (auto &arg: _phi->args()) if (arg == dest) {
+      arg = val;
+      if (std::find(pending.begin(), pending.end(), _phi) == pending.end() && std::find(users.begin(), users.end(), _phi) == users.end())
+         users.push_back(_phi);
+   }
+   for (auto user: users) if (std::find(phis.begin(), phis.end(), user) != phis.end()) try_remove(user);
+   return resolve(val);
+}
+
+/* References:
+   - A Simple, Fast Dominance Algorithm by Keith D. Cooper, Timothy J. Harvey, and Ken Kennedy
+*/
+rsn::opt::cfg_info::cfg_info(proc *pc) {
+   // Number BBs ///////////////////////////////////////////////////////////////////////////////////
+   for (auto bb = pc->head(); bb; bb = bb->next()) bb->sn = bblocks.size(), bblocks.push_back(bb);
+   const auto bb_count = bblocks.size();
+   preds.resize(bb_count), succs.resize(bb_count), rpo_num.resize(bb_count, -1);
+   idom.resize(bb_count), dom_kids.resize(bb_count), dom_pre.resize(bb_count, -1), dom_post.resize(bb_count);
+
+   // Build BB Successor Lists and Reverse Postorder (using DFS) ///////////////////////////////////
+   {  std::vector<signed char> visited(bb_count);
+      auto traverse = [&](auto &traverse, bblock *bb) RSN_NOINLINE->void{
+         if (RSN_UNLIKELY(visited[bb->sn])) return;
+         visited[bb->sn] = true;
+         for (const auto &target: bb->rear()->targets())
+         if (RSN_LIKELY(std::find(succs[bb->sn].begin(), succs[bb->sn].end(), target) == succs[bb->sn].end()))
+            succs[bb->sn].push_back(target);
+         for (auto succ: succs[bb->sn]) traverse(traverse, succ);
+         rpo.push_back(bb);
+      };
+      traverse(traverse, pc->head());
+      std::reverse(rpo.begin(), rpo.end());
+      for (std::size_t sn = 0; sn < rpo.size(); ++sn) rpo_num[rpo[sn]->sn] = sn;
+   }
+   // Build BB Predecessor Lists (in the procedure order) //////////////////////////////////////////
+   for (auto bb: bblocks) for (auto succ: succs[bb->sn]) preds[succ->sn].push_back(bb);
+
+   // Build Dominator Tree /////////////////////////////////////////////////////////////////////////
+   {  const auto intersect = [&](bblock *lhs, bblock *rhs) noexcept RSN_INLINE{
+         while (lhs != rhs) {
+            while (rpo_num[lhs->sn] > rpo_num[rhs->sn]) lhs = idom[lhs->sn];
+            while (rpo_num[rhs->sn] > rpo_num[lhs->sn]) rhs = idom[rhs->sn];
+         }
+         return lhs;
+      };
+      idom[pc->head()->sn] = pc->head();
+      for (;;) {
+         bool changed = false;
+         for (auto bb: lib::range_ref(rpo).drop_first()) {
+            bblock *new_idom = {};
+            for (auto pred: preds[bb->sn]) if (RSN_LIKELY(idom[pred->sn]))
+               new_idom = RSN_LIKELY(new_idom) ? intersect(new_idom, pred) : pred;
+            changed |= idom[bb->sn] != new_idom, idom[bb->sn] = new_idom;
+         }
+         if (RSN_UNLIKELY(!changed)) break;
+      }
+      for (auto bb: lib::range_ref(rpo).drop_first()) dom_kids[idom[bb->sn]->sn].push_back(bb);
+      // number the dominator tree nodes for constant-time dominance queries
+      std::size_t num = 0;
+      auto traverse = [&](auto &traverse, bblock *bb) noexcept RSN_NOINLINE->void{
+         dom_pre[bb->sn] = num++;
+         for (auto kid: dom_kids[bb->sn]) traverse(traverse, kid);
+         dom_post[bb->sn] = num++;
+      };
+      traverse(traverse, pc->head());
+   }
+}
+
+std::size_t rsn::opt::cfg_info::pred_index(const bblock *bb, const bblock *pred) const noexcept {
+   return std::find(preds[bb->sn].begin(), preds[bb->sn].end(), pred) - preds[bb->sn].begin();
+}
+
+auto rsn::opt::cfg_info::dom_frontiers() const->std::vector<std::vector<bblock *>> {
+   std::vector<std::vector<bblock *>> res(bblocks.size());
+   for (auto bb: rpo) if (RSN_UNLIKELY(preds[bb->sn].size() > 1))
+   for (auto runner: preds[bb->sn])
+   for (; runner != idom[bb->sn]; runner = idom[runner->sn])
+   if (res[runner->sn].empty() || RSN_LIKELY(res[runner->sn].back() != bb))
+      res[runner->sn].push_back(bb);
+   return res;
+}
+
+rsn::opt::liveness::liveness(const cfg_info &cfg, std::size_t vr_count)
+   : live_in(cfg.bblocks.size(), std::vector<bool>(vr_count)), live_out(cfg.bblocks.size(), std::vector<bool>(vr_count)) {
+   // Compute Local Upward-exposed Uses and Definitions ////////////////////////////////////////////
+   std::vector<std::vector<bool>> uses(cfg.bblocks.size(), std::vector<bool>(vr_count)), defs = uses;
+   for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) {
+      if (RSN_LIKELY(!is<insn_phi>(in))) for (const auto &input: in->inputs())
+         if (is<vreg>(input) && !defs[bb->sn][as<vreg>(input)->sn]) uses[bb->sn][as<vreg>(input)->sn] = true;
+      for (const auto &output: in->outputs()) defs[bb->sn][output->sn] = true;
+   }
+   // Propagate Backwards until a Fixed Point is Reached ///////////////////////////////////////////
+   for (;;) {
+      bool changed = false;
+      for (auto bb: lib::range_ref(cfg.rpo).reverse()) {
+         auto &out = live_out[bb->sn];
+         for (auto succ: cfg.succs[bb->sn]) {
+            for (std::size_t sn = 0; sn < vr_count; ++sn) if (RSN_UNLIKELY(live_in[succ->sn][sn]) && !out[sn]) out[sn] = changed = true;
+            const auto arg_index = cfg.pred_index(succ, bb);
+            for (auto in = succ->head(); is<insn_phi>(in); in = in->next()) {
+               const auto &arg = as<insn_phi>(in)->args()[arg_index];
+               if (is<vreg>(arg) && !out[as<vreg>(arg)->sn]) out[as<vreg>(arg)->sn] = changed = true;
+            }
+         }
+         for (std::size_t sn = 0; sn < vr_count; ++sn)
+         if (RSN_UNLIKELY(uses[bb->sn][sn] || (out[sn] && !defs[bb->sn][sn])) && !live_in[bb->sn][sn]) live_in[bb->sn][sn] = changed = true;
+      }
+      if (RSN_UNLIKELY(!changed)) break;
+   }
+}
+
+rsn::opt::loop_forest::loop_forest(const cfg_info &cfg): cfg(cfg) {
+   // Discover Natural Loops (one per header) //////////////////////////////////////////////////////
+   for (auto header: cfg.rpo) {
+      loop lp{header, {}, {}, {}, {}, {}, 0};
+      for (auto pred: cfg.preds[header->sn]) if (RSN_UNLIKELY(cfg.dominates(header, pred))) lp.latches.push_back(pred);
+      if (RSN_LIKELY(lp.latches.empty())) continue;
+      std::vector<signed char> in_loop(cfg.bblocks.size());
+      in_loop[header->sn] = true, lp.bblocks.push_back(header);
+      for (auto worklist = lp.latches; !worklist.empty();) {
+         auto bb = worklist.back(); worklist.pop_back();
+         if (RSN_UNLIKELY(in_loop[bb->sn])) continue;
+         in_loop[bb->sn] = true, lp.bblocks.push_back(bb);
+         for (auto pred: cfg.preds[bb->sn]) worklist.push_back(pred);
+      }
+      std::sort(lp.bblocks.begin(), lp.bblocks.end(), [&](auto lhs, auto rhs) noexcept{ return cfg.rpo_num[lhs->sn] < cfg.rpo_num[rhs->sn]; });
+      for (auto bb: lp.bblocks) for (auto succ: cfg.succs[bb->sn])
+      if (RSN_UNLIKELY(!in_loop[succ->sn]) && std::find(lp.exits.begin(), lp.exits.end(), succ) == lp.exits.end())
+         lp.exits.push_back(succ);
+      loops.push_back(std::move(lp));
+   }
+   // nested loops are strictly smaller than enclosing ones
+   std::stable_sort(loops.begin(), loops.end(), [](const loop &lhs, const loop &rhs) noexcept{ return lhs.bblocks.size() < rhs.bblocks.size(); });
+
+   // Build Loop Nest Forest ///////////////////////////////////////////////////////////////////////
+   innermost.resize(cfg.bblocks.size());
+   for (auto &lp: lib::range_ref(loops).reverse()) {
+      lp.parent = innermost[lp.header->sn], lp.depth = RSN_LIKELY(!lp.parent) ? 1 : lp.parent->depth + 1;
+      if (RSN_UNLIKELY(lp.parent)) lp.parent->kids.push_back(&lp);
+      for (auto bb: lp.bblocks) innermost[bb->sn] = &lp;
+   }
+}
+
+auto rsn::opt::loop_forest::preheader(const loop &lp) const noexcept->bblock * {
+   bblock *res = {};
+   for (auto pred: cfg.preds[lp.header->sn]) if (RSN_LIKELY(!contains(&lp, pred))) {
+      if (RSN_UNLIKELY(res)) return {};
+      res = pred;
+   }
+   return RSN_LIKELY(res) && is<insn_jmp>(res->rear()) ? res : nullptr;
+}
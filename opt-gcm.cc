@@ -0,0 +1,111 @@
+// opt-gcm.cc -- global code motion
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "opt.hh"
+
+# include <unordered_map> // unordered_map
+
+/* References:
+   - Global Code Motion / Global Value Numbering by Cliff Click
+
+   Speculatable insns float, and the rest (including phi insns, loads of mutable memory, and trapping divisions) are pinned. The earliest
+   legal BB for a floating insn is the deepest (in the dominator tree) of the BBs where its inputs become available, and the latest one is
+   the nearest common dominator of its uses (a use by a phi insn counts at the end of the respective predecessor). The insn is placed on the
+   dominator tree path between them, in the latest BB with the least loop depth: thus, values used in rare branches are computed there,
+   and loop-invariant values are computed outside loops. Users are placed before their inputs, and an insn moved to another BB goes right
+   before its first user there (or before the jump). */
+bool rsn::opt::transform_gcm(proc *pc) {
+   const cfg_info cfg(pc); const loop_forest loops(cfg);
+   const auto vr_count = number_vregs(pc);
+   std::vector<insn *> def(vr_count);
+   std::vector<signed char> def_count(vr_count);
+   std::vector<std::vector<insn *>> users(vr_count);
+   for (auto bb: cfg.bblocks) for (auto in = bb->head(); in; in = in->next()) {
+      for (const auto &input: in->inputs()) if (is<vreg>(input) && (users[as<vreg>(input)->sn].empty() || users[as<vreg>(input)->sn].back() != in))
+         users[as<vreg>(input)->sn].push_back(in);
+      for (const auto &output: in->outputs()) def[output->sn] = in, def_count[output->sn] += def_count[output->sn] < 2;
+   }
+   std::vector<std::size_t> dom_depth(cfg.bblocks.size());
+   for (auto bb: cfg.rpo) if (RSN_LIKELY(bb != cfg.rpo.front())) dom_depth[bb->sn] = dom_depth[cfg.idom[bb->sn]->sn] + 1;
+   const auto lca = [&](bblock *lhs, bblock *rhs) noexcept{
+      if (!lhs) return rhs;
+      while (lhs != rhs) if (dom_depth[lhs->sn] >= dom_depth[rhs->sn]) lhs = cfg.idom[lhs->sn]; else rhs = cfg.idom[rhs->sn];
+      return lhs;
+   };
+
+   struct node { bblock *early, *best; bool floating, placed; };
+   std::unordered_map<const insn *, node> nodes;
+   for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) {
+      auto &nd = nodes[in];
+      nd.floating = speculatable(in) && !in->outputs().empty();
+      for (const auto &output: in->outputs()) {
+         if (RSN_UNLIKELY(def_count[output->sn] != 1)) nd.floating = false; // not in SSA form
+         for (auto user: users[output->sn]) if (RSN_UNLIKELY(!cfg.reachable(user->owner()))) nd.floating = false;
+      }
+      for (const auto &input: in->inputs()) if (RSN_UNLIKELY(is<vreg>(input)) && RSN_UNLIKELY(def_count[as<vreg>(input)->sn] != 1)) nd.floating = false;
+   }
+
+   // Schedule Early ///////////////////////////////////////////////////////////////////////////////
+   const auto early = [&](auto &early, insn *in)->bblock *{
+      auto &nd = nodes[in];
+      if (!nd.floating) return in->owner();
+      if (nd.early) return nd.early;
+      auto res = cfg.rpo.front();
+      for (const auto &input: in->inputs()) if (is<vreg>(input)) {
+         const auto bb = early(early, def[as<vreg>(input)->sn]);
+         if (dom_depth[bb->sn] > dom_depth[res->sn]) res = bb; // the inputs are available along a single dominator tree path
+      }
+      return nd.early = res;
+   };
+
+   // Schedule Late ////////////////////////////////////////////////////////////////////////////////
+   std::vector<insn *> order; // users before their inputs
+   const auto late = [&](auto &late, insn *in)->bblock *{
+      auto &nd = nodes[in];
+      if (!nd.floating) return in->owner();
+      if (nd.placed) return nd.best;
+      nd.placed = true;
+      bblock *res = {};
+      for (const auto &output: in->outputs()) for (auto user: users[output->sn])
+      if (is<insn_phi>(user)) {
+         const auto &preds = cfg.preds[user->owner()->sn];
+         for (std::size_t sn = 0; sn < preds.size(); ++sn) if (as<insn_phi>(user)->args()[sn] == output) res = lca(res, preds[sn]);
+      } else
+         res = lca(res, late(late, user));
+      nd.best = in->owner();
+      if (RSN_LIKELY(res) && RSN_LIKELY(cfg.dominates(early(early, in), res))) { // otherwise, dead or unschedulable
+         nd.best = res;
+         for (auto bb = res; bb != nd.early;) if (bb = cfg.idom[bb->sn], loops.depth(bb) < loops.depth(nd.best)) nd.best = bb;
+      }
+      order.push_back(in);
+      return nd.best;
+   };
+   for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) late(late, in);
+
+   // Move Insns ///////////////////////////////////////////////////////////////////////////////////
+   bool changed{};
+   for (auto in: order) {
+      const auto bb = nodes[in].best;
+      if (RSN_LIKELY(bb == in->owner())) continue;
+      auto next = bb->rear();
+      for (auto _in = bb->head(); _in != bb->rear(); _in = _in->next()) if (RSN_LIKELY(!is<insn_phi>(_in)))
+      for (const auto &input: _in->inputs()) for (const auto &output: in->outputs()) if (RSN_UNLIKELY(input == output)) {
+         next = _in;
+         goto found;
+      }
+   found:
+      ++(cfg.dominates(bb, in->owner()) ? stats.gcm_hoisted : stats.gcm_sunk);
+      in->reattach(next), changed = true;
+   }
+   return changed;
+}
@@ -0,0 +1,109 @@
+// opt-ifconv.cc -- if-conversion
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "opt.hh"
+
+# include <algorithm> // find, min, upper_bound
+
+/* A conditional branch heads a diamond if either target is an arm (a BB entered only from the branch, which has only speculatable insns
+   and jumps on) and both arms jump to the same join BB, or a triangle if one target is an arm that jumps to the other target. The arms
+   are then executed unconditionally, and phi insns in the join BB pick their arguments by select insns with the condition of the branch.
+   This pays if the arms are short, unless the branch is predictable: with the probability p of either way (from the profile if there is
+   one, or estimated statically otherwise), the branch costs p * size1 + (1 - p) * size2 plus a misprediction penalty for the less likely
+   way, and the selects cost size1 + size2 plus one per select insn. */
+bool rsn::opt::transform_if_conversion(proc *pc, const if_conversion_params &params, const edge_weights &weights) {
+   bool changed{};
+   for (bool _changed = true; _changed;) { // nested diamonds collapse inside-out
+      _changed = false;
+      const cfg_info cfg(pc); const loop_forest loops(cfg);
+      const block_frequency freq(cfg, loops);
+      std::vector<bool> touched(cfg.bblocks.size()); // BBs of converted branches (their CFG data got stale)
+      std::vector<bblock *> dead; // emptied arms (eliminated after the round, as they may still come up in RPO)
+      std::vector<bool> stray(cfg.bblocks.size()); // BBs referred to from unreachable ones (and thus not to be eliminated)
+      for (auto bb: cfg.bblocks) if (RSN_UNLIKELY(!cfg.reachable(bb))) for (auto &target: bb->rear()->targets()) stray[target->sn] = true;
+
+      // an arm and the number of insns in it
+      const auto arm = [&](bblock *bb, bblock *head, std::size_t &size) noexcept{
+         if (bb == head || touched[bb->sn] || stray[bb->sn] || cfg.preds[bb->sn].size() != 1 || !is<insn_jmp>(bb->rear())) return false;
+         size = 0;
+         for (auto in = bb->head(); in != bb->rear(); in = in->next()) if (!speculatable(in) || ++size > params.max_arm_size) return false;
+         return true;
+      };
+      const auto same = [](operand *lhs, operand *rhs) noexcept{
+         return lhs == rhs || (is<abs>(lhs) && is<abs>(rhs) && as<abs>(lhs)->val == as<abs>(rhs)->val);
+      };
+
+      for (auto head: cfg.rpo) {
+         if (touched[head->sn] || RSN_LIKELY(!is<insn_br>(head->rear()))) continue;
+         const auto br = as<insn_br>(head->rear());
+         const auto dest1 = br->dest1(), dest2 = br->dest2();
+         if (RSN_UNLIKELY(dest1 == dest2)) continue;
+
+         // Recognize the Shape /////////////////////////////////////////////////////////////////////
+         std::size_t size1, size2;
+         const bool arm1 = arm(dest1, head, size1), arm2 = arm(dest2, head, size2);
+         const auto next = [](bblock *bb) noexcept{ return as<insn_jmp>(bb->rear())->dest(); };
+         bblock *join, *via1, *via2; // and its preds on either way
+         if (arm1 && arm2 && next(dest1) == next(dest2))
+            join = next(dest1), via1 = dest1, via2 = dest2;
+         else if (arm1 && next(dest1) == dest2)
+            join = dest2, via1 = dest1, via2 = head, size2 = 0;
+         else if (arm2 && next(dest2) == dest1)
+            join = dest1, via1 = head, via2 = dest2, size1 = 0;
+         else
+            continue;
+         if (RSN_UNLIKELY(join == head) || touched[join->sn]) continue;
+         const auto index1 = cfg.pred_index(join, via1), index2 = cfg.pred_index(join, via2);
+         std::size_t selects = 0;
+         for (auto in = join->head(); is<insn_phi>(in); in = in->next())
+            selects += !same(as<insn_phi>(in)->args()[index1], as<insn_phi>(in)->args()[index2]);
+
+         // Apply the Cost Model ////////////////////////////////////////////////////////////////////
+         double prob = freq.probability(head, dest1);
+         if (!weights.empty()) {
+            const auto weight = [&](bblock *to) noexcept{ const auto it = weights.find({head, to}); return it == weights.end() ? 0 : it->second; };
+            if (const auto weight1 = weight(dest1), weight2 = weight(dest2); weight1 + weight2) prob = (double)weight1 / (weight1 + weight2);
+         }
+         const double branchy = params.branch_cost + params.alu_cost * (prob * size1 + (1 - prob) * size2) +
+            params.mispredict_cost * std::min(prob, 1 - prob);
+         if (params.alu_cost * (size1 + size2 + selects) > branchy) continue;
+
+         // Convert /////////////////////////////////////////////////////////////////////////////////
+         for (auto via: {via1, via2}) if (via != head) for (auto in: all(via->head(), via->rear())) in->reattach(br);
+         std::vector<bblock *> preds; // of the join BB afterwards
+         for (auto pred: cfg.preds[join->sn]) if ((pred != via1 && pred != via2) || pred == head) preds.push_back(pred);
+         if (std::find(preds.begin(), preds.end(), head) == preds.end())
+            preds.insert(std::upper_bound(preds.begin(), preds.end(), head, [](auto lhs, auto rhs) noexcept{ return lhs->sn < rhs->sn; }), head);
+         const auto op = br->op == insn_br::_beq ? insn_select::_eq : br->op == insn_br::_bult ? insn_select::_ult : insn_select::_slt;
+         for (auto in: all(join)) {
+            if (!is<insn_phi>(in)) break;
+            const auto phi = as<insn_phi>(in);
+            lib::smart_ptr<operand> val = phi->args()[index1];
+            if (!same(val, phi->args()[index2])) {
+               auto res = vreg::make();
+               insn_select::make(br, op, br->lhs(), br->rhs(), std::move(val), phi->args()[index2], res), val = std::move(res);
+            }
+            std::vector<lib::smart_ptr<operand>> args;
+            for (auto pred: preds) args.push_back(pred == head ? val : phi->args()[cfg.pred_index(join, pred)]);
+            insn_phi::make(phi, std::move(args), std::move(phi->dest())), phi->eliminate();
+         }
+         insn_jmp::make(br, join), br->eliminate();
+         for (auto via: {via1, via2}) if (via != head) touched[via->sn] = true, dead.push_back(via);
+         touched[head->sn] = touched[join->sn] = true;
+         ++stats.if_converted, stats.if_selects += selects, _changed = true;
+      }
+      for (auto bb: dead) bb->eliminate();
+      changed |= _changed;
+   }
+   return changed;
+}
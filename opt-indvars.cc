@@ -0,0 +1,276 @@
+// opt-indvars.cc -- induction variables and strength reduction
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "opt.hh"
+
+# include <algorithm>     // find, find_if, max, min
+# include <unordered_map>
+# include <utility>       // pair
+
+rsn::opt::induction_vars::induction_vars(const cfg_info &cfg, const loop_forest &loops, std::size_t vr_count)
+   : cfg(cfg), loops(loops), recs(vr_count), def(vr_count) {
+   for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) for (const auto &output: in->outputs()) def[output->sn] = in;
+
+   // Find Basic Induction VRs /////////////////////////////////////////////////////////////////////
+   const auto advance = [&](operand *op, operand *from, unsigned long long &step) noexcept{ // whether op = from + step (by add and sub insns)
+      for (step = 0; op != from;) {
+         if (!is<vreg>(op) || !def[as<vreg>(op)->sn] || !is<insn_binop>(def[as<vreg>(op)->sn])) return false;
+         const auto in = as<insn_binop>(def[as<vreg>(op)->sn]);
+         if (in->op == insn_binop::_add && is<abs>(in->rhs()))
+            step += as<abs>(in->rhs())->val, op = in->lhs();
+         else if (in->op == insn_binop::_add && is<abs>(in->lhs()))
+            step += as<abs>(in->lhs())->val, op = in->rhs();
+         else if (in->op == insn_binop::_sub && is<abs>(in->rhs()))
+            step -= as<abs>(in->rhs())->val, op = in->lhs();
+         else
+            return false;
+      }
+      return true;
+   };
+   for (auto &lp: loops.loops) {
+      const auto &preds = cfg.preds[lp.header->sn];
+      const auto entering = std::find_if(preds.begin(), preds.end(), [&](auto pred) noexcept{ return !loops.contains(&lp, pred); }) - preds.begin();
+      if (RSN_UNLIKELY(entering == (std::ptrdiff_t)preds.size()) || // the entry BB
+          std::find_if(preds.begin() + entering + 1, preds.end(), [&](auto pred) noexcept{ return !loops.contains(&lp, pred); }) != preds.end())
+         continue;
+      for (auto in = lp.header->head(); is<insn_phi>(in); in = in->next()) {
+         const auto phi = as<insn_phi>(in);
+         unsigned long long step{};
+         for (std::size_t sn = 0; sn < preds.size(); ++sn) if (sn != (std::size_t)entering) {
+            unsigned long long _step;
+            if (!advance(phi->args()[sn], phi->dest(), _step) || (sn != (entering ? 0 : 1) && _step != step)) goto next;
+            step = _step;
+         }
+         if (RSN_LIKELY(step)) recs[phi->dest()->sn] = {&lp, phi, phi->args()[entering], step, 1, 0, {}, 0};
+      next:;
+      }
+   }
+
+   // Derive Recurrences (in Reverse Postorder, so Definitions Precede Uses) ///////////////////////
+   for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) {
+      recurrence res;
+      if (is<insn_mov>(in)) {
+         const auto rec = of(as<insn_mov>(in)->src());
+         if (RSN_LIKELY(!rec)) continue;
+         res = *rec;
+      } else
+      if (is<insn_binop>(in)) {
+         const auto binop = as<insn_binop>(in);
+         const auto lhs = of(binop->lhs()), rhs = of(binop->rhs());
+         if (RSN_LIKELY(!lhs && !rhs) || (lhs && rhs && lhs->iv != rhs->iv)) continue;
+         // a loop-invariant operand is taken as a recurrence with zero scale
+         const auto lift = [&](const recurrence *rec, const lib::smart_ptr<operand> &op, recurrence &res) noexcept{
+            if (rec) return res = *rec, true;
+            if (!invariant(op, (lhs ? lhs : rhs)->lp)) return false;
+            res = *(lhs ? lhs : rhs), res.scale = res.offset = res.base_scale = 0, res.base = {};
+            if (is<abs>(op)) res.offset = as<abs>(op)->val; else res.base = op, res.base_scale = 1;
+            return true;
+         };
+         recurrence _rhs;
+         if (!lift(lhs, binop->lhs(), res) || !lift(rhs, binop->rhs(), _rhs)) continue;
+         switch (binop->op) {
+         case insn_binop::_sub:
+            _rhs.scale = -_rhs.scale, _rhs.offset = -_rhs.offset, _rhs.base_scale = -_rhs.base_scale;
+            [[fallthrough]];
+         case insn_binop::_add:
+            if (res.base && _rhs.base && res.base != _rhs.base) continue;
+            res.scale += _rhs.scale, res.offset += _rhs.offset, res.base_scale += _rhs.base_scale;
+            if (!res.base) res.base = std::move(_rhs.base);
+            break;
+         case insn_binop::_umul:
+         case insn_binop::_smul:
+            if ((lhs && rhs) || !is<abs>(lhs ? binop->rhs() : binop->lhs())) continue;
+            if (!lhs) res = std::move(_rhs);
+            {  const auto val = as<abs>(lhs ? binop->rhs() : binop->lhs())->val;
+               res.scale *= val, res.offset *= val, res.base_scale *= val;
+            }
+            break;
+         case insn_binop::_shl:
+            if (!lhs || !is<abs>(binop->rhs())) continue;
+            {  const auto count = as<abs>(binop->rhs())->val & 63;
+               res.scale <<= count, res.offset <<= count, res.base_scale <<= count;
+            }
+            break;
+         default:
+            continue;
+         }
+         if (!res.base_scale) res.base = {};
+      } else
+         continue;
+      if (RSN_LIKELY(loops.contains(res.lp, bb))) recs[in->outputs()[0]->sn] = std::move(res); // outside, the IV is not current any more
+   }
+}
+
+bool rsn::opt::induction_vars::invariant(operand *op, const loop_forest::loop *lp) const noexcept {
+   return !is<vreg>(op) || !def[as<vreg>(op)->sn] || !loops.contains(lp, def[as<vreg>(op)->sn]->owner());
+}
+
+bool rsn::opt::induction_vars::trip_count(const loop_forest::loop &lp, unsigned long long &res) const noexcept {
+   if (!is<insn_br>(lp.header->rear())) return false;
+   const auto br = as<insn_br>(lp.header->rear());
+   if (br->dest1() == br->dest2() || loops.contains(&lp, br->dest1()) == loops.contains(&lp, br->dest2())) return false;
+   const bool proceeds = loops.contains(&lp, br->dest1()); // whether the loop proceeds when the condition holds
+   const bool lhs_iv = of(br->lhs()) && of(br->lhs())->lp == &lp;
+   const auto rec = of(lhs_iv ? br->lhs() : br->rhs());
+   const auto &bound = lhs_iv ? br->rhs() : br->lhs();
+   if (!rec || rec->lp != &lp || rec->base || !is<abs>(rec->init) || !is<abs>(bound)) return false;
+   // the IV that is tested goes through start, start + step, start + 2 * step, ...
+   const auto start = rec->scale * as<abs>(rec->init)->val + rec->offset, step = rec->scale * rec->step, val = as<abs>(bound)->val;
+   if (RSN_UNLIKELY(!step)) return false;
+
+   if (br->op == insn_br::_beq) {
+      if (proceeds) return res = start == val, true;
+      // the least k such that start + k * step == val (mod 2**64)
+      const auto dist = val - start;
+      if (!dist) return res = 0, true;
+      const auto tz = __builtin_ctzll(step);
+      if (__builtin_ctzll(dist) < tz) return false; // never
+      auto odd = step >> tz, inv = odd; // the inverse of odd (Newton's iteration, each step doubles the number of correct low bits)
+      for (int count = 0; count < 5; ++count) inv *= 2 - odd * inv;
+      return res = (dist >> tz) * inv & (tz ? (1ull << (64 - tz)) - 1 : ~0ull), true;
+   }
+   // the loop proceeds while the IV (with the sign bit flipped for bslt) is in [lo, hi]
+   const auto flip = br->op == insn_br::_bslt ? 1ull << 63 : 0;
+   const auto _start = start ^ flip, _val = val ^ flip;
+   unsigned long long lo, hi;
+   if (lhs_iv == proceeds) { // IV < val or IV >= val
+      if (proceeds) { if (!_val) return res = 0, true; lo = 0, hi = _val - 1; } else lo = _val, hi = ~0ull;
+   } else {                  // val < IV or val >= IV
+      if (proceeds) { if (!~_val) return res = 0, true; lo = _val + 1, hi = ~0ull; } else lo = 0, hi = _val;
+   }
+   if (_start < lo || _start > hi) return res = 0, true;
+   unsigned long long count; bool wraps;
+   if ((long long)step > 0)
+      count = (hi - _start) / step + 1, wraps = (unsigned __int128)_start + (unsigned __int128)count * step > ~0ull;
+   else
+      count = (_start - lo) / -step + 1, wraps = (unsigned __int128)count * -step > _start;
+   if (const auto last = _start + count * step; wraps && last >= lo && last <= hi) return false; // back into the range
+   return res = count, true;
+}
+
+/* Mul and shl insns in loops computing recurrences are replaced with new induction VRs (one per distinct recurrence), which are initialized
+   in the preheader and advanced by an add on each back edge. Then the exit test in the header of a loop is rewritten in terms of such an
+   induction VR (linear-function test replacement) if the basic induction VR would be dead otherwise, and the latter is deleted: this is
+   exact for beq when the scale is odd (i.e., the mapping is invertible), and otherwise (for beq and bult) when the trip count is known and
+   the mapping does not overflow over the range of tested values. */
+bool rsn::opt::transform_strength_reduction(proc *pc) {
+   bool changed = transform_loop_preheaders(pc);
+   const cfg_info cfg(pc); const loop_forest loops(cfg);
+   const induction_vars ivs(cfg, loops, number_vregs(pc));
+   using recurrence = induction_vars::recurrence;
+
+   // base_scale * base + scale * val + offset (computed at the end of the BB unless known)
+   const auto apply = [](bblock *bb, lib::smart_ptr<operand> val, const recurrence &rec)->lib::smart_ptr<operand>{
+      const auto make = [bb](decltype(insn_binop::_add) op, lib::smart_ptr<operand> lhs, lib::smart_ptr<operand> rhs) {
+         auto res = vreg::make(); insn_binop::make(bb->rear(), op, std::move(lhs), std::move(rhs), res);
+         return res;
+      };
+      if (is<abs>(val))
+         val = abs::make(rec.scale * as<abs>(val)->val + rec.offset);
+      else {
+         if (rec.scale != 1) val = make(insn_binop::_umul, std::move(val), abs::make(rec.scale));
+         if (rec.offset) val = make(insn_binop::_add, std::move(val), abs::make(rec.offset));
+      }
+      if (rec.base) val = make(insn_binop::_add, std::move(val),
+         rec.base_scale == 1 ? rec.base : (lib::smart_ptr<operand>)make(insn_binop::_umul, rec.base, abs::make(rec.base_scale)));
+      return val;
+   };
+
+   // Strength Reduction ///////////////////////////////////////////////////////////////////////////
+   std::vector<std::pair<const recurrence *, lib::smart_ptr<vreg>>> reduced; // new induction VRs
+   std::vector<lib::smart_ptr<operand>> orphans; // inputs of replaced insns (which may become dead)
+   for (auto bb: cfg.rpo) for (auto in: all(bb)) {
+      if (RSN_LIKELY(!is<insn_binop>(in))) continue;
+      const auto binop = as<insn_binop>(in);
+      if (binop->op != insn_binop::_umul && binop->op != insn_binop::_smul && binop->op != insn_binop::_shl) continue;
+      const auto rec = ivs.of(binop->dest());
+      if (RSN_LIKELY(!rec) || !rec->scale || !loops.preheader(*rec->lp)) continue;
+      auto it = std::find_if(reduced.begin(), reduced.end(), [&](const auto &it) noexcept{
+         return it.first->iv == rec->iv && it.first->scale == rec->scale && it.first->offset == rec->offset &&
+            it.first->base == rec->base && it.first->base_scale == rec->base_scale;
+      });
+      if (it == reduced.end()) {
+         const auto preheader = loops.preheader(*rec->lp), header = rec->lp->header;
+         const auto start = apply(preheader, rec->init, *rec);
+         auto iv = vreg::make();
+         std::vector<lib::smart_ptr<operand>> args;
+         for (auto pred: cfg.preds[header->sn]) if (pred == preheader) args.push_back(start); else {
+            auto next = vreg::make();
+            insn_binop::make_add(pred->rear(), iv, abs::make(rec->scale * rec->step), next), args.push_back(std::move(next));
+         }
+         insn_phi::make(header->head(), std::move(args), iv);
+         reduced.emplace_back(rec, std::move(iv)), it = reduced.end() - 1;
+      }
+      orphans.push_back(binop->lhs()), orphans.push_back(binop->rhs());
+      insn_mov::make(in, it->second, std::move(binop->dest())), in->eliminate();
+      ++stats.sr_insns, changed = true;
+   }
+   if (RSN_LIKELY(reduced.empty())) return changed;
+
+   // Linear-Function Test Replacement /////////////////////////////////////////////////////////////
+   std::unordered_map<operand *, std::pair<std::size_t, insn *>> info; // use count and definition
+   for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) {
+      for (const auto &input: in->inputs()) if (is<vreg>(input)) ++info[input].first;
+      for (const auto &output: in->outputs()) info[output].second = in;
+   }
+   for (std::size_t sn = 0; sn < orphans.size(); ++sn) { // eliminate recurrences that are dead now (so that they do not keep induction VRs alive)
+      const auto op = orphans[sn];
+      auto &[uses, in] = info[op];
+      if (uses || !in || is<insn_phi>(in) || !ivs.of(op)) continue;
+      for (const auto &input: in->inputs()) if (is<vreg>(input)) --info[input].first, orphans.push_back(input);
+      in->eliminate(), in = nullptr;
+   }
+   for (auto &lp: loops.loops) {
+      const auto header = lp.header, preheader = loops.preheader(lp);
+      if (!preheader || !is<insn_br>(header->rear())) continue;
+      const auto br = as<insn_br>(header->rear());
+      if (br->op == insn_br::_bslt || br->dest1() == br->dest2() || loops.contains(&lp, br->dest1()) == loops.contains(&lp, br->dest2())) continue;
+      const auto basic = [&](operand *op) noexcept{ const auto rec = ivs.of(op); return rec && rec->lp == &lp && rec->iv->dest() == op ? rec : nullptr; };
+      const bool lhs_iv = basic(br->lhs());
+      auto &iv_op = lhs_iv ? br->lhs() : br->rhs(), &bound = lhs_iv ? br->rhs() : br->lhs();
+      const auto iv = basic(iv_op);
+      if (!iv || !ivs.invariant(bound, &lp)) continue;
+
+      // besides the test, the basic induction VR is used only by its increments, which are used only by itself
+      std::vector<insn *> incs;
+      std::size_t latch_count = 0, inc_uses = 0;
+      for (std::size_t sn = 0; sn < cfg.preds[header->sn].size(); ++sn) if (cfg.preds[header->sn][sn] != preheader) {
+         const auto in = info[iv->iv->args()[sn]].second;
+         if (!is<insn_binop>(in) || !((as<insn_binop>(in)->lhs() == iv_op && is<abs>(as<insn_binop>(in)->rhs())) ||
+             (as<insn_binop>(in)->op == insn_binop::_add && as<insn_binop>(in)->rhs() == iv_op && is<abs>(as<insn_binop>(in)->lhs())))) goto next;
+         if (std::find(incs.begin(), incs.end(), in) == incs.end()) incs.push_back(in), inc_uses += info[as<insn_binop>(in)->dest()].first;
+         ++latch_count;
+      }
+      if (inc_uses != latch_count || info[iv_op].first != incs.size() + 1) continue;
+
+      // the new test (on the first suitable reduced induction VR)
+      for (const auto &[rec, val]: reduced) if (rec->iv == iv->iv) {
+         if (br->op != insn_br::_beq || !(rec->scale & 1)) { // unless invertible, the tested values (with the bound) must map monotonically
+            unsigned long long trips;
+            if (rec->base || !is<abs>(bound) || !is<abs>(iv->init) || (long long)rec->scale <= 0 || !ivs.trip_count(lp, trips)) continue;
+            const __int128 first = as<abs>(iv->init)->val, last = first + (__int128)(long long)iv->step * trips, val = as<abs>(bound)->val;
+            const auto lo = std::min({first, last, val}), hi = std::max({first, last, val});
+            const auto map = [&](__int128 val) noexcept{ return val * rec->scale + (long long)rec->offset; };
+            if (lo < 0 || hi > (__int128)~0ull || map(lo) < 0 || map(hi) > (__int128)~0ull) continue;
+         }
+         bound = apply(preheader, bound, *rec);
+         iv_op = val;
+         iv->iv->eliminate();
+         for (auto in: incs) in->eliminate();
+         ++stats.sr_tests;
+         break;
+      }
+   next:;
+   }
+   return changed;
+}
@@ -0,0 +1,167 @@
+// opt-ipcp.cc -- interprocedural constant propagation and specialization of procedures on constant arguments
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "opt.hh"
+
+# include <algorithm>     // find, find_if, remove_if
+# include <unordered_map> // unordered_map
+# include <utility>       // pair
+
+namespace rsn::opt {
+   // link-time symbol of a specialized version (derived from the callee's one and the bindings, for the same clone to get the same symbol
+   // across runs and compilations)
+   static decltype(rel_base::id) derive_id(const specialization_cache::key &key) noexcept {
+      auto res = key.first;
+      const auto mix = [&res](unsigned long long val) noexcept{ // two cross-fed lanes of multiply-xorshift (MurmurHash3's finalizer)
+         res.first  = (res.first ^ val) * 0xFF51AFD7ED558CCD, res.first ^= res.first >> 33;
+         res.second = (res.second ^ res.first) * 0xC4CEB9FE1A85EC53, res.second ^= res.second >> 33;
+      };
+      for (const auto &[sn, val]: key.second) mix(sn), mix(val);
+      mix(key.second.size());
+      return res;
+   }
+
+   // a copy of the procedure under another link-time symbol (with BBs and VRs of its own)
+   static lib::smart_ptr<proc> clone(proc *pc, decltype(rel_base::id) id) {
+      auto res = proc::make(std::move(id));
+      std::vector<bblock *> bbmap;
+      for (auto bb = pc->head(); bb; bb = bb->next()) bb->sn = bbmap.size(), bbmap.push_back(bblock::make(res));
+      std::vector<lib::smart_ptr<vreg>> vrmap(number_vregs(pc));
+      for (auto &vr: vrmap) vr = vreg::make();
+      for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) {
+         const auto _in = in->clone(bbmap[bb->sn]);
+         for (auto &input: _in->inputs()) if (is<vreg>(input)) input = vrmap[as<vreg>(input)->sn];
+         for (auto &output: _in->outputs()) output = vrmap[output->sn];
+         for (auto &target: _in->targets()) target = bbmap[target->sn];
+      }
+      return res;
+   }
+
+   // the params get the constants by mov insns right after the insn_entry, which defines dummy VRs instead (so SSA form is preserved)
+   static void bind(proc *pc, const std::vector<std::pair<std::size_t, unsigned long long>> &bindings) {
+      const auto entry = as<insn_entry>(pc->head()->head());
+      for (const auto &[sn, val]: bindings)
+         insn_mov::make(entry->next(), abs::make(val), entry->params()[sn]), entry->params()[sn] = vreg::make();
+   }
+}
+
+/* References:
+   - Interprocedural Constant Propagation by David Callahan, Keith D. Cooper, Ken Kennedy, and Linda Torczon
+   - Procedure Cloning by Keith D. Cooper, Mary W. Hall, and Ken Kennedy
+
+   Only abs arguments of direct calls (insn_call of a proc with a body) are considered, and only for params the callee uses (so that the
+   pass is idempotent). When all call sites of an internal callee whose address does not escape pass the same constant for a param, the
+   param gets bound in place (call sites are intact, and constant propagation in the callee is left to the client). Otherwise, a call
+   site passing constants for the (remaining) params is redirected to a clone of the callee with them bound, which is looked up in (or
+   added to) the specialization cache; in turn, clones are specialized further for their new call sites (but never bound in place, as
+   they are not internal). Clones are not added to the program, so their own call sites are examined only if the client passes them in
+   another run. The address of a procedure escapes when it is an operand other than the dest of an insn_call, or a value of a static data
+   block referenced from the program. */
+bool rsn::opt::transform_ipcp(const std::vector<proc *> &procs, const std::vector<proc *> &internal, specialization_cache &cache,
+   const ipcp_params &params) {
+   // Collect Call Sites ///////////////////////////////////////////////////////////////////////////
+   struct callee {
+      proc *pc;
+      std::vector<insn_call *> sites;
+      bool open; // the address escapes, or not all call sites are known
+   };
+   std::vector<callee> callees; std::unordered_map<proc *, std::size_t> index; // in the order of discovery (for determinism)
+   std::vector<proc *> escaped;
+   for (auto pc: procs) for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) {
+      for (const auto &input: in->inputs()) {
+         if (is<data>(input)) for (const auto &value: as<data>(input)->values) if (RSN_UNLIKELY(is<proc>(value))) escaped.push_back(as<proc>(value));
+         if (RSN_UNLIKELY(is<proc>(input)) && (!is<insn_call>(in) || &input != &as<insn_call>(in)->dest())) escaped.push_back(as<proc>(input));
+      }
+      if (RSN_LIKELY(!is<insn_call>(in)) || RSN_UNLIKELY(!is<proc>(as<insn_call>(in)->dest()))) continue;
+      const auto _pc = as<proc>(as<insn_call>(in)->dest());
+      if (RSN_UNLIKELY(!_pc->head()) || RSN_UNLIKELY(!is<insn_entry>(_pc->head()->head()))) continue; // external procedure
+      auto [it, inserted] = index.try_emplace(_pc, callees.size());
+      if (inserted) callees.push_back({_pc, {}, false});
+      callees[it->second].sites.push_back(as<insn_call>(in));
+   }
+   for (auto pc: escaped) if (auto it = index.find(pc); it != index.end()) callees[it->second].open = true;
+
+   bool changed{};
+   std::vector<std::pair<proc *, insn_call *>> redirected; // new call sites of clones (which might be specialized further)
+   for (std::size_t cl_sn = 0; cl_sn < callees.size(); ++cl_sn) {
+      auto &cl = callees[cl_sn];
+      const auto entry = as<insn_entry>(cl.pc->head()->head());
+      const auto param_count = entry->params().size();
+      if (RSN_UNLIKELY(std::find_if(cl.sites.begin(), cl.sites.end(), [&](insn_call *site) noexcept{ return site->params().size() != param_count; })
+         != cl.sites.end())) continue; // mismatched calls trap
+      std::vector<signed char> used(param_count); // params the callee uses (and not bound yet)
+      {  std::vector<signed char> _used(number_vregs(cl.pc));
+         for (auto bb = cl.pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next())
+            for (const auto &input: in->inputs()) if (is<vreg>(input)) _used[as<vreg>(input)->sn] = true;
+         for (std::size_t sn = 0; sn < param_count; ++sn) used[sn] = _used[entry->params()[sn]->sn];
+      }
+
+      const bool in_place = std::find(internal.begin(), internal.end(), cl.pc) != internal.end() && !cl.open;
+      for (bool progress = true; progress;) { // binding in place and redirection enable each other (bounded by params and call sites)
+         progress = false;
+
+         // Bind Params in Place Where All (Remaining) Call Sites Agree ////////////////////////////
+         if (in_place && !cl.sites.empty()) {
+            std::vector<std::pair<std::size_t, unsigned long long>> bindings;
+            for (std::size_t sn = 0; sn < param_count; ++sn) {
+               if (!used[sn]) continue;
+               const auto agreed = [&]() noexcept->abs *{
+                  if (!is<abs>(cl.sites.front()->params()[sn])) return {};
+                  const auto res = as<abs>(cl.sites.front()->params()[sn]);
+                  for (auto site: cl.sites) if (!is<abs>(site->params()[sn]) || as<abs>(site->params()[sn])->val != res->val) return {};
+                  return res;
+               }();
+               if (agreed) bindings.emplace_back(sn, agreed->val), used[sn] = false;
+            }
+            if (!bindings.empty()) bind(cl.pc, bindings), stats.ipcp_bound += bindings.size(), progress = true;
+         }
+
+         // Redirect Call Sites to Specialized Versions ///////////////////////////////////////////
+         const auto size = [&]() noexcept{
+            std::size_t res = 0;
+            for (auto bb = cl.pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) ++res;
+            return res;
+         }();
+         if (size <= params.max_size) for (auto site: cl.sites) {
+            specialization_cache::key key{cl.pc->id, {}};
+            for (std::size_t sn = 0; sn < param_count; ++sn)
+               if (used[sn] && is<abs>(site->params()[sn])) key.second.emplace_back(sn, as<abs>(site->params()[sn])->val);
+            if (key.second.empty()) continue;
+            auto it = cache.clones.find(key);
+            if (it == cache.clones.end()) {
+               std::size_t count = 0;
+               for (auto _it = cache.clones.lower_bound({key.first, {}}); _it != cache.clones.end() && _it->first.first == key.first; ++_it) ++count;
+               if (count >= params.max_clones) continue;
+               auto res = clone(cl.pc, derive_id(key));
+               bind(res, key.second), ++stats.ipcp_clones;
+               it = cache.clones.emplace(std::move(key), std::move(res)).first;
+            }
+            site->dest() = it->second, redirected.emplace_back(it->second, site), ++stats.ipcp_redirected, progress = true;
+         }
+         cl.sites.erase(std::remove_if(cl.sites.begin(), cl.sites.end(), [&](insn_call *site) noexcept{ return site->dest() != cl.pc; }), cl.sites.end());
+         changed |= progress;
+      }
+
+      // Enqueue Clones with Their New Call Sites /////////////////////////////////////////////////
+      for (const auto &[pc, site]: redirected) {
+         auto [it, inserted] = index.try_emplace(pc, callees.size());
+         if (RSN_UNLIKELY(!inserted) && RSN_UNLIKELY(it->second <= cl_sn)) // already done (with the other call sites, unknown by now)
+            it->second = callees.size(), callees.push_back({pc, {}, true});
+         else if (inserted)
+            callees.push_back({pc, {}, false});
+         callees[it->second].sites.push_back(site);
+      }
+      redirected.clear();
+   }
+   return changed;
+}
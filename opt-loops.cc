@@ -0,0 +1,297 @@
+// opt-loops.cc -- loop transformations
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "opt.hh"
+
+# include <algorithm> // all_of, equal, find_if
+
+bool rsn::opt::transform_loop_preheaders(proc *pc) {
+   bool changed{};
+   for (;;) {
+      cfg_info cfg(pc); loop_forest loops(cfg);
+      // find a loop without a preheader
+      auto lp = std::find_if(loops.loops.begin(), loops.loops.end(), [&](const auto &lp) noexcept{
+         return !loops.preheader(lp) && lp.header != pc->head(); // no room for a preheader before the entry BB
+      });
+      if (RSN_LIKELY(lp == loops.loops.end())) return changed;
+      const auto header = lp->header;
+      const auto &old_preds = cfg.preds[header->sn];
+      std::vector<bblock *> outside;
+      for (auto pred: old_preds) if (!loops.contains(&*lp, pred)) outside.push_back(pred);
+
+      // insert the preheader immediately before the header and redirect entering edges to it
+      auto preheader = bblock::make(header);
+      insn_jmp::make(preheader, header);
+      for (auto pred: outside) for (auto &target: pred->rear()->targets()) if (target == header) target = preheader;
+
+      // split phi insns between the header and preheader
+      std::vector<bblock *> new_preds; // the preheader goes after the latches preceding the header in the procedure order
+      for (auto pred: old_preds) if (loops.contains(&*lp, pred) && pred->sn < header->sn) new_preds.push_back(pred);
+      new_preds.push_back(preheader);
+      for (auto pred: old_preds) if (loops.contains(&*lp, pred) && pred->sn >= header->sn) new_preds.push_back(pred); // a self-loop header is a latch
+      for (auto in: all(header)) {
+         if (RSN_LIKELY(!is<insn_phi>(in))) break;
+         const auto args = as<insn_phi>(in)->args();
+         lib::smart_ptr<operand> entering;
+         {  std::vector<lib::smart_ptr<operand>> outside_args;
+            for (auto pred: outside) outside_args.push_back(args[cfg.pred_index(header, pred)]);
+            if (std::all_of(outside_args.begin(), outside_args.end(), [&](const auto &arg) noexcept{ return arg == outside_args.front(); }))
+               entering = outside_args.front();
+            else {
+               auto phi_dest = vreg::make();
+               insn_phi::make(preheader->rear(), std::move(outside_args), phi_dest), entering = std::move(phi_dest);
+            }
+         }
+         std::vector<lib::smart_ptr<operand>> new_args;
+         for (auto pred: new_preds) new_args.push_back(pred == preheader ? entering : args[cfg.pred_index(header, pred)]);
+         insn_phi::make(in, std::move(new_args), std::move(as<insn_phi>(in)->dest())), in->eliminate();
+      }
+      ++stats.loop_preheaders, changed = true;
+   }
+}
+
+/* Hoist invariant insns into loop preheaders, innermost loops first (an insn hoisted out of a nested loop may then be hoisted out of the
+   enclosing loop as well). An insn is invariant when its vreg inputs are all defined outside the loop; only pure insns that cannot trap
+   qualify. */
+bool rsn::opt::transform_licm(proc *pc) {
+   bool changed = transform_loop_preheaders(pc);
+   cfg_info cfg(pc); loop_forest loops(cfg);
+
+   std::vector<bblock *> def_bb(number_vregs(pc));
+   for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next())
+      for (const auto &output: in->outputs()) def_bb[output->sn] = bb;
+
+   for (auto &lp: loops.loops) {
+      const auto preheader = loops.preheader(lp);
+      if (RSN_UNLIKELY(!preheader)) continue;
+      for (auto bb: lp.bblocks) for (auto in: all(bb)) {
+         if (RSN_LIKELY(!speculatable(in))) continue;
+         for (const auto &input: in->inputs())
+            if (is<vreg>(input) && def_bb[as<vreg>(input)->sn] && loops.contains(&lp, def_bb[as<vreg>(input)->sn])) goto next;
+         in->reattach(preheader->rear());
+         for (const auto &output: in->outputs()) def_bb[output->sn] = preheader;
+         ++stats.licm_hoisted, changed = true;
+      next:;
+      }
+   }
+   return changed;
+}
+
+/* A call to the procedure itself whose results are returned immediately (a tail call) is replaced with a jump back to a loop header split
+   off the entry BB right after the insn_entry. Phi insns in the header rebind the parameters: to the values from the insn_entry on the way in,
+   and to the call arguments on the back edges. Thus recursion runs in constant stack, and loop optimizations apply to it. */
+bool rsn::opt::transform_tail_recursion(proc *pc) {
+   const cfg_info cfg(pc);
+   const auto entry = pc->head();
+   if (RSN_UNLIKELY(!cfg.preds[entry->sn].empty())) return false; // the entry BB is not to be entered but from the caller
+   const auto params = as<insn_entry>(entry->head())->params();
+
+   std::vector<bblock *> sites; // BBs ending in a self tail call (in the procedure order, like the predecessors of the header will be)
+   for (auto bb: cfg.bblocks) if (RSN_LIKELY(cfg.reachable(bb)) && RSN_UNLIKELY(is<insn_ret>(bb->rear())) && bb->rear() != bb->head()) {
+      const auto ret = as<insn_ret>(bb->rear());
+      if (RSN_LIKELY(!is<insn_call>(ret->prev()))) continue;
+      const auto call = as<insn_call>(ret->prev());
+      if (is<proc>(call->dest()) && as<proc>(call->dest())->id == pc->id && call->params().size() == params.size() &&
+         std::equal(ret->results().begin(), ret->results().end(), call->results().begin(), call->results().end(),
+            [](const auto &lhs, const auto &rhs) noexcept{ return lhs == rhs; }) ) sites.push_back(bb);
+   }
+   if (RSN_LIKELY(sites.empty())) return false;
+
+   // split the entry BB after the insn_entry
+   const auto header = RSN_LIKELY(entry->next()) ? bblock::make(entry->next()) : bblock::make(pc);
+   for (auto in: all(entry->head()->next(), {})) in->reattach(header);
+   insn_jmp::make(entry, header);
+   if (sites.front() == entry) sites.front() = header;
+
+   // rebind the parameters and turn the tail calls into jumps
+   const auto first = header->head();
+   for (std::size_t sn = 0; sn < params.size(); ++sn) {
+      auto init = vreg::make();
+      std::vector<lib::smart_ptr<operand>> args; args.reserve(sites.size() + 1);
+      args.push_back(init);
+      for (auto bb: sites) args.push_back(as<insn_call>(bb->rear()->prev())->params()[sn]);
+      insn_phi::make(first, std::move(args), std::move(params[sn])), params[sn] = std::move(init);
+   }
+   for (auto bb: sites) {
+      bb->rear()->prev()->eliminate(), bb->rear()->eliminate();
+      insn_jmp::make(bb, header);
+   }
+   stats.tail_calls += sites.size();
+   return true;
+}
+
+/* A counted loop is an innermost loop with a preheader and a single latch that is only left from its header, where the header ends in a beq
+   or bult insn comparing a basic induction VR (a header phi stepped by an add or sub of an absolute value) with a loop-invariant bound. When
+   the trip count is a small compile-time constant, the loop is peeled completely. Otherwise, the body is unrolled into a new loop that runs
+   several iterations per round while at least that many iterations remain (as established by a single test of the distance to the bound,
+   preceded by the original test where the distance may wrap around), and the original loop runs the remaining iterations. */
+bool rsn::opt::transform_loop_unroll(proc *pc, const loop_unroll_params &params) {
+   bool changed = transform_loop_preheaders(pc);
+   std::vector<bblock *> done; // headers of remainder loops
+   for (;;) {
+      const cfg_info cfg(pc); const loop_forest loops(cfg);
+      const auto vr_count = number_vregs(pc);
+      std::vector<insn *> def(vr_count);
+      for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) for (const auto &output: in->outputs()) def[output->sn] = in;
+      const auto header_phi = [&](operand *op, bblock *header) noexcept{
+         return is<vreg>(op) && def[as<vreg>(op)->sn] && is<insn_phi>(def[as<vreg>(op)->sn]) && def[as<vreg>(op)->sn]->owner() == header;
+      };
+
+      for (auto &lp: loops.loops) {
+         // Recognize a Counted Loop /////////////////////////////////////////////////////////////////
+         const auto header = lp.header, preheader = loops.preheader(lp);
+         if (!lp.kids.empty() || !preheader || lp.latches.size() != 1 || std::find(done.begin(), done.end(), header) != done.end()) continue;
+         const auto latch = lp.latches.front();
+         if (!is<insn_br>(header->rear())) continue;
+         const auto br = as<insn_br>(header->rear());
+         if (br->dest1() == br->dest2() || loops.contains(&lp, br->dest1()) == loops.contains(&lp, br->dest2())) continue;
+         const auto stay = loops.contains(&lp, br->dest1()) ? br->dest1() : br->dest2(), exit = stay == br->dest1() ? br->dest2() : br->dest1();
+         if (stay != header && cfg.preds[stay->sn].size() != 1) continue;
+         unsigned size = 0; // not counting phi and jmp insns
+         for (auto bb: lp.bblocks) {
+            if (bb != header) for (auto succ: cfg.succs[bb->sn]) if (!loops.contains(&lp, succ)) goto next;
+            for (auto in = bb->head(); in; in = in->next()) size += !is<insn_phi>(in) && !is<insn_jmp>(in);
+         }
+         {  // the induction VR, its step, and the bound
+            const bool lhs_iv = header_phi(br->lhs(), header);
+            if (!lhs_iv && !header_phi(br->rhs(), header)) continue;
+            const auto &bound = lhs_iv ? br->rhs() : br->lhs();
+            if (!is<abs>(bound) && !(is<vreg>(bound) && (!def[as<vreg>(bound)->sn] || !loops.contains(&lp, def[as<vreg>(bound)->sn]->owner()))))
+               continue;
+            const auto iv = as<insn_phi>(def[as<vreg>(lhs_iv ? br->lhs() : br->rhs())->sn]);
+            const auto pre_sn = cfg.pred_index(header, preheader), latch_sn = cfg.pred_index(header, latch);
+            const auto &init = iv->args()[pre_sn], &next = iv->args()[latch_sn];
+            if (!is<vreg>(next) || !def[as<vreg>(next)->sn] || !is<insn_binop>(def[as<vreg>(next)->sn])) continue;
+            unsigned long long step;
+            if (const auto inc = as<insn_binop>(def[as<vreg>(next)->sn]); inc->op == insn_binop::_add && inc->lhs() == iv->dest() && is<abs>(inc->rhs()))
+               step = as<abs>(inc->rhs())->val;
+            else if (inc->op == insn_binop::_add && inc->rhs() == iv->dest() && is<abs>(inc->lhs()))
+               step = as<abs>(inc->lhs())->val;
+            else if (inc->op == insn_binop::_sub && inc->lhs() == iv->dest() && is<abs>(inc->rhs()))
+               step = -as<abs>(inc->rhs())->val;
+            else
+               continue;
+            if (RSN_UNLIKELY(!step)) continue;
+            const bool positive = (long long)step > 0; // distance to the bound: bound - IV if positive, IV - bound otherwise
+
+            // Cost Model ///////////////////////////////////////////////////////////////////////////////
+            unsigned factor = 0; bool peel = false;
+            if (is<abs>(init) && is<abs>(bound)) { // simulate the loop
+               const auto proceeds = [&](unsigned long long val) noexcept{
+                  const auto lhs = lhs_iv ? val : as<abs>(bound)->val, rhs = lhs_iv ? as<abs>(bound)->val : val;
+                  return (br->op == insn_br::_beq ? lhs == rhs : br->op == insn_br::_bult ? lhs < rhs : (long long)lhs < (long long)rhs) ==
+                     (stay == br->dest1());
+               };
+               unsigned trips = 0;
+               for (auto val = as<abs>(init)->val; trips <= params.max_peel_trips && proceeds(val); val += step) ++trips;
+               if (trips <= params.max_peel_trips && trips * size <= params.max_peel_size) factor = trips, peel = true;
+            }
+            bool range_test = true;        // whether the distance may wrap around
+            unsigned long long min_dist{}; // for factor iterations in a row
+            if (!peel) {
+               factor = std::min(params.max_factor, params.max_size / size);
+               if (factor < 2 || (positive ? step : -step) >= 1ull << 32) continue;
+               bool strict = true;
+               switch (br->op) {
+               case insn_br::_beq: // proceeds while IV != bound
+                  if (stay != br->dest2() || (step != 1 && step != -1ull)) continue;
+                  range_test = false;
+                  break;
+               case insn_br::_bult: // proceeds while IV < bound or bound < IV (strict), or IV >= bound or bound >= IV
+                  strict = stay == br->dest1();
+                  if (positive != (lhs_iv == strict)) continue;
+                  break;
+               default:
+                  continue;
+               }
+               min_dist = (factor - 1) * (positive ? step : -step) + strict;
+            }
+
+            // Unroll or Peel ///////////////////////////////////////////////////////////////////////////
+            std::vector<insn_phi *> phis;
+            for (auto in = header->head(); is<insn_phi>(in); in = in->next()) phis.push_back(as<insn_phi>(in));
+            const std::size_t iv_sn = std::find(phis.begin(), phis.end(), iv) - phis.begin();
+            const auto pos = [&](bblock *bb) noexcept->std::size_t{ return std::find(lp.bblocks.begin(), lp.bblocks.end(), bb) - lp.bblocks.begin(); };
+
+            // the head of the unrolled loop where each round begins (phis are added at the end), and the copies of the body
+            bblock *head{}, *test{};
+            std::vector<lib::smart_ptr<vreg>> head_vals(phis.size());
+            if (!peel) {
+               head = bblock::make(header), test = range_test ? bblock::make(header) : head;
+               for (auto &val: head_vals) val = vreg::make();
+            }
+            std::vector<std::vector<bblock *>> copies(factor, std::vector<bblock *>(lp.bblocks.size()));
+            for (auto &copy: copies) for (auto &bb: copy) bb = bblock::make(header);
+            const auto proceed = [&](std::size_t sn)->bblock *{ return sn + 1 < factor ? copies[sn + 1].front() : peel ? header : head; };
+            if (!peel) {
+               if (range_test) {
+                  const auto clone = br->clone(head);
+                  (lhs_iv ? clone->lhs() : clone->rhs()) = head_vals[iv_sn];
+                  for (auto &target: clone->targets()) target = target == stay ? test : header;
+               }
+               const auto dist = vreg::make();
+               insn_binop::make_sub(test, positive ? bound : head_vals[iv_sn], positive ? head_vals[iv_sn] : bound, dist);
+               insn_br::make_bult(test, dist, abs::make(min_dist), header, copies.front().front());
+            }
+
+            std::vector<lib::smart_ptr<operand>> vals(vr_count); // values of the loop VRs in the current copy (indexed by vreg::sn)
+            const auto val = [&](const lib::smart_ptr<operand> &op){ return is<vreg>(op) && vals[as<vreg>(op)->sn] ? vals[as<vreg>(op)->sn] : op; };
+            for (std::size_t sn = 0; sn < phis.size(); ++sn) vals[phis[sn]->dest()->sn] = peel ? phis[sn]->args()[pre_sn] : head_vals[sn];
+            std::vector<std::pair<bblock *, std::vector<bblock *>>> phi_preds; // copies of BBs with phis and the predecessors in the original order
+            for (std::size_t sn = 0; sn < factor; ++sn) {
+               for (std::size_t _sn = 0; _sn < lp.bblocks.size(); ++_sn) { // in reverse postorder, so definitions precede uses
+                  const auto bb = lp.bblocks[_sn], copy = copies[sn][_sn];
+                  if (bb != header && is<insn_phi>(bb->head())) {
+                     phi_preds.emplace_back(copy, std::vector<bblock *>{});
+                     for (auto pred: cfg.preds[bb->sn]) phi_preds.back().second.push_back(copies[sn][pos(pred)]);
+                  }
+                  for (auto in = bb->head(); in; in = in->next()) {
+                     if (RSN_UNLIKELY(in == br)) { insn_jmp::make(copy, stay == header ? proceed(sn) : copies[sn][pos(stay)]); break; }
+                     if (bb == header && is<insn_phi>(in)) continue;
+                     const auto clone = in->clone(copy);
+                     for (auto &input: clone->inputs()) input = val(input);
+                     for (auto &output: clone->outputs()) { auto _output = vreg::make(); vals[output->sn] = _output, output = std::move(_output); }
+                     for (auto &target: clone->targets()) target = target == header ? proceed(sn) : copies[sn][pos(target)];
+                  }
+               }
+               std::vector<lib::smart_ptr<operand>> next_vals; // for the next iteration
+               for (auto phi: phis) next_vals.push_back(val(phi->args()[latch_sn]));
+               for (std::size_t _sn = 0; _sn < phis.size(); ++_sn) vals[phis[_sn]->dest()->sn] = std::move(next_vals[_sn]);
+            }
+
+            // redirect the loop entry and bind the header values
+            for (auto &target: preheader->rear()->targets()) target = peel ? factor ? copies.front().front() : header : head;
+            if (peel) insn_jmp::make(br, exit), br->eliminate();
+            const cfg_info _cfg(pc);
+            const auto first = head ? head->head() : nullptr;
+            for (std::size_t sn = 0; sn < phis.size(); ++sn) {
+               const auto &last = vals[phis[sn]->dest()->sn];
+               std::vector<lib::smart_ptr<operand>> args;
+               if (!peel) {
+                  for (auto pred: _cfg.preds[head->sn]) args.push_back(pred == preheader ? phis[sn]->args()[pre_sn] : last);
+                  insn_phi::make(first, std::move(args), head_vals[sn]), args.clear();
+               }
+               for (auto pred: _cfg.preds[header->sn]) args.push_back(pred == latch ? phis[sn]->args()[latch_sn] : peel ? last : head_vals[sn]);
+               insn_phi::make(phis[sn], std::move(args), std::move(phis[sn]->dest())), phis[sn]->eliminate();
+            }
+            for (const auto &[bb, preds]: phi_preds) reorder_phi_args(bb, preds, _cfg.preds[bb->sn]);
+            if (peel) ++stats.loops_peeled; else ++stats.loops_unrolled, done.push_back(header);
+            changed = true;
+            goto restart;
+         }
+      next:;
+      }
+      return changed;
+   restart:;
+   }
+}
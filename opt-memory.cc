@@ -0,0 +1,282 @@
+// opt-memory.cc -- alias analysis and Memory SSA
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "opt.hh"
+
+# include <algorithm> // find, replace
+
+namespace rsn::opt {
+   // the address and size of the memory written by a scalar or vector store
+   static std::pair<operand *, std::size_t> written(insn *in) noexcept {
+      if (is<insn_store>(in)) return {as<insn_store>(in)->dest(), 8};
+      return {as<insn_vstore>(in)->dest(), as<insn_vstore>(in)->lanes * as<insn_vstore>(in)->width};
+   }
+}
+
+rsn::opt::alias_oracle::alias_oracle(proc *pc) {
+   const auto vr_count = number_vregs(pc);
+   std::vector<insn *> def(vr_count);
+   std::vector<signed char> def_count(vr_count);
+   for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next())
+      for (const auto &output: in->outputs()) def[output->sn] = in, def_count[output->sn] += def_count[output->sn] < 2;
+
+   // Decompose Definitions of VRs (Following Copies and Additions of Constants) ///////////////////
+   vregs.resize(vr_count);
+   std::vector<signed char> visited(vr_count);
+   const auto traverse = [&](auto &traverse, vreg *vr)->address{
+      if (RSN_UNLIKELY(visited[vr->sn])) return vregs[vr->sn].first ? vregs[vr->sn].second : address{vr, 0}; // cycles go through phi insns
+      visited[vr->sn] = true;
+      const auto part = [&](operand *op){ return is<vreg>(op) ? traverse(traverse, as<vreg>(op)) : decompose(op); };
+      address res{vr, 0};
+      if (RSN_LIKELY(def_count[vr->sn] == 1)) {
+         const auto in = def[vr->sn];
+         if (is<insn_mov>(in))
+            res = part(as<insn_mov>(in)->src());
+         else
+         if (is<insn_binop>(in)) switch (const auto binop = as<insn_binop>(in); binop->op) {
+         case insn_binop::_add:
+            if (is<abs>(binop->rhs())) res = part(binop->lhs()), res.offset += as<abs>(binop->rhs())->val;
+            else
+            if (is<abs>(binop->lhs())) res = part(binop->rhs()), res.offset += as<abs>(binop->lhs())->val;
+            break;
+         case insn_binop::_sub:
+            if (is<abs>(binop->rhs())) res = part(binop->lhs()), res.offset -= as<abs>(binop->rhs())->val;
+            break;
+         default:;
+         }
+      }
+      return vregs[vr->sn] = {vr, res}, res;
+   };
+   for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next())
+      for (const auto &output: in->outputs()) traverse(traverse, output);
+}
+
+auto rsn::opt::alias_oracle::decompose(operand *op) const noexcept->address {
+   if (is<abs>(op)) return {{}, as<abs>(op)->val};
+   if (is<rel_base>(op)) return {op, 0};
+   if (is<rel_disp>(op)) return {as<rel_disp>(op)->base, as<rel_disp>(op)->add};
+   if (RSN_LIKELY(as<vreg>(op)->sn < vregs.size()) && RSN_LIKELY(vregs[as<vreg>(op)->sn].first == op)) return vregs[as<vreg>(op)->sn].second;
+   return {op, 0}; // a VR created after the analysis
+}
+
+auto rsn::opt::alias_oracle::query(operand *lhs, std::size_t lhs_size, operand *rhs, std::size_t rhs_size, bool same_instances) const noexcept->result {
+   const auto _lhs = decompose(lhs), _rhs = decompose(rhs);
+   const auto by_distance = [&, distance = _lhs.offset - _rhs.offset]() noexcept{
+      return !distance && lhs_size == rhs_size ? must_alias : distance >= rhs_size && distance <= -lhs_size ? no_alias : may_alias;
+   };
+   if (!_lhs.root && !_rhs.root) return by_distance(); // absolute addresses
+   if (!_lhs.root || !_rhs.root) return may_alias;     // a symbol may reside at any absolute address
+   if (is<vreg>(_lhs.root) || is<vreg>(_rhs.root))
+      return _lhs.root == _rhs.root && same_instances ? by_distance() : may_alias;
+   return as<rel_base>(_lhs.root)->id == as<rel_base>(_rhs.root)->id ? by_distance() : no_alias;
+}
+
+bool rsn::opt::alias_oracle::immutable(operand *addr) const noexcept {
+   const auto _addr = decompose(addr);
+   return _addr.root && is<data>(_addr.root) &&
+      as<data>(_addr.root)->values.size() && _addr.offset <= as<data>(_addr.root)->values.size() * 8 - 8;
+}
+
+/* References:
+   - Memory SSA - A Unified Approach for Sparsely Representing Memory Operations by Diego Novillo
+   - MemorySSA in LLVM (llvm/Analysis/MemorySSA.h)
+
+   Memory phis are placed at the iterated dominance frontier of BBs with defs (no pruning), and the memory state is renamed along the
+   dominator tree, as for VRs in transform_to_ssa. */
+rsn::opt::memory_ssa::memory_ssa(const cfg_info &cfg, const alias_oracle &oracle): cfg(cfg), oracle(oracle), phis(cfg.bblocks.size()) {
+   const auto make = [&](auto kind, insn *in, bblock *bb){ return &storage.emplace_back(access{kind, in, bb, {}, {}, {}, {}}); };
+   live_on_entry = make(access::_live_on_entry, {}, cfg.rpo.front());
+
+   // Create Accesses and Place Memory Phis ////////////////////////////////////////////////////////
+   {  std::vector<bblock *> def_bbs;
+      for (auto bb: cfg.rpo) {
+         bool defines = false;
+         for (auto in = bb->head(); in; in = in->next())
+         if (is<insn_store>(in) || is<insn_vstore>(in) || is<insn_call>(in))
+            accesses[in] = make(access::_def, in, bb), defines = true;
+         else
+         if ((is<insn_load>(in) && !oracle.immutable(as<insn_load>(in)->src())) || is<insn_vload>(in) || is<insn_ret>(in) || is<insn_oops>(in))
+            accesses[in] = make(access::_use, in, bb);
+         if (defines) def_bbs.push_back(bb);
+      }
+      const auto frontiers = cfg.dom_frontiers();
+      for (std::size_t sn = 0; sn < def_bbs.size(); ++sn) for (auto bb: frontiers[def_bbs[sn]->sn]) if (RSN_UNLIKELY(!phis[bb->sn])) {
+         phis[bb->sn] = make(access::_phi, {}, bb), phis[bb->sn]->args.resize(cfg.preds[bb->sn].size());
+         def_bbs.push_back(bb); // a phi is a def too
+      }
+   }
+   // Rename Memory States /////////////////////////////////////////////////////////////////////////
+   const auto traverse = [&](auto &traverse, bblock *bb, access *state)->void{
+      if (RSN_UNLIKELY(phis[bb->sn])) state = phis[bb->sn];
+      for (auto in = bb->head(); in; in = in->next()) if (const auto acc = of(in)) {
+         acc->def = state, state->users.push_back(acc);
+         if (acc->kind == access::_def) state = acc;
+      }
+      for (auto succ: cfg.succs[bb->sn]) if (RSN_UNLIKELY(phis[succ->sn])) {
+         phis[succ->sn]->args[cfg.pred_index(succ, bb)] = state;
+         if (std::find(state->users.begin(), state->users.end(), phis[succ->sn]) == state->users.end()) state->users.push_back(phis[succ->sn]);
+      }
+      for (auto kid: cfg.dom_kids[bb->sn]) traverse(traverse, kid, state);
+   };
+   traverse(traverse, cfg.rpo.front(), live_on_entry);
+}
+
+/* The walk skips defs that do not alias the loaded word. A memory phi is looked through when the walks from all its arguments arrive at the
+   same clobber, except for the ones that return to a phi being looked through (i.e., around a loop without clobbers). Beyond a phi, the
+   walk can no longer assume that VR-rooted addresses refer to the same instances. */
+auto rsn::opt::memory_ssa::clobbering_def(access *use)->access * {
+   if (RSN_LIKELY(use->clobber)) return use->clobber;
+   if (RSN_UNLIKELY(use->kind != access::_use) || RSN_UNLIKELY(!is<insn_load>(use->in))) return use->def;
+   const auto addr = as<insn_load>(use->in)->src();
+
+   std::vector<access *> stack;  // phis being looked through
+   access *outermost = {};       // the first phi encountered
+   unsigned budget = 100;        // phis to look through, to bound compilation time
+   const auto walk = [&](auto &walk, access *acc, bool same_instances)->access *{ // null if the walk only returns to a phi on the stack
+      for (;; acc = acc->def) switch (acc->kind) {
+      case access::_live_on_entry:
+         return acc;
+      case access::_def:
+         if (RSN_UNLIKELY(is<insn_call>(acc->in))) return acc;
+         if (const auto [dest, size] = written(acc->in); RSN_UNLIKELY(oracle.query(dest, size, addr, 8, same_instances) != alias_oracle::no_alias)) return acc;
+         continue;
+      case access::_phi:
+         {  if (RSN_UNLIKELY(std::find(stack.begin(), stack.end(), acc) != stack.end())) return nullptr;
+            if (RSN_UNLIKELY(!outermost)) outermost = acc;
+            if (RSN_UNLIKELY(!budget)) return outermost;
+            --budget, stack.push_back(acc);
+            access *res = {};
+            for (auto arg: acc->args) {
+               const auto clobber = walk(walk, arg, false);
+               if (RSN_LIKELY(!clobber) || RSN_LIKELY(clobber == res)) continue;
+               if (RSN_UNLIKELY(res) || RSN_UNLIKELY(!budget)) { res = acc; break; }
+               res = clobber;
+            }
+            stack.pop_back();
+            return RSN_LIKELY(budget) ? (RSN_LIKELY(res) ? res : acc) : outermost;
+         }
+      default:
+         RSN_UNREACHABLE();
+      }
+   };
+   return use->clobber = walk(walk, use->def, true);
+}
+
+void rsn::opt::memory_ssa::remove(access *acc) {
+   const auto def = acc->def; // users of a def now depend on the preceding memory state
+   def->users.erase(std::find(def->users.begin(), def->users.end(), acc));
+   for (auto user: acc->users) {
+      if (RSN_UNLIKELY(user->kind == access::_phi)) std::replace(user->args.begin(), user->args.end(), acc, def); else user->def = def;
+      if (std::find(def->users.begin(), def->users.end(), user) == def->users.end()) def->users.push_back(user);
+   }
+   for (auto &it: storage) if (RSN_UNLIKELY(it.clobber == acc)) it.clobber = {}; // clobbers cached elsewhere remain conservative
+   accesses.erase(acc->in), acc->users.clear();
+}
+
+# if RSN_USE_DEBUG
+void rsn::opt::memory_ssa::dump() const noexcept {
+   std::unordered_map<const access *, std::size_t> num;
+   for (const auto &it: storage) num.insert({&it, num.size()});
+   std::fprintf(stderr, "memory SSA (M%zu = live on entry)\n", num[live_on_entry]);
+   for (auto bb: cfg.rpo) {
+      std::fprintf(stderr, "BB #%zu (in the procedure order):\n", bb->sn);
+      if (phis[bb->sn]) {
+         std::fprintf(stderr, "    M%zu = mphi", num[phis[bb->sn]]);
+         for (auto arg: phis[bb->sn]->args) std::fprintf(stderr, " M%zu", num[arg]);
+         std::fputc('\n', stderr);
+      }
+      for (auto in = bb->head(); in; in = in->next()) if (const auto acc = of(in)) {
+         if (acc->kind == access::_def) std::fprintf(stderr, "    M%zu = mdef M%zu: ", num[acc], num[acc->def]);
+         else std::fprintf(stderr, "    muse M%zu: ", num[acc->def]);
+         in->dump(), std::fputc('\n', stderr);
+      }
+   }
+   std::fputc('\n', stderr);
+}
+# endif // # if RSN_USE_DEBUG
+
+/* Loads are replaced by the value of a must-aliased store or earlier load when it is the nearest clobber (or shares the nearest clobber and
+   dominates the load, respectively); a clobbering access dominates the load, so VR-rooted addresses are comparable. Then stores are
+   eliminated when every path in the Memory SSA overlay reaches a must-aliased store before anything that may read the word (including
+   calls and ret/oops insns). Within a BB, both are plain forward scans along the chain of memory accesses. */
+bool rsn::opt::transform_load_store_elim(proc *pc) {
+   bool changed{};
+   const cfg_info cfg(pc);
+   // Forward Stored and Loaded Values /////////////////////////////////////////////////////////////
+   {  const alias_oracle oracle(pc);
+      memory_ssa mssa(cfg, oracle);
+      std::unordered_map<memory_ssa::access *, std::vector<insn_load *>> loads; // available loads by their nearest clobbers
+      for (auto bb: cfg.rpo) for (auto in: all(bb)) {
+         if (RSN_LIKELY(!is<insn_load>(in))) continue;
+         const auto acc = mssa.of(in);
+         if (RSN_UNLIKELY(!acc)) continue; // from a data block
+         const auto clobber = mssa.clobbering_def(acc);
+         if (clobber->kind == memory_ssa::access::_def && is<insn_store>(clobber->in) &&
+            oracle.query(as<insn_store>(clobber->in)->dest(), as<insn_load>(in)->src()) == alias_oracle::must_alias) {
+            insn_mov::make(in, as<insn_store>(clobber->in)->src(), as<insn_load>(in)->dest()), mssa.remove(acc), in->eliminate();
+            ++stats.mem_forwarded, changed = true;
+            continue;
+         }
+         auto &available = loads[clobber];
+         for (auto load: available) if (cfg.dominates(load->owner(), bb) && oracle.query(load->src(), as<insn_load>(in)->src()) == alias_oracle::must_alias) {
+            insn_mov::make(in, load->dest(), as<insn_load>(in)->dest()), mssa.remove(acc), in->eliminate();
+            ++stats.mem_redundant, changed = true;
+            goto next;
+         }
+         available.push_back(as<insn_load>(in));
+      next:;
+      }
+   }
+   // Eliminate Dead Stores ////////////////////////////////////////////////////////////////////////
+   {  const alias_oracle oracle(pc);
+      memory_ssa mssa(cfg, oracle);
+      for (auto bb: cfg.rpo) for (auto in: all(bb)) {
+         if (RSN_LIKELY(!is<insn_store>(in))) continue;
+         const auto addr = as<insn_store>(in)->dest();
+         std::vector<memory_ssa::access *> visited; // memory phis
+         unsigned budget = 100;                     // accesses to visit, to bound compilation time
+         // whether the word written by the store is overwritten before being read on all paths through the state
+         const auto dead = [&](auto &dead, memory_ssa::access *state, bool same_instances)->bool{
+            for (auto user: state->users) {
+               if (RSN_UNLIKELY(!budget--)) return false;
+               switch (user->kind) {
+               case memory_ssa::access::_use:
+                  if ((is<insn_load>(user->in) && oracle.query(as<insn_load>(user->in)->src(), addr, same_instances) == alias_oracle::no_alias) ||
+                     (is<insn_vload>(user->in) && oracle.query(as<insn_vload>(user->in)->src(),
+                        as<insn_vload>(user->in)->lanes * as<insn_vload>(user->in)->width, addr, 8, same_instances) == alias_oracle::no_alias)) continue;
+                  return false;
+               case memory_ssa::access::_def:
+                  if (RSN_UNLIKELY(is<insn_call>(user->in))) return false;
+                  if (const auto [dest, size] = written(user->in); oracle.query(dest, size, addr, 8, same_instances) == alias_oracle::must_alias)
+                     continue; // killed
+                  if (!dead(dead, user, same_instances)) return false;
+                  continue;
+               case memory_ssa::access::_phi:
+                  if (std::find(visited.begin(), visited.end(), user) != visited.end()) continue;
+                  visited.push_back(user);
+                  if (!dead(dead, user, false)) return false;
+                  continue;
+               default:
+                  RSN_UNREACHABLE();
+               }
+            }
+            return true;
+         };
+         const auto acc = mssa.of(in);
+         if (RSN_LIKELY(!dead(dead, acc, true))) continue;
+         mssa.remove(acc), in->eliminate();
+         ++stats.mem_dead_stores, changed = true;
+      }
+   }
+   return changed;
+}
@@ -11,71 +11,100 @@
    You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
 
 
-# include "ir.hh"
+# include "opt.hh"
+
+# include <algorithm> // find, find_if
+# include <set>       // set
 
 namespace rsn::opt {
    using namespace lib;
 
-   bool transform_insn_simplify(proc *tu) { // constant folding (including inlining as a particular case), algebraic simplification, and canonicalization
+   // constant folding (including inlining as a particular case, unless disabled), algebraic simplification, and canonicalization
+   bool transform_insn_simplify(proc *tu, bool inlining) {
+      std::vector<std::pair<bblock *, std::vector<bblock *>>> phi_preds; // in SSA form
+      {  const cfg_info cfg(tu);
+         for (auto bb: cfg.rpo) if (RSN_UNLIKELY(is<insn_phi>(bb->head()))) phi_preds.emplace_back(bb, cfg.preds[bb->sn]);
+      }
       bool changed{};
-      for (auto bb: lib::all(tu)) for (auto in: lib::all(bb))
+      for (auto bb: lib::all(tu)) for (auto in: lib::all(bb)) if (RSN_LIKELY(inlining) || RSN_LIKELY(!is<insn_call>(in)))
          changed |= in->simplify();
+      if (RSN_UNLIKELY(!phi_preds.empty()) && RSN_LIKELY(changed)) { // phi args follow the preds (some of which went away with folded branches)
+         const cfg_info cfg(tu);
+         for (auto &[bb, preds]: phi_preds) {
+            // a new pred is the rest of an old one split at an inlined call (only the callee BBs are in between)
+            for (auto pred: cfg.preds[bb->sn]) if (RSN_UNLIKELY(std::find(preds.begin(), preds.end(), pred) == preds.end()))
+            for (auto _pred = pred->prev(); _pred; _pred = _pred->prev())
+               if (const auto it = std::find(preds.begin(), preds.end(), _pred); RSN_UNLIKELY(it != preds.end())) { *it = pred; break; }
+            reorder_phi_args(bb, preds, cfg.preds[bb->sn]);
+         }
+      }
       return changed;
    }
 
-   void update_cfg_preds(proc *tu) { // CFG predecessors
-      for (auto bb = tu->head(); bb; bb = bb->next()) bb->temp.preds.clear();
-      for (auto bb = tu->head(); bb; bb = bb->next()) for (auto &target: bb->rear()->targets())
-      if (target->temp.preds.empty() || target->temp.preds.back() != bb)
-         target->temp.preds.push_back(bb);
-      for (auto bb = tu->head(); bb; bb = bb->next()) bb->temp.preds.shrink_to_fit();
-   }
-
-   bool transform_const_propag(proc *tu) noexcept { // constant propagation (from mov and beq insns)
-      static constexpr auto
-      traverse = [](auto traverse, insn *in, vreg *vr) noexcept->operand *{
-         for (auto _in = in->prev(); _in; _in = _in->prev()) {
-            if (RSN_UNLIKELY(_in->temp.visited)) return {};
-            _in->temp.visited = true;
+   bool transform_const_propag(proc *tu) { // constant propagation (from mov and beq insns)
+      const cfg_info cfg(tu);
+      std::vector<signed char> visited(cfg.bblocks.size());
+      insn *start; vreg *vr;
+      // look for the nearest definition of vr preceding in (but not preceding stop)
+      const auto scan = [&](insn *in, insn *stop, operand *&res) noexcept{
+         for (auto _in = in->prev(); _in != stop; _in = _in->prev()) {
             if (RSN_UNLIKELY(is<insn_mov>(_in)) && RSN_UNLIKELY(as<insn_mov>(_in)->dest() == vr) && is<imm>(as<insn_mov>(_in)->src()))
-               return as<insn_mov>(_in)->src();
+               return res = as<insn_mov>(_in)->src(), true;
             for (auto &output: _in->outputs()) if (RSN_UNLIKELY(output == vr))
-               return vr;
+               return res = vr, true;
          }
-         const auto _traverse =
-         [traverse, in, &vr](insn *_in) noexcept{
-            return RSN_UNLIKELY(is<insn_br>(_in)) && RSN_UNLIKELY(as<insn_br>(_in)->op == insn_br::_beq) && RSN_UNLIKELY(as<insn_br>(_in)->lhs() == vr) &&
-               is<imm>(as<insn_br>(_in)->rhs()) && as<insn_br>(_in)->dest2() != in->owner() ? (operand *)as<insn_br>(_in)->rhs() : traverse(traverse, _in, vr);
-         };
+         return false;
+      };
+      // the value of vr on entry to bb (nullptr when unknown on all paths)
+      const auto traverse = [&](auto &traverse, bblock *bb) noexcept->operand *{
          operand *res = {};
-         for (auto bb: in->owner()->temp.preds) {
-            auto _res = _traverse(bb->rear());
-            if (_res)
-            if (RSN_UNLIKELY(!res))
-               res = _res;
+         for (auto pred: cfg.preds[bb->sn]) {
+            operand *_res = {};
+            const auto br = pred->rear();
+            if (RSN_UNLIKELY(is<insn_br>(br)) && RSN_UNLIKELY(as<insn_br>(br)->op == insn_br::_beq) && RSN_UNLIKELY(as<insn_br>(br)->lhs() == vr) &&
+               is<imm>(as<insn_br>(br)->rhs()) && as<insn_br>(br)->dest2() != bb)
+               _res = as<insn_br>(br)->rhs();
             else
-            if (RSN_UNLIKELY(is<abs>(res))) {
-               if (!is<abs>(_res) || as<abs>(_res)->val != as<abs>(res)->val) return vr;
-            } else
-            if (RSN_UNLIKELY(is<proc>(res) || is<data>(res))) {
-               if (!is<rel_base>(_res) || as<rel_base>(_res)->id != as<rel_base>(res)->id) return vr;
-            } else
-            if (RSN_UNLIKELY(is<rel_base>(res))) {
-               if (!is<rel_base>(_res) || as<rel_base>(_res)->id != as<rel_base>(res)->id) return vr;
-               res = _res;
-            } else
-               RSN_UNREACHABLE();
+            if (RSN_UNLIKELY(pred == start->owner())) { // around a loop back to the starting point
+               if (!scan(br, start->prev(), _res)) continue;
+            } else {
+               if (RSN_UNLIKELY(visited[pred->sn])) continue;
+               visited[pred->sn] = true;
+               if (!scan(br, {}, _res)) _res = traverse(traverse, pred);
+            }
+            if (_res) {
+               if (RSN_UNLIKELY(!res))
+                  res = _res;
+               else
+               if (RSN_UNLIKELY(is<abs>(res))) {
+                  if (!is<abs>(_res) || as<abs>(_res)->val != as<abs>(res)->val) return vr;
+               } else
+               if (RSN_UNLIKELY(is<proc>(res) || is<data>(res))) {
+                  if (!is<rel_base>(_res) || as<rel_base>(_res)->id != as<rel_base>(res)->id) return vr;
+               } else
+               if (RSN_UNLIKELY(is<rel_base>(res))) {
+                  if (!is<rel_base>(_res) || as<rel_base>(_res)->id != as<rel_base>(res)->id) return vr;
+                  res = _res;
+               } else
+               if (RSN_UNLIKELY(is<rel_disp>(res))) { // e.g., the address of a word in a lookup table
+                  if (!is<rel_disp>(_res) || as<rel_disp>(_res)->base->id != as<rel_disp>(res)->base->id || as<rel_disp>(_res)->add != as<rel_disp>(res)->add)
+                     return vr;
+               } else
+                  return vr;
+            }
          }
          return res;
       };
       bool changed{};
       for (;;) {
          bool _changed{};
-         for (auto bb = tu->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next())
-         for (auto &input: in->inputs()) if (is<vreg>(input)) {
-            for (auto bb = tu->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) in->temp.visited = {};
-            auto res = traverse(traverse, in, lib::as<vreg>(input));
-            if (res) _changed |= res != input, input = std::move(res);
+         for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next())
+         if (RSN_LIKELY(!is<insn_phi>(in))) for (auto &input: in->inputs()) if (is<vreg>(input)) {
+            std::fill(visited.begin(), visited.end(), false);
+            operand *res;
+            start = in, vr = as<vreg>(input);
+            if (!scan(in, {}, res)) res = traverse(traverse, bb);
+            if (res) _changed |= res != input, input = res;
          }
          changed |= _changed;
          if (!RSN_LIKELY(_changed)) break;
@@ -83,12 +112,12 @@ namespace rsn::opt {
       return changed;
    }
 
-   bool transform_copy_propag(proc *tu) noexcept { // copy propagation
-      static constexpr auto
-      traverse = [](auto traverse, insn *in, vreg *vr) noexcept->vreg *{
+   bool transform_copy_propag(proc *tu) { // copy propagation
+      const cfg_info cfg(tu);
+      std::vector<signed char> visited(cfg.bblocks.size());
+      vreg *vr;
+      const auto traverse = [&](auto &traverse, insn *in) noexcept->vreg *{
          for (auto _in = in->prev(); _in; _in = _in->prev()) {
-            if (RSN_UNLIKELY(_in->temp.visited)) return vr;
-            _in->temp.visited = true;
             if (RSN_UNLIKELY(is<insn_mov>(_in)) && RSN_UNLIKELY(as<insn_mov>(_in)->dest() == vr) && is<vreg>(as<insn_mov>(_in)->src())) {
                for (auto _in2 = _in->next(); _in2 != in; _in2 = _in2->next()) for (auto &output: _in2->outputs())
                   if (RSN_UNLIKELY(output == as<insn_mov>(_in)->src())) return vr;
@@ -97,22 +126,29 @@ namespace rsn::opt {
             for (auto &output: _in->outputs())
                if (RSN_UNLIKELY(output == vr)) return vr;
          }
-         if (RSN_UNLIKELY(in->owner()->temp.preds.empty())) return vr;
-         auto res = traverse(traverse, in->owner()->temp.preds.front()->rear(), vr);
-         for (auto bb: range_ref(in->owner()->temp.preds).drop_first())
-            if (traverse(traverse, in->owner()->rear(), vr) != res) return vr;
-         for (auto _in2 = in->owner()->head(); _in2 != in; _in2 = _in2->next()) for (auto &output: _in2->outputs())
+         const auto bb = in->owner();
+         if (RSN_UNLIKELY(cfg.preds[bb->sn].empty())) return vr;
+         vreg *res = {};
+         for (auto pred: cfg.preds[bb->sn]) {
+            if (RSN_UNLIKELY(visited[pred->sn])) return vr;
+            visited[pred->sn] = true;
+            auto _res = traverse(traverse, pred->rear());
+            if (RSN_UNLIKELY(res) && RSN_UNLIKELY(_res != res)) return vr;
+            res = _res;
+         }
+         for (auto _in2 = bb->head(); _in2 != in; _in2 = _in2->next()) for (auto &output: _in2->outputs())
             if (RSN_UNLIKELY(output == res)) return vr;
          return res;
       };
       bool changed{};
       for (;;) {
          bool _changed{};
-         for (auto bb = tu->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next())
-         for (auto &input: in->inputs()) if (is<vreg>(input)) {
-            for (auto bb = tu->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) in->temp.visited = {};
-            auto res = traverse(traverse, in, as<vreg>(input));
-            _changed |= res != input, input = std::move(res);
+         for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next())
+         if (RSN_LIKELY(!is<insn_phi>(in))) for (auto &input: in->inputs()) if (is<vreg>(input)) {
+            std::fill(visited.begin(), visited.end(), false), visited[bb->sn] = true;
+            vr = as<vreg>(input);
+            auto res = traverse(traverse, in);
+            _changed |= res != input, input = res;
          }
          changed |= _changed;
          if (!RSN_LIKELY(_changed)) break;
@@ -120,25 +156,30 @@ namespace rsn::opt {
       return changed;
    }
 
-   bool transform_dce(proc *tu) noexcept { // eliminate instructions whose only effect is to produce dead values
-      static constexpr auto
-      traverse = [](auto traverse, insn *in, vreg *vr) noexcept{
+   bool transform_dce(proc *tu) { // eliminate instructions whose only effect is to produce dead values
+      const cfg_info cfg(tu);
+      std::vector<signed char> visited(cfg.bblocks.size());
+      insn *start; vreg *vr;
+      // whether vr is used at or after in (or in BBs reachable from there)
+      const auto traverse = [&](auto &traverse, bblock *bb, insn *in) noexcept->bool{
          for (auto _in = in; _in; _in = _in->next()) {
-            if (RSN_UNLIKELY(_in->temp.visited)) return false;
-            _in->temp.visited = true;
             for (auto &input: _in->inputs())
                if (RSN_UNLIKELY(input == vr)) return true;
+            if (RSN_UNLIKELY(_in == start)) return false; // around a loop back to the starting point
+         }
+         for (auto target: bb->rear()->targets()) if (RSN_LIKELY(!visited[target->sn])) {
+            visited[target->sn] = true;
+            if (RSN_UNLIKELY(traverse(traverse, target, target->head()))) return true;
          }
-         for (auto &target: in->owner()->rear()->targets())
-            if (RSN_UNLIKELY(traverse(traverse, target->head(), vr))) return true;
          return false;
       };
       bool changed{};
-      for (auto bb = tu->head(); bb; bb = bb->next()) for (auto in: lib::all(bb->head(), bb->rear())) {
-         if (RSN_UNLIKELY(is<insn_call>(in)) || RSN_UNLIKELY(is<insn_entry>(in))) goto next;
+      for (auto bb: cfg.bblocks) for (auto in: lib::all(bb->head(), bb->rear())) {
+         if (RSN_UNLIKELY(!is<insn_phi>(in)) && RSN_UNLIKELY(!speculatable(in))) goto next; // calls, stores, trapping divisions, etc.
          for (auto &output: in->outputs()) {
-            for (auto bb = tu->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) in->temp.visited = {};
-            if (traverse(traverse, in->next(), output)) goto next;
+            std::fill(visited.begin(), visited.end(), false);
+            start = in, vr = output;
+            if (traverse(traverse, bb, in->next())) goto next;
          }
          changed = (in->eliminate(), true);
       next:;
@@ -146,74 +187,188 @@ namespace rsn::opt {
       return changed;
    }
 
-   bool transform_cfg_gc(proc *tu) noexcept { // eliminate basic blocks unreachable from the entry basic block
-      static constexpr auto traverse = [](auto traverse, bblock *bb) noexcept{
-         if (RSN_UNLIKELY(bb->temp.visited)) return;
-         bb->temp.visited = true;
-         for (auto &target: bb->rear()->targets()) traverse(traverse, target);
-      };
-      for (auto bb = tu->head(); bb; bb = bb->next()) bb->temp.visited = {};
-      traverse(traverse, tu->head());
+   bool transform_cfg_gc(proc *tu) { // eliminate basic blocks unreachable from the entry basic block
+      const cfg_info cfg(tu);
       bool changed{};
-      for (auto bb: lib::all(tu)) if (!RSN_LIKELY(bb->temp.visited))
+      for (auto bb: cfg.bblocks) if (!RSN_LIKELY(cfg.reachable(bb)))
          changed = (bb->eliminate(), true);
       return changed;
    }
 
-   bool transform_cfg_merge(proc *tu) noexcept {
+   bool transform_cfg_merge(proc *tu) { // merge BBs into their only predecessors that jump to them unconditionally
+      const cfg_info cfg(tu);
+      // BBs referred to from a single (reachable) predecessor
+      std::vector<std::size_t> refs(cfg.bblocks.size());
+      for (auto bb: cfg.bblocks) for (auto succ: cfg.succs[bb->sn]) ++refs[succ->sn];
+      for (auto bb: cfg.bblocks) if (RSN_UNLIKELY(!cfg.reachable(bb))) for (auto &target: bb->rear()->targets()) refs[target->sn] = -1;
+      std::vector<std::size_t> pred(cfg.bblocks.size(), -1);
+      for (auto bb: cfg.rpo) if (RSN_UNLIKELY(refs[bb->sn] == 1) && RSN_LIKELY(bb != tu->head()) && RSN_LIKELY(cfg.preds[bb->sn].front() != bb) &&
+         RSN_UNLIKELY(is<insn_jmp>(cfg.preds[bb->sn].front()->rear()))) pred[bb->sn] = cfg.preds[bb->sn].front()->sn;
+      std::vector<std::pair<std::size_t, std::vector<std::size_t>>> phi_preds; // of BBs staying in place (by SN)
+      for (auto bb: cfg.rpo) if (RSN_UNLIKELY(is<insn_phi>(bb->head())) && RSN_LIKELY(pred[bb->sn] == (std::size_t)-1)) {
+         phi_preds.emplace_back(bb->sn, std::vector<std::size_t>{});
+         for (auto _pred: cfg.preds[bb->sn]) phi_preds.back().second.push_back(_pred->sn);
+      }
+
+      std::vector<bblock *> host(cfg.bblocks); // where the contents of BBs have been moved to
       bool changed{};
-      for (auto bb: all(tu))
-      if (RSN_UNLIKELY(bb->temp.preds.size() == 1) && RSN_UNLIKELY(is<insn_jmp>(bb->temp.preds.front()->rear()))) {
-         bb->temp.preds.front()->rear()->eliminate();
-         for (auto in: all(bb)) in->reattach(bb->temp.preds.front());
-         bb->eliminate();
+      for (std::size_t sn = 0; sn < cfg.bblocks.size(); ++sn) if (RSN_UNLIKELY(pred[sn] != (std::size_t)-1)) {
+         const auto bb = cfg.bblocks[sn], into = host[pred[sn]];
+         if (RSN_UNLIKELY(into == bb)) continue; // a cycle of BBs (unreachable otherwise)
+         into->rear()->eliminate();
+         for (auto in: all(bb)) {
+            if (RSN_UNLIKELY(is<insn_phi>(in))) insn_mov::make(in, as<insn_phi>(in)->args().first(), as<insn_phi>(in)->dest()), in->eliminate();
+         }
+         for (auto in: all(bb)) in->reattach(into);
+         bb->eliminate(), host[sn] = into;
+         for (auto &it: host) if (RSN_UNLIKELY(it == bb)) it = into;
          changed = true;
       }
+      if (RSN_UNLIKELY(!phi_preds.empty()) && RSN_LIKELY(changed)) { // in SSA form, phi args follow the (now changed) order of preds
+         std::vector<std::pair<bblock *, std::vector<bblock *>>> _phi_preds;
+         for (const auto &[sn, preds]: phi_preds) {
+            _phi_preds.emplace_back(cfg.bblocks[sn], std::vector<bblock *>{});
+            for (auto pred_sn: preds) _phi_preds.back().second.push_back(host[pred_sn]);
+         }
+         const cfg_info _cfg(tu);
+         for (const auto &[bb, preds]: _phi_preds) reorder_phi_args(bb, preds, _cfg.preds[bb->sn]);
+      }
       return changed;
    }
 
-# if 0
-   bool transform_jump_threading(proc *tu) { // only considers the most trivial case for now: jumping or branching to a jumping BB
-   }
-
-
-   bool transform_copypropag(proc *tu) { // copy propagation
-      static const auto
-      traverse = [](auto traverse, bblock *bb, insn *in, const smart_ptr<vreg> &vr) noexcept->smart_ptr<vreg>{
-         for (auto _in = in->prev(); _in; _in = _in->prev()) {
-            if (RSN_UNLIKELY(_in->temp.visited)) return vr;
-            _in->temp.visited = true;
-            if (RSN_UNLIKELY(is<insn_mov>(_in)) && RSN_UNLIKELY(as<insn_mov>(_in)->dest() == vr) && is<vreg>(as<insn_mov>(_in)->src())) {
-               for (auto _in2 = _in->next(); _in2 != in; _in2 = _in2->next()) for (auto &output: _in2->outputs())
-                  if (RSN_UNLIKELY(output == as<insn_mov>(_in)->src())) return vr;
-               return as<insn_mov>(_in)->src();
-            }
-            for (auto &output: _in->outputs())
-               if (RSN_UNLIKELY(output == vr)) return vr;
-         }
-         if (RSN_UNLIKELY(in->owner()->temp.preds.empty())) return vr;
-         auto res = traverse(traverse, bb->temp.preds.front(), bb->temp.preds.front()->rear(), vr);
-         for (auto bb: range_ref(in->owner()->temp.preds).drop_first())
-            if (traverse(traverse, bb, bb->rear(), vr) != res) return vr;
-         for (auto _in2 = _in->next(); _in2 != in; _in2 = _in2->next()) for (auto &output: _in2->outputs())
-            if (RSN_UNLIKELY(output == res)) return vr;
-         return res;
+   /* Jump threading: an edge pred->bb is redirected to a successor of bb when bb has no effect except for choosing the successor, and
+      the choice is already known on the edge. This is the case for
+      - forwarding BBs (ending in jmp), and
+      - BBs ending in br or switch_br whose outcome follows from the branch at the end of pred (either the same comparison or a beq fact
+        as in transform_const_propag) or from constant arguments of phi insns in bb for the edge.
+      bb may have phi insns only if their results are not used beyond the branch and phi insns in the successors of bb. */
+   bool transform_jump_threading(proc *tu) {
+      static constexpr auto same = [](operand *lhs, operand *rhs) noexcept{
+         return lhs == rhs || (is<abs>(lhs) && is<abs>(rhs) && as<abs>(lhs)->val == as<abs>(rhs)->val);
       };
       bool changed{};
-      for (;;) {
-         bool _changed{};
-         for (auto bb = tu->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next())
-         for (auto &input: in->inputs()) if (is<vreg>(input)) {
-            for (auto bb = tu->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) in->temp.visited = {};
-            auto res = traverse(traverse, bb, in, as_smart<vreg>(input));
-            _changed |= res != input, input = std::move(res);
+      std::set<std::pair<bblock *, bblock *>> bypassed; // to avoid threading around empty infinite loops forever
+      // the CFG snapshot is taken once per sweep; the predecessor lists (and phi insns) are kept up to date in between, and the lists may retain
+      // BBs that have become unreachable, whose phi arguments are dropped when the next snapshot is taken
+      std::vector<std::vector<bblock *>> preds;
+      for (bool _changed = true; _changed;) {
+         _changed = false;
+         const cfg_info cfg(tu);
+         if (RSN_LIKELY(!preds.empty())) for (auto _bb: cfg.rpo) if (RSN_UNLIKELY(is<insn_phi>(_bb->head())))
+            if (RSN_UNLIKELY(preds[_bb->sn] != cfg.preds[_bb->sn])) reorder_phi_args(_bb, preds[_bb->sn], cfg.preds[_bb->sn]);
+         preds = cfg.preds;
+         const auto pred_index = [&](const bblock *bb, const bblock *pred) noexcept{
+            return std::find(preds[bb->sn].begin(), preds[bb->sn].end(), pred) - preds[bb->sn].begin();
+         };
+         std::vector<std::size_t> uses(number_vregs(tu)); // occurrences in inputs
+         for (auto _bb = tu->head(); _bb; _bb = _bb->next()) for (auto in = _bb->head(); in; in = in->next())
+            for (const auto &input: in->inputs()) if (is<vreg>(input)) ++uses[as<vreg>(input)->sn];
+         bblock *pred, *bb, *dest = {};
+         // the value of an operand in bb (after phi insns) on entry from pred
+         const auto on_edge = [&](operand *op) noexcept->operand *{
+            if (is<vreg>(op)) for (auto in = bb->head(); is<insn_phi>(in); in = in->next())
+               if (as<insn_phi>(in)->dest() == op) return as<insn_phi>(in)->args()[pred_index(bb, pred)];
+            return op;
+         };
+         // whether the results of phi insns in bb are used beyond the branch and successor phi insns
+         const auto phis_escape = [&]() noexcept{
+            for (auto phi = bb->head(); is<insn_phi>(phi); phi = phi->next()) {
+               const auto vr = as<insn_phi>(phi)->dest();
+               auto count = uses[vr->sn];
+               for (const auto &input: bb->rear()->inputs()) count -= input == vr;
+               for (const auto &succ: bb->rear()->targets()) if (RSN_UNLIKELY(is<insn_phi>(succ->head()))) {
+                  if (std::find(bb->rear()->targets().begin(), bb->rear()->targets().end(), succ) != &succ) continue; // seen
+                  const auto index = pred_index(succ, bb);
+                  for (auto _phi = succ->head(); is<insn_phi>(_phi); _phi = _phi->next()) count -= as<insn_phi>(_phi)->args()[index] == vr;
+               }
+               if (RSN_UNLIKELY(count)) return true;
+            }
+            return false;
+         };
+         // rebuild the phi insns in bb with the argument at index dropped (when val is null) or val inserted there
+         const auto update_phis = [&](bblock *bb, std::size_t index, const std::vector<lib::smart_ptr<operand>> &vals){
+            std::size_t sn = 0;
+            for (auto phi: all(bb)) {
+               if (RSN_LIKELY(!is<insn_phi>(phi))) break;
+               std::vector<lib::smart_ptr<operand>> args(as<insn_phi>(phi)->args().begin(), as<insn_phi>(phi)->args().end());
+               const auto &arg = vals.empty() ? args[index] : vals[sn++];
+               if (is<vreg>(arg)) vals.empty() ? --uses[as<vreg>(arg)->sn] : ++uses[as<vreg>(arg)->sn];
+               if (vals.empty()) args.erase(args.begin() + index); else args.insert(args.begin() + index, arg);
+               insn_phi::make(phi, std::move(args), std::move(as<insn_phi>(phi)->dest())), phi->eliminate();
+            }
+         };
+         // Sweep for Edges to Thread ////////////////////////////////////////////////////////////////
+         for (auto _bb: cfg.rpo) {
+            bb = _bb;
+            auto in = bb->head();
+            while (is<insn_phi>(in)) in = in->next();
+            if (RSN_LIKELY(in != bb->rear())) continue;
+            for (auto _pred: std::vector<bblock *>(preds[bb->sn])) {
+               pred = _pred, dest = {};
+               if (is<insn_jmp>(in)) dest = as<insn_jmp>(in)->dest();
+               else
+               if (is<insn_br>(in)) {
+                  const auto br = as<insn_br>(in);
+                  const auto lhs = on_edge(br->lhs()), rhs = on_edge(br->rhs());
+                  if (RSN_UNLIKELY(is<abs>(lhs)) && RSN_UNLIKELY(is<abs>(rhs))) switch (br->op) {
+                  case insn_br::_beq:  dest = as<abs>(lhs)->val == as<abs>(rhs)->val ? br->dest1() : br->dest2(); break;
+                  case insn_br::_bult: dest = as<abs>(lhs)->val <  as<abs>(rhs)->val ? br->dest1() : br->dest2(); break;
+                  case insn_br::_bslt: dest = (long long)as<abs>(lhs)->val < (long long)as<abs>(rhs)->val ? br->dest1() : br->dest2(); break;
+                  } else
+                  if (is<insn_br>(pred->rear()) && as<insn_br>(pred->rear())->dest1() != as<insn_br>(pred->rear())->dest2()) {
+                     const auto _br = as<insn_br>(pred->rear());
+                     const bool taken = _br->dest1() == bb;
+                     if (_br->op == br->op && same(_br->lhs(), lhs) && same(_br->rhs(), rhs)) // the same comparison
+                        dest = taken ? br->dest1() : br->dest2();
+                     else
+                     if (_br->op == insn_br::_beq && taken && is<abs>(_br->rhs())) { // a beq fact
+                        auto _lhs = lhs, _rhs = rhs;
+                        if (_lhs == _br->lhs()) _lhs = _br->rhs();
+                        if (_rhs == _br->lhs()) _rhs = _br->rhs();
+                        if (br->op == insn_br::_beq && RSN_UNLIKELY(same(_lhs, _rhs))) dest = br->dest1();
+                        else
+                        if (RSN_UNLIKELY(is<abs>(_lhs)) && RSN_UNLIKELY(is<abs>(_rhs))) switch (br->op) {
+                        case insn_br::_beq:  dest = br->dest2(); break;
+                        case insn_br::_bult: dest = as<abs>(_lhs)->val <  as<abs>(_rhs)->val ? br->dest1() : br->dest2(); break;
+                        case insn_br::_bslt: dest = (long long)as<abs>(_lhs)->val < (long long)as<abs>(_rhs)->val ? br->dest1() : br->dest2(); break;
+                        }
+                     }
+                  }
+               } else
+               if (is<insn_switch_br>(in)) {
+                  auto index = on_edge(as<insn_switch_br>(in)->index());
+                  if (is<insn_br>(pred->rear()) && as<insn_br>(pred->rear())->op == insn_br::_beq && as<insn_br>(pred->rear())->dest1() == bb &&
+                     as<insn_br>(pred->rear())->dest2() != bb && as<insn_br>(pred->rear())->lhs() == index) index = as<insn_br>(pred->rear())->rhs();
+                  if (is<abs>(index) && as<abs>(index)->val < as<insn_switch_br>(in)->dests().size())
+                     dest = as<insn_switch_br>(in)->dests()[as<abs>(index)->val];
+               }
+               if (RSN_LIKELY(!dest) || RSN_UNLIKELY(dest == bb) || RSN_UNLIKELY(bypassed.count({pred, dest}))) continue;
+               // the arguments of phi insns in dest must agree if pred already jumps there
+               const bool joins = std::find(preds[dest->sn].begin(), preds[dest->sn].end(), pred) != preds[dest->sn].end();
+               if (RSN_UNLIKELY(joins)) for (auto phi = dest->head(); is<insn_phi>(phi); phi = phi->next())
+               if (!same(as<insn_phi>(phi)->args()[pred_index(dest, pred)], on_edge(as<insn_phi>(phi)->args()[pred_index(dest, bb)])))
+                  { dest = {}; break; }
+               if (RSN_LIKELY(dest) && RSN_UNLIKELY(is<insn_phi>(bb->head())) && phis_escape()) dest = {};
+               if (RSN_LIKELY(!dest)) continue;
+
+               // Redirect the Edge and Update Phi Insns ////////////////////////////////////////////////
+               bypassed.insert({pred, bb});
+               ++(is<insn_jmp>(bb->rear()) ? stats.jt_forwarded : stats.jt_branches), changed = _changed = true;
+               std::vector<lib::smart_ptr<operand>> via_bb; // arguments for the new edge pred->dest
+               if (RSN_LIKELY(!joins)) for (auto phi = dest->head(); is<insn_phi>(phi); phi = phi->next())
+                  via_bb.push_back(on_edge(as<insn_phi>(phi)->args()[pred_index(dest, bb)]));
+               for (auto &target: pred->rear()->targets()) if (target == bb) target = dest;
+               const auto index = pred_index(bb, pred);
+               if (RSN_UNLIKELY(is<insn_phi>(bb->head()))) update_phis(bb, index, {});
+               preds[bb->sn].erase(preds[bb->sn].begin() + index);
+               if (RSN_LIKELY(!joins)) { // the predecessors (and phi arguments) follow the procedure order
+                  const auto pos = std::find_if(preds[dest->sn].begin(), preds[dest->sn].end(), [&](bblock *_pred) noexcept{ return _pred->sn > pred->sn; });
+                  if (RSN_UNLIKELY(!via_bb.empty())) update_phis(dest, pos - preds[dest->sn].begin(), via_bb);
+                  preds[dest->sn].insert(pos, pred);
+               }
+            }
          }
-         changed |= _changed;
-         if (!RSN_LIKELY(_changed)) break;
       }
       return changed;
    }
-
-#endif
-
 }
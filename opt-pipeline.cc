@@ -11,32 +11,94 @@
    You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
 
 
-# include "ir.hh"
+# include "opt.hh"
 
-namespace rsn::opt { void optimize(proc *); }
+/* The budget is checked before each pass, so the pipeline stops between passes (each of which leaves valid IR), and translation out of SSA
+   form is not optional (nor charged). The work of a pass is estimated by the size of the procedure, since most passes are linear in it
+   (modulo a logarithmic factor or the number of rounds of an iterative analysis); the size is measured once per round of a fixed-point
+   loop (and before each group of one-shot passes), so a check costs O(1). */
+bool rsn::opt::optimize(proc *tu, opt_level level, const opt_budget &budget) {
+   const auto start = std::chrono::steady_clock::now();
+   unsigned long long work = 0, size = 0;
+   bool exhausted{};
+   // the size of the procedure (in insns) to charge for each pass until measured again
+   const auto measure = [&]() noexcept{
+      size = 0;
+      for (auto bb = tu->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) ++size;
+   };
+   // whether one more pass fits in the budget (then it is charged)
+   const auto afford = [&]() noexcept{
+      if (RSN_UNLIKELY(exhausted)) return false;
+      work += size;
+      return !(exhausted = work > budget.work || std::chrono::steady_clock::now() - start > budget.time);
+   };
+   const auto finish = [&]() noexcept{
+      if (RSN_UNLIKELY(exhausted)) ++stats.budget_stops;
+      return !exhausted;
+   };
 
-void rsn::opt::optimize(proc *tu) {
-   bool transform_insn_simplify(proc *);
-   void update_cfg_preds(proc *);
-   bool transform_const_propag(proc *) noexcept;
-   bool transform_copy_propag(proc *) noexcept;
-   bool transform_dce(proc *) noexcept;
-   bool transform_cfg_gc(proc *) noexcept;
-   bool transform_cfg_merge(proc *tu) noexcept;
-
-   update_cfg_preds(tu),
-   transform_const_propag(tu);
-   return;
+   // Tier O0 //////////////////////////////////////////////////////////////////////////////////////
+   for (unsigned round = 0; round < budget.max_rounds; ++round) {
+      measure();
+      bool changed{};
+      changed |= afford() && transform_insn_simplify(tu, level >= O2 && round < budget.inline_depth),
+      changed |= afford() && transform_cfg_gc(tu);
+      if (!RSN_LIKELY(changed) || RSN_UNLIKELY(exhausted)) break;
+   }
+   if (level == O0 || !afford()) return finish();
 
-   for (;;) {
+   // Tier O1 //////////////////////////////////////////////////////////////////////////////////////
+   transform_to_ssa(tu);
+   const auto cleanup = [&]{
       bool changed{};
-      update_cfg_preds(tu),
-      changed |= transform_const_propag(tu),
-      changed |= transform_copy_propag(tu),
-      changed |= transform_dce(tu),
-      changed |= transform_cfg_gc(tu),
-      changed |= transform_insn_simplify(tu),
-      changed |= transform_cfg_merge(tu);
-      if (!RSN_LIKELY(changed)) return;
+      changed |= afford() && transform_const_propag(tu),
+      changed |= afford() && transform_copy_propag(tu),
+      changed |= afford() && transform_value_ranges(tu),
+      changed |= afford() && transform_insn_simplify(tu, false),
+      changed |= afford() && transform_cfg_gc(tu),
+      changed |= afford() && transform_dce(tu);
+      return changed;
+   };
+   if (level == O1) for (unsigned round = 0; round < budget.max_rounds; ++round) {
+      measure();
+      if (!RSN_LIKELY(cleanup()) || RSN_UNLIKELY(exhausted)) break;
+   }
+
+   // Tier O2 //////////////////////////////////////////////////////////////////////////////////////
+   if (level >= O2) {
+      for (unsigned round = 0; round < budget.max_rounds; ++round) {
+         measure();
+         bool changed{};
+         changed |= cleanup(),
+         changed |= afford() && transform_tail_recursion(tu),
+         changed |= afford() && transform_reassociation(tu),
+         changed |= afford() && transform_strength_reduction(tu),
+         changed |= afford() && transform_jump_threading(tu),
+         changed |= afford() && transform_if_conversion(tu),
+         changed |= afford() && transform_load_store_elim(tu),
+         changed |= afford() && transform_pre(tu),
+         changed |= afford() && transform_cfg_merge(tu);
+         if (!RSN_LIKELY(changed) || RSN_UNLIKELY(exhausted)) break;
+      }
+      measure();
+      if (afford()) transform_licm(tu);
+      if (afford()) transform_gcm(tu);
+      if (afford()) transform_loop_unroll(tu); // once (remainder loops would be unrolled again)
+      measure();
+      if (afford()) transform_const_propag(tu); // exposes adjacent addresses in unrolled bodies (along with the next two)
+      if (afford()) transform_copy_propag(tu);
+      if (afford()) transform_dce(tu);
+      if (afford()) transform_slp_vectorization(tu);
+   }
+   transform_out_of_ssa(tu);
+   if (level >= O2) {
+      measure();
+      if (afford()) transform_switch_lowering(tu);
+      if (afford()) transform_hot_cold_split(tu);
+      if (afford()) {
+         const cfg_info cfg(tu); const loop_forest loops(cfg);
+         transform_block_layout(tu, block_frequency(cfg, loops).weights());
+      }
    }
+   return finish();
 }
@@ -0,0 +1,301 @@
+// opt-pre.cc -- partial redundancy elimination
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "opt.hh"
+
+# include <algorithm>     // find, sort, unique
+# include <map>           // map
+# include <unordered_map> // unordered_map
+
+/* References:
+   - Lazy Code Motion by Jens Knoop, Oliver Rüthing, and Bernhard Steffen
+   - A Variation of Knoop, Rüthing, and Steffen's Lazy Code Motion by Karl-Heinz Drechsler and Manfred P. Stadel
+   - Value-Based Partial Redundancy Elimination by Thomas VanDrunen and Antony L. Hosking
+   - Simple and Efficient Construction of Static Single Assignment Form by Matthias Braun et al.
+
+   An expression is a speculatable binop or a load, identified by its operation and operands (SSA VRs are just names here). A BB kills an
+   expression if it defines an operand VR, or, for a load, if it has a call or a store that may alias the address. For each expression
+   evaluated more than once (a lone one in a loop is up to LICM), the edge-based LCM equations are solved: availability (greatest fixed
+   point), anticipability (least fixed point, so that nothing is inserted ahead of a path that never evaluates the expression), the
+   earliest edges, and how far down insertions may be delayed. Evaluations are inserted on the latest edges where they are still down-safe
+   (at the end of the source if it has a single successor, or in a BB splitting a critical edge otherwise), and upward exposed evaluations
+   where the value is then available become copies. Since insertions are as late as possible and only where every path would evaluate the
+   expression anyway, no path evaluates it more often, and live ranges are not stretched over (cold) paths that do not need the value. The
+   value reaching a redundant evaluation is looked up backwards from it, with phi insns placed on demand at joins (trivial ones turn into
+   copies), and evaluations redundant within a BB become copies as well.
+
+   Lexically, an expression over a phi insn result differs from the expressions over its arguments, so binops over phi insn results are
+   then translated to predecessors: if the translated expression is available at the end of some predecessor (computed in a dominator),
+   the binop becomes a phi insn, with the expression evaluated at the end of the other predecessors, provided they have a single successor
+   and precede the BB in reverse postorder (so evaluations only move along forward edges to where they are executed anyway). Binops over
+   the new phi insn results are translated in turn. */
+bool rsn::opt::transform_pre(proc *pc) {
+   const auto vr_count = number_vregs(pc);
+   const alias_oracle oracle(pc);
+   std::vector<insn *> def(vr_count);
+   std::vector<signed char> def_count(vr_count);
+   std::vector<insn *> clobbers; // calls and stores
+   const auto key = [](std::vector<unsigned long long> &res, operand *op) noexcept{
+      if (is<vreg>(op)) res.insert(res.end(), {0, as<vreg>(op)->sn, 0, 0}); else
+      if (is<abs>(op)) res.insert(res.end(), {1, as<abs>(op)->val, 0, 0}); else
+      if (is<rel_base>(op)) res.insert(res.end(), {2, as<rel_base>(op)->id.first, as<rel_base>(op)->id.second, 0}); else
+         res.insert(res.end(), {3, as<rel_disp>(op)->base->id.first, as<rel_disp>(op)->base->id.second, as<rel_disp>(op)->add});
+   };
+   const auto kills = [&](insn *in, insn *proto, bool same_instances) noexcept{ // whether in changes the value of the expression
+      for (const auto &output: in->outputs()) for (const auto &input: proto->inputs()) if (output == input) return true;
+      if (!is<insn_load>(proto)) return false;
+      if (is<insn_call>(in)) return true;
+      if (is<insn_store>(in)) return oracle.query(as<insn_store>(in)->dest(), as<insn_load>(proto)->src(), same_instances) != alias_oracle::no_alias;
+      if (is<insn_vstore>(in)) return oracle.query(as<insn_vstore>(in)->dest(), as<insn_vstore>(in)->lanes * as<insn_vstore>(in)->width,
+         as<insn_load>(proto)->src(), 8, same_instances) != alias_oracle::no_alias;
+      return false;
+   };
+
+   // Collect Expressions //////////////////////////////////////////////////////////////////////////
+   struct plan { std::vector<insn *> evals; std::vector<bblock *> inserts, deletes; };
+   std::vector<plan> plans;
+   {  const cfg_info cfg(pc);
+      std::map<std::vector<unsigned long long>, std::vector<insn *>> exprs; // evaluations by key
+      for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) {
+         for (const auto &output: in->outputs()) def[output->sn] = in, def_count[output->sn] += def_count[output->sn] < 2;
+         if (is<insn_call>(in) || is<insn_store>(in) || is<insn_vstore>(in)) clobbers.push_back(in);
+      }
+      for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) {
+         if (!is<insn_load>(in) && !(is<insn_binop>(in) && speculatable(in))) continue;
+         if (RSN_UNLIKELY(def_count[in->outputs()[0]->sn] != 1)) continue; // not in SSA form
+         std::vector<unsigned long long> res{is<insn_load>(in) ? ~0ull : (unsigned long long)as<insn_binop>(in)->op};
+         for (const auto &input: in->inputs()) {
+            if (is<vreg>(input) && RSN_UNLIKELY(def_count[as<vreg>(input)->sn] != 1)) goto skip;
+            key(res, input);
+         }
+         exprs[std::move(res)].push_back(in);
+      skip:;
+      }
+
+      // Solve LCM Equations ///////////////////////////////////////////////////////////////////////
+      const auto bb_count = cfg.bblocks.size();
+      std::vector<std::pair<bblock *, bblock *>> edges; // incl. a virtual edge into the entry BB (from nullptr)
+      std::vector<std::vector<std::size_t>> in_edges(bb_count);
+      edges.push_back({{}, cfg.rpo.front()}), in_edges[cfg.rpo.front()->sn].push_back(0);
+      for (auto bb: cfg.rpo) for (auto succ: cfg.succs[bb->sn]) in_edges[succ->sn].push_back(edges.size()), edges.push_back({bb, succ});
+      std::vector<bblock *> at(edges.size()); // where to insert evaluations for edges
+
+      for (auto &[_, evals]: exprs) if (evals.size() > 1) { // otherwise, nothing is redundant (and loop invariants are up to LICM)
+         const auto proto = evals.front();
+         std::vector<insn *> killers; // insns that kill the expression
+         for (const auto &input: proto->inputs()) if (is<vreg>(input)) killers.push_back(def[as<vreg>(input)->sn]);
+         std::vector<bool> transp(bb_count, true), antloc(bb_count), comp(bb_count);
+         if (is<insn_load>(proto)) for (auto in: clobbers) if (kills(in, proto, false)) {
+            // across BBs, VR-rooted addresses may refer to different dynamic instances of the roots
+            transp[in->owner()->sn] = false;
+            if (kills(in, proto, true)) killers.push_back(in);
+         }
+         std::vector<bblock *> touched; // BBs with evaluations or killers
+         for (auto in: evals) touched.push_back(in->owner());
+         for (auto in: killers) touched.push_back(in->owner()), transp[in->owner()->sn] = false;
+         std::sort(touched.begin(), touched.end()), touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+         for (auto bb: touched) {
+            bool killed = false;
+            for (auto in = bb->head(); in; in = in->next()) {
+               if (std::find(evals.begin(), evals.end(), in) != evals.end()) antloc[bb->sn] = antloc[bb->sn] || !killed, comp[bb->sn] = true; else
+               if (std::find(killers.begin(), killers.end(), in) != killers.end()) killed = true, comp[bb->sn] = false;
+            }
+         }
+         std::vector<bool> avout(bb_count, true), antin(bb_count), antout(bb_count);
+         for (bool changed = true; changed;) {
+            changed = false;
+            for (auto bb: cfg.rpo) {
+               bool avin = bb != cfg.rpo.front();
+               for (auto pred: cfg.preds[bb->sn]) avin = avin && avout[pred->sn];
+               const bool res = comp[bb->sn] || (avin && transp[bb->sn]);
+               changed |= res != avout[bb->sn], avout[bb->sn] = res;
+            }
+         }
+         for (bool changed = true; changed;) {
+            changed = false;
+            for (auto bb: lib::range_ref(cfg.rpo).reverse()) {
+               bool res = !cfg.succs[bb->sn].empty();
+               for (auto succ: cfg.succs[bb->sn]) res = res && antin[succ->sn];
+               antout[bb->sn] = res, res = antloc[bb->sn] || (transp[bb->sn] && res);
+               changed |= res != antin[bb->sn], antin[bb->sn] = res;
+            }
+         }
+         const auto earliest = [&](std::size_t sn) noexcept{
+            const auto [from, to] = edges[sn];
+            return antin[to->sn] && (!from || (!avout[from->sn] && (!transp[from->sn] || !antout[from->sn])));
+         };
+         std::vector<bool> later(edges.size(), true), laterin(bb_count, true);
+         for (bool changed = true; changed;) {
+            changed = false;
+            for (auto bb: cfg.rpo) {
+               bool res = true;
+               for (auto sn: in_edges[bb->sn]) {
+                  const auto from = edges[sn].first;
+                  later[sn] = earliest(sn) || (from && laterin[from->sn] && !antloc[from->sn]);
+                  res = res && later[sn];
+               }
+               changed |= res != laterin[bb->sn], laterin[bb->sn] = res;
+            }
+         }
+         plan res{evals, {}, {}};
+         for (auto bb: touched) if (antloc[bb->sn] && !laterin[bb->sn]) res.deletes.push_back(bb);
+         for (std::size_t sn = 1; sn < edges.size(); ++sn) if (RSN_UNLIKELY(later[sn]) && RSN_UNLIKELY(!laterin[edges[sn].second->sn])) {
+            const auto [from, to] = edges[sn];
+            if (!at[sn]) {
+               if (cfg.succs[from->sn].size() == 1) at[sn] = from; else {
+                  const auto split = RSN_LIKELY(from->next()) ? bblock::make(from->next()) : bblock::make(pc); // preserves the order of predecessors
+                  insn_jmp::make(split, to);
+                  for (auto &target: from->rear()->targets()) if (target == to) target = split;
+                  at[sn] = split;
+               }
+            }
+            res.inserts.push_back(at[sn]);
+         }
+         // with no deletions, there still may be evaluations redundant within a BB
+         bool local = false;
+         for (auto bb: touched) {
+            bool avail = false;
+            for (auto in = bb->head(); in; in = in->next())
+            if (std::find(evals.begin(), evals.end(), in) != evals.end()) local |= avail, avail = true; else
+            if (std::find(killers.begin(), killers.end(), in) != killers.end()) avail = false;
+         }
+         if (!res.deletes.empty() || local) plans.push_back(std::move(res));
+      }
+   }
+
+   // Rewrite Evaluations //////////////////////////////////////////////////////////////////////////
+   const cfg_info cfg(pc);
+   std::vector<insn *> phis, dead; // phis placed on demand, and evaluations replaced with copies
+   for (auto &it: plans) {
+      const auto proto = it.evals.front();
+      std::vector<insn *> sites = it.evals; // available values are defined here
+      for (auto bb: it.inserts) {
+         sites.push_back(is<insn_load>(proto) ?
+            (insn *)insn_load::make(bb->rear(), as<insn_load>(proto)->src(), vreg::make()) :
+            (insn *)insn_binop::make(bb->rear(), as<insn_binop>(proto)->op, as<insn_binop>(proto)->lhs(), as<insn_binop>(proto)->rhs(), vreg::make()));
+         ++stats.pre_inserted;
+      }
+      // the value of the expression on entry to and on exit from BBs (always available there per LCM)
+      std::unordered_map<bblock *, operand *> entry_vals;
+      const auto exit_val = [&](auto &entry_val, bblock *bb)->operand *{
+         for (auto in = bb->rear(); in; in = in->prev()) {
+            if (std::find(sites.begin(), sites.end(), in) != sites.end()) return in->outputs()[0];
+            if (RSN_UNLIKELY(kills(in, proto, true))) return {};
+         }
+         return entry_val(entry_val, bb);
+      };
+      const auto entry_val = [&](auto &entry_val, bblock *bb)->operand *{
+         if (const auto it = entry_vals.find(bb); it != entry_vals.end()) return it->second;
+         const auto &preds = cfg.preds[bb->sn];
+         if (RSN_UNLIKELY(preds.empty())) return entry_vals[bb] = nullptr;
+         if (preds.size() == 1) return entry_vals[bb] = exit_val(entry_val, preds.front());
+         auto dest = vreg::make();
+         const auto phi = insn_phi::make(bb->head(), std::vector<lib::smart_ptr<operand>>(preds.size(), dest), dest);
+         entry_vals[bb] = dest, phis.push_back(phi);
+         for (std::size_t sn = 0; sn < preds.size(); ++sn) phi->args()[sn] = exit_val(entry_val, preds[sn]);
+         return dest;
+      };
+      std::vector<bblock *> touched;
+      for (auto in: it.evals) if (touched.empty() || touched.back() != in->owner()) touched.push_back(in->owner()); // in RPO
+      for (auto bb: touched) {
+         operand *avail = {}; bool exposed = true;
+         for (auto in = bb->head(); in; in = in->next())
+         if (std::find(it.evals.begin(), it.evals.end(), in) != it.evals.end()) {
+            if (exposed && std::find(it.deletes.begin(), it.deletes.end(), bb) != it.deletes.end()) avail = entry_val(entry_val, bb);
+            exposed = false;
+            if (avail) {
+               in = insn_mov::make(in, avail, in->outputs()[0])->next(), dead.push_back(in); // still in it.evals and sites
+               ++stats.pre_deleted;
+            } else
+               avail = in->outputs()[0];
+         } else
+         if (kills(in, proto, true)) avail = {}, exposed = false;
+      }
+   }
+   for (auto in: dead) in->eliminate();
+   // phi insns with only one distinct argument (other than their own results) become copies
+   for (bool changed = true; changed;) {
+      changed = false;
+      for (auto &phi: phis) if (phi) {
+         operand *val = {};
+         for (const auto &arg: as<insn_phi>(phi)->args()) if (arg != as<insn_phi>(phi)->dest()) {
+            if (val && arg != val) goto next;
+            val = arg;
+         }
+         if (RSN_LIKELY(val)) {
+            auto first = phi->owner()->head();
+            while (is<insn_phi>(first)) first = first->next();
+            insn_mov::make(first, val, as<insn_phi>(phi)->dest()), phi->eliminate(), phi = nullptr, changed = true;
+         }
+      next:;
+      }
+   }
+   bool changed = !plans.empty();
+
+   // Translate Binops through Phi Insns ///////////////////////////////////////////////////////////
+   def.assign(number_vregs(pc), nullptr);
+   for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) for (const auto &output: in->outputs()) def[output->sn] = in;
+   const auto origin = [&](operand *op) noexcept{ // looking through copies
+      while (is<vreg>(op) && def[as<vreg>(op)->sn] && is<insn_mov>(def[as<vreg>(op)->sn])) op = as<insn_mov>(def[as<vreg>(op)->sn])->src();
+      return op;
+   };
+   const auto binop_key = [&](decltype(insn_binop::op) op, operand *lhs, operand *rhs) {
+      std::vector<unsigned long long> res{op};
+      return key(res, lhs), key(res, rhs), res;
+   };
+   std::map<std::vector<unsigned long long>, std::vector<std::pair<bblock *, vreg *>>> values; // where binops are evaluated
+   for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) if (is<insn_binop>(in) && speculatable(in)) {
+      const auto binop = as<insn_binop>(in);
+      values[binop_key(binop->op, origin(binop->lhs()), origin(binop->rhs()))].push_back({bb, binop->dest()});
+   }
+   for (auto bb: cfg.rpo) if (RSN_LIKELY(bb != cfg.rpo.front()) && cfg.preds[bb->sn].size() > 1)
+   for (auto in = bb->head(), next = in->next(); in; in = next, next = in ? in->next() : nullptr) if (is<insn_binop>(in) && speculatable(in)) {
+      const auto &preds = cfg.preds[bb->sn];
+      const auto binop = as<insn_binop>(in);
+      operand *lhs = origin(binop->lhs()), *rhs = origin(binop->rhs());
+      bool phi_based = false;
+      for (auto op: {lhs, rhs}) if (is<vreg>(op)) {
+         const auto def_in = def[as<vreg>(op)->sn];
+         if (RSN_UNLIKELY(!def_in) || (def_in->owner() == bb && !is<insn_phi>(def_in))) goto skip_binop;
+         phi_based |= def_in->owner() == bb;
+      }
+      if (RSN_LIKELY(!phi_based)) continue;
+      {  // the expression as evaluated at the end of each predecessor
+         const auto translate = [&](operand *op, std::size_t sn) noexcept{
+            return is<vreg>(op) && def[as<vreg>(op)->sn]->owner() == bb ? origin(as<insn_phi>(def[as<vreg>(op)->sn])->args()[sn]) : op;
+         };
+         std::vector<vreg *> avail(preds.size());
+         bool any = false;
+         for (std::size_t sn = 0; sn < preds.size(); ++sn) {
+            if (const auto it = values.find(binop_key(binop->op, translate(lhs, sn), translate(rhs, sn))); it != values.end())
+            for (const auto &[site, val]: it->second) if (cfg.dominates(site, preds[sn])) { avail[sn] = val, any = true; break; }
+            // evaluating along the edge is not speculative (nor moves evaluations backwards around loops) only in these cases
+            if (!avail[sn] && (cfg.succs[preds[sn]->sn].size() != 1 || cfg.rpo_num[preds[sn]->sn] >= cfg.rpo_num[bb->sn])) goto skip_binop;
+         }
+         if (RSN_LIKELY(!any)) continue;
+         std::vector<lib::smart_ptr<operand>> args(preds.size());
+         for (std::size_t sn = 0; sn < preds.size(); ++sn) if (avail[sn]) args[sn] = avail[sn]; else {
+            auto dest = vreg::make();
+            const auto eval = insn_binop::make(preds[sn]->rear(), binop->op, translate(lhs, sn), translate(rhs, sn), dest);
+            dest->sn = def.size(), def.push_back(eval), args[sn] = dest;
+            values[binop_key(binop->op, translate(lhs, sn), translate(rhs, sn))].push_back({preds[sn], dest});
+            ++stats.pre_inserted;
+         }
+         def[binop->dest()->sn] = insn_phi::make(bb->head(), std::move(args), binop->dest());
+         in->eliminate(), in = {}, changed = true;
+         ++stats.pre_translated;
+      }
+   skip_binop:;
+   }
+   return changed;
+}
@@ -0,0 +1,359 @@
+// opt-profile.cc -- edge profiling and profile-guided block layout
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "opt.hh"
+
+# include <algorithm> // all_of, count, find, max, min, sort, stable_sort
+# include <queue>
+
+/* References:
+   - Optimal Measurement Points for Program Frequency Counts by Donald E. Knuth and Francis R. Stevenson
+   - Optimally Profiling and Tracing Programs by Thomas Ball and James R. Larus
+*/
+rsn::opt::edge_profiler::edge_profiler(proc *pc): pc(pc) {
+   const cfg_info cfg(pc); const loop_forest loops(cfg);
+   bblocks = cfg.bblocks;
+   const auto exit = bblocks.size();
+   edges.push_back({exit, pc->head()->sn});
+   for (auto bb: cfg.rpo) {
+      for (auto succ: cfg.succs[bb->sn]) edges.push_back({bb->sn, succ->sn});
+      if (RSN_UNLIKELY(is<insn_ret>(bb->rear())) || RSN_UNLIKELY(is<insn_oops>(bb->rear()))) edges.push_back({bb->sn, exit});
+   }
+
+   // Choose Instrumented Edges (Chords of a Maximum Spanning Tree) ////////////////////////////////
+   // static estimate: an edge is executed 8 times as often per level of loop nesting (the virtual edge must belong to the tree)
+   std::vector<unsigned long long> estimate(edges.size());
+   estimate.front() = ~0ull;
+   for (std::size_t sn = 1; sn < edges.size(); ++sn) {
+      const auto depth = std::min(edges[sn].to == exit ? 0 : std::min(loops.depth(bblocks[edges[sn].from]), loops.depth(bblocks[edges[sn].to])), 20u);
+      estimate[sn] = 1ull << depth * 3;
+   }
+   std::vector<std::size_t> order(edges.size());
+   for (std::size_t sn = 0; sn < order.size(); ++sn) order[sn] = sn;
+   std::stable_sort(order.begin(), order.end(), [&](auto lhs, auto rhs) noexcept{ return estimate[lhs] > estimate[rhs]; });
+   // Kruskal's algorithm (with a disjoint-set forest, path halving)
+   std::vector<std::size_t> parent(exit + 1);
+   for (std::size_t sn = 0; sn <= exit; ++sn) parent[sn] = sn;
+   const auto find = [&](std::size_t node) noexcept{
+      while (parent[node] != node) node = parent[node] = parent[parent[node]];
+      return node;
+   };
+   for (auto sn: order) {
+      const auto from = find(edges[sn].from), to = find(edges[sn].to);
+      if (RSN_LIKELY(from != to)) parent[from] = to; else counter_edges.push_back(sn);
+   }
+   std::sort(counter_edges.begin(), counter_edges.end()); // counters in the order of edges
+}
+
+void rsn::opt::edge_profiler::instrument(const lib::smart_ptr<rel_base> &base) {
+   const cfg_info cfg(pc);
+   for (std::size_t counter = 0; counter < counter_edges.size(); ++counter) {
+      const auto from = bblocks[edges[counter_edges[counter]].from];
+      const auto to = edges[counter_edges[counter]].to < bblocks.size() ? bblocks[edges[counter_edges[counter]].to] : nullptr;
+      // probe the edge at the end of the source if it is the only successor (or the exit), at the start of the target if it is the only
+      // predecessor, or in a BB splitting the edge otherwise (placed right after the source so as to preserve the order of predecessors)
+      insn *next;
+      if (!to || cfg.succs[from->sn].size() == 1)
+         next = from->rear();
+      else
+      if (cfg.preds[to->sn].size() == 1 && to != pc->head()) {
+         next = to->head();
+         while (is<insn_phi>(next)) next = next->next();
+      } else {
+         const auto split = RSN_LIKELY(from->next()) ? bblock::make(from->next()) : bblock::make(pc);
+         next = insn_jmp::make(split, to);
+         for (auto &target: from->rear()->targets()) if (target == to) target = split;
+         splits.push_back({split, counter_edges[counter]});
+         ++stats.prof_split_edges;
+      }
+      lib::smart_ptr<operand> addr;
+      if (RSN_LIKELY(counter)) addr = rel_disp::make(base, counter * 8); else addr = base;
+      auto count = vreg::make(), new_count = vreg::make();
+      probes.push_back(insn_load::make(next, addr, count));
+      probes.push_back(insn_binop::make_add(next, std::move(count), abs::make(1), new_count));
+      probes.push_back(insn_store::make(next, std::move(new_count), std::move(addr)));
+      ++stats.prof_counters;
+   }
+}
+
+void rsn::opt::edge_profiler::uninstrument() noexcept {
+   for (auto in: probes) in->eliminate();
+   for (const auto &[split, sn]: splits) {
+      for (auto &target: bblocks[edges[sn].from]->rear()->targets()) if (target == split) target = bblocks[edges[sn].to];
+      split->eliminate();
+   }
+   probes.clear(), splits.clear();
+}
+
+auto rsn::opt::edge_profiler::import(const unsigned long long counters[]) const->edge_weights {
+   std::vector<unsigned long long> counts(edges.size());
+   std::vector<bool> known(edges.size());
+   for (std::size_t counter = 0; counter < counter_edges.size(); ++counter)
+      counts[counter_edges[counter]] = counters[counter], known[counter_edges[counter]] = true;
+
+   // Derive Counts of Tree Edges (Peeling Leaves of the Tree) /////////////////////////////////////
+   // the count of the only unknown edge incident to a node balances the known inflow and outflow (in modular arithmetic)
+   std::vector<std::vector<std::size_t>> incident(bblocks.size() + 1);
+   std::vector<std::size_t> unknown(bblocks.size() + 1);
+   for (std::size_t sn = 0; sn < edges.size(); ++sn) {
+      incident[edges[sn].from].push_back(sn), unknown[edges[sn].from] += !known[sn];
+      if (RSN_LIKELY(edges[sn].to != edges[sn].from)) incident[edges[sn].to].push_back(sn), unknown[edges[sn].to] += !known[sn];
+   }
+   std::vector<std::size_t> worklist;
+   for (std::size_t node = 0; node < unknown.size(); ++node) if (RSN_UNLIKELY(unknown[node] == 1)) worklist.push_back(node);
+   while (!worklist.empty()) {
+      const auto node = worklist.back(); worklist.pop_back();
+      if (RSN_UNLIKELY(unknown[node] != 1)) continue;
+      unsigned long long inflow = 0, outflow = 0; std::size_t target{};
+      for (auto sn: incident[node]) if (RSN_LIKELY(known[sn])) {
+         if (edges[sn].to == node) inflow += counts[sn];
+         if (edges[sn].from == node) outflow += counts[sn];
+      } else target = sn;
+      counts[target] = edges[target].from == node ? inflow - outflow : outflow - inflow, known[target] = true;
+      const auto other = edges[target].from == node ? edges[target].to : edges[target].from;
+      --unknown[node];
+      if (--unknown[other] == 1) worklist.push_back(other);
+   }
+
+   edge_weights res;
+   for (std::size_t sn = 1; sn < edges.size(); ++sn)
+      if (RSN_LIKELY(edges[sn].to < bblocks.size())) res.emplace(std::pair{bblocks[edges[sn].from], bblocks[edges[sn].to]}, counts[sn]);
+   return res;
+}
+
+/* References:
+   - Branch Prediction for Free by Thomas Ball and James R. Larus
+   - Static Branch Frequency and Program Profile Analysis by Youfeng Wu and James R. Larus
+*/
+rsn::opt::block_frequency::block_frequency(const cfg_info &cfg, const loop_forest &loops): cfg(cfg) {
+   const auto bb_count = cfg.bblocks.size();
+   freq.resize(bb_count), prob.resize(bb_count), is_cold.resize(bb_count);
+
+   // BBs whose paths all end in oops insns (a least fixed point, so that infinite loops are not cold)
+   for (bool changed = true; changed;) {
+      changed = false;
+      for (auto bb: lib::range_ref(cfg.rpo).reverse()) if (!is_cold[bb->sn] && (is<insn_oops>(bb->rear()) ||
+         (!cfg.succs[bb->sn].empty() && std::all_of(cfg.succs[bb->sn].begin(), cfg.succs[bb->sn].end(), [&](auto succ) noexcept{ return is_cold[succ->sn]; }))))
+         is_cold[bb->sn] = true, changed = true;
+   }
+   // BBs that return (possibly via forwarding BBs)
+   const auto returns = [&](bblock *bb) noexcept{
+      for (int steps = 0; steps < 4 && is<insn_jmp>(bb->head()); ++steps) bb = as<insn_jmp>(bb->head())->dest();
+      return is<insn_ret>(bb->rear());
+   };
+   const auto calls = [&](bblock *bb) noexcept{
+      for (auto in = bb->head(); in; in = in->next()) if (RSN_UNLIKELY(is<insn_call>(in))) return true;
+      return false;
+   };
+
+   // Estimate Branch Probabilities ////////////////////////////////////////////////////////////////
+   constexpr double cold_prob = 1.0 / (1 << 20), loop_branch_prob = 0.88, opcode_prob = 0.84, pointer_prob = 0.60, loop_header_prob = 0.75,
+      return_prob = 0.72, call_prob = 0.78;
+   for (auto bb: cfg.rpo) {
+      const auto &succs = cfg.succs[bb->sn];
+      auto &probs = prob[bb->sn];
+      probs.assign(succs.size(), 1.0 / std::max<std::size_t>(succs.size(), 1));
+      if (RSN_UNLIKELY(is<insn_switch_br>(bb->rear()))) { // in proportion to the numbers of table entries
+         const auto sw = as<insn_switch_br>(bb->rear());
+         for (std::size_t sn = 0; sn < succs.size(); ++sn)
+            probs[sn] = (double)std::count(sw->dests().begin(), sw->dests().end(), succs[sn]) / sw->dests().size();
+      }
+      if (RSN_LIKELY(succs.size() == 2) && RSN_LIKELY(is<insn_br>(bb->rear()))) {
+         const auto br = as<insn_br>(bb->rear());
+         const auto taken = br->dest1() == succs[0] ? 0 : 1; // index of dest1 in succs
+         double p = 0.5; // that dest1 is taken
+         const auto combine = [&](double q) noexcept{ p = p * q / (p * q + (1 - p) * (1 - q)); };
+         // the predicate holds for dest1 only, for dest2 only, or neither (predicting dest1 with the probability q if a heuristic applies)
+         const auto apply = [&](bool for1, bool for2, double q) noexcept{ if (for1 != for2) combine(for1 ? q : 1 - q); };
+         const auto lp = loops.innermost[bb->sn];
+         const auto exits = [&](bblock *dest) noexcept{ return lp && !loops.contains(lp, dest); };
+         const auto back = [&](bblock *dest) noexcept{ // a back edge to the header of a loop
+            return loops.innermost[dest->sn] && loops.innermost[dest->sn]->header == dest && cfg.dominates(dest, bb);
+         };
+         const auto enters = [&](bblock *dest) noexcept{ // a loop header or preheader not containing bb
+            if (is<insn_jmp>(dest->rear()) && dest->head() == dest->rear()) dest = as<insn_jmp>(dest->rear())->dest();
+            return loops.innermost[dest->sn] && loops.innermost[dest->sn]->header == dest && !loops.contains(loops.innermost[dest->sn], bb);
+         };
+         apply(back(br->dest1()), back(br->dest2()), loop_branch_prob);
+         apply(!exits(br->dest1()), !exits(br->dest2()), loop_branch_prob);
+         if (br->op == insn_br::_beq) {
+            if (is<abs>(br->lhs()) || is<abs>(br->rhs())) combine(1 - opcode_prob); // equality to a constant (including zero) fails
+            else
+            if (is<vreg>(br->lhs()) && is<vreg>(br->rhs())) combine(1 - pointer_prob);
+         } else
+         if (br->op == insn_br::_bslt && is<abs>(br->rhs()) && as<abs>(br->rhs())->val == 0) combine(1 - opcode_prob); // negative values are rare
+         apply(enters(br->dest1()), enters(br->dest2()), loop_header_prob);
+         apply(calls(br->dest2()), calls(br->dest1()), call_prob);
+         apply(returns(br->dest2()), returns(br->dest1()), return_prob);
+         probs[taken] = p, probs[1 - taken] = 1 - p;
+      }
+      // cold successors get a negligible share of non-cold ones
+      double cold_share = 0, warm_share = 0;
+      for (std::size_t sn = 0; sn < succs.size(); ++sn) (is_cold[succs[sn]->sn] ? cold_share : warm_share) += probs[sn];
+      if (RSN_UNLIKELY(cold_share > 0) && RSN_LIKELY(warm_share > 0)) for (std::size_t sn = 0; sn < succs.size(); ++sn)
+         probs[sn] = is_cold[succs[sn]->sn] ? probs[sn] / cold_share * cold_prob : probs[sn] / warm_share * (1 - cold_prob);
+   }
+
+   // Propagate Frequencies (Innermost Loops First, then the Whole Procedure) //////////////////////
+   // loops are bounded to 4095 expected iterations per entry (so that frequencies do not blow up)
+   constexpr double max_cyclic_prob = 1 - 1.0 / 4096;
+   std::vector<double> cyclic(bb_count); // probability of returning to a loop header via back edges (with the header frequency taken as 1)
+   const auto propagate = [&](bblock *head, const std::vector<bblock *> &bblocks, const loop_forest::loop *lp){
+      for (auto bb: bblocks) {
+         double sum = 0;
+         if (bb == head) sum = 1; else for (auto pred: cfg.preds[bb->sn])
+            if (cfg.rpo_num[pred->sn] < cfg.rpo_num[bb->sn] && (!lp || loops.contains(lp, pred))) sum += freq[pred->sn] * probability(pred, bb);
+         freq[bb->sn] = bb == head && lp ? sum : sum / (1 - cyclic[bb->sn]);
+      }
+      if (lp) {
+         double sum = 0;
+         for (auto latch: lp->latches) sum += freq[latch->sn] * probability(latch, head);
+         cyclic[head->sn] = std::min(sum, max_cyclic_prob);
+      }
+   };
+   for (const auto &lp: loops.loops) propagate(lp.header, lp.bblocks, &lp);
+   propagate(cfg.rpo.front(), cfg.rpo, {});
+}
+
+double rsn::opt::block_frequency::probability(const bblock *from, const bblock *to) const noexcept {
+   const auto &succs = cfg.succs[from->sn];
+   const auto it = std::find(succs.begin(), succs.end(), to);
+   return it != succs.end() ? prob[from->sn][it - succs.begin()] : 0;
+}
+
+auto rsn::opt::block_frequency::weights(double scale) const->edge_weights {
+   edge_weights res;
+   for (auto bb: cfg.rpo) for (std::size_t sn = 0; sn < cfg.succs[bb->sn].size(); ++sn)
+      res.emplace(std::pair{bb, cfg.succs[bb->sn][sn]}, (unsigned long long)std::min(freq[bb->sn] * prob[bb->sn][sn] * scale + 0.5, 0x1p62));
+   return res;
+}
+
+/* References:
+   - Profile Guided Code Positioning by Karl Pettis and Robert C. Hansen
+
+   Bottom-up positioning: edges are visited from the heaviest, and each one links the chain ending in its source with the chain starting
+   at its target (if distinct), so that hot paths become fall-throughs; chains are then laid out starting from the one with the entry BB,
+   each next one being the most heavily connected to those placed so far, which keeps hot loops together while never-executed chains sink
+   to the end (in the original order, followed by chains of BBs marked cold and then unreachable BBs). */
+bool rsn::opt::transform_block_layout(proc *pc, const edge_weights &weights) {
+   const cfg_info cfg(pc);
+   const auto bb_count = cfg.bblocks.size();
+   const auto weight = [&](const bblock *from, const bblock *to) noexcept{
+      const auto it = weights.find({from, to});
+      return it != weights.end() ? it->second : 0;
+   };
+   struct edge { bblock *from, *to; unsigned long long weight; };
+   std::vector<edge> edges;
+   for (auto bb: cfg.rpo) for (auto succ: cfg.succs[bb->sn]) if (const auto w = weight(bb, succ); RSN_LIKELY(w)) edges.push_back({bb, succ, w});
+   std::stable_sort(edges.begin(), edges.end(), [](const auto &lhs, const auto &rhs) noexcept{ return lhs.weight > rhs.weight; });
+
+   // Build Chains of Fall-Through Edges (Heaviest First) //////////////////////////////////////////
+   std::vector<std::vector<bblock *>> chains(bb_count); // indexed by the bblock::sn of the head (in the original order)
+   std::vector<std::size_t> chain(bb_count);
+   for (auto bb: cfg.rpo) chains[bb->sn] = {bb}, chain[bb->sn] = bb->sn;
+   for (const auto &[from, to, _]: edges) {
+      const auto lhs = chain[from->sn], rhs = chain[to->sn];
+      if (RSN_UNLIKELY(lhs == rhs) || chains[lhs].back() != from || chains[rhs].front() != to || RSN_UNLIKELY(to == pc->head()) ||
+         RSN_UNLIKELY(from->cold != to->cold)) continue;
+      for (auto bb: chains[rhs]) chain[bb->sn] = lhs;
+      chains[lhs].insert(chains[lhs].end(), chains[rhs].begin(), chains[rhs].end()), chains[rhs].clear();
+   }
+
+   // Order Chains (by Connection to Placed Chains; Unexecuted Chains Last) ////////////////////////
+   std::vector<bblock *> order; order.reserve(bb_count);
+   {  std::vector<unsigned long long> connection(bb_count);
+      std::vector<signed char> placed(bb_count);
+      std::priority_queue<std::pair<unsigned long long, std::size_t>> queue; // by connection and -sn (so that ties favor earlier heads)
+      const auto place = [&](std::size_t sn){
+         placed[sn] = true, order.insert(order.end(), chains[sn].begin(), chains[sn].end());
+         for (auto bb: chains[sn]) {
+            const auto connect = [&](bblock *other, unsigned long long w){
+               if (RSN_LIKELY(w) && !placed[chain[other->sn]] && RSN_LIKELY(!other->cold)) queue.push({connection[chain[other->sn]] += w, -chain[other->sn]});
+            };
+            for (auto succ: cfg.succs[bb->sn]) connect(succ, weight(bb, succ));
+            for (auto pred: cfg.preds[bb->sn]) connect(pred, weight(pred, bb));
+         }
+      };
+      place(pc->head()->sn);
+      while (!queue.empty()) {
+         const auto [w, neg_sn] = queue.top(); queue.pop();
+         const auto sn = -neg_sn;
+         if (RSN_LIKELY(!placed[sn]) && RSN_LIKELY(w == connection[sn])) place(sn); // skip stale entries
+      }
+      for (auto bb: cfg.bblocks) if (cfg.reachable(bb) && chains[bb->sn].size() && !placed[bb->sn] && RSN_LIKELY(!bb->cold)) place(bb->sn);
+      for (auto bb: cfg.bblocks) if (cfg.reachable(bb) && chains[bb->sn].size() && !placed[bb->sn]) place(bb->sn);
+      for (auto bb: cfg.bblocks) if (RSN_UNLIKELY(!cfg.reachable(bb))) order.push_back(bb);
+   }
+   if (RSN_LIKELY(order == cfg.bblocks)) return false;
+
+   // Reorder BBs and Phi Arguments ////////////////////////////////////////////////////////////////
+   std::vector<std::size_t> pos(bb_count);
+   for (std::size_t sn = 0; sn < bb_count; ++sn) pos[order[sn]->sn] = sn;
+   for (const auto &[from, to, _]: edges)
+      stats.layout_fallthru += pos[to->sn] == pos[from->sn] + 1 && to->sn != from->sn + 1;
+   for (auto bb: order) bb->reattach();
+   for (auto bb: cfg.rpo) if (RSN_UNLIKELY(is<insn_phi>(bb->head()))) {
+      auto new_preds = cfg.preds[bb->sn];
+      std::sort(new_preds.begin(), new_preds.end(), [&](auto lhs, auto rhs) noexcept{ return pos[lhs->sn] < pos[rhs->sn]; });
+      reorder_phi_args(bb, cfg.preds[bb->sn], new_preds);
+   }
+   return true;
+}
+
+/* Cold code is that which can only end in a trap (see block_frequency::cold). Trap BBs (ending in oops insns after insns w/o observable
+   effects) are merged into one per procedure, and then cold BBs are marked as such and moved to the end of the procedure (keeping their
+   order), so that a backend can emit them into a separate section and keep hot code dense. */
+bool rsn::opt::transform_hot_cold_split(proc *pc) {
+   bool changed{};
+
+   // Merge Trap BBs ///////////////////////////////////////////////////////////////////////////////
+   {  const cfg_info cfg(pc);
+      const auto trap = [&](bblock *bb) noexcept{
+         if (RSN_LIKELY(!is<insn_oops>(bb->rear()))) return false;
+         for (auto in = bb->head(); in != bb->rear(); in = in->next()) if (!is<insn_phi>(in) && !speculatable(in)) return false;
+         return true;
+      };
+      bblock *shared = {};
+      for (auto bb: cfg.rpo) {
+         if (RSN_LIKELY(!trap(bb))) continue;
+         if (!shared) {
+            while (bb->head() != bb->rear()) bb->head()->eliminate(), changed = true; // results are dead anyway
+            shared = bb;
+            continue;
+         }
+         for (auto pred: cfg.preds[bb->sn]) for (auto &target: pred->rear()->targets()) if (target == bb) target = shared;
+         bb->eliminate();
+         ++stats.cold_traps_merged, changed = true;
+      }
+   }
+   // Move Cold BBs to the End /////////////////////////////////////////////////////////////////////
+   const cfg_info cfg(pc); const loop_forest loops(cfg); const block_frequency freq(cfg, loops);
+   if (RSN_UNLIKELY(freq.cold(pc->head()))) return changed; // no hot part
+   std::vector<bblock *> order; order.reserve(cfg.bblocks.size());
+   for (auto bb: cfg.bblocks) {
+      const bool cold = cfg.reachable(bb) && freq.cold(bb);
+      if (RSN_UNLIKELY(cold != bb->cold)) bb->cold = cold, stats.cold_bblocks += cold, changed = true;
+      if (RSN_LIKELY(!cold)) order.push_back(bb);
+   }
+   for (auto bb: cfg.bblocks) if (RSN_UNLIKELY(bb->cold)) order.push_back(bb);
+   if (RSN_LIKELY(order == cfg.bblocks)) return changed;
+   std::vector<std::size_t> pos(cfg.bblocks.size());
+   for (std::size_t sn = 0; sn < order.size(); ++sn) pos[order[sn]->sn] = sn;
+   for (auto bb: order) if (RSN_UNLIKELY(bb->cold)) bb->reattach();
+   for (auto bb: cfg.rpo) if (RSN_UNLIKELY(bb->cold) && RSN_UNLIKELY(is<insn_phi>(bb->head()))) { // only cold BBs may have cold preds
+      auto new_preds = cfg.preds[bb->sn];
+      std::sort(new_preds.begin(), new_preds.end(), [&](auto lhs, auto rhs) noexcept{ return pos[lhs->sn] < pos[rhs->sn]; });
+      reorder_phi_args(bb, cfg.preds[bb->sn], new_preds);
+   }
+   return true;
+}
@@ -0,0 +1,319 @@
+// opt-ranges.cc -- known bits and value ranges
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "opt.hh"
+
+# include <algorithm> // max, min
+# include <limits>    // numeric_limits
+
+namespace rsn::opt {
+   using value = value_ranges::value;
+   static constexpr value top{0, 0, 0, ~0ull}, none{0, 0, 1, 0};
+   static constexpr auto smin = std::numeric_limits<long long>::min(), smax = std::numeric_limits<long long>::max();
+
+   static constexpr value exact(unsigned long long val) noexcept { return {~val, val, val, val}; }
+
+   static value normalize(value val) noexcept { // let known bits and the interval refine each other
+      if (RSN_UNLIKELY(val.zero & val.one)) return none;
+      val.lo = std::max(val.lo, val.one), val.hi = std::min(val.hi, ~val.zero);
+      if (RSN_UNLIKELY(val.lo > val.hi)) return none;
+      if (const auto diff = val.lo ^ val.hi; diff) { // the common prefix of the bounds is known
+         const auto prefix = ~(~0ull >> __builtin_clzll(diff));
+         val.zero |= ~val.lo & prefix, val.one |= val.lo & prefix;
+      } else
+         val.zero = ~val.lo, val.one = val.lo;
+      return val;
+   }
+   static value interval(unsigned long long lo, unsigned long long hi) noexcept { return normalize({0, 0, lo, hi}); }
+
+   static value join(const value &lhs, const value &rhs) noexcept {
+      if (lhs.empty()) return rhs;
+      if (rhs.empty()) return lhs;
+      return normalize({lhs.zero & rhs.zero, lhs.one & rhs.one, std::min(lhs.lo, rhs.lo), std::max(lhs.hi, rhs.hi)});
+   }
+   static value meet(const value &lhs, const value &rhs) noexcept {
+      return normalize({lhs.zero | rhs.zero, lhs.one | rhs.one, std::max(lhs.lo, rhs.lo), std::min(lhs.hi, rhs.hi)});
+   }
+
+   // signed bounds (unknown if the interval crosses the boundary between non-negative and negative values)
+   static std::pair<long long, long long> signed_bounds(const value &val) noexcept {
+      if (val.hi <= (unsigned long long)smax || val.lo > (unsigned long long)smax) return {val.lo, val.hi};
+      return {smin, smax};
+   }
+   static value meet_signed(const value &val, long long lo, long long hi) noexcept { // the intersection with a signed interval
+      if (RSN_UNLIKELY(lo > hi)) return none;
+      auto res = none;
+      if (hi >= 0) res = join(res, meet(val, interval(std::max(lo, 0ll), hi)));
+      if (lo < 0) res = join(res, meet(val, interval(lo, std::min(hi, -1ll))));
+      return res;
+   }
+
+   static value add(const value &lhs, const value &rhs, bool carry) noexcept { // lhs + rhs + carry (the known bits per LLVM's computeForAddSub)
+      const auto sum_zero = ~lhs.zero + ~rhs.zero + carry, sum_one = lhs.one + rhs.one + carry; // with unknown bits being all ones or zeros
+      const auto carry_zero = ~(sum_zero ^ lhs.zero ^ rhs.zero), carry_one = sum_one ^ lhs.one ^ rhs.one;
+      const auto known = (lhs.zero | lhs.one) & (rhs.zero | rhs.one) & (carry_zero | carry_one);
+      value res{~sum_zero & known, sum_one & known, 0, ~0ull};
+      const auto lo = lhs.lo + rhs.lo + carry, hi = lhs.hi + rhs.hi + carry;
+      const bool lo_wraps = lhs.lo + carry > ~rhs.lo || (carry && lhs.lo == ~0ull), hi_wraps = lhs.hi + carry > ~rhs.hi || (carry && lhs.hi == ~0ull);
+      if (lo_wraps == hi_wraps) res.lo = lo, res.hi = hi;
+      return normalize(res);
+   }
+   static unsigned trailing_zeros(const value &val) noexcept { return ~val.zero ? __builtin_ctzll(~val.zero) : 64; }
+
+   static value transfer(decltype(insn_binop::op) op, const value &lhs, const value &rhs) noexcept {
+      if (lhs.empty() || rhs.empty()) return none;
+      switch (op) {
+      default:
+         RSN_UNREACHABLE();
+      case insn_binop::_add:
+         return add(lhs, rhs, false);
+      case insn_binop::_sub: // lhs + ~rhs + 1
+         return add(lhs, {rhs.one, rhs.zero, ~rhs.hi, ~rhs.lo}, true);
+      case insn_binop::_umul:
+      case insn_binop::_smul:
+         if (lhs.exact() && rhs.exact()) return exact(lhs.lo * rhs.lo);
+         if (const auto tz = trailing_zeros(lhs) + trailing_zeros(rhs); tz >= 64) return exact(0); else {
+            value res{(1ull << tz) - 1, 0, 0, ~0ull};
+            if (!umulh(lhs.hi, rhs.hi)) res.lo = lhs.lo * rhs.lo, res.hi = lhs.hi * rhs.hi;
+            return normalize(res);
+         }
+      case insn_binop::_udiv:
+         if (RSN_UNLIKELY(!rhs.hi)) return none; // always traps
+         return interval(lhs.lo / rhs.hi, lhs.hi / std::max(rhs.lo, 1ull));
+      case insn_binop::_urem:
+         if (RSN_UNLIKELY(!rhs.hi)) return none; // ditto
+         if (lhs.hi < rhs.lo) return lhs;
+         return interval(0, std::min(lhs.hi, rhs.hi - 1));
+      case insn_binop::_umulh:
+         return interval(umulh(lhs.lo, rhs.lo), umulh(lhs.hi, rhs.hi));
+      case insn_binop::_sdiv:
+      case insn_binop::_srem:
+      case insn_binop::_smulh:
+         if (lhs.exact() && rhs.exact() && op == insn_binop::_smulh) return exact(smulh(lhs.lo, rhs.lo));
+         return top;
+      case insn_binop::_and:
+         return normalize({lhs.zero | rhs.zero, lhs.one & rhs.one, 0, std::min(lhs.hi, rhs.hi)});
+      case insn_binop::_or:
+         return normalize({lhs.zero & rhs.zero, lhs.one | rhs.one, std::max(lhs.lo, rhs.lo), ~0ull});
+      case insn_binop::_xor:
+         return normalize({(lhs.zero & rhs.zero) | (lhs.one & rhs.one), (lhs.zero & rhs.one) | (lhs.one & rhs.zero), 0, ~0ull});
+      case insn_binop::_shl:
+         if (rhs.exact()) {
+            const auto count = rhs.lo & 0x3F; // x86 semantics
+            value res{(lhs.zero << count) | ((1ull << count) - 1), lhs.one << count, 0, ~0ull};
+            if (lhs.hi <= ~0ull >> count) res.lo = lhs.lo << count, res.hi = lhs.hi << count;
+            return normalize(res);
+         }
+         return normalize({(1ull << std::min(trailing_zeros(lhs), 63u)) - 1, 0, 0, ~0ull});
+      case insn_binop::_ushr:
+         if (rhs.exact()) {
+            const auto count = rhs.lo & 0x3F; // ditto
+            return normalize({lhs.zero >> count | ~(~0ull >> count), lhs.one >> count, lhs.lo >> count, lhs.hi >> count});
+         }
+         if (rhs.hi <= 0x3F) return interval(lhs.lo >> rhs.hi, lhs.hi >> rhs.lo);
+         return top;
+      case insn_binop::_sshr:
+         if (rhs.exact()) {
+            const auto count = rhs.lo & 0x3F; // ditto
+            value res{(unsigned long long)((long long)lhs.zero >> count), (unsigned long long)((long long)lhs.one >> count), 0, ~0ull};
+            if (const auto [lo, hi] = signed_bounds(lhs); lo != smin || hi != smax) res.lo = lo >> count, res.hi = hi >> count;
+            return normalize(res);
+         }
+         return top;
+      }
+   }
+} // namespace rsn::opt
+
+rsn::opt::value_ranges::value_ranges(const cfg_info &cfg, std::size_t vr_count): cfg(cfg), vregs(vr_count, top) {
+   // Find BBs Entered Only via Conditional Branches ///////////////////////////////////////////////
+   cond_dom.resize(cfg.bblocks.size());
+   for (auto bb: cfg.rpo) {
+      if (RSN_UNLIKELY(bb == cfg.rpo.front())) continue; // the entry BB is also entered from the caller
+      const auto &preds = cfg.preds[bb->sn];
+      cond_dom[bb->sn] = preds.size() == 1 && is<insn_br>(preds.front()->rear()) &&
+         as<insn_br>(preds.front()->rear())->dest1() != as<insn_br>(preds.front()->rear())->dest2() ? bb : cond_dom[cfg.idom[bb->sn]->sn];
+   }
+
+   // Propagate Values to a Fixed Point ////////////////////////////////////////////////////////////
+   for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next())
+      if (is<insn_binop>(in) || is<insn_mov>(in) || is<insn_select>(in) || is<insn_phi>(in)) vregs[in->outputs()[0]->sn] = none;
+   std::vector<unsigned char> changes(vr_count);
+   for (bool changed = true; changed;) {
+      changed = false;
+      for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) {
+         value val;
+         if (is<insn_binop>(in))
+            val = transfer(as<insn_binop>(in)->op, at(as<insn_binop>(in)->lhs(), bb), at(as<insn_binop>(in)->rhs(), bb));
+         else
+         if (is<insn_mov>(in))
+            val = at(as<insn_mov>(in)->src(), bb);
+         else
+         if (is<insn_select>(in))
+            val = join(at(as<insn_select>(in)->val1(), bb), at(as<insn_select>(in)->val2(), bb));
+         else
+         if (is<insn_phi>(in)) {
+            val = none;
+            const auto &preds = cfg.preds[bb->sn];
+            for (std::size_t sn = 0; sn < preds.size(); ++sn) val = join(val, at(as<insn_phi>(in)->args()[sn], preds[sn], bb));
+         } else
+            continue;
+         auto &res = vregs[in->outputs()[0]->sn];
+         auto _res = join(res, val);
+         if (RSN_LIKELY(_res.zero == res.zero && _res.one == res.one && _res.lo == res.lo && _res.hi == res.hi)) continue;
+         if (RSN_UNLIKELY(++changes[in->outputs()[0]->sn] > 8) && !res.empty()) { // widening
+            if (_res.lo < res.lo) _res.lo = 0;
+            if (_res.hi > res.hi) _res.hi = ~0ull;
+            _res = normalize(_res);
+         }
+         res = _res, changed = true;
+      }
+   }
+}
+
+auto rsn::opt::value_ranges::at(operand *op, const bblock *bb) const noexcept->value {
+   if (is<abs>(op)) return exact(as<abs>(op)->val);
+   if (!is<vreg>(op)) return top;
+   auto res = vregs[as<vreg>(op)->sn];
+   for (auto _bb = cond_dom[bb->sn]; _bb && !res.empty(); _bb = cond_dom[cfg.idom[_bb->sn]->sn])
+      res = refine(res, op, cfg.preds[_bb->sn].front(), _bb);
+   return res;
+}
+
+auto rsn::opt::value_ranges::at(operand *op, const bblock *from, const bblock *to) const noexcept->value {
+   auto res = at(op, from);
+   if (is<insn_br>(from->rear()) && as<const insn_br>(from->rear())->dest1() != as<const insn_br>(from->rear())->dest2()) res = refine(res, op, from, to);
+   return res;
+}
+
+auto rsn::opt::value_ranges::refine(value val, operand *op, const bblock *from, const bblock *to) const noexcept->value {
+   const auto br = as<const insn_br>(from->rear());
+   if (RSN_LIKELY(br->lhs() != op && br->rhs() != op)) return val;
+   const bool taken = br->dest1() == to;
+   if (RSN_UNLIKELY(br->lhs() == br->rhs())) return taken && br->op != insn_br::_beq ? none : val;
+   const bool lhs = br->lhs() == op;
+   const auto other = [&]() noexcept{
+      const auto other = lhs ? (operand *)br->rhs() : (operand *)br->lhs();
+      return is<abs>(other) ? exact(as<abs>(other)->val) : is<vreg>(other) ? vregs[as<vreg>(other)->sn] : top;
+   }();
+   if (RSN_UNLIKELY(other.empty())) return none;
+   switch (br->op) {
+   default:
+      RSN_UNREACHABLE();
+   case insn_br::_beq:
+      if (taken) return meet(val, other);
+      if (other.exact()) { // exclude a bound
+         if (val.lo == other.lo) { if (RSN_UNLIKELY(val.hi == val.lo)) return none; ++val.lo; }
+         if (val.hi == other.lo) --val.hi;
+         return normalize(val);
+      }
+      return val;
+   case insn_br::_bult:
+      if (taken) // lhs < rhs
+         return lhs ? other.hi ? meet(val, interval(0, other.hi - 1)) : none : ~other.lo ? meet(val, interval(other.lo + 1, ~0ull)) : none;
+      else // lhs >= rhs
+         return lhs ? meet(val, interval(other.lo, ~0ull)) : meet(val, interval(0, other.hi));
+   case insn_br::_bslt:
+      if (const auto [lo, hi] = signed_bounds(other); taken)
+         return lhs ? hi != smin ? meet_signed(val, smin, hi - 1) : none : lo != smax ? meet_signed(val, lo + 1, smax) : none;
+      else
+         return lhs ? meet_signed(val, lo, smax) : meet_signed(val, smin, hi);
+   }
+}
+
+auto rsn::opt::value_ranges::decide(insn_br *br) const noexcept->outcome {
+   if (RSN_UNLIKELY(br->lhs() == br->rhs())) return br->op == insn_br::_beq ? taken_dest1 : taken_dest2;
+   const auto lhs = at(br->lhs(), br->owner()), rhs = at(br->rhs(), br->owner());
+   if (RSN_UNLIKELY(lhs.empty() || rhs.empty())) return unknown; // never executed
+   switch (br->op) {
+   default:
+      RSN_UNREACHABLE();
+   case insn_br::_beq:
+      if (lhs.exact() && rhs.exact() && lhs.lo == rhs.lo) return taken_dest1;
+      if (lhs.hi < rhs.lo || rhs.hi < lhs.lo || lhs.zero & rhs.one || lhs.one & rhs.zero) return taken_dest2;
+      return unknown;
+   case insn_br::_bult:
+      return lhs.hi < rhs.lo ? taken_dest1 : lhs.lo >= rhs.hi ? taken_dest2 : unknown;
+   case insn_br::_bslt: {
+         const auto [lhs_lo, lhs_hi] = signed_bounds(lhs);
+         const auto [rhs_lo, rhs_hi] = signed_bounds(rhs);
+         return lhs_hi < rhs_lo ? taken_dest1 : lhs_lo >= rhs_hi ? taken_dest2 : unknown;
+      }
+   }
+}
+
+/* Replace VRs with constants where their values are exact, eliminate and/or insns that do not change their operands, and remainders and
+   quotients with known outcomes, and decide conditional branches (which removes the guards inserted for division by VRs known to be
+   non-zero). */
+bool rsn::opt::transform_value_ranges(proc *pc) {
+   const cfg_info cfg(pc);
+   const value_ranges ranges(cfg, number_vregs(pc));
+   bool changed{};
+   std::vector<std::pair<insn_br *, bblock *>> decided; // and the targets they never take
+   for (auto bb: cfg.rpo) for (auto in: all(bb)) {
+      // exact operands
+      if (is<insn_phi>(in)) {
+         const auto &preds = cfg.preds[bb->sn];
+         for (std::size_t sn = 0; sn < preds.size(); ++sn) if (auto &arg = as<insn_phi>(in)->args()[sn]; is<vreg>(arg))
+         if (const auto val = ranges.at(arg, preds[sn], bb); RSN_UNLIKELY(val.exact()))
+            arg = abs::make(val.lo), ++stats.vr_consts, changed = true;
+         continue;
+      }
+      for (auto &input: in->inputs()) if (is<vreg>(input))
+      if (const auto val = ranges.at(input, bb); RSN_UNLIKELY(val.exact()))
+         input = abs::make(val.lo), ++stats.vr_consts, changed = true;
+
+      // redundant insns
+      if (is<insn_binop>(in)) {
+         const auto binop = as<insn_binop>(in);
+         const auto lhs = ranges.at(binop->lhs(), bb), rhs = ranges.at(binop->rhs(), bb);
+         if (RSN_UNLIKELY(lhs.empty() || rhs.empty())) continue;
+         lib::smart_ptr<operand> res;
+         switch (binop->op) {
+         case insn_binop::_and: // the result is an operand whose possible one bits are known ones in the other
+            if (!(~lhs.zero & ~rhs.one)) res = binop->lhs(); else if (!(~rhs.zero & ~lhs.one)) res = binop->rhs();
+            break;
+         case insn_binop::_or:  // the result is an operand whose bits include all possible one bits of the other
+            if (!(~rhs.zero & ~lhs.one)) res = binop->lhs(); else if (!(~lhs.zero & ~rhs.one)) res = binop->rhs();
+            break;
+         case insn_binop::_urem:
+            if (lhs.hi < rhs.lo) res = binop->lhs();
+            break;
+         case insn_binop::_udiv:
+            if (lhs.hi < rhs.lo) res = abs::make(0);
+            break;
+         default:;
+         }
+         if (RSN_UNLIKELY(res)) insn_mov::make(in, std::move(res), std::move(binop->dest())), in->eliminate(), ++stats.vr_insns, changed = true;
+      } else
+      // conditional branches
+      if (is<insn_br>(in)) switch (ranges.decide(as<insn_br>(in))) {
+      case value_ranges::unknown:
+         break;
+      case value_ranges::taken_dest1:
+         decided.emplace_back(as<insn_br>(in), as<insn_br>(in)->dest2());
+         break;
+      case value_ranges::taken_dest2:
+         decided.emplace_back(as<insn_br>(in), as<insn_br>(in)->dest1());
+         break;
+      }
+   }
+
+   // Replace Decided Branches with Jumps //////////////////////////////////////////////////////////
+   if (RSN_LIKELY(decided.empty())) return changed;
+   for (const auto &[br, target]: decided)
+      insn_jmp::make(br, br->dest1() == target ? br->dest2() : br->dest1()), br->eliminate(), ++stats.vr_branches;
+   // whole regions may have become unreachable, so phi args are matched against the predecessors from a fresh CFG
+   const cfg_info _cfg(pc);
+   for (auto bb: _cfg.rpo) reorder_phi_args(bb, cfg.preds[bb->sn], _cfg.preds[bb->sn]);
+   return true;
+}
@@ -0,0 +1,157 @@
+// opt-reassoc.cc -- reassociation of commutative and associative operations
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "opt.hh"
+
+# include <algorithm> // adjacent_find, max, remove_if, stable_sort, unique
+
+/* An expression tree is made of binop insns with the same associative and commutative operation (add, umul, smul, and, or, and xor) in
+   the same BB, where each VR computed by an inner node is used only by its parent. Leaves are ranked: VRs defined by phi, entry, load, and
+   call insns get the rank of their BB in reverse postorder, other VRs get the rank of their highest-ranked input plus one, and immediate
+   operands come last. The tree is then rebuilt as a left-leaning chain, the lowest-ranked leaves first (so that loop invariants are
+   combined with each other before loop variants, and equal trees look the same to value numbering), with all absolute constants folded
+   into a single one at the root (for add, the constant is folded into a relocatable leaf if there is any). */
+bool rsn::opt::transform_reassociation(proc *pc) {
+   const cfg_info cfg(pc);
+   const auto vr_count = number_vregs(pc);
+   std::vector<insn *> def(vr_count), user(vr_count);
+   std::vector<signed char> def_count(vr_count), use_count(vr_count);
+   for (auto bb: cfg.bblocks) for (auto in = bb->head(); in; in = in->next()) {
+      for (const auto &input: in->inputs()) if (is<vreg>(input))
+         user[as<vreg>(input)->sn] = in, use_count[as<vreg>(input)->sn] += use_count[as<vreg>(input)->sn] < 2;
+      for (const auto &output: in->outputs()) def[output->sn] = in, def_count[output->sn] += def_count[output->sn] < 2;
+   }
+
+   const auto reassociable = [](insn *in) noexcept{
+      if (!is<insn_binop>(in)) return false;
+      switch (as<insn_binop>(in)->op) {
+      case insn_binop::_add: case insn_binop::_umul: case insn_binop::_smul: case insn_binop::_and: case insn_binop::_or: case insn_binop::_xor:
+         return true;
+      default:
+         return false;
+      }
+   };
+
+   // Rank VRs and Identify Inner Nodes of Expression Trees ////////////////////////////////////////
+   std::vector<unsigned long long> rank(vr_count);
+   std::vector<bool> inner(vr_count);
+   for (auto bb: cfg.rpo) {
+      const auto bb_rank = (unsigned long long)(cfg.rpo_num[bb->sn] + 1) << 16;
+      for (auto in = bb->head(); in; in = in->next()) {
+         unsigned long long in_rank = 0;
+         if (is<insn_binop>(in) || is<insn_mov>(in)) {
+            for (const auto &input: in->inputs()) if (is<vreg>(input)) in_rank = std::max(in_rank, rank[as<vreg>(input)->sn]);
+            in_rank += is<insn_binop>(in);
+         } else
+            in_rank = bb_rank;
+         for (const auto &output: in->outputs()) rank[output->sn] = in_rank;
+      }
+   }
+   for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) if (reassociable(in)) {
+      const auto sn = as<insn_binop>(in)->dest()->sn;
+      inner[sn] = def_count[sn] == 1 && use_count[sn] == 1 && reassociable(user[sn]) && as<insn_binop>(user[sn])->op == as<insn_binop>(in)->op &&
+         user[sn]->owner() == bb;
+   }
+
+   // Rebuild Expression Trees /////////////////////////////////////////////////////////////////////
+   bool changed{};
+   std::vector<insn_binop *> roots;
+   for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next())
+      if (reassociable(in) && !inner[as<insn_binop>(in)->dest()->sn]) roots.push_back(as<insn_binop>(in));
+
+   std::vector<lib::smart_ptr<operand>> leaves;
+   std::vector<insn_binop *> nodes;
+   for (const auto root: roots) {
+      const auto op = root->op;
+      leaves.clear(), nodes.clear();
+      const auto traverse = [&](auto &traverse, insn_binop *node)->void{
+         nodes.push_back(node);
+         for (const auto &input: node->inputs())
+         if (is<vreg>(input) && inner[as<vreg>(input)->sn])
+            traverse(traverse, as<insn_binop>(def[as<vreg>(input)->sn]));
+         else
+            leaves.push_back(input);
+      };
+      traverse(traverse, root);
+
+      // fold absolute constants
+      const unsigned long long identity = op == insn_binop::_umul || op == insn_binop::_smul ? 1 : op == insn_binop::_and ? ~0ull : 0;
+      auto val = identity;
+      for (const auto &leaf: leaves) if (is<abs>(leaf)) switch (const auto _val = as<abs>(leaf)->val; op) {
+      default:
+         RSN_UNREACHABLE();
+      case insn_binop::_add:  val += _val; break;
+      case insn_binop::_umul:
+      case insn_binop::_smul: val *= _val; break;
+      case insn_binop::_and:  val &= _val; break;
+      case insn_binop::_or:   val |= _val; break;
+      case insn_binop::_xor:  val ^= _val; break;
+      }
+      leaves.erase(std::remove_if(leaves.begin(), leaves.end(), [](const auto &leaf) noexcept{ return is<abs>(leaf); }), leaves.end());
+      if (op == insn_binop::_add && val) for (auto &leaf: leaves) if (is<rel_base>(leaf) || is<rel_disp>(leaf)) {
+         if (is<rel_base>(leaf))
+            leaf = rel_disp::make(as_smart<rel_base>(leaf), val);
+         else
+            leaf = as<rel_disp>(leaf)->add + val ? (lib::smart_ptr<operand>)rel_disp::make(as<rel_disp>(leaf)->base, as<rel_disp>(leaf)->add + val) :
+               (lib::smart_ptr<operand>)as<rel_disp>(leaf)->base;
+         val = 0;
+         break;
+      }
+
+      // order the leaves (VRs by rank, then relocatables), and cancel out repeated VRs where possible
+      std::stable_sort(leaves.begin(), leaves.end(), [&](const auto &lhs, const auto &rhs) noexcept{
+         if (!is<vreg>(lhs) || !is<vreg>(rhs)) return is<vreg>(lhs) && !is<vreg>(rhs);
+         return rank[as<vreg>(lhs)->sn] < rank[as<vreg>(rhs)->sn] ||
+                (rank[as<vreg>(lhs)->sn] == rank[as<vreg>(rhs)->sn] && as<vreg>(lhs)->sn < as<vreg>(rhs)->sn);
+      });
+      if (op == insn_binop::_and || op == insn_binop::_or) // x & x == x, x | x == x
+         leaves.erase(std::unique(leaves.begin(), leaves.end()), leaves.end());
+      else
+      if (op == insn_binop::_xor) // x ^ x == 0
+      for (auto it = leaves.begin(); (it = std::adjacent_find(it, leaves.end())) != leaves.end();)
+         it = leaves.erase(it, it + 2);
+      if ( ((op == insn_binop::_umul || op == insn_binop::_smul || op == insn_binop::_and) && val == 0) ||
+           (op == insn_binop::_or && val == ~0ull) ) // absorbing element
+         leaves.clear();
+      if (val != identity || leaves.empty()) leaves.push_back(abs::make(val));
+
+      // rebuild unless already in canonical form
+      const auto same = [](operand *lhs, operand *rhs) noexcept{
+         return lhs == rhs ||
+            (is<abs>(lhs) && is<abs>(rhs) && as<abs>(lhs)->val == as<abs>(rhs)->val) ||
+            (is<rel_disp>(lhs) && is<rel_disp>(rhs) && as<rel_disp>(lhs)->base->id == as<rel_disp>(rhs)->base->id &&
+             as<rel_disp>(lhs)->add == as<rel_disp>(rhs)->add);
+      };
+      if (leaves.size() == nodes.size() + 1) for (auto [node, sn] = std::pair{root, leaves.size() - 1};;) {
+         if (!same(node->rhs(), leaves[sn])) break;
+         if (--sn == 0) { if (same(node->lhs(), leaves[0])) goto next; break; }
+         if (!is<vreg>(node->lhs()) || !inner[as<vreg>(node->lhs())->sn]) break;
+         node = as<insn_binop>(def[as<vreg>(node->lhs())->sn]);
+      }
+      {  const auto dest = root->dest();
+         if (leaves.size() == 1)
+            insn_mov::make(root, std::move(leaves.front()), dest);
+         else {
+            auto res = std::move(leaves.front());
+            for (std::size_t sn = 1; sn < leaves.size(); ++sn) {
+               auto _res = sn == leaves.size() - 1 ? dest : vreg::make();
+               insn_binop::make(root, op, std::move(res), std::move(leaves[sn]), _res), res = std::move(_res);
+            }
+         }
+         for (auto node: nodes) node->eliminate();
+      }
+      ++stats.reassoc_trees, changed = true;
+   next:;
+   }
+   return changed;
+}
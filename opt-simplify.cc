@@ -11,9 +11,11 @@
    You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
 
 
-# include "ir.hh"
+# include "opt.hh"
+# include "pattern.hh"
 
-# include <limits> // numeric_limits
+# include <limits>  // numeric_limits
+# include <utility> // pair
 
 namespace rsn::opt {
    // Some absolute immediate operands to share
@@ -23,309 +25,279 @@ namespace rsn::opt {
       auto bb = RSN_LIKELY(in->owner()->next()) ? bblock::make(in->owner()->next()) : bblock::make(in->owner()->owner());
       for (auto _in: all(in, {})) _in->reattach(bb);
    }
-} // namespace rsn::opt
-
-
-namespace rsn::opt { static bool simplify(insn_binop *); bool rsn::opt::insn_binop::simplify() { return opt::simplify(this); } }
-
-RSN_INLINE static inline bool rsn::opt::simplify(insn_binop *insn) {
-   const auto eliminate = [insn]() noexcept RSN_INLINE -> void   { insn->eliminate(); };
-   const auto owner     = [insn]() noexcept RSN_INLINE -> auto   { return insn->owner(); };
-   const auto lhs       = [insn]() noexcept RSN_INLINE -> auto & { return insn->lhs(); };
-   const auto rhs       = [insn]() noexcept RSN_INLINE -> auto & { return insn->rhs(); };
-   const auto dest      = [insn]() noexcept RSN_INLINE -> auto & { return insn->dest(); };
 
-   bool changed{};
-   switch (insn->op) {
-   default:
-      RSN_UNREACHABLE();
-   case insn_binop::_add:
-      if (is<abs>(lhs())) {
-         if (!is<abs>(rhs())) // canonicalization
-            changed = (lhs().swap(rhs()), true);
-      } else
-      if (is<imm>(lhs()) && !is<imm>(rhs())) // canonicalization
-         return lhs().swap(rhs()), true;
-      if (is<abs>(rhs())) {
-         if (as<abs>(rhs())->val == 0) // algebraic simplification
-            return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-         if (is<abs>(lhs())) // constant folding
-            return insn_mov::make(insn, abs::make(as<abs>(lhs())->val + as<abs>(rhs())->val), std::move(dest())), eliminate(), true;
-         if (is<rel_base>(lhs())) // constant folding
-            return insn_mov::make(insn, rel_disp::make(as_smart<rel_base>(std::move(lhs())), +as<abs>(rhs())->val), std::move(dest())), eliminate(), true;
-         if (is<rel_disp>(lhs())) // constant folding
-            return insn_mov::make(insn, as<rel_disp>(lhs())->add + as<abs>(rhs())->val == 0 ? (lib::smart_ptr<operand>)as<rel_disp>(lhs())->base :
-               (lib::smart_ptr<operand>)rel_disp::make(as<rel_disp>(lhs())->base, as<rel_disp>(lhs())->add + as<abs>(rhs())->val), std::move(dest())),
-               eliminate(), true;
-      }
-      return changed;
-   case insn_binop::_sub:
-      if (lhs() == rhs()) // algebraic simplification
-         return insn_mov::make(insn, abs_0, std::move(dest())), eliminate(), true;
-      if (is<abs>(rhs())) {
-         if (as<abs>(rhs())->val == 0) // algebraic simplification
-            return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-         if (is<abs>(lhs())) // constant folding
-            return insn_mov::make(insn, abs::make(as<abs>(lhs())->val - as<abs>(rhs())->val), std::move(dest())), eliminate(), true;
-         if (is<rel_base>(lhs())) // constant folding
-            return insn_mov::make(insn, rel_disp::make(as_smart<rel_base>(std::move(lhs())), -as<abs>(rhs())->val), std::move(dest())), eliminate(), true;
-         if (is<rel_disp>(lhs())) // constant folding
-            return insn_mov::make(insn, as<rel_disp>(lhs())->add - as<abs>(rhs())->val == 0 ? (lib::smart_ptr<operand>)as<rel_disp>(lhs())->base :
-               (lib::smart_ptr<operand>)rel_disp::make(as<rel_disp>(lhs())->base, as<rel_disp>(lhs())->add - as<abs>(rhs())->val), std::move(dest())),
-               eliminate(), true;
-         // canonicalization
-         return insn_binop::make_add(insn, std::move(lhs()), abs::make(-as<abs>(rhs())->val), std::move(dest())), eliminate(), true;
+   /* Strength reduction of division by constants
+      References:
+      - Division by Invariant Integers using Multiplication by Torbjorn Granlund and Peter L. Montgomery
+      - Hacker's Delight by Henry S. Warren, Jr. (Chapter 10)
+      - libdivide by ridiculous_fish (the choice between the "add" and "no add" variants)
+   */
+   static unsigned long long div_pow2(unsigned shift, unsigned long long rhs, unsigned long long &rem) noexcept { // 2**(64 + shift) / rhs
+      unsigned long long hi = 1ull << shift, res = 0; // precondition: 1ull << shift < rhs
+      for (int sn = 0; sn < 64; ++sn) {
+         const bool carry = hi >> 63;
+         hi <<= 1, res <<= 1;
+         if (carry || hi >= rhs) hi -= rhs, res |= 1;
       }
-      if (is<rel_base>(lhs())) {
-         if (is<rel_base>(rhs())) {
-            if (as<rel_base>(lhs())->id == as<rel_base>(rhs())->id) // constant folding
-               return insn_mov::make(insn, abs_0, std::move(dest())), eliminate(), true;
-         } else
-         if (is<rel_disp>(rhs())) {
-            if (as<rel_base>(lhs())->id == as<rel_disp>(rhs())->base->id) // constant folding
-               return insn_mov::make(insn, abs::make(-as<rel_disp>(rhs())->add), std::move(dest())), eliminate(), true;
-         }
-      } else
-      if (is<rel_disp>(lhs())) {
-         if (is<rel_base>(rhs())) {
-            if (as<rel_disp>(lhs())->base->id == as<rel_base>(rhs())->id) // constant folding
-               return insn_mov::make(insn, abs::make(+as<rel_disp>(lhs())->add), std::move(dest())), eliminate(), true;
-         } else
-         if (is<rel_disp>(rhs())) {
-            if (as<rel_disp>(lhs())->base->id == as<rel_disp>(rhs())->base->id) // constant folding
-               return insn_mov::make(insn, abs::make(as<rel_disp>(lhs())->add - as<rel_disp>(rhs())->add), std::move(dest())), eliminate(), true;
-         }
-      }
-      return {};
-   case insn_binop::_umul:
-      if (is<abs>(lhs())) {
-         if (!is<abs>(rhs())) // canonicalization
-            changed = (lhs().swap(rhs()), true);
-      } else
-      if (is<imm>(lhs()) && !is<imm>(rhs())) // canonicalization
-         return lhs().swap(rhs()), true;
-      if (is<abs>(rhs())) {
-         if (as<abs>(rhs())->val == 1) // algebraic simplification
-            return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-         if (as<abs>(rhs())->val == 0) // algebraic simplification
-            return insn_mov::make(insn, std::move(rhs()), std::move(dest())), eliminate(), true;
-         if (is<abs>(lhs())) // constant folding
-            return insn_mov::make(insn, abs::make(as<abs>(lhs())->val * as<abs>(rhs())->val), std::move(dest())), eliminate(), true;
-      }
-      return changed;
-   case insn_binop::_udiv:
-      if (lhs() == rhs()) // algebraic simplification
-         return insn_oops::make(bblock::make(owner()->owner())),
-            split(insn), insn_br::make_bne(owner()->prev(), std::move(rhs()), abs_0, owner(), owner()->owner()->rear()),
-            insn_mov::make(insn, abs_1, std::move(dest())), eliminate(), true;
-      if (is<abs>(rhs())) {
-         if (!RSN_LIKELY(as<abs>(rhs())->val)) // x86 semantics
-            return insn_oops::make(insn), eliminate(), true;
-         if (as<abs>(rhs())->val == 1) // algebraic simplification
-            return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-         if (is<abs>(lhs())) // constant folding
-            return insn_mov::make(insn, abs::make(as<abs>(lhs())->val / as<abs>(rhs())->val), std::move(dest())), eliminate(), true;
-      }
-      if (is<abs>(lhs()) && as<abs>(lhs())->val == 0) // algebraic simplification
-         return insn_oops::make(bblock::make(owner()->owner())),
-            split(insn), insn_br::make_bne(owner()->prev(), std::move(rhs()), abs_0, owner(), owner()->owner()->rear()),
-            insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-      if ( is<rel_base>(lhs()) && is<rel_base>(rhs()) && as<rel_base>(lhs())->id == as<rel_base>(rhs())->id ||
-           is<rel_disp>(lhs()) && is<rel_disp>(rhs()) && as<rel_disp>(lhs())->base->id == as<rel_disp>(rhs())->base->id &&
-           as<rel_disp>(lhs())->add == as<rel_disp>(rhs())->add ) // algebraic simplification
-         return insn_oops::make(bblock::make(owner()->owner())),
-            split(insn), insn_br::make_bne(owner()->prev(), std::move(rhs()), abs_0, owner(), owner()->owner()->rear()),
-            insn_mov::make(insn, abs_1, std::move(dest())), eliminate(), true;
-      return {};
-   case insn_binop::_urem:
-      if (lhs() == rhs()) // algebraic simplification
-         return insn_oops::make(bblock::make(owner()->owner())),
-            split(insn), insn_br::make_bne(owner()->prev(), std::move(rhs()), abs_0, owner(), owner()->owner()->rear()),
-            insn_mov::make(insn, abs_0, std::move(dest())), eliminate(), true;
-      if (is<abs>(rhs())) {
-         if (!RSN_LIKELY(as<abs>(rhs())->val)) // x86 semantics
-            return insn_oops::make(insn), eliminate(), true;
-         if (as<abs>(rhs())->val == 1) // algebraic simplification
-            return insn_mov::make(insn, abs_0, std::move(dest())), eliminate(), true;
-         if (is<abs>(lhs())) // constant folding
-            return insn_mov::make(insn, abs::make(as<abs>(lhs())->val % as<abs>(rhs())->val), std::move(dest())), eliminate(), true;
-      }
-      if (is<abs>(lhs()) && as<abs>(lhs())->val == 0) // algebraic simplification
-         return insn_oops::make(bblock::make(owner()->owner())),
-            split(insn), insn_br::make_bne(owner()->prev(), std::move(rhs()), abs_0, owner(), owner()->owner()->rear()),
-            insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-      if ( is<rel_base>(lhs()) && is<rel_base>(rhs()) && as<rel_base>(lhs())->id == as<rel_base>(rhs())->id ||
-           is<rel_disp>(lhs()) && is<rel_disp>(rhs()) && as<rel_disp>(lhs())->base->id == as<rel_disp>(rhs())->base->id &&
-           as<rel_disp>(lhs())->add == as<rel_disp>(rhs())->add ) // algebraic simplification
-         return insn_oops::make(bblock::make(owner()->owner())),
-            split(insn), insn_br::make_bne(owner()->prev(), std::move(rhs()), abs_0, owner(), owner()->owner()->rear()),
-            insn_mov::make(insn, abs_0, std::move(dest())), eliminate(), true;
-      return {};
-   case insn_binop::_smul:
-      if (is<abs>(lhs())) {
-         if (!is<abs>(rhs())) // canonicalization
-            changed = (lhs().swap(rhs()), true);
-      } else
-      if (is<imm>(lhs()) && !is<imm>(rhs())) // canonicalization
-         return lhs().swap(rhs()), true;
-      if (is<abs>(rhs())) {
-         if (as<abs>(rhs())->val == 1) // algebraic simplification
-            return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-         if (as<abs>(rhs())->val == 0) // algebraic simplification
-            return insn_mov::make(insn, std::move(rhs()), std::move(dest())), eliminate(), true;
-         if (is<abs>(lhs())) // constant folding
-            return insn_mov::make(insn, abs::make((long long)as<abs>(lhs())->val * (long long)as<abs>(rhs())->val), std::move(dest())), eliminate(), true;
-      }
-      return changed;
-   case insn_binop::_sdiv:
-      if (lhs() == rhs()) // algebraic simplification
-         return insn_oops::make(bblock::make(owner()->owner())),
-            split(insn), insn_br::make_bne(owner()->prev(), std::move(rhs()), abs_0, owner(), owner()->owner()->rear()),
-            insn_mov::make(insn, abs_1, std::move(dest())), eliminate(), true;
-      if (is<abs>(rhs())) {
-         if (!RSN_LIKELY(as<abs>(rhs())->val)) // x86 semantics
-            return insn_oops::make(insn), eliminate(), true;
-         if (as<abs>(rhs())->val == 1) // algebraic simplification
-            return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-         if (is<abs>(lhs())) { // constant folding
-            if (RSN_UNLIKELY(as<abs>(lhs())->val == std::numeric_limits<long long>::min()) && RSN_UNLIKELY(as<abs>(rhs())->val == -1)) // x86 semantics
-               return insn_oops::make(insn), eliminate(), true;
-            return insn_mov::make(insn, abs::make((long long)as<abs>(lhs())->val / (long long)as<abs>(rhs())->val), std::move(dest())), eliminate(), true;
-         }
+      return rem = hi, res;
+   }
+   static void make_udiv(insn *next, lib::smart_ptr<operand> lhs, unsigned long long rhs, lib::smart_ptr<vreg> dest) { // rhs >= 2
+      const unsigned log2 = 63 - __builtin_clzll(rhs);
+      if (!(rhs & (rhs - 1))) { // power of 2
+         insn_binop::make_ushr(next, std::move(lhs), abs::make(log2), std::move(dest));
+         return;
       }
-      if (is<abs>(lhs()) && as<abs>(lhs())->val == 0) // algebraic simplification
-         return insn_oops::make(bblock::make(owner()->owner())),
-            split(insn), insn_br::make_bne(owner()->prev(), std::move(rhs()), abs_0, owner(), owner()->owner()->rear()),
-            insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-      if ( is<rel_base>(lhs()) && is<rel_base>(rhs()) && as<rel_base>(lhs())->id == as<rel_base>(rhs())->id ||
-           is<rel_disp>(lhs()) && is<rel_disp>(rhs()) && as<rel_disp>(lhs())->base->id == as<rel_disp>(rhs())->base->id &&
-           as<rel_disp>(lhs())->add == as<rel_disp>(rhs())->add ) // algebraic simplification
-         return insn_oops::make(bblock::make(owner()->owner())),
-            split(insn), insn_br::make_bne(owner()->prev(), std::move(rhs()), abs_0, owner(), owner()->owner()->rear()),
-            insn_mov::make(insn, abs_1, std::move(dest())), eliminate(), true;
-      return {};
-   case insn_binop::_srem:
-      if (lhs() == rhs()) // algebraic simplification
-         return insn_oops::make(bblock::make(owner()->owner())),
-            split(insn), insn_br::make_bne(owner()->prev(), std::move(rhs()), abs_0, owner(), owner()->owner()->rear()),
-            insn_mov::make(insn, abs_0, std::move(dest())), eliminate(), true;
-      if (is<abs>(rhs())) {
-         if (!RSN_LIKELY(as<abs>(rhs())->val)) // x86 semantics
-            return insn_oops::make(insn), eliminate(), true;
-         if (as<abs>(rhs())->val == 1) // algebraic simplification
-            return insn_mov::make(insn, abs_0, std::move(dest())), eliminate(), true;
-         if (is<abs>(lhs())) { // constant folding
-            if (RSN_UNLIKELY(as<abs>(lhs())->val == std::numeric_limits<long long>::min()) && RSN_UNLIKELY(as<abs>(rhs())->val == -1)) // x86 semantics
-               return insn_oops::make(insn), eliminate(), true;
-            return insn_mov::make(insn, abs::make((long long)as<abs>(lhs())->val % (long long)as<abs>(rhs())->val), std::move(dest())), eliminate(), true;
+      unsigned long long rem, magic = div_pow2(log2, rhs, rem);
+      if (rhs - rem < 1ull << log2) { // the magic number fits in 64 bits
+         auto hi = vreg::make();
+         insn_binop::make_umulh(next, lhs, abs::make(magic + 1), hi);
+         insn_binop::make_ushr(next, std::move(hi), abs::make(log2), std::move(dest));
+         return;
+      } // otherwise, the magic number is 2**64 + magic, and the high part is computed as hi + lhs without overflowing
+      magic += magic + (rem + rem >= rhs || rem + rem < rem);
+      auto hi = vreg::make(), diff = vreg::make(), half = vreg::make(), sum = vreg::make();
+      insn_binop::make_umulh(next, lhs, abs::make(magic + 1), hi);
+      insn_binop::make_sub(next, lhs, hi, diff);
+      insn_binop::make_ushr(next, std::move(diff), abs_1, half);
+      insn_binop::make_add(next, std::move(half), std::move(hi), sum);
+      insn_binop::make_ushr(next, std::move(sum), abs::make(log2), std::move(dest));
+   }
+   static void make_sdiv(insn *next, lib::smart_ptr<operand> lhs, unsigned long long rhs, lib::smart_ptr<vreg> dest) { // rhs != 0, 1, -1
+      const auto abs_rhs = (long long)rhs < 0 ? -rhs : rhs;
+      const unsigned log2 = 63 - __builtin_clzll(abs_rhs);
+      if (!(abs_rhs & (abs_rhs - 1))) { // power of 2 (round toward zero by biasing negative dividends)
+         auto sign = vreg::make(), bias = vreg::make(), sum = vreg::make(), quot = (long long)rhs < 0 ? vreg::make() : dest;
+         if (RSN_UNLIKELY(log2 == 1))
+            insn_binop::make_ushr(next, lhs, abs::make(63), bias);
+         else
+            insn_binop::make_sshr(next, lhs, abs::make(63), sign), insn_binop::make_ushr(next, std::move(sign), abs::make(64 - log2), bias);
+         insn_binop::make_add(next, std::move(lhs), std::move(bias), sum);
+         insn_binop::make_sshr(next, std::move(sum), abs::make(log2), quot);
+         if ((long long)rhs < 0) insn_binop::make_sub(next, abs_0, std::move(quot), std::move(dest));
+      } else { // a negative divisor comes with a negated magic number
+         unsigned long long rem, magic = div_pow2(log2 - 1, abs_rhs, rem);
+         const bool add = abs_rhs - rem >= 1ull << log2;
+         if (add) magic += magic + (rem + rem >= abs_rhs || rem + rem < rem);
+         auto hi = vreg::make(), shifted = vreg::make(), sign = vreg::make();
+         insn_binop::make_smulh(next, lhs, abs::make((long long)rhs < 0 ? -(magic + 1) : magic + 1), hi);
+         if (add) {
+            auto sum = vreg::make();
+            if ((long long)rhs < 0)
+               insn_binop::make_sub(next, std::move(hi), std::move(lhs), sum);
+            else
+               insn_binop::make_add(next, std::move(hi), std::move(lhs), sum);
+            hi = std::move(sum);
          }
+         insn_binop::make_sshr(next, std::move(hi), abs::make(add ? log2 : log2 - 1), shifted);
+         insn_binop::make_ushr(next, shifted, abs::make(63), sign);
+         insn_binop::make_add(next, std::move(shifted), std::move(sign), std::move(dest));
       }
-      if (is<abs>(lhs()) && as<abs>(lhs())->val == 0) // algebraic simplification
-         return insn_oops::make(bblock::make(owner()->owner())),
-            split(insn), insn_br::make_bne(owner()->prev(), std::move(rhs()), abs_0, owner(), owner()->owner()->rear()),
-            insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-      if ( is<rel_base>(lhs()) && is<rel_base>(rhs()) && as<rel_base>(lhs())->id == as<rel_base>(rhs())->id ||
-           is<rel_disp>(lhs()) && is<rel_disp>(rhs()) && as<rel_disp>(lhs())->base->id == as<rel_disp>(rhs())->base->id &&
-           as<rel_disp>(lhs())->add == as<rel_disp>(rhs())->add ) // algebraic simplification
-         return insn_oops::make(bblock::make(owner()->owner())),
-            split(insn), insn_br::make_bne(owner()->prev(), std::move(rhs()), abs_0, owner(), owner()->owner()->rear()),
-            insn_mov::make(insn, abs_0, std::move(dest())), eliminate(), true;
-      return {};
-   case insn_binop::_and:
-      if (lhs() == rhs()) // algebraic simplification
-         return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-      if (is<abs>(lhs())) {
-         if (!is<abs>(rhs())) // canonicalization
-            changed = (lhs().swap(rhs()), true);
-      } else
-      if (is<imm>(lhs()) && !is<imm>(rhs())) // canonicalization
-         return lhs().swap(rhs()), true;
-      if (is<abs>(rhs())) {
-         if (as<abs>(rhs())->val == ~0ull) // algebraic simplification
-            return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-         if (as<abs>(rhs())->val == +0ull) // algebraic simplification
-            return insn_mov::make(insn, std::move(rhs()), std::move(dest())), eliminate(), true;
-         if (is<abs>(lhs())) // constant folding
-            return insn_mov::make(insn, abs::make(as<abs>(lhs())->val & as<abs>(rhs())->val), std::move(dest())), eliminate(), true;
-      } else
-      if ( is<rel_base>(lhs()) && is<rel_base>(rhs()) && as<rel_base>(lhs())->id == as<rel_base>(rhs())->id ||
-           is<rel_disp>(lhs()) && is<rel_disp>(rhs()) && as<rel_disp>(lhs())->base->id == as<rel_disp>(rhs())->base->id &&
-           as<rel_disp>(lhs())->add == as<rel_disp>(rhs())->add ) // algebraic simplification
-         return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-      return changed;
-   case insn_binop::_or:
-      if (lhs() == rhs()) // algebraic simplification
-         return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-      if (is<abs>(lhs())) {
-         if (!is<abs>(rhs())) // canonicalization
-            changed = (lhs().swap(rhs()), true);
-      } else
-      if (is<imm>(lhs()) && !is<imm>(rhs())) // canonicalization
-         return lhs().swap(rhs()), true;
-      if (is<abs>(rhs())) {
-         if (as<abs>(rhs())->val == +0ull) // algebraic simplification
-            return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-         if (as<abs>(rhs())->val == ~0ull) // algebraic simplification
-            return insn_mov::make(insn, std::move(rhs()), std::move(dest())), eliminate(), true;
-         if (is<abs>(lhs())) // constant folding
-            return insn_mov::make(insn, abs::make(as<abs>(lhs())->val | as<abs>(rhs())->val), std::move(dest())), eliminate(), true;
-      } else
-      if ( is<rel_base>(lhs()) && is<rel_base>(rhs()) && as<rel_base>(lhs())->id == as<rel_base>(rhs())->id ||
-           is<rel_disp>(lhs()) && is<rel_disp>(rhs()) && as<rel_disp>(lhs())->base->id == as<rel_disp>(rhs())->base->id &&
-           as<rel_disp>(lhs())->add == as<rel_disp>(rhs())->add ) // algebraic simplification
-         return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-      return changed;
-   case insn_binop::_xor:
-      if (lhs() == rhs()) // algebraic simplification
-         return insn_mov::make(insn, abs_0, std::move(dest())), eliminate(), true;
-      if (is<abs>(lhs())) {
-         if (!is<abs>(rhs())) // canonicalization
-            changed = (lhs().swap(rhs()), true);
-      } else
-      if (is<imm>(lhs()) && !is<imm>(rhs())) // canonicalization
-         return lhs().swap(rhs()), true;
-      if (is<abs>(rhs())) {
-         if (as<abs>(rhs())->val == +0ull) // algebraic simplification
-            return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-         if (is<abs>(lhs())) // constant folding
-            return insn_mov::make(insn, abs::make(as<abs>(lhs())->val ^ as<abs>(rhs())->val), std::move(dest())), eliminate(), true;
-      } else
-      if ( is<rel_base>(lhs()) && is<rel_base>(rhs()) && as<rel_base>(lhs())->id == as<rel_base>(rhs())->id ||
-           is<rel_disp>(lhs()) && is<rel_disp>(rhs()) && as<rel_disp>(lhs())->base->id == as<rel_disp>(rhs())->base->id &&
-           as<rel_disp>(lhs())->add == as<rel_disp>(rhs())->add ) // algebraic simplification
-         return insn_mov::make(insn, abs_0, std::move(dest())), eliminate(), true;
-      return changed;
-   case insn_binop::_shl:
-      if (is<abs>(rhs())) {
-         if ((as<abs>(rhs())->val & 0x3F) == 0) // algebraic simplification (x86 semantics)
-            return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-         if (is<abs>(lhs())) // constant folding (x86 semantics)
-            return insn_mov::make(insn, abs::make(as<abs>(lhs())->val << (as<abs>(rhs())->val & 0x3F)), std::move(dest())), eliminate(), true;
-      }
-      if (is<abs>(lhs()) && as<abs>(lhs())->val == 0) // algebraic simplification
-         return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-      return {};
-   case insn_binop::_ushr:
-      if (is<abs>(rhs())) {
-         if ((as<abs>(rhs())->val & 0x3F) == 0) // algebraic simplification (x86 semantics)
-            return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-         if (is<abs>(lhs())) // constant folding (x86 semantics)
-            return insn_mov::make(insn, abs::make(as<abs>(lhs())->val >> (as<abs>(rhs())->val & 0x3F)), std::move(dest())), eliminate(), true;
-      }
-      if (is<abs>(lhs()) && as<abs>(lhs())->val == 0) // algebraic simplification
-         return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-      return {};
-   case insn_binop::_sshr:
-      if (is<abs>(rhs())) {
-         if ((as<abs>(rhs())->val & 0x3F) == 0) // algebraic simplification (x86 semantics)
-            return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-         if (is<abs>(lhs())) // constant folding (x86 semantics)
-            return insn_mov::make(insn, abs::make((long long)as<abs>(lhs())->val >> (as<abs>(rhs())->val & 0x3F)), std::move(dest())), eliminate(), true;
+   }
+} // namespace rsn::opt
+
+
+namespace rsn::opt { static bool simplify(insn_binop *); bool rsn::opt::insn_binop::simplify() { return opt::simplify(this); } }
+
+// Rewrites for insn_binop (each one replaces the insn and returns true)
+namespace rsn::opt::binop {
+   static unsigned long long fold(decltype(insn_binop::op) op, unsigned long long lhs, unsigned long long rhs) noexcept { // w/o trapping cases
+      switch (op) {
+      default: RSN_UNREACHABLE();
+      case insn_binop::_add:   return lhs + rhs;
+      case insn_binop::_sub:   return lhs - rhs;
+      case insn_binop::_umul:  return lhs * rhs;
+      case insn_binop::_udiv:  return lhs / rhs;
+      case insn_binop::_urem:  return lhs % rhs;
+      case insn_binop::_smul:  return (long long)lhs * (long long)rhs;
+      case insn_binop::_sdiv:  return (long long)lhs / (long long)rhs;
+      case insn_binop::_srem:  return (long long)lhs % (long long)rhs;
+      case insn_binop::_and:   return lhs & rhs;
+      case insn_binop::_or:    return lhs | rhs;
+      case insn_binop::_xor:   return lhs ^ rhs;
+      case insn_binop::_shl:   return lhs << (rhs & 0x3F); // x86 semantics
+      case insn_binop::_ushr:  return lhs >> (rhs & 0x3F); // ditto
+      case insn_binop::_sshr:  return (long long)lhs >> (rhs & 0x3F); // ditto
+      case insn_binop::_umulh: return umulh(lhs, rhs);
+      case insn_binop::_smulh: return smulh(lhs, rhs);
       }
-      if (is<abs>(lhs()) && as<abs>(lhs())->val == 0) // algebraic simplification
-         return insn_mov::make(insn, std::move(lhs()), std::move(dest())), eliminate(), true;
-      return {};
    }
+   static bool mov_lhs(insn_binop *in) { return insn_mov::make(in, std::move(in->lhs()), std::move(in->dest())), in->eliminate(), true; }
+   static bool mov_rhs(insn_binop *in) { return insn_mov::make(in, std::move(in->rhs()), std::move(in->dest())), in->eliminate(), true; }
+   static bool mov_0(insn_binop *in) { return insn_mov::make(in, abs_0, std::move(in->dest())), in->eliminate(), true; }
+   static bool mov_1(insn_binop *in) { return insn_mov::make(in, abs_1, std::move(in->dest())), in->eliminate(), true; }
+   static bool mov_fold(insn_binop *in) {
+      return insn_mov::make(in, abs::make(fold(in->op, as<abs>(in->lhs())->val, as<abs>(in->rhs())->val)), std::move(in->dest())), in->eliminate(), true;
+   }
+   static bool oops(insn_binop *in) { return insn_oops::make(in), in->eliminate(), true; }
+   static bool swap(insn_binop *in) { return in->lhs().swap(in->rhs()), true; }
+   static bool swap_and_retry(insn_binop *in) { return in->lhs().swap(in->rhs()), simplify(in), true; }
+   // trap on a zero divisor in a new BB (splitting the current one) and proceed with the result of Then
+   template<bool (*Then)(insn_binop *)> static bool guard_nonzero(insn_binop *in) {
+      insn_oops::make(bblock::make(in->owner()->owner()));
+      split(in);
+      insn_br::make_bne(in->owner()->prev(), std::move(in->rhs()), abs_0, in->owner(), in->owner()->owner()->rear());
+      return Then(in);
+   }
+   static bool displace(insn_binop *in) { // rel_base or rel_disp plus or minus abs
+      const auto rhs = in->op == insn_binop::_add ? +as<abs>(in->rhs())->val : -as<abs>(in->rhs())->val;
+      if (is<rel_base>(in->lhs()))
+         return insn_mov::make(in, rel_disp::make(as_smart<rel_base>(std::move(in->lhs())), rhs), std::move(in->dest())), in->eliminate(), true;
+      const auto lhs = as<rel_disp>(in->lhs());
+      return insn_mov::make(in, lhs->add + rhs == 0 ? (lib::smart_ptr<operand>)lhs->base :
+         (lib::smart_ptr<operand>)rel_disp::make(lhs->base, lhs->add + rhs), std::move(in->dest())), in->eliminate(), true;
+   }
+   static bool distance(insn_binop *in) { // between relocatables with the same symbol
+      const auto add = [](operand *op) noexcept{ return is<rel_disp>(op) ? as<rel_disp>(op)->add : 0; };
+      return insn_mov::make(in, abs::make(add(in->lhs()) - add(in->rhs())), std::move(in->dest())), in->eliminate(), true;
+   }
+   static bool add_neg(insn_binop *in) {
+      return insn_binop::make_add(in, std::move(in->lhs()), abs::make(-as<abs>(in->rhs())->val), std::move(in->dest())), in->eliminate(), true;
+   }
+   static bool sign(insn_binop *in) { return insn_binop::make_sshr(in, std::move(in->lhs()), abs::make(63), std::move(in->dest())), in->eliminate(), true; }
+   static bool mask(insn_binop *in) {
+      return insn_binop::make_and(in, std::move(in->lhs()), abs::make(as<abs>(in->rhs())->val - 1), std::move(in->dest())), in->eliminate(), true;
+   }
+   static bool sdiv_fold(insn_binop *in) {
+      if (RSN_UNLIKELY(as<abs>(in->lhs())->val == (unsigned long long)std::numeric_limits<long long>::min()) &&
+         RSN_UNLIKELY(as<abs>(in->rhs())->val == -1ull)) // x86 semantics
+         return oops(in);
+      return mov_fold(in);
+   }
+   static bool udiv_const(insn_binop *in) { return make_udiv(in, std::move(in->lhs()), as<abs>(in->rhs())->val, std::move(in->dest())), in->eliminate(), true; }
+   static bool sdiv_const(insn_binop *in) { return make_sdiv(in, std::move(in->lhs()), as<abs>(in->rhs())->val, std::move(in->dest())), in->eliminate(), true; }
+   static bool urem_const(insn_binop *in) {
+      auto quot = vreg::make(), prod = vreg::make();
+      make_udiv(in, in->lhs(), as<abs>(in->rhs())->val, quot);
+      insn_binop::make_umul(in, std::move(quot), std::move(in->rhs()), prod);
+      return insn_binop::make_sub(in, std::move(in->lhs()), std::move(prod), std::move(in->dest())), in->eliminate(), true;
+   }
+   static bool srem_const(insn_binop *in) { // the remainder has the sign of the dividend
+      auto quot = vreg::make(), prod = vreg::make();
+      make_sdiv(in, in->lhs(), as<abs>(in->rhs())->val, quot);
+      insn_binop::make_smul(in, std::move(quot), std::move(in->rhs()), prod);
+      return insn_binop::make_sub(in, std::move(in->lhs()), std::move(prod), std::move(in->dest())), in->eliminate(), true;
+   }
+
+   static bool pow2(unsigned long long val) noexcept { return !(val & (val - 1)); }
+   static bool not_minus_1(unsigned long long val) noexcept { return val != -1ull; }
+   static bool at_most_1(unsigned long long val) noexcept { return val <= 1; }
+   static bool no_shift(unsigned long long val) noexcept { return (val & 0x3F) == 0; } // x86 semantics
+
+   using namespace pattern;
+   // canonicalization for commutative operations: absolute values go right, and then other immediate values go right
+   template<typename... Rules> using commutative = rules<
+      rule<m_abs, m_not_abs, swap_and_retry>,
+      rule<m_rel, m_reg, swap>,
+      Rules... >;
+   using add_rules = commutative<
+      rule<m_any,      m_abs_val<0>, mov_lhs>,    // algebraic simplification
+      rule<m_abs,      m_abs,        mov_fold>,   // constant folding
+      rule<m_rel,      m_abs,        displace> >; // constant folding
+   using sub_rules = rules<
+      rule<m_any,      m_any,        mov_0,    same_operand>,        // algebraic simplification
+      rule<m_any,      m_abs_val<0>, mov_lhs>,                       // algebraic simplification
+      rule<m_abs,      m_abs,        mov_fold>,                      // constant folding
+      rule<m_rel,      m_abs,        displace>,                      // constant folding
+      rule<m_reg,      m_abs,        add_neg>,                       // canonicalization
+      rule<m_rel,      m_rel,        distance, same_symbol<false>> >; // constant folding
+   using umul_rules = commutative<
+      rule<m_any,      m_abs_val<1>, mov_lhs>,    // algebraic simplification
+      rule<m_any,      m_abs_val<0>, mov_rhs>,    // algebraic simplification
+      rule<m_abs,      m_abs,        mov_fold> >; // constant folding
+   using smul_rules = umul_rules;
+   using udiv_rules = rules<
+      rule<m_any,          m_any,        guard_nonzero<mov_1>, same_operand>,        // algebraic simplification
+      rule<m_any,          m_abs_val<0>, oops>,                                      // x86 semantics
+      rule<m_any,          m_abs_val<1>, mov_lhs>,                                   // algebraic simplification
+      rule<m_abs,          m_abs,        mov_fold>,                                  // constant folding
+      rule<m_any,          m_abs,        udiv_const>,                                // strength reduction
+      rule<m_abs_val<0>,   m_any,        guard_nonzero<mov_lhs>>,                    // algebraic simplification
+      rule<m_rel_base,     m_rel_base,   guard_nonzero<mov_1>, same_symbol<true>>,   // algebraic simplification
+      rule<m_rel_disp,     m_rel_disp,   guard_nonzero<mov_1>, same_symbol<true>> >; // algebraic simplification
+   using urem_rules = rules<
+      rule<m_any,          m_any,        guard_nonzero<mov_0>, same_operand>,        // algebraic simplification
+      rule<m_any,          m_abs_val<0>, oops>,                                      // x86 semantics
+      rule<m_any,          m_abs_val<1>, mov_0>,                                     // algebraic simplification
+      rule<m_abs,          m_abs,        mov_fold>,                                  // constant folding
+      rule<m_any,          m_abs_if<pow2>, mask>,                                    // strength reduction
+      rule<m_any,          m_abs,        urem_const>,                                // strength reduction
+      rule<m_abs_val<0>,   m_any,        guard_nonzero<mov_lhs>>,                    // algebraic simplification
+      rule<m_rel_base,     m_rel_base,   guard_nonzero<mov_0>, same_symbol<true>>,   // algebraic simplification
+      rule<m_rel_disp,     m_rel_disp,   guard_nonzero<mov_0>, same_symbol<true>> >; // algebraic simplification
+   using sdiv_rules = rules<
+      rule<m_any,          m_any,        guard_nonzero<mov_1>, same_operand>,        // algebraic simplification
+      rule<m_any,          m_abs_val<0>, oops>,                                      // x86 semantics
+      rule<m_any,          m_abs_val<1>, mov_lhs>,                                   // algebraic simplification
+      rule<m_abs,          m_abs,        sdiv_fold>,                                 // constant folding
+      rule<m_any,          m_abs_if<not_minus_1>, sdiv_const>,                       // strength reduction (dividing by -1 may trap)
+      rule<m_abs_val<0>,   m_any,        guard_nonzero<mov_lhs>>,                    // algebraic simplification
+      rule<m_rel_base,     m_rel_base,   guard_nonzero<mov_1>, same_symbol<true>>,   // algebraic simplification
+      rule<m_rel_disp,     m_rel_disp,   guard_nonzero<mov_1>, same_symbol<true>> >; // algebraic simplification
+   using srem_rules = rules<
+      rule<m_any,          m_any,        guard_nonzero<mov_0>, same_operand>,        // algebraic simplification
+      rule<m_any,          m_abs_val<0>, oops>,                                      // x86 semantics
+      rule<m_any,          m_abs_val<1>, mov_0>,                                     // algebraic simplification
+      rule<m_abs,          m_abs,        sdiv_fold>,                                 // constant folding
+      rule<m_any,          m_abs_if<not_minus_1>, srem_const>,                       // strength reduction
+      rule<m_abs_val<0>,   m_any,        guard_nonzero<mov_lhs>>,                    // algebraic simplification
+      rule<m_rel_base,     m_rel_base,   guard_nonzero<mov_0>, same_symbol<true>>,   // algebraic simplification
+      rule<m_rel_disp,     m_rel_disp,   guard_nonzero<mov_0>, same_symbol<true>> >; // algebraic simplification
+   using and_rules = rules<
+      rule<m_any,      m_any,          mov_lhs, same_operand>,       // algebraic simplification
+      rule<m_abs,      m_not_abs,      swap_and_retry>,              // canonicalization
+      rule<m_rel,      m_reg,          swap>,                        // canonicalization
+      rule<m_any,      m_abs_val<~0ull>, mov_lhs>,                   // algebraic simplification
+      rule<m_any,      m_abs_val<0>,   mov_rhs>,                     // algebraic simplification
+      rule<m_abs,      m_abs,          mov_fold>,                    // constant folding
+      rule<m_rel_base, m_rel_base,     mov_lhs, same_symbol<true>>,  // algebraic simplification
+      rule<m_rel_disp, m_rel_disp,     mov_lhs, same_symbol<true>> >; // algebraic simplification
+   using or_rules = rules<
+      rule<m_any,      m_any,          mov_lhs, same_operand>,       // algebraic simplification
+      rule<m_abs,      m_not_abs,      swap_and_retry>,              // canonicalization
+      rule<m_rel,      m_reg,          swap>,                        // canonicalization
+      rule<m_any,      m_abs_val<0>,   mov_lhs>,                     // algebraic simplification
+      rule<m_any,      m_abs_val<~0ull>, mov_rhs>,                   // algebraic simplification
+      rule<m_abs,      m_abs,          mov_fold>,                    // constant folding
+      rule<m_rel_base, m_rel_base,     mov_lhs, same_symbol<true>>,  // algebraic simplification
+      rule<m_rel_disp, m_rel_disp,     mov_lhs, same_symbol<true>> >; // algebraic simplification
+   using xor_rules = rules<
+      rule<m_any,      m_any,          mov_0, same_operand>,         // algebraic simplification
+      rule<m_abs,      m_not_abs,      swap_and_retry>,              // canonicalization
+      rule<m_rel,      m_reg,          swap>,                        // canonicalization
+      rule<m_any,      m_abs_val<0>,   mov_lhs>,                     // algebraic simplification
+      rule<m_abs,      m_abs,          mov_fold>,                    // constant folding
+      rule<m_rel_base, m_rel_base,     mov_0, same_symbol<true>>,    // algebraic simplification
+      rule<m_rel_disp, m_rel_disp,     mov_0, same_symbol<true>> >;  // algebraic simplification
+   using shift_rules = rules<
+      rule<m_any,          m_abs_if<no_shift>, mov_lhs>, // algebraic simplification
+      rule<m_abs,          m_abs,              mov_fold>, // constant folding
+      rule<m_abs_val<0>,   m_any,              mov_lhs> >; // algebraic simplification
+   using umulh_rules = commutative<
+      rule<m_any,      m_abs_if<at_most_1>, mov_0>,    // algebraic simplification
+      rule<m_abs,      m_abs,               mov_fold> >; // constant folding
+   using smulh_rules = commutative<
+      rule<m_any,      m_abs_val<0>, mov_rhs>,    // algebraic simplification
+      rule<m_any,      m_abs_val<1>, sign>,       // algebraic simplification
+      rule<m_abs,      m_abs,        mov_fold> >; // constant folding
+} // namespace rsn::opt::binop
+
+RSN_INLINE static inline bool rsn::opt::simplify(insn_binop *insn) {
+   using namespace binop;
+   using dispatch = pattern::switch_<add_rules, sub_rules, umul_rules, udiv_rules, urem_rules, smul_rules, sdiv_rules, srem_rules,
+      and_rules, or_rules, xor_rules, shift_rules, shift_rules, shift_rules, umulh_rules, smulh_rules>; // in the order of insn_binop::op
+   return dispatch::apply(insn, insn->op);
+}
+
+namespace rsn::opt { static bool simplify(insn_load *); bool insn_load::simplify() { return opt::simplify(this); } }
+
+RSN_INLINE static inline bool rsn::opt::simplify(insn_load *in) {
+   // constant folding (static data blocks are immutable; only whole aligned words are resolved, and out-of-bounds accesses are left alone)
+   const data *block; unsigned long long add;
+   if (is<data>(in->src())) block = as<data>(in->src()), add = 0; else
+   if (is<rel_disp>(in->src()) && is<data>(as<rel_disp>(in->src())->base)) block = as<data>(as<rel_disp>(in->src())->base), add = as<rel_disp>(in->src())->add;
+   else return {};
+   if (RSN_UNLIKELY(add % 8) || RSN_UNLIKELY(add / 8 >= block->values.size())) return {};
+   return insn_mov::make(in, block->values[add / 8], std::move(in->dest())), in->eliminate(), true;
 }
 
 namespace rsn::opt { static bool simplify(insn_br *); bool insn_br::simplify() { return opt::simplify(this); } }
@@ -360,12 +332,43 @@ RSN_INLINE static inline bool rsn::opt::simplify(insn_br *in) {
    }
 }
 
+namespace rsn::opt { static bool simplify(insn_select *); bool insn_select::simplify() { return opt::simplify(this); } }
+
+RSN_INLINE static inline bool rsn::opt::simplify(insn_select *in) {
+   decltype(auto) lhs = in->lhs(), rhs = in->rhs();
+   decltype(auto) val1 = in->val1(), val2 = in->val2();
+   const auto select = [in](lib::smart_ptr<operand> &val)RSN_INLINE{ return insn_mov::make(in, std::move(val), std::move(in->dest())), in->eliminate(), true; };
+   if (val1 == val2 || (is<abs>(val1) && is<abs>(val2) && as<abs>(val1)->val == as<abs>(val2)->val)) // either way the same
+      return select(val1);
+   switch (in->op) {
+   default:
+      RSN_UNREACHABLE();
+   case insn_select::_eq:
+      if (lhs == rhs) return select(val1);
+      if (is<abs>(lhs) && is<abs>(rhs)) // constant folding
+         return select(as<abs>(lhs)->val == as<abs>(rhs)->val ? val1 : val2);
+      if (is<imm>(lhs) && !is<imm>(rhs)) // canonicalization
+         return lhs.swap(rhs), true;
+      return {};
+   case insn_select::_ult:
+      if (lhs == rhs || (is<abs>(rhs) && as<abs>(rhs)->val == 0)) return select(val2);
+      if (is<abs>(lhs) && is<abs>(rhs)) // constant folding
+         return select(as<abs>(lhs)->val < as<abs>(rhs)->val ? val1 : val2);
+      return {};
+   case insn_select::_slt:
+      if (lhs == rhs) return select(val2);
+      if (is<abs>(lhs) && is<abs>(rhs)) // constant folding
+         return select((long long)as<abs>(lhs)->val < (long long)as<abs>(rhs)->val ? val1 : val2);
+      return {};
+   }
+}
+
 namespace rsn::opt { static bool simplify(insn_switch_br *); bool insn_switch_br::simplify() { return opt::simplify(this); } }
 
 RSN_INLINE static inline bool rsn::opt::simplify(insn_switch_br *in) {
    if (!is<abs>(in->index())) return {};
    // constant folding
-   if (RSN_UNLIKELY(as<abs>(in->index())->val >= in->dests().size())) insn_oops::make(in), in->eliminate(), true;
+   if (RSN_UNLIKELY(as<abs>(in->index())->val >= in->dests().size())) return insn_oops::make(in), in->eliminate(), true;
    return insn_jmp::make(in, in->dests()[as<abs>(in->index())->val]), in->eliminate(), true;
 }
 
@@ -383,25 +386,36 @@ RSN_INLINE inline bool rsn::opt::simplify(insn_call *insn) {
 
    if (RSN_LIKELY(!is<proc>(dest()))) return false;
    auto pc = as<proc>(dest());
+   if (RSN_UNLIKELY(pc == owner()->owner())) return false; // recursion (the callee would grow while being integrated)
 
    // temporary mappings
    auto bbmap = [&]() RSN_INLINE{
       std::vector<bblock *>::size_type count = 0;
-      for (auto bb = pc->head(); bb; bb = bb->next()) ++count;
+      for (auto bb = pc->head(); bb; bb = bb->next()) bb->sn = count++; // the callee might have changed since it was last numbered
       std::vector<bblock *> res(count);
       return res;
    }();
    auto vrmap = [&]() RSN_INLINE{
-      std::vector<lib::smart_ptr<vreg>>::size_type count = 0;
-      for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) {
-         for (auto &input: in->inputs()) if (is<vreg>(input)) if (RSN_UNLIKELY(as<vreg>(input)->sn >= count)) count = as<vreg>(input)->sn + 1;
-         for (auto &output: in->outputs()) if (RSN_UNLIKELY(output->sn >= count)) count = output->sn + 1;
-      }
-      std::vector<lib::smart_ptr<vreg>> res(count);
+      std::vector<lib::smart_ptr<vreg>>::size_type count = number_vregs(pc); // likewise
+      std::vector<lib::smart_ptr<vreg>> res; res.reserve(count);
       for (; count; --count) res.push_back(vreg::make());
       return res;
    }();
 
+   // in SSA form (no VR defined twice in the caller and the callee), each insn_ret of several ones defines its own copies of the results (to be
+   // merged by an SSA repair below), and otherwise the results just get several definitions
+   const bool ssa = [&]() RSN_INLINE{
+      std::size_t ret_count = 0;
+      for (auto bb = pc->head(); bb; bb = bb->next()) ret_count += is<insn_ret>(bb->rear());
+      if (RSN_LIKELY(ret_count < 2)) return false;
+      for (auto _pc: {owner()->owner(), pc}) {
+         std::vector<signed char> defined(number_vregs(_pc));
+         for (auto bb = _pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next())
+         for (const auto &output: in->outputs()) if (RSN_UNLIKELY(defined[output->sn])) return false; else defined[output->sn] = true;
+      }
+      return true;
+   }();
+
    // integrate and expand the insn_entry
    if (RSN_UNLIKELY(as<insn_entry>(pc->head()->head())->params().size() != params().size()))
       insn_oops::make(insn);
@@ -439,6 +453,7 @@ RSN_INLINE inline bool rsn::opt::simplify(insn_call *insn) {
          }
       }
 
+      std::vector<std::pair<bblock *, std::vector<lib::smart_ptr<vreg>>>> rets;
       for (auto bb = pc->head(); bb; bb = bb->next())
       if (RSN_LIKELY(!is<insn_ret>(bbmap[bb->sn]->rear())))
          // fixup jump targets
@@ -447,12 +462,31 @@ RSN_INLINE inline bool rsn::opt::simplify(insn_call *insn) {
          // expand an insn_ret
          if (RSN_UNLIKELY(as<insn_ret>(bbmap[bb->sn]->rear())->results().size() != results().size()))
             insn_oops::make(bbmap[bb->sn]->rear());
-         else
-         for (std::size_t sn = 0; sn < results().size(); ++sn)
-            insn_mov::make(bbmap[bb->sn]->rear(), std::move(as<insn_ret>(bbmap[bb->sn]->rear())->results()[sn]), results()[sn]);
+         else {
+            if (RSN_UNLIKELY(ssa)) rets.emplace_back(bbmap[bb->sn], std::vector<lib::smart_ptr<vreg>>{});
+            for (std::size_t sn = 0; sn < results().size(); ++sn) {
+               lib::smart_ptr<vreg> res = results()[sn];
+               if (RSN_UNLIKELY(ssa)) rets.back().second.push_back(res = vreg::make());
+               insn_mov::make(bbmap[bb->sn]->rear(), std::move(as<insn_ret>(bbmap[bb->sn]->rear())->results()[sn]), std::move(res));
+            }
+         }
          insn_jmp::make(bbmap[bb->sn]->rear(), owner());
          bbmap[bb->sn]->rear()->eliminate();
       }
+
+      if (RSN_UNLIKELY(!rets.empty())) {
+         // restore single definitions
+         const std::vector<lib::smart_ptr<vreg>> vars(results().begin(), results().end());
+         const auto caller = owner()->owner();
+         eliminate();
+         ssa_updater up(caller);
+         for (std::size_t sn = 0; sn < vars.size(); ++sn) {
+            up.reset();
+            for (const auto &ret: rets) up.add_def(ret.first, ret.second[sn]);
+            up.rewrite_uses(vars[sn]);
+         }
+         return true;
+      }
    }
 
    return eliminate(), true;
@@ -0,0 +1,239 @@
+// opt-slp.cc -- superword-level parallelism (SLP) vectorization
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "opt.hh"
+
+# include <algorithm>     // all_of, find, find_if, max, min_element, sort
+# include <type_traits>   // remove_const_t
+# include <unordered_map> // unordered_map
+
+/* References:
+   - Exploiting Superword Level Parallelism with Multimedia Instruction Sets by Samuel Larsen and Saman Amarasinghe
+   - The SLP vectorizer in LLVM (llvm/Transforms/Vectorize/SLPVectorizer.cpp)
+
+   Seeds are groups of scalar stores in a BB to adjacent words relative to the same root (as decomposed by the alias oracle), with as many
+   stores as there are lanes (or half as many, and so on down to two). From the stored values, a tree of packs is grown bottom-up: a pack
+   of binop insns with the same operation (with operands of commutative operations swapped to match where needed) has packs of their
+   operands below it, a pack of loads from adjacent words is a leaf, and so is a pack of the same value in all lanes (to be broadcast).
+   Anything else fails the tree. The vector insns are emitted before the last store of the group, which is where the stores are sunk and
+   the loads are delayed to, so no other access in between may alias them. The scalar insns of the tree that are still used elsewhere stay,
+   and count against the profitability of the tree, which is vectorized when the vector insns (with broadcasts and remaining scalar
+   insns) cost less than the scalar insns they replace. */
+bool rsn::opt::transform_slp_vectorization(proc *pc, const slp_params &params) {
+   bool changed{};
+restart:
+   const auto vr_count = number_vregs(pc);
+   std::vector<insn *> def(vr_count);
+   std::vector<signed char> def_count(vr_count);
+   std::vector<std::size_t> use_count(vr_count);
+   for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) {
+      for (const auto &input: in->inputs()) if (is<vreg>(input)) ++use_count[as<vreg>(input)->sn];
+      for (const auto &output: in->outputs()) def[output->sn] = in, def_count[output->sn] += def_count[output->sn] < 2;
+   }
+   const alias_oracle oracle(pc);
+   const auto same_root = [](operand *lhs, operand *rhs) noexcept{
+      return lhs == rhs || (lhs && rhs && is<rel_base>(lhs) && is<rel_base>(rhs) && as<rel_base>(lhs)->id == as<rel_base>(rhs)->id);
+   };
+   const auto same = [](operand *lhs, operand *rhs) noexcept{
+      return lhs == rhs || (is<abs>(lhs) && is<abs>(rhs) && as<abs>(lhs)->val == as<abs>(rhs)->val);
+   };
+   const auto vectorizable = [](decltype(insn_binop::op) op) noexcept{
+      switch (op) {
+      case insn_binop::_add: case insn_binop::_sub: case insn_binop::_umul: case insn_binop::_smul:
+      case insn_binop::_and: case insn_binop::_or: case insn_binop::_xor: case insn_binop::_shl: case insn_binop::_ushr: case insn_binop::_sshr:
+         return true;
+      default:
+         return false;
+      }
+   };
+   const auto commutative = [](decltype(insn_binop::op) op) noexcept{
+      return op == insn_binop::_add || op == insn_binop::_umul || op == insn_binop::_smul ||
+         op == insn_binop::_and || op == insn_binop::_or || op == insn_binop::_xor;
+   };
+
+   for (auto bb = pc->head(); bb; bb = bb->next()) {
+      // Collect Memory Accesses and Seeds ///////////////////////////////////////////////////////////
+      std::unordered_map<const insn *, std::size_t> pos;
+      std::vector<insn *> accesses; // in the order of execution
+      std::vector<std::pair<insn_store *, alias_oracle::address>> stores;
+      for (auto in = bb->head(); in; in = in->next()) {
+         pos[in] = pos.size();
+         if (is<insn_load>(in) || is<insn_store>(in) || is<insn_vload>(in) || is<insn_vstore>(in) || is<insn_call>(in)) accesses.push_back(in);
+         if (is<insn_store>(in)) stores.push_back({as<insn_store>(in), oracle.decompose(as<insn_store>(in)->dest())});
+      }
+      if (RSN_LIKELY(stores.size() < 2)) continue;
+      std::sort(stores.begin(), stores.end(), [](const auto &lhs, const auto &rhs) noexcept{
+         const auto key = [](operand *root) noexcept{ return !root ? 0 : is<rel_base>(root) ? (unsigned long long)as<rel_base>(root)->id.first : 1; };
+         if (key(lhs.second.root) != key(rhs.second.root)) return key(lhs.second.root) < key(rhs.second.root);
+         if (lhs.second.root != rhs.second.root) return lhs.second.root < rhs.second.root;
+         return (long long)lhs.second.offset < (long long)rhs.second.offset;
+      });
+
+      // whether an access in the BB after the position start and before the position end may touch the word at addr (or any memory, if null)
+      const auto clobbered = [&](std::size_t start, std::size_t end, operand *addr, bool loads_too, const std::vector<insn *> &except) {
+         for (auto in: accesses) if (pos[in] > start && pos[in] < end && std::find(except.begin(), except.end(), in) == except.end()) {
+            if (is<insn_call>(in)) return true;
+            if (is<insn_store>(in) && oracle.query(as<insn_store>(in)->dest(), addr) != alias_oracle::no_alias) return true;
+            if (is<insn_vstore>(in) && oracle.query(as<insn_vstore>(in)->dest(),
+               as<insn_vstore>(in)->lanes * as<insn_vstore>(in)->width, addr, 8) != alias_oracle::no_alias) return true;
+            if (!loads_too) continue;
+            if (is<insn_load>(in) && oracle.query(as<insn_load>(in)->src(), addr) != alias_oracle::no_alias) return true;
+            if (is<insn_vload>(in) && oracle.query(as<insn_vload>(in)->src(),
+               as<insn_vload>(in)->lanes * as<insn_vload>(in)->width, addr, 8) != alias_oracle::no_alias) return true;
+         }
+         return false;
+      };
+
+      for (std::size_t start = 0; start + 1 < stores.size(); ++start) for (auto lanes = params.lanes; lanes >= 2; lanes /= 2) {
+         if (start + lanes > stores.size()) continue;
+         std::vector<insn *> group;
+         for (std::size_t sn = 0; sn < lanes; ++sn) {
+            const auto &[store, addr] = stores[start + sn];
+            if (!same_root(addr.root, stores[start].second.root) || addr.offset != stores[start].second.offset + 8 * sn) goto next_width;
+            group.push_back(store);
+         }
+         {  // Check Sinking the Stores ////////////////////////////////////////////////////////////
+            std::size_t last = 0;
+            for (auto store: group) last = std::max(last, pos[store]);
+            for (auto store: group) if (clobbered(pos[store], last, as<insn_store>(store)->dest(), true, group)) goto next_width;
+            const auto at = *std::find_if(group.begin(), group.end(), [&](auto store) noexcept{ return pos[store] == last; });
+
+            // Grow the Tree of Packs //////////////////////////////////////////////////////////////
+            struct pack {
+               enum { _load, _binop, _broadcast } kind;
+               std::vector<insn *> insns;              // by lanes (none if broadcast)
+               lib::smart_ptr<operand> val;            // the operand broadcast, or the resulting vector
+               std::remove_const_t<decltype(insn_binop::op)> op;
+               std::size_t lhs, rhs;                   // packs of operands (for binops)
+               bool kept[8];                           // by lanes, whether the scalar insn stays
+            };
+            std::vector<pack> packs; // operands before users
+            std::unordered_map<const insn *, std::size_t> packed;
+            bool failed = false;
+            const auto grow = [&](auto &grow, const std::vector<operand *> &vals)->std::size_t{
+               if (std::all_of(vals.begin(), vals.end(), [&](operand *val) noexcept{ return same(val, vals.front()); }))
+                  return packs.push_back({pack::_broadcast, {}, vals.front(), {}, {}, {}, {}}), packs.size() - 1;
+               std::vector<insn *> insns;
+               for (auto val: vals) {
+                  if (!is<vreg>(val) || def_count[as<vreg>(val)->sn] != 1 || def[as<vreg>(val)->sn]->owner() != bb) return failed = true, 0;
+                  insns.push_back(def[as<vreg>(val)->sn]);
+               }
+               if (const auto it = packed.find(insns.front()); it != packed.end()) { // the same pack again (otherwise, a conflict)
+                  if (packs[it->second].insns != insns) failed = true;
+                  return it->second;
+               }
+               for (std::size_t sn = 0; sn < insns.size(); ++sn)
+                  if (packed.count(insns[sn]) || std::find(insns.begin(), insns.begin() + sn, insns[sn]) != insns.begin() + sn) return failed = true, 0;
+               pack res{};
+               if (std::all_of(insns.begin(), insns.end(), [&](insn *in) noexcept{ return is<insn_load>(in); })) {
+                  const auto base = oracle.decompose(as<insn_load>(insns.front())->src());
+                  for (std::size_t sn = 0; sn < insns.size(); ++sn) {
+                     const auto addr = oracle.decompose(as<insn_load>(insns[sn])->src());
+                     if (!same_root(addr.root, base.root) || addr.offset != base.offset + 8 * sn ||
+                        clobbered(pos[insns[sn]], pos[at], as<insn_load>(insns[sn])->src(), false, group)) return failed = true, 0;
+                  }
+                  res.kind = pack::_load;
+               } else
+               if (std::all_of(insns.begin(), insns.end(), [&](insn *in) noexcept{
+                  return is<insn_binop>(in) && as<insn_binop>(in)->op == as<insn_binop>(insns.front())->op; }) &&
+                  vectorizable(as<insn_binop>(insns.front())->op)) {
+                  res.kind = pack::_binop, res.op = as<insn_binop>(insns.front())->op;
+                  std::vector<operand *> lhs, rhs;
+                  for (auto in: insns) lhs.push_back(as<insn_binop>(in)->lhs()), rhs.push_back(as<insn_binop>(in)->rhs());
+                  // align operands of commutative operations with the first lane (by the kind of their definitions)
+                  const auto shape = [&](operand *op) noexcept->std::size_t{
+                     if (!is<vreg>(op)) return op->kind_sn();
+                     const auto in = def[as<vreg>(op)->sn];
+                     if (!in || in->owner() != bb) return operand::kind_count;
+                     return is<insn_load>(in) ? operand::kind_count + 1 : is<insn_binop>(in) ? operand::kind_count + 2 + as<insn_binop>(in)->op : 0;
+                  };
+                  if (commutative(res.op)) for (std::size_t sn = 1; sn < insns.size(); ++sn)
+                     if (shape(lhs[sn]) != shape(lhs.front()) && shape(rhs[sn]) == shape(lhs.front())) std::swap(lhs[sn], rhs[sn]);
+                  res.lhs = grow(grow, lhs);
+                  if (RSN_UNLIKELY(failed)) return 0;
+                  res.rhs = grow(grow, rhs);
+                  if (RSN_UNLIKELY(failed)) return 0;
+               } else
+                  return failed = true, 0;
+               res.insns = std::move(insns);
+               for (auto in: res.insns) packed[in] = packs.size();
+               return packs.push_back(std::move(res)), packs.size() - 1;
+            };
+            std::vector<operand *> vals;
+            for (auto store: group) vals.push_back(as<insn_store>(store)->src());
+            const auto root = grow(grow, vals);
+            if (failed || packs[root].kind == pack::_broadcast) goto next_width;
+
+            // Apply the Cost Model ////////////////////////////////////////////////////////////////
+            {  // scalar insns used outside the tree (and their operands in the tree) stay
+               std::unordered_map<const vreg *, std::size_t> tree_uses;
+               for (const auto &it: packs) for (auto in: it.insns) for (const auto &input: in->inputs()) if (is<vreg>(input)) ++tree_uses[as<vreg>(input)];
+               for (auto store: group) if (is<vreg>(as<insn_store>(store)->src())) ++tree_uses[as<vreg>(as<insn_store>(store)->src())];
+               for (auto it = packs.rbegin(); it != packs.rend(); ++it) for (std::size_t sn = 0; sn < it->insns.size(); ++sn) {
+                  const auto dest = it->insns[sn]->outputs()[0];
+                  it->kept[sn] = use_count[dest->sn] > tree_uses[dest];
+                  for (const auto &user: packs) for (std::size_t _sn = 0; _sn < user.insns.size(); ++_sn) if (user.kept[_sn])
+                     for (const auto &input: user.insns[_sn]->inputs()) if (input == dest) it->kept[sn] = true;
+               }
+               std::size_t scalar_cost = lanes, vector_cost = params.vector_cost; // the stores
+               for (const auto &it: packs) {
+                  for (std::size_t sn = 0; sn < it.insns.size(); ++sn) scalar_cost += 1, vector_cost += it.kept[sn];
+                  switch (it.kind) {
+                  case pack::_load:
+                     vector_cost += params.vector_cost;
+                     break;
+                  case pack::_binop:
+                     vector_cost +=
+                        it.op == insn_binop::_umul || it.op == insn_binop::_smul ? params.mul_cost :
+                        it.op == insn_binop::_sshr ? params.sshr_cost :
+                        (it.op == insn_binop::_shl || it.op == insn_binop::_ushr) && packs[it.rhs].kind != pack::_broadcast ? params.var_shift_cost :
+                        params.vector_cost;
+                     break;
+                  case pack::_broadcast:
+                     vector_cost += is<vreg>(it.val) ? params.broadcast_cost : 0; // immediates come from a constant pool
+                  }
+               }
+               if (vector_cost >= scalar_cost) goto next_width;
+            }
+
+            // Vectorize ///////////////////////////////////////////////////////////////////////////
+            for (auto &it: packs) switch (it.kind) {
+            case pack::_load:
+               {  auto res = vreg::make();
+                  insn_vload::make(at, lanes, 8, as<insn_load>(it.insns.front())->src(), res), it.val = std::move(res);
+               }
+               ++stats.slp_insns;
+               break;
+            case pack::_binop:
+               {  auto res = vreg::make();
+                  insn_vbinop::make(at, it.op, lanes, 8, packs[it.lhs].val, packs[it.rhs].val, res), it.val = std::move(res);
+               }
+               ++stats.slp_insns;
+               break;
+            case pack::_broadcast:;
+            }
+            const auto dest = as<insn_store>(*std::min_element(group.begin(), group.end(), [&](auto lhs, auto rhs) noexcept{
+               return (long long)oracle.decompose(as<insn_store>(lhs)->dest()).offset < (long long)oracle.decompose(as<insn_store>(rhs)->dest()).offset;
+            }))->dest();
+            insn_vstore::make(at, lanes, 8, packs[root].val, dest);
+            for (auto store: group) store->eliminate();
+            for (auto it = packs.rbegin(); it != packs.rend(); ++it)
+               for (std::size_t sn = 0; sn < it->insns.size(); ++sn) if (!it->kept[sn]) it->insns[sn]->eliminate();
+            ++stats.slp_groups, ++stats.slp_insns, changed = true;
+            goto restart;
+         }
+      next_width:;
+      }
+   }
+   return changed;
+}
@@ -0,0 +1,198 @@
+// opt-switch.cc -- lowering of switch_br insns
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "opt.hh"
+
+# include <algorithm> // find, find_if, max, sort, stable_sort
+# include <map>
+
+/* References:
+   - Improving Switch Lowering for The LLVM Compiler System by Anton Korobeynikov
+   - A Superoptimizer Analysis of Multiway Branch Code Generation by Roger Anthony Sayle
+
+   A switch_br insn jumps to dests[index] and traps when the index is out of range, which amounts to a bounds-checked jump table. The
+   index domain is partitioned into case ranges (maximal runs of equal targets, the trap range being the last one), and the ranges are
+   lowered to a balanced tree of bult insns whose subtrees are single targets, beq tests, bit-test clusters, or smaller jump tables,
+   whichever is the cheapest along the longest path according to the cost model. */
+bool rsn::opt::transform_switch_lowering(proc *pc, const switch_lowering_params &params) {
+   bool changed{};
+   std::vector<bblock *> worklist;
+   {  const cfg_info cfg(pc);
+      for (auto bb: cfg.rpo) if (RSN_UNLIKELY(is<insn_switch_br>(bb->rear()))) worklist.push_back(bb);
+   }
+   for (auto bb: worklist) {
+      const auto sw = as<insn_switch_br>(bb->rear());
+      if (RSN_UNLIKELY(!is<vreg>(sw->index())) || RSN_UNLIKELY(sw->dests().empty())) continue; // left to transform_insn_simplify
+
+      struct range { unsigned long long lo, hi; bblock *dest; }; // dest is null for the trap range
+      std::vector<range> ranges;
+      for (unsigned long long val = 0; val < sw->dests().size(); ++val)
+         if (ranges.empty() || ranges.back().dest != sw->dests()[val]) ranges.push_back({val, val, sw->dests()[val]}); else ++ranges.back().hi;
+      ranges.push_back({sw->dests().size(), ~0ull, {}});
+
+      // Choose the Lowering (Cost Model) /////////////////////////////////////////////////////////////
+      enum kind { _leaf, _beq, _bit_tests, _table, _split };
+      // the number of table entries for ranges [first, last) (the trap range is covered by the bounds check)
+      const auto table_size = [&](std::size_t first, std::size_t last) noexcept{
+         return (RSN_LIKELY(ranges[last - 1].dest) ? ranges[last - 1].hi + 1 : ranges[last - 1].lo) - ranges[first].lo;
+      };
+      // the number of distinct targets in ranges [first, last), up to the limit (plus one)
+      const auto dest_count = [&](std::size_t first, std::size_t last, std::size_t limit) noexcept{
+         std::vector<bblock *> dests;
+         for (auto sn = first; sn < last && dests.size() <= limit; ++sn)
+            if (std::find(dests.begin(), dests.end(), ranges[sn].dest) == dests.end()) dests.push_back(ranges[sn].dest);
+         return dests.size();
+      };
+      // the number of table entries for ranges [first, last) that lead to the most popular target
+      const auto popular_size = [&](std::size_t first, std::size_t last){
+         std::vector<std::pair<bblock *, unsigned long long>> sizes;
+         for (auto sn = first; sn < last; ++sn) if (RSN_LIKELY(ranges[sn].dest)) sizes.push_back({ranges[sn].dest, ranges[sn].hi - ranges[sn].lo + 1});
+         std::sort(sizes.begin(), sizes.end());
+         unsigned long long res = 0, size = 0;
+         for (std::size_t sn = 0; sn < sizes.size(); ++sn) {
+            size = sn && sizes[sn].first == sizes[sn - 1].first ? size + sizes[sn].second : sizes[sn].second;
+            res = std::max(res, size);
+         }
+         return res;
+      };
+      struct choice { kind how; unsigned cost; std::size_t split; };
+      std::map<std::pair<std::size_t, std::size_t>, choice> memo;
+      // the cheapest lowering of ranges [first, last) and its cost
+      const auto plan = [&](auto &plan, std::size_t first, std::size_t last)->choice{
+         if (last - first == 1) return {_leaf, 0, 0};
+         if (last - first == 3 && ranges[first].dest == ranges[first + 2].dest && ranges[first + 1].lo == ranges[first + 1].hi)
+            return {_beq, params.branch_cost, 0};
+         if (const auto it = memo.find({first, last}); it != memo.end()) return it->second;
+         const auto lo = ranges[first].lo, hi = ranges[last - 1].hi;
+         choice res{_split, ~0u, 0};
+         // split at the middle (for balance) and around the widest range (to separate dense parts from sparse ones and the trap range)
+         std::size_t widest = first;
+         for (auto sn = first; sn < last; ++sn) if (ranges[sn].hi - ranges[sn].lo > ranges[widest].hi - ranges[widest].lo) widest = sn;
+         for (auto split: {first + (last - first) / 2, widest, widest + 1})
+         if (split > first && split < last && (split == first + (last - first) / 2 || last - first <= params.max_skewed_ranges || !ranges[widest].dest)) {
+            const unsigned cost = params.branch_cost + std::max(plan(plan, first, split).cost, plan(plan, split, last).cost);
+            if (cost < res.cost) res = {_split, cost, split};
+         }
+         if (hi - lo < 64) {
+            const auto count = dest_count(first, last, params.max_bit_test_dests);
+            const unsigned cost = (RSN_LIKELY(lo) ? 2 : 1) * params.alu_cost + (count - 1) * (params.alu_cost + params.branch_cost);
+            if (count <= params.max_bit_test_dests && cost < res.cost) res = {_bit_tests, cost, 0};
+         }
+         if (last - first >= params.min_table_cases && table_size(first, last) <= params.max_table_size) {
+            const auto size = table_size(first, last);
+            const unsigned cost = params.jump_table_cost + (RSN_LIKELY(lo) ? params.alu_cost : 0);
+            if ((size - popular_size(first, last)) * 100 >= size * params.min_table_density && cost < res.cost) res = {_table, cost, 0};
+         }
+         return memo[{first, last}] = res;
+      };
+      if (plan(plan, 0, ranges.size()).how == _table) continue; // already in the best form
+
+      // Remember Phi Arguments of the Targets ////////////////////////////////////////////////////////
+      std::vector<std::pair<bblock *, std::vector<bblock *>>> old_preds; // targets with phi insns and their preds
+      {  const cfg_info cfg(pc);
+         for (const auto &it: ranges) if (RSN_LIKELY(it.dest) && RSN_UNLIKELY(is<insn_phi>(it.dest->head())) &&
+            std::find_if(old_preds.begin(), old_preds.end(), [&](const auto &_it) noexcept{ return _it.first == it.dest; }) == old_preds.end())
+            old_preds.push_back({it.dest, cfg.preds[it.dest->sn]});
+      }
+
+      // Emit the Lowered Code ////////////////////////////////////////////////////////////////////////
+      const lib::smart_ptr<operand> index = sw->index();
+      sw->eliminate();
+      std::vector<bblock *> created;
+      const auto next = bb->next(); // new BBs go immediately after bb in the order of creation
+      const auto make_bb = [&](){
+         const auto res = RSN_LIKELY(next) ? bblock::make(next) : bblock::make(pc);
+         return created.push_back(res), res;
+      };
+      bblock *trap = {};
+      const auto dest = [&](std::size_t sn){
+         if (RSN_LIKELY(ranges[sn].dest)) return ranges[sn].dest;
+         if (RSN_UNLIKELY(!trap)) insn_oops::make(trap = bblock::make(pc)), created.push_back(trap); // off the hot path
+         return trap;
+      };
+      const auto emit = [&](auto &emit, bblock *bb, std::size_t first, std::size_t last)->void{
+         // the target that handles ranges [first, last)
+         const auto target = [&](std::size_t first, std::size_t last){
+            if (last - first == 1) return dest(first);
+            const auto res = make_bb();
+            return emit(emit, res, first, last), res;
+         };
+         // the index relative to the lowest value in the ranges
+         const auto rebase = [&]()->lib::smart_ptr<operand>{
+            if (RSN_UNLIKELY(!ranges[first].lo)) return index;
+            auto res = vreg::make();
+            return insn_binop::make_sub(bb, index, abs::make(ranges[first].lo), res), res;
+         };
+         const auto choice = plan(plan, first, last);
+         switch (choice.how) {
+         case _leaf:
+            insn_jmp::make(bb, dest(first));
+            return;
+         case _beq:
+            insn_br::make_beq(bb, index, abs::make(ranges[first + 1].lo), dest(first + 1), dest(first)), ++stats.sw_branches;
+            return;
+         case _split:
+            {  const auto left = target(first, choice.split), right = target(choice.split, last);
+               insn_br::make_bult(bb, index, abs::make(ranges[choice.split].lo), left, right), ++stats.sw_branches;
+            }
+            return;
+         case _bit_tests:
+            {  struct cluster { bblock *dest; unsigned long long mask, size; };
+               std::vector<cluster> clusters;
+               for (auto sn = first; sn < last; ++sn) {
+                  auto it = std::find_if(clusters.begin(), clusters.end(), [&](const auto &it) noexcept{ return it.dest == ranges[sn].dest; });
+                  if (it == clusters.end()) clusters.push_back({ranges[sn].dest, 0, 0}), it = clusters.end() - 1;
+                  const auto lo = ranges[sn].lo - ranges[first].lo, hi = ranges[sn].hi - ranges[first].lo;
+                  it->mask |= ~0ull >> (63 - (hi - lo)) << lo, it->size += hi - lo + 1;
+               }
+               // the most popular targets are tested first, and the least popular one needs no test
+               std::stable_sort(clusters.begin(), clusters.end(), [](const auto &lhs, const auto &rhs) noexcept{ return lhs.size > rhs.size; });
+               auto bits = vreg::make();
+               insn_binop::make_shl(bb, abs::make(1), rebase(), bits);
+               for (std::size_t sn = 0; sn < clusters.size() - 1; ++sn) {
+                  auto masked = vreg::make();
+                  insn_binop::make_and(bb, bits, abs::make(clusters[sn].mask), masked);
+                  const auto next = sn + 2 < clusters.size() ? make_bb() : clusters.back().dest;
+                  insn_br::make_bne(bb, std::move(masked), abs::make(0), clusters[sn].dest, next), ++stats.sw_branches;
+                  bb = next;
+               }
+               ++stats.sw_bit_tests;
+            }
+            return;
+         case _table:
+            {  std::vector<bblock *> dests;
+               for (auto sn = first; sn < last; ++sn)
+                  if (RSN_LIKELY(ranges[sn].dest)) dests.insert(dests.end(), ranges[sn].hi - ranges[sn].lo + 1, ranges[sn].dest);
+               insn_switch_br::make(bb, rebase(), std::move(dests)), ++stats.sw_tables;
+            }
+            return;
+         }
+      };
+      emit(emit, bb, 0, ranges.size());
+      changed = true;
+
+      // Rebuild Phi Insns in the Targets /////////////////////////////////////////////////////////////
+      if (RSN_LIKELY(old_preds.empty())) continue;
+      const cfg_info cfg(pc);
+      for (const auto &[target, preds]: old_preds) for (auto phi: all(target)) {
+         if (RSN_LIKELY(!is<insn_phi>(phi))) break;
+         std::vector<lib::smart_ptr<operand>> args;
+         for (auto pred: cfg.preds[target->sn]) {
+            if (std::find(created.begin(), created.end(), pred) != created.end()) pred = bb; // new edges inherit the arguments of bb
+            args.push_back(as<insn_phi>(phi)->args()[std::find(preds.begin(), preds.end(), pred) - preds.begin()]);
+         }
+         insn_phi::make(phi, std::move(args), std::move(as<insn_phi>(phi)->dest())), phi->eliminate();
+      }
+   }
+   return changed;
+}
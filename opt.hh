@@ -0,0 +1,485 @@
+// opt.hh -- analyses and transformation passes
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# ifndef RSN_INCLUDED_OPT
+# define RSN_INCLUDED_OPT
+
+# include <chrono>
+# include <deque>
+# include <map>
+# include <unordered_map>
+
+# include "ir.hh"
+
+namespace rsn::opt {
+
+   // Pass Statistics //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+# define RSN_OPT_STATS(M) \
+   M(licm_hoisted,       "insns hoisted out of loops (LICM)") \
+   M(loop_preheaders,    "loop preheaders inserted") \
+   M(tail_calls,         "self tail calls turned into jumps (tail-recursion elimination)") \
+   M(loops_unrolled,     "counted loops unrolled (with a remainder loop)") \
+   M(loops_peeled,       "loops with a constant trip count peeled completely") \
+   M(sr_insns,           "mul and shl insns strength-reduced to induction VRs") \
+   M(sr_tests,           "loop exit tests replaced (linear-function test replacement)") \
+   M(ssa_split_edges,    "edges split for out-of-SSA translation") \
+   M(ssa_coalesced,      "phi-related VRs coalesced (copies avoided)") \
+   M(ssa_copies,         "copies inserted by out-of-SSA translation") \
+   M(jt_forwarded,       "edges threaded through forwarding BBs") \
+   M(jt_branches,        "edges threaded through branches with a known outcome") \
+   M(mem_forwarded,      "loads replaced by stored values") \
+   M(mem_redundant,      "loads replaced by the results of earlier loads") \
+   M(mem_dead_stores,    "dead stores eliminated") \
+   M(sw_tables,          "switch_br insns (or their parts) lowered to jump tables") \
+   M(sw_bit_tests,       "switch_br insns (or their parts) lowered to bit tests") \
+   M(sw_branches,        "conditional branches emitted for switch_br insns") \
+   M(prof_counters,      "edge counters inserted by profiling instrumentation") \
+   M(prof_split_edges,   "edges split for profiling instrumentation") \
+   M(layout_fallthru,    "profiled edges turned into fall-throughs by block layout") \
+   M(cold_bblocks,       "BBs marked cold (and moved to the end)") \
+   M(cold_traps_merged,  "trap BBs merged into shared ones") \
+   M(reassoc_trees,      "expression trees reassociated (with constants combined)") \
+   M(vr_branches,        "conditional branches decided by value-range analysis") \
+   M(vr_consts,          "operands found constant by value-range analysis") \
+   M(vr_insns,           "insns found redundant by value-range analysis (masks, remainders, and quotients)") \
+   M(if_converted,       "conditional branches if-converted (triangles and diamonds)") \
+   M(if_selects,         "select insns emitted by if-conversion") \
+   M(slp_groups,         "groups of adjacent stores vectorized (SLP)") \
+   M(slp_insns,          "vector insns emitted by SLP vectorization") \
+   M(gcm_hoisted,        "insns hoisted to dominating BBs with less loop depth (GCM)") \
+   M(gcm_sunk,           "insns sunk closer to their uses (GCM)") \
+   M(pre_inserted,       "evaluations inserted on edges by partial redundancy elimination (PRE)") \
+   M(pre_deleted,        "evaluations replaced with copies of available values (PRE)") \
+   M(pre_translated,     "binops replaced with phi insns of values translated to predecessors (PRE)") \
+   M(ipcp_bound,         "callee params bound to constants all call sites agree on (IPCP)") \
+   M(ipcp_clones,        "procedures specialized on constant arguments (IPCP)") \
+   M(ipcp_redirected,    "call sites redirected to specialized procedures (IPCP)") \
+   M(budget_stops,       "invocations of the pipeline stopped short by their compile-time budgets") \
+// end # define RSN_OPT_STATS(M)
+
+   struct statistics { // event counters updated by the passes (accumulated until reset by the client)
+   # define RSN_M1(NAME, DESCR) unsigned long long NAME;
+      RSN_OPT_STATS(RSN_M1)
+   # undef RSN_M1
+   };
+   inline RSN_IF_WITH_MT(thread_local) statistics stats{};
+# if RSN_USE_DEBUG
+   void dump_stats() noexcept;
+# endif
+
+   // Arithmetic Helpers ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   // High halves of 128-bit products (w/o relying on __int128, which is unavailable on 32-bit targets)
+   RSN_INLINE inline unsigned long long umulh(unsigned long long lhs, unsigned long long rhs) noexcept {
+      const auto lo_lo = (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF), hi_lo = (lhs >> 32) * (rhs & 0xFFFFFFFF),
+                 lo_hi = (lhs & 0xFFFFFFFF) * (rhs >> 32),        hi_hi = (lhs >> 32) * (rhs >> 32);
+      return hi_hi + (hi_lo >> 32) + (((lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi) >> 32);
+   }
+   RSN_INLINE inline unsigned long long smulh(unsigned long long lhs, unsigned long long rhs) noexcept {
+      return umulh(lhs, rhs) - ((long long)lhs < 0 ? rhs : 0) - ((long long)rhs < 0 ? lhs : 0);
+   }
+
+   // Control-Flow Graph and Dominator Tree ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /* Conventions
+      - bblock::sn is (re)assigned to the position of the BB in the procedure, and all per-BB vectors below are indexed by it
+      - only BBs reachable from the entry BB participate (the rest have no preds, no succs, and no idom)
+      - predecessors are listed in the order of the procedure (each one once, even if it refers to the BB several times), and the arguments
+        of phi insns correspond to the predecessors in this order
+      - the snapshot gets stale on any CFG change (including the order of BBs in the procedure)
+   */
+   class cfg_info { // CFG snapshot and dominator tree
+   public: // construction
+      explicit cfg_info(proc *);
+   public: // control-flow graph
+      std::vector<bblock *> bblocks;                   // all BBs in the procedure order
+      std::vector<std::vector<bblock *>> preds, succs; // predecessors and successors
+      std::vector<bblock *> rpo;                       // reachable BBs in reverse postorder (the entry BB first)
+      std::vector<std::size_t> rpo_num;                // position in rpo
+   public: // dominator tree
+      std::vector<bblock *> idom;                      // immediate dominators (the entry BB is its own idom)
+      std::vector<std::vector<bblock *>> dom_kids;     // immediate dominatees
+   public: // queries
+      RSN_INLINE bool reachable(const bblock *bb) const noexcept { return idom[bb->sn]; }
+      RSN_INLINE bool dominates(const bblock *lhs, const bblock *rhs) const noexcept // reflexive
+         { return dom_pre[lhs->sn] <= dom_pre[rhs->sn] && dom_post[rhs->sn] <= dom_post[lhs->sn]; }
+      std::size_t pred_index(const bblock *bb, const bblock *pred) const noexcept; // phi argument index for the edge pred->bb
+      std::vector<std::vector<bblock *>> dom_frontiers() const;
+   private: // internal representation
+      std::vector<std::size_t> dom_pre, dom_post; // dominator tree DFS numbering
+   };
+
+   // number all VRs mentioned in the procedure (in vreg::sn) and return their count
+   std::size_t number_vregs(proc *);
+
+   class liveness { // live VRs at BB boundaries (arguments of phi insns are live out of respective predecessors, and results are not live in)
+   public: // construction
+      explicit liveness(const cfg_info &, std::size_t vr_count); // VRs are to be numbered by number_vregs
+   public: // live sets (indexed by bblock::sn and vreg::sn)
+      std::vector<std::vector<bool>> live_in, live_out;
+   };
+
+   // whether the insn may be executed speculatively, i.e., it is pure and cannot trap (phi insns do not qualify)
+   bool speculatable(insn *) noexcept;
+
+   // rearrange the arguments of phi insns in bb after a CFG edit (each BB in new_preds must appear in old_preds)
+   void reorder_phi_args(bblock *bb, const std::vector<bblock *> &old_preds, const std::vector<bblock *> &new_preds);
+
+   /* Incremental repair of SSA form for a variable that got several definitions (e.g., by code duplication or inlining): the definitions are
+      registered per BB, and uses are rewritten with the reaching definitions, where phi insns are placed on demand (only at the joins that
+      a query actually reaches, with trivial ones removed). Only the predecessor lists of reachable BBs are needed, so neither the dominator
+      tree nor dominance frontiers are (re)computed, and only the region between the definitions and the uses is visited. The entry BB is
+      expected to have no predecessors, and a use with no reaching definition gets a fresh (undefined) VR. */
+   class ssa_updater {
+   public: // construction
+      explicit ssa_updater(proc *);    // snapshot of the CFG (gets stale on any CFG change)
+      void reset();                    // for another variable (keeping the snapshot)
+   public: // definitions
+      void add_def(bblock *, vreg *);  // the value on exit from the BB (the last definition in it replaces earlier ones)
+   public: // queries (phi insns are placed as needed)
+      vreg *value_on_exit(bblock *);
+      vreg *value_on_entry(bblock *);  // disregarding definitions in the BB itself
+      vreg *value_before(insn *);      // considering definitions preceding the insn in its BB
+   public: // rewriting
+      void rewrite_use(insn *, lib::smart_ptr<operand> &use); // a phi argument gets the value on exit from the respective predecessor
+      void rewrite_uses(vreg *);       // all uses of the VR in reachable BBs (its own definitions, if any remain, are to be registered)
+      void rewrite_uses(const std::vector<std::pair<insn *, lib::smart_ptr<operand> *>> &); // the given uses only (e.g., collected beforehand)
+   private: // internal representation
+      std::vector<bblock *> order;                               // reachable BBs in the procedure order (for deterministic placement of phi insns)
+      std::unordered_map<bblock *, std::vector<bblock *>> preds; // for reachable BBs (in the procedure order)
+      bblock *const entry;
+      std::unordered_map<bblock *, lib::smart_ptr<vreg>> defs, entry_vals;
+      std::vector<lib::smart_ptr<vreg>> vals;            // all registered definitions
+      std::vector<insn_phi *> phis, pending;             // placed so far, and those with arguments being determined
+      std::unordered_map<vreg *, lib::smart_ptr<vreg>> forward; // replacements of removed phi insns
+      std::vector<lib::smart_ptr<vreg>> retired;         // results of removed phi insns (kept alive as keys of the above)
+      lib::smart_ptr<vreg> undef;
+   private: // implementation helpers
+      vreg *resolve(vreg *) const noexcept;
+      vreg *try_remove(insn_phi *);
+   };
+
+   // Loop Nest Forest /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /* Natural loops (identified by back edges to a dominating header); back edges to the same header make up a single loop, and irreducible
+      cycles are not loops. */
+   class loop_forest {
+   public: // construction
+      explicit loop_forest(const cfg_info &);
+   public: // loop nodes
+      struct loop {
+         bblock *header;
+         loop *parent;                   // immediately enclosing loop (if any)
+         std::vector<loop *> kids;       // immediately nested loops
+         std::vector<bblock *> bblocks;  // all BBs of the loop (including nested loops) in reverse postorder (the header first)
+         std::vector<bblock *> latches;  // sources of back edges
+         std::vector<bblock *> exits;    // BBs outside the loop that are targeted from inside
+         unsigned depth;                 // nesting depth (1 for outermost loops)
+      };
+      std::vector<loop> loops;           // nested loops precede enclosing ones
+      std::vector<loop *> innermost;     // the innermost loop a BB belongs to (if any), indexed by bblock::sn
+   public: // queries
+      RSN_INLINE unsigned depth(const bblock *bb) const noexcept { return innermost[bb->sn] ? innermost[bb->sn]->depth : 0; }
+      RSN_INLINE bool contains(const loop *lp, const bblock *bb) const noexcept {
+         for (auto it = innermost[bb->sn]; it && it->depth >= lp->depth; it = it->parent) if (it == lp) return true;
+         return false;
+      }
+      bblock *preheader(const loop &) const noexcept; // the only BB outside the loop that enters it (and only via an unconditional jump)
+   private:
+      const cfg_info &cfg;
+   };
+
+   // Alias Analysis and Memory SSA ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /* Memory is accessed in 8-byte words (or vectors) at byte addresses. An address is decomposed into a root and a constant offset, where the
+      root is a relocatable base (identified by its link-time symbol), a VR (with constant additions folded), or nothing (for absolute
+      addresses). Accesses relative to different symbols never alias, and so do accesses relative to the same root that do not overlap.
+      Data blocks are immutable. */
+   class alias_oracle {
+   public: // construction
+      explicit alias_oracle(proc *); // expects SSA form (and numbers VRs by number_vregs)
+   public: // queries
+      enum result { no_alias, may_alias, must_alias };
+      /* VR-rooted addresses are only comparable when they refer to the same dynamic instances of the root VRs, which holds for accesses
+         related by a Memory SSA chain that does not pass through memory phis; otherwise, same_instances is to be false */
+      result query(operand *lhs, operand *rhs, bool same_instances = true) const noexcept { return query(lhs, 8, rhs, 8, same_instances); }
+      // ditto for accesses of the specified sizes in bytes (must_alias means exactly the same bytes)
+      result query(operand *lhs, std::size_t lhs_size, operand *rhs, std::size_t rhs_size, bool same_instances = true) const noexcept;
+      bool immutable(operand *addr) const noexcept; // whether the word is within a data block
+      struct address { operand *root; unsigned long long offset; };
+      address decompose(operand *) const noexcept;
+   private: // internal representation
+      std::vector<std::pair<const vreg *, address>> vregs; // VRs and their decomposed definitions (indexed by vreg::sn)
+   };
+
+   /* An overlay that threads the memory state through memory accesses: stores and calls define a new state, loads (except from data blocks)
+      and ret/oops insns use the current one, and memory phis merge states at the iterated dominance frontier of the definitions. The
+      overlay gets stale on any change to memory accesses or the CFG. */
+   class memory_ssa {
+   public: // construction
+      memory_ssa(const cfg_info &, const alias_oracle &);
+   public: // memory accesses
+      struct access {
+         enum { _live_on_entry, _def, _use, _phi } kind;
+         insn *in;                    // the accessing insn (null for phis and the initial state)
+         bblock *bb;
+         access *def;                 // the memory state the access depends on (null for phis and the initial state)
+         std::vector<access *> args;  // phi arguments (in the order of cfg_info::preds)
+         std::vector<access *> users; // accesses that depend on this memory state (if a def or phi), each listed once
+         access *clobber;             // cached result of clobbering_def
+      };
+      access *live_on_entry;          // the initial memory state
+      RSN_INLINE access *of(const insn *in) const noexcept { const auto it = accesses.find(in); return it != accesses.end() ? it->second : nullptr; }
+      RSN_INLINE access *phi(const bblock *bb) const noexcept { return phis[bb->sn]; }
+      /* the nearest access that may have written the word read by a load (a def, a phi that merges distinct clobbers, or the initial
+         state), or the defining access for other kinds of uses */
+      access *clobbering_def(access *use);
+      void remove(access *); // unlink an access (whose insn is about to be eliminated) from the overlay
+   # if RSN_USE_DEBUG
+   public: // debugging
+      void dump() const noexcept;
+   # endif
+   private: // internal representation
+      const cfg_info &cfg;
+      const alias_oracle &oracle;
+      std::deque<access> storage;
+      std::unordered_map<const insn *, access *> accesses;
+      std::vector<access *> phis; // indexed by bblock::sn
+   };
+
+   // Known Bits and Value Ranges /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /* Each VR is approximated by known bits and an unsigned interval, which refine each other. Values flow through insns and phi joins
+      (iterated in reverse postorder to a fixed point, with intervals widened after a few changes to ensure termination), and are further
+      refined within BBs controlled by conditional branches: a fact inferred from the taken edge holds in all BBs dominated by the target,
+      provided that the target has no other predecessors. Values that can never occur (e.g., in BBs that are only entered through an edge
+      that is never taken) are empty. */
+   class value_ranges {
+   public: // construction
+      value_ranges(const cfg_info &, std::size_t vr_count); // expects SSA form, and VRs are to be numbered by number_vregs
+   public: // values
+      struct value {
+         unsigned long long zero, one; // known zero and known one bits
+         unsigned long long lo, hi;    // unsigned interval (empty if lo > hi)
+         RSN_INLINE bool empty() const noexcept { return lo > hi; }
+         RSN_INLINE bool exact() const noexcept { return lo == hi; }
+      };
+      // the value of an operand throughout a BB, or on a CFG edge (with the condition of the branch taken)
+      value at(operand *, const bblock *) const noexcept;
+      value at(operand *, const bblock *from, const bblock *to) const noexcept;
+      // the outcome of a conditional branch (when it is known), provided that the BB is ever executed
+      enum outcome { unknown, taken_dest1, taken_dest2 };
+      outcome decide(insn_br *) const noexcept;
+   private: // internal representation
+      const cfg_info &cfg;
+      std::vector<value> vregs;          // unrefined values (indexed by vreg::sn)
+      std::vector<bblock *> cond_dom;    // the nearest dominating BB (inclusive) entered only via a conditional branch (indexed by bblock::sn)
+      value refine(value, operand *, const bblock *from, const bblock *to) const noexcept;
+   };
+
+   // Induction Variables ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /* A basic induction VR is a phi in a loop header that the back edges advance by the same constant step, starting from the value on the
+      only entering edge. VRs computed from a basic induction VR by add, sub, mul, and shl insns with loop-invariant operands (as far as the
+      result remains an affine function of the induction VR) are recurrences of the same loop, which evaluate to base_scale * base + scale * iv +
+      offset for each value of the induction VR (in SCEV notation, {base_scale * base + scale * init + offset, +, scale * step}). */
+   class induction_vars {
+   public: // construction
+      induction_vars(const cfg_info &, const loop_forest &, std::size_t vr_count); // expects SSA form, and VRs are to be numbered by number_vregs
+   public: // recurrences
+      struct recurrence {
+         const loop_forest::loop *lp;
+         insn_phi *iv;                     // the basic induction VR
+         lib::smart_ptr<operand> init;     // its value on the entering edge
+         unsigned long long step;          // its increment per iteration
+         unsigned long long scale, offset;
+         lib::smart_ptr<operand> base;     // a loop-invariant addendum (if any)
+         unsigned long long base_scale;    // and its multiplier
+      };
+      // the recurrence computed by a VR (if any)
+      RSN_INLINE const recurrence *of(operand *op) const noexcept
+         { return is<vreg>(op) && recs[as<vreg>(op)->sn].lp ? &recs[as<vreg>(op)->sn] : nullptr; }
+      // the number of times the exit test in the header of the loop lets it proceed (an upper bound if the loop has other exits)
+      bool trip_count(const loop_forest::loop &, unsigned long long &) const noexcept;
+      bool invariant(operand *, const loop_forest::loop *) const noexcept; // whether the operand is loop-invariant
+   private: // internal representation
+      const cfg_info &cfg; const loop_forest &loops;
+      std::vector<recurrence> recs;     // indexed by vreg::sn
+      std::vector<insn *> def;          // ditto
+   };
+
+   // Loop Unrolling /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   struct loop_unroll_params { // cost model (sizes are in insns, not counting phi and jmp insns)
+      unsigned max_factor         = 8;    // maximum number of iterations per round of an unrolled loop
+      unsigned max_size           = 64;   // maximum size of the body of an unrolled loop
+      unsigned max_peel_trips     = 16;   // maximum trip count of a loop to be peeled completely
+      unsigned max_peel_size      = 128;  // maximum size of the code of a peeled loop
+   };
+
+   // If-Conversion ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   struct if_conversion_params { // cost model (costs are in abstract units per execution of the branch)
+      unsigned max_arm_size       = 4;    // maximum number of insns in an arm (not counting the jmp insn)
+      unsigned branch_cost        = 1;    // conditional branch (correctly predicted)
+      unsigned mispredict_cost    = 12;   // penalty for a mispredicted branch
+      unsigned alu_cost           = 1;    // insn in an arm, or select insn
+   };
+
+   // SLP Vectorization ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   struct slp_params { // cost model (costs are in abstract units, where a scalar insn costs one)
+      unsigned lanes              = 2;    // number of 64-bit lanes in a vector register
+      unsigned vector_cost        = 1;    // vector load, store, add, sub, and, or, xor, or shift by a broadcast count
+      unsigned mul_cost           = 5;    // lanewise multiplication (emulated by 32-bit multiplications)
+      unsigned sshr_cost          = 4;    // lanewise arithmetic shift right (emulated)
+      unsigned var_shift_cost     = 4;    // shift by lanewise counts (emulated w/o AVX2)
+      unsigned broadcast_cost     = 1;    // scalar VR broadcast to all lanes
+   };
+   inline constexpr slp_params slp_sse2{}, slp_avx2{4, 1, 5, 4, 1, 1}; // x86-64 targets
+
+   // Switch Lowering //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   struct switch_lowering_params { // cost model (costs are in abstract units along the longest path through the lowered code)
+      unsigned branch_cost        = 2;    // conditional branch
+      unsigned alu_cost           = 1;    // arithmetic or logical insn
+      unsigned jump_table_cost    = 6;    // indirect jump through a table (switch_br), including the bounds check
+      unsigned min_table_cases    = 4;    // minimum number of case ranges (runs of equal targets) to justify a jump table
+      unsigned min_table_density  = 40;   // minimum percentage of table entries that lead to targets other than the most popular one
+      unsigned max_table_size     = 4096; // maximum number of table entries
+      unsigned max_bit_test_dests = 3;    // maximum number of distinct targets in a bit-test cluster (the range must fit in 64 bits)
+      unsigned max_skewed_ranges  = 64;   // unbalanced splits are only tried for up to so many case ranges (to bound compilation time)
+   };
+
+   // Edge Profiles and Frequency Estimates ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   // execution counts of CFG edges, keyed by their source and target BBs (missing edges count as never taken)
+   using edge_weights = std::map<std::pair<const bblock *, const bblock *>, unsigned long long>;
+
+   /* Edge profiling with optimal counter placement (Knuth and Stevenson; Ball and Larus): the CFG is extended with a virtual exit node
+      (targeted from BBs ending in ret or oops insns) and a virtual edge from it to the entry BB, which turns edge counts into a circulation,
+      so that counters are only needed on the chords of a spanning tree, and the counts of tree edges follow from flow conservation. The
+      tree is a maximum one w.r.t. static estimates (by loop nesting), for counters to go to colder edges. Counts are exact for runs that
+      end in ret or oops insns (rather than other traps). */
+   class edge_profiler {
+   public: // construction
+      explicit edge_profiler(proc *); // snapshot the CFG and place counters
+   public: // instrumentation
+      RSN_INLINE std::size_t counters() const noexcept { return counter_edges.size(); } // the number of counters needed
+      // insert counter increments (counters are the words at base, base + 8, etc., to be zero-initialized by the client)
+      void instrument(const lib::smart_ptr<rel_base> &base);
+      void uninstrument() noexcept; // remove the instrumentation (the procedure is not to be changed in between)
+   public: // profile import
+      edge_weights import(const unsigned long long counters[]) const; // the counts of all edges between reachable BBs
+   private: // internal representation
+      proc *const pc;
+      struct edge { std::size_t from, to; }; // by bblock::sn at construction, the virtual exit node being bblocks.size()
+      std::vector<bblock *> bblocks;
+      std::vector<edge> edges;               // the virtual edge comes first
+      std::vector<std::size_t> counter_edges; // instrumented edges (indexed by counter)
+      std::vector<insn *> probes;            // inserted insns
+      std::vector<std::pair<bblock *, std::size_t>> splits; // inserted BBs and the edges they split
+   };
+
+   /* Static estimation of branch probabilities (combining the heuristics of Ball and Larus by the Dempster-Shafer rule, as Wu and Larus do)
+      and of BB frequencies (propagated through the loop nest, innermost loops first, so that a loop multiplies the frequencies within it
+      by its expected trip count); paths that can only end in oops insns are deemed cold. */
+   class block_frequency {
+   public: // construction
+      block_frequency(const cfg_info &, const loop_forest &);
+   public: // queries
+      RSN_INLINE double frequency(const bblock *bb) const noexcept { return freq[bb->sn]; } // executions per invocation (0 if unreachable)
+      double probability(const bblock *from, const bblock *to) const noexcept;             // that from proceeds to to
+      RSN_INLINE double frequency(const bblock *from, const bblock *to) const noexcept { return frequency(from) * probability(from, to); }
+      RSN_INLINE bool cold(const bblock *bb) const noexcept { return is_cold[bb->sn]; }      // whether all paths from bb end in oops insns
+      edge_weights weights(double scale = 1 << 16) const; // estimated edge counts (for profile-driven passes) per so many invocations
+   private: // internal representation
+      const cfg_info &cfg;
+      std::vector<double> freq;
+      std::vector<std::vector<double>> prob; // parallel to cfg_info::succs
+      std::vector<signed char> is_cold;
+   };
+
+   // Interprocedural Constant Propagation ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   struct ipcp_params { // cost model (sizes are in insns)
+      unsigned max_size           = 256;  // maximum size of a procedure to be specialized
+      unsigned max_clones         = 4;    // maximum number of specialized versions of a procedure (in the cache)
+   };
+
+   // specialized versions of procedures, keyed by the callee and its params bound to constants (to be shared by all call sites that agree
+   // on them, including in later runs of transform_ipcp); the cache keeps its clones alive
+   class specialization_cache {
+   public: // queries
+      using key = std::pair<decltype(rel_base::id), std::vector<std::pair<std::size_t, unsigned long long>>>; // callee and (param index, value)s
+      RSN_INLINE proc *find(const key &k) const noexcept { auto it = clones.find(k); return it == clones.end() ? nullptr : (proc *)it->second; }
+      RSN_INLINE std::size_t size() const noexcept { return clones.size(); }
+      RSN_INLINE void clear() noexcept { clones.clear(); }
+   private: // internal representation
+      std::map<key, lib::smart_ptr<proc>> clones;
+      friend bool transform_ipcp(const std::vector<proc *> &, const std::vector<proc *> &, specialization_cache &, const ipcp_params &);
+   };
+
+   // Transformation Passes ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   bool transform_insn_simplify(proc *, bool inlining = true); // constant folding, algebraic simplification, and canonicalization (opt-passes.cc)
+   bool transform_const_propag(proc *);     // constant propagation from mov and beq insns (opt-passes.cc)
+   bool transform_copy_propag(proc *);      // copy propagation (opt-passes.cc)
+   bool transform_dce(proc *);              // dead code elimination (opt-passes.cc)
+   bool transform_cfg_gc(proc *);           // elimination of unreachable BBs (opt-passes.cc)
+   bool transform_cfg_merge(proc *);        // merging of BBs into their only predecessors (opt-passes.cc)
+   bool transform_jump_threading(proc *);   // jump threading through forwarding BBs and branches with a known outcome (opt-passes.cc)
+   bool transform_reassociation(proc *);    // reassociation and constant combining for add, mul, and, or, and xor; expects SSA form (opt-reassoc.cc)
+   bool transform_value_ranges(proc *);     // folding of branches, operands, and insns by known bits and value ranges; expects SSA form (opt-ranges.cc)
+   void transform_to_ssa(proc *);           // construction of SSA form (ssa.cc)
+   void transform_out_of_ssa(proc *);       // translation out of SSA form, with copy coalescing (ssa-out.cc)
+   bool transform_loop_preheaders(proc *);  // give each loop a dedicated preheader BB (opt-loops.cc)
+   bool transform_licm(proc *);             // loop-invariant code motion; expects SSA form (opt-loops.cc)
+   bool transform_gcm(proc *);              // global code motion of speculatable insns (out of loops and into branches); expects SSA form (opt-gcm.cc)
+   bool transform_strength_reduction(proc *); // of mul and shl insns on induction VRs, and linear-function test replacement; expects SSA form (opt-indvars.cc)
+   bool transform_loop_unroll(proc *, const loop_unroll_params & = {}); // unrolling and peeling of counted loops; expects SSA form (opt-loops.cc)
+   bool transform_tail_recursion(proc *);   // conversion of self tail calls into a loop around the procedure body; expects SSA form (opt-loops.cc)
+   bool transform_load_store_elim(proc *);  // store-to-load forwarding and elimination of redundant loads and dead stores; expects SSA form (opt-memory.cc)
+   bool transform_pre(proc *);              // partial redundancy elimination (lazy code motion) of binops and loads; expects SSA form (opt-pre.cc)
+   bool transform_if_conversion(proc *, const if_conversion_params & = {}, const edge_weights & = {}); // diamonds to selects; expects SSA form (opt-ifconv.cc)
+   bool transform_slp_vectorization(proc *, const slp_params & = {}); // packing of isomorphic insns into vector insns; expects SSA form (opt-slp.cc)
+   bool transform_switch_lowering(proc *, const switch_lowering_params & = {}); // switch_br to jump tables, bit tests, and br trees (opt-switch.cc)
+   bool transform_block_layout(proc *, const edge_weights &); // profile-guided ordering of BBs for fall-through (opt-profile.cc)
+   bool transform_hot_cold_split(proc *);   // merging of trap BBs and moving of cold BBs to the end (opt-profile.cc)
+   // interprocedural constant propagation over the procedures of a program, where internal ones are only called by its insn_call insns
+   // (and may be changed in place), and specialization of callees on constant arguments; not in SSA form is OK (opt-ipcp.cc)
+   bool transform_ipcp(const std::vector<proc *> &, const std::vector<proc *> &internal, specialization_cache &, const ipcp_params & = {});
+
+   // Optimization Pipeline ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   /* Tiers (each one includes the previous ones):
+      - O0: elimination of unreachable BBs and insn simplification (w/o inlining), to a fixed point, not in SSA form;
+      - O1: SSA form, constant and copy propagation, value ranges (sparse conditional folding of branches), and DCE;
+      - O2: inlining, redundancy elimination (reassociation, loads and stores, and PRE), loop transformations, LICM, GCM, if-conversion,
+        SLP vectorization, switch lowering, and block layout by estimated frequencies. */
+   enum opt_level { O0, O1, O2 };
+
+   struct opt_budget { // compile-time limits for optimization of a procedure (the pipeline stops at whichever is exhausted first)
+      std::chrono::steady_clock::duration time = std::chrono::steady_clock::duration::max();
+      unsigned long long work   = -1;   // in insns visited (each run of a pass is charged the size of the procedure as of the start of its round)
+      unsigned max_rounds       = 8;    // of each fixed-point loop
+      unsigned inline_depth     = 2;    // rounds of inlining (of the calls exposed by the previous round)
+   };
+
+   // returns false if the budget got exhausted (the IR is valid anyway, and translated out of SSA form if the pipeline got to it)
+   bool optimize(proc *, opt_level = O2, const opt_budget & = {}); // (opt-pipeline.cc)
+
+} // namespace rsn::opt
+
+# endif // # ifndef RSN_INCLUDED_OPT
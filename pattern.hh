@@ -0,0 +1,109 @@
+// pattern.hh -- compile-time pattern matching for peephole rules
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# ifndef RSN_INCLUDED_PATTERN
+# define RSN_INCLUDED_PATTERN
+
+# include <array>
+# include <utility> // index_sequence, make_index_sequence
+
+# include "ir.hh"
+
+namespace rsn::opt::pattern {
+
+   /* Peephole rules for binary insns are declared as rule<Lhs, Rhs, Action, When>, where Lhs and Rhs are operand patterns, When is an extra
+      condition on the whole insn, and Action performs the rewrite and returns true (or declines by returning false). A rule set is compiled
+      into a decision tree of depth one: a table indexed by the kinds of both operands, each entry of which tries, in the order of
+      declaration, only the rules whose patterns admit that pair of kinds (there are no null entries, so dispatch is branch-free). Thus operand
+      kinds are tested once per insn, and only value conditions are left for run time. Rule sets for different opcodes are further merged by switch_. */
+
+   // Operand Patterns /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   // operands of the kinds specified by a bit mask indexed by operand::kind_sn
+   template<unsigned Kinds> struct kinds { static constexpr unsigned mask = Kinds; RSN_INLINE static bool test(operand *) noexcept { return true; } };
+
+   using m_any      = kinds<077>;
+   using m_reg      = kinds<001>;
+   using m_abs      = kinds<002>;
+   using m_not_abs  = kinds<075>;
+   using m_imm      = kinds<076>;
+   using m_rel_disp = kinds<004>;
+   using m_rel_base = kinds<070>; // including procedures and data blocks
+   using m_rel      = kinds<074>; // rel_base or rel_disp
+
+   // absolute values that equal Val or satisfy Pred
+   template<unsigned long long Val> struct m_abs_val: m_abs
+      { RSN_INLINE static bool test(operand *op) noexcept { return as<abs>(op)->val == Val; } };
+   template<bool (*Pred)(unsigned long long) noexcept> struct m_abs_if: m_abs
+      { RSN_INLINE static bool test(operand *op) noexcept { return Pred(as<abs>(op)->val); } };
+
+   // Insn Conditions //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   struct always { RSN_INLINE static bool test(insn_binop *) noexcept { return true; } };
+   struct same_operand { RSN_INLINE static bool test(insn_binop *in) noexcept { return in->lhs() == in->rhs(); } };
+   // relocatable operands with the same link-time symbol (and, if Exact, the same addendum)
+   template<bool Exact> struct same_symbol {
+      RSN_INLINE static bool test(insn_binop *in) noexcept {
+         const auto base = [](operand *op) noexcept{ return is<rel_disp>(op) ? &*as<rel_disp>(op)->base : as<rel_base>(op); };
+         const auto add = [](operand *op) noexcept{ return is<rel_disp>(op) ? as<rel_disp>(op)->add : 0; };
+         return base(in->lhs())->id == base(in->rhs())->id && (!Exact || add(in->lhs()) == add(in->rhs()));
+      }
+   };
+
+   // Rules and Rule Sets //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+   template<typename Lhs, typename Rhs, bool (*Action)(insn_binop *), typename When = always> struct rule {
+      template<unsigned LhsKind, unsigned RhsKind> static constexpr bool admits = Lhs::mask >> LhsKind & 1 && Rhs::mask >> RhsKind & 1;
+      RSN_INLINE static bool apply(insn_binop *in) { return Lhs::test(in->lhs()) && Rhs::test(in->rhs()) && When::test(in) && Action(in); }
+   };
+
+   inline bool decline(insn_binop *) { return false; } // table entry for no rules at all
+
+   template<typename... Rules> class rules {
+   public:
+      RSN_INLINE static bool apply(insn_binop *in) {
+         return table[in->lhs()->kind_sn() * operand::kind_count + in->rhs()->kind_sn()](in);
+      }
+   private:
+      template<unsigned LhsKind, unsigned RhsKind, typename Rule> RSN_INLINE static bool try_rule(insn_binop *in) {
+         if constexpr (Rule::template admits<LhsKind, RhsKind>) return Rule::apply(in); else return false;
+      }
+      template<unsigned LhsKind, unsigned RhsKind> static constexpr bool admits = (Rules::template admits<LhsKind, RhsKind> || ...);
+      template<unsigned LhsKind, unsigned RhsKind> static bool try_rules(insn_binop *in) { return (try_rule<LhsKind, RhsKind, Rules>(in) || ...); }
+      template<std::size_t... Sn> static constexpr auto make_table(std::index_sequence<Sn...>) noexcept {
+         return std::array<bool (*)(insn_binop *), sizeof...(Sn)>{
+            admits<Sn / operand::kind_count, Sn % operand::kind_count> ? try_rules<Sn / operand::kind_count, Sn % operand::kind_count> : decline... };
+      }
+   public:
+      static constexpr auto table = make_table(std::make_index_sequence<operand::kind_count * operand::kind_count>{});
+   };
+
+   // several rule sets selected by a small integer (such as an opcode) and merged into one table, so the whole dispatch is a single indirect call
+   template<typename... RuleSets> class switch_ {
+   public:
+      RSN_INLINE static bool apply(insn_binop *in, unsigned sn) {
+         return table[(sn * operand::kind_count + in->lhs()->kind_sn()) * operand::kind_count + in->rhs()->kind_sn()](in);
+      }
+   private:
+      static constexpr auto make_table() noexcept {
+         std::array<bool (*)(insn_binop *), sizeof...(RuleSets) * operand::kind_count * operand::kind_count> res{};
+         std::size_t pos{};
+         ([&]() noexcept{ for (auto entry: RuleSets::table) res[pos++] = entry; }(), ...);
+         return res;
+      }
+      static constexpr auto table = make_table();
+   };
+
+} // namespace rsn::opt::pattern
+
+# endif // # ifndef RSN_INCLUDED_PATTERN
@@ -0,0 +1,151 @@
+// ssa-out.cc -- translation out of static single assignment form
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# include "opt.hh"
+
+# include <algorithm> // find_if, stable_sort
+
+/* References:
+   - Fast Copy Coalescing and Live-Range Identification by Zoran Budimlic, Keith D. Cooper, Timothy J. Harvey, Ken Kennedy, Timothy S. Oberg,
+     and Steven W. Reeves
+   - Revisiting Out-of-SSA Translation for Correctness, Code Quality, and Efficiency by Benoit Boissinot, Alain Darte, Fabrice Rastello,
+     Benoit Dupont de Dinechin, and Christophe Guillon
+
+   Phi insns are replaced by parallel copies at the end of respective predecessors, which requires the predecessors to end in an
+   unconditional jump (critical edges are split otherwise). Before that, each phi destination is coalesced with its arguments (if their live
+   ranges do not interfere), so that the corresponding copies disappear; the remaining parallel copies are sequentialized with temporary VRs
+   only where copies form cycles.
+*/
+void rsn::opt::transform_out_of_ssa(proc *pc) {
+   // Split Edges into BBs with Phi Insns //////////////////////////////////////////////////////////
+   {  cfg_info cfg(pc);
+      for (auto bb: cfg.rpo) if (RSN_UNLIKELY(is<insn_phi>(bb->head())))
+      for (auto pred: cfg.preds[bb->sn]) if (RSN_UNLIKELY(!is<insn_jmp>(pred->rear()))) {
+         // the new BB goes immediately after the predecessor, so the order of predecessors (and phi arguments) is preserved
+         auto split = RSN_LIKELY(pred->next()) ? bblock::make(pred->next()) : bblock::make(pc);
+         insn_jmp::make(split, bb);
+         for (auto &target: pred->rear()->targets()) if (target == bb) target = split;
+         ++stats.ssa_split_edges;
+      }
+   }
+   cfg_info cfg(pc);
+   const auto vr_count = number_vregs(pc);
+   liveness live(cfg, vr_count);
+
+   std::vector<vreg *> vregs(vr_count);
+   std::vector<bblock *> def_bb(vr_count, pc->head()); // undefined VRs are deemed to be defined on entry
+   std::vector<long> def_pos(vr_count, -1);            // -1 for phi destinations (and undefined VRs)
+   std::vector<std::vector<std::pair<bblock *, long>>> uses(vr_count); // excluding uses by phi insns
+   // Collect Definition and Use Points ////////////////////////////////////////////////////////////
+   for (auto bb: cfg.rpo) {
+      long pos = 0;
+      for (auto in = bb->head(); in; in = in->next(), ++pos) {
+         for (const auto &input: in->inputs()) if (is<vreg>(input)) {
+            vregs[as<vreg>(input)->sn] = as<vreg>(input);
+            if (RSN_LIKELY(!is<insn_phi>(in))) uses[as<vreg>(input)->sn].push_back({bb, pos});
+         }
+         for (const auto &output: in->outputs())
+            vregs[output->sn] = output, def_bb[output->sn] = bb, def_pos[output->sn] = RSN_UNLIKELY(is<insn_phi>(in)) ? -1 : pos;
+      }
+   }
+
+   // whether the value of lhs is live immediately after the definition of rhs
+   const auto live_at_def = [&](std::size_t lhs, std::size_t rhs) noexcept{
+      const auto bb = def_bb[rhs];
+      if (RSN_UNLIKELY(def_pos[rhs] < 0)) // phi destinations are defined simultaneously
+         return live.live_in[bb->sn][lhs] || (def_bb[lhs] == bb && def_pos[lhs] < 0);
+      if (live.live_out[bb->sn][lhs]) return true;
+      for (const auto &use: uses[lhs]) if (use.first == bb && use.second > def_pos[rhs]) return true;
+      return false;
+   };
+   // SSA live ranges interfere iff one VR is live at the definition of the other (which is then dominated by the former)
+   const auto interfere = [&](std::size_t lhs, std::size_t rhs) noexcept{
+      const auto dominates = [&](std::size_t lhs, std::size_t rhs) noexcept{
+         return def_bb[lhs] == def_bb[rhs] ? def_pos[lhs] <= def_pos[rhs] : cfg.dominates(def_bb[lhs], def_bb[rhs]);
+      };
+      return (dominates(lhs, rhs) && live_at_def(lhs, rhs)) || (dominates(rhs, lhs) && live_at_def(rhs, lhs));
+   };
+
+   std::vector<std::size_t> rep(vr_count);               // congruence class representatives (union-find)
+   std::vector<std::vector<std::size_t>> members(vr_count); // congruence class members (valid for representatives)
+   for (std::size_t sn = 0; sn < vr_count; ++sn) rep[sn] = sn, members[sn].push_back(sn);
+   const auto find = [&](std::size_t sn) noexcept{
+      while (rep[sn] != sn) sn = rep[sn] = rep[rep[sn]];
+      return sn;
+   };
+   // Coalesce Phi Destinations with Arguments (copies in deeper loops first) //////////////////////
+   {  loop_forest loops(cfg);
+      struct candidate { std::size_t dest, arg; unsigned depth; };
+      std::vector<candidate> candidates;
+      for (auto bb: cfg.rpo) for (auto in = bb->head(); is<insn_phi>(in); in = in->next())
+      for (std::size_t sn = 0; sn < cfg.preds[bb->sn].size(); ++sn) if (is<vreg>(as<insn_phi>(in)->args()[sn])) candidates.push_back({
+         as<insn_phi>(in)->dest()->sn, as<vreg>(as<insn_phi>(in)->args()[sn])->sn, loops.depth(cfg.preds[bb->sn][sn]) });
+      std::stable_sort(candidates.begin(), candidates.end(), [](const auto &lhs, const auto &rhs) noexcept{ return lhs.depth > rhs.depth; });
+
+      for (const auto &it: candidates) {
+         auto dest = find(it.dest), arg = find(it.arg);
+         if (RSN_UNLIKELY(dest == arg)) continue;
+         for (auto lhs: members[dest]) for (auto rhs: members[arg]) if (RSN_UNLIKELY(interfere(lhs, rhs))) goto next;
+         if (members[dest].size() < members[arg].size()) std::swap(dest, arg);
+         rep[arg] = dest, members[dest].insert(members[dest].end(), members[arg].begin(), members[arg].end()), members[arg].clear();
+         ++stats.ssa_coalesced;
+      next:;
+      }
+   }
+   // Rename VRs to Their Class Representatives ////////////////////////////////////////////////////
+   for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) {
+      for (auto &input: in->inputs()) if (is<vreg>(input)) input = vregs[find(as<vreg>(input)->sn)];
+      for (auto &output: in->outputs()) output = vregs[find(output->sn)];
+   }
+
+   // Replace Phi Insns with Sequentialized Parallel Copies ////////////////////////////////////////
+   {  std::vector<unsigned> readers(vr_count); // number of pending copies that read the VR
+      std::vector<vreg *> loc(vr_count);       // where the original value of the VR has been saved (if moved away to break a cycle)
+      for (auto bb: cfg.rpo) if (RSN_UNLIKELY(is<insn_phi>(bb->head())))
+      for (std::size_t arg_index = 0; arg_index < cfg.preds[bb->sn].size(); ++arg_index) {
+         const auto pred = cfg.preds[bb->sn][arg_index];
+         const auto emit = [&](lib::smart_ptr<operand> src, lib::smart_ptr<vreg> dest) RSN_INLINE{
+            insn_mov::make(pred->rear(), std::move(src), std::move(dest)), ++stats.ssa_copies;
+         };
+         std::vector<std::pair<vreg *, vreg *>> pending; // destination and source
+         for (auto in = bb->head(); is<insn_phi>(in); in = in->next()) {
+            const auto &arg = as<insn_phi>(in)->args()[arg_index];
+            if (is<vreg>(arg) && as<vreg>(arg) != as<insn_phi>(in)->dest())
+               pending.push_back({as<insn_phi>(in)->dest(), as<vreg>(arg)}), ++readers[as<vreg>(arg)->sn];
+         }
+         while (!pending.empty()) {
+            // emit a copy whose destination is not needed anymore as a source, if any
+            auto it = std::find_if(pending.begin(), pending.end(), [&](const auto &copy) noexcept{ return !readers[copy.first->sn] || loc[copy.first->sn]; });
+            if (RSN_LIKELY(it != pending.end())) {
+               const auto [dest, src] = *it; pending.erase(it);
+               emit(RSN_LIKELY(!loc[src->sn]) ? src : loc[src->sn], dest), --readers[src->sn];
+               continue;
+            }
+            // otherwise, the remaining copies form cycles -- break one by saving a destination into a temporary VR
+            const auto dest = pending.back().first;
+            auto temp = vreg::make();
+            emit(dest, temp), loc[dest->sn] = temp;
+         }
+         // constants go last since their destinations may be still needed as sources
+         for (auto in = bb->head(); is<insn_phi>(in); in = in->next()) {
+            const auto &arg = as<insn_phi>(in)->args()[arg_index];
+            if (is<vreg>(arg)) loc[as<vreg>(arg)->sn] = {};
+            else emit(arg, as<insn_phi>(in)->dest());
+         }
+      }
+      for (auto bb: cfg.bblocks) for (auto in: all(bb)) {
+         if (RSN_LIKELY(!is<insn_phi>(in))) break;
+         in->eliminate();
+      }
+   }
+}
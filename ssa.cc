@@ -13,6 +13,8 @@
 
 # include "ir.hh"
 
+# include <algorithm> // find
+
 namespace rsn::opt { void transform_to_ssa(proc *); }
 
 /* References:
@@ -34,17 +36,20 @@ void rsn::opt::transform_to_ssa(proc *pc) {
    }
 
    std::vector<std::vector<bblock *>> preds(bb_count), succs(bb_count);
-   // Build BB Predecessor and Successor Lists (using preorder DFS) ////////////////////////////////
+   // Build BB Predecessor and Successor Lists (for BBs reachable from the entry) //////////////////
    {  std::vector<signed char> visited(bb_count);
       auto traverse = [&](auto &traverse, bblock *bb) RSN_NOINLINE{
          if (RSN_UNLIKELY(visited[bb->sn])) return;
          visited[bb->sn] = true;
          for (const auto &target: bb->rear()->targets())
-         if (preds[target->sn].empty() || RSN_LIKELY(preds[target->sn].back() != bb))
-            preds[target->sn].push_back(bb), succs[bb->sn].push_back(target);
+         if (RSN_LIKELY(std::find(succs[bb->sn].begin(), succs[bb->sn].end(), target) == succs[bb->sn].end()))
+            succs[bb->sn].push_back(target);
          for (auto succ: succs[bb->sn]) traverse(traverse, succ);
       };
       traverse(traverse, pc->head());
+      // predecessors are listed in the BB order of the procedure (so are phi arguments)
+      for (auto bb = pc->head(); bb; bb = bb->next())
+         if (RSN_LIKELY(visited[bb->sn])) for (auto succ: succs[bb->sn]) preds[succ->sn].push_back(bb);
    }
 
    std::vector<bblock *> idom(bb_count);
@@ -77,9 +82,9 @@ void rsn::opt::transform_to_ssa(proc *pc) {
       for (;;) {
          bool changed = false;
          for (auto bb: lib::range_ref(postdfs).drop_last().reverse()) {
-            auto new_idom = lib::range_ref(preds[bb->sn]).first();
-            for (auto pred: lib::range_ref(preds[bb->sn]).drop_first())
-               if (RSN_LIKELY(idom[pred->sn])) new_idom = intersect(new_idom, pred);
+            bblock *new_idom = {}; // start from any already processed predecessor (not necessarily the first one)
+            for (auto pred: preds[bb->sn]) if (RSN_LIKELY(idom[pred->sn]))
+               new_idom = RSN_LIKELY(new_idom) ? intersect(new_idom, pred) : pred;
             changed |= idom[bb->sn] != new_idom, idom[bb->sn] = new_idom;
          }
          if (RSN_UNLIKELY(!changed)) break;
@@ -112,11 +117,9 @@ void rsn::opt::transform_to_ssa(proc *pc) {
    }
 
    dom_front.clear(), dom_front.shrink_to_fit();
-   preds.clear(), preds.shrink_to_fit();
 
    // Rename VRs ///////////////////////////////////////////////////////////////////////////////////
    {  std::vector<vreg *> vr_map(vr_count);
-      std::vector<std::size_t> phi_arg_index(bb_count);
       std::vector<signed char> visited(bb_count);
       auto traverse = [&](auto &traverse, bblock *bb) RSN_NOINLINE{
          if (RSN_UNLIKELY(visited[bb->sn])) return;
@@ -127,6 +130,7 @@ void rsn::opt::transform_to_ssa(proc *pc) {
          for (; is<insn_phi>(in); in = in->next()) {
             stack.reserve(7), stack.push_back({as<insn_phi>(in)->dest()->sn, vr_map[as<insn_phi>(in)->dest()->sn]}),
                vr_map[stack.back().first] = as<insn_phi>(in)->dest() = vreg::make(); // "reserve" speeds up in practice
+            as<insn_phi>(in)->dest()->sn = vr_count++;
          }
          // rewrite normal instructions
          for (; in; in = in->next()) {
@@ -134,14 +138,14 @@ void rsn::opt::transform_to_ssa(proc *pc) {
                if (is<vreg>(input)) input = vr_map[as<vreg>(input)->sn];
             for (auto &output: in->outputs())
                stack.reserve(7), stack.push_back({output->sn, vr_map[output->sn]}),
-                  vr_map[stack.back().first] = output = vreg::make(); // ditto
+                  vr_map[stack.back().first] = output = vreg::make(), output->sn = vr_count++; // ditto
          }
          // process successors
          for (auto succ: succs[bb->sn]) {
             // rewrite phi arguments
+            const auto arg_index = std::find(preds[succ->sn].begin(), preds[succ->sn].end(), bb) - preds[succ->sn].begin();
             for (auto in = succ->head(); is<insn_phi>(in); in = in->next())
-               as<insn_phi>(in)->args()[phi_arg_index[succ->sn]] = vr_map[as<vreg>(as<insn_phi>(in)->args()[phi_arg_index[succ->sn]])->sn];
-            ++phi_arg_index[succ->sn];
+               as<insn_phi>(in)->args()[arg_index] = vr_map[as<vreg>(as<insn_phi>(in)->args()[arg_index])->sn];
             // recur into the successor
             traverse(traverse, succ);
          }
@@ -157,6 +161,8 @@ void rsn::opt::transform_to_ssa(proc *pc) {
       traverse(traverse, pc->head());
    }
 
+   preds.clear(), preds.shrink_to_fit();
+
    // Prune SSA: DCE for Useless Phis //////////////////////////////////////////////////////////////
    for (;;) {
       std::vector<signed char> used(vr_count);
@@ -0,0 +1,132 @@
+// test/block-frequency.cc -- check (and benchmark) of block_frequency
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/block-frequency.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc -o block-frequency
+   Running:
+      ./block-frequency [N]        -- N (500 by default) seeds of random procedures of 2 kinds (arithmetic and switch_br, with division and
+                                      oops BBs from insn simplification every other seed, and memory accesses), each not in SSA form and in
+                                      SSA form; the probabilities out of each BB must sum to 1, frequencies must be finite and non-negative,
+                                      and BBs ending in oops insns cold; the edge trace of 5 runs by the reference interpreter tells how often
+                                      the more probable direction of two-way branches is taken (against the first one, as with uniform
+                                      probabilities), and the procedure is laid out by the estimates, which must leave its behavior unchanged,
+                                      and then by the real profile
+      ./block-frequency bench [N]  -- the time for the estimation in N (200 by default) random procedures of 200 BBs
+   Prints the number of failures, the predicted share of dynamic two-way branches, and the taken transfers (to other than the next BB) with
+   the original layout, the static layout, and the profiled layout, or the figures. */
+
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <chrono>  // steady_clock
+# include <cmath>   // fabs, isfinite
+# include <cstdio>  // printf
+# include <cstdlib> // atoi
+# include <cstring> // strcmp
+# include <random>  // mt19937_64
+# include <vector>  // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   // dynamic transfers to other than the next BB
+   unsigned long long taken(const opt::edge_weights &weights) {
+      unsigned long long res = 0;
+      for (const auto &[edge, count]: weights) if (edge.first->next() != edge.second) res += count;
+      return res;
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count) {
+      int bad = 0;
+      unsigned long long branches = 0, hits = 0, first_hits = 0, taken_orig = 0, taken_static = 0, taken_profiled = 0, transfers = 0;
+      ref_interp ref;
+      opt::edge_weights trace;
+      for (int seed = 0; seed < count; ++seed) for (int kind = 0; kind < 4; ++kind) {
+         std::mt19937_64 rng(seed);
+         const auto pc = kind < 2 ? rsn::test::gen(rng, 3 + seed % 8, 3 + seed % 3, 5, kind == 0) : rsn::test::gen_mem(rng, 3 + seed % 8, 3 + seed % 3, 6);
+         if (kind % 2) opt::transform_to_ssa(pc);
+         if (kind == 0 && seed % 2) opt::transform_insn_simplify(pc); // introduces oops BBs for division
+         const auto fail = [&](const char *what){ std::printf("seed %d, kind %d: %s\n", seed, kind, what), ++bad; };
+
+         const std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {7, 1}, {-1ull, 1ull << 63}};
+         std::vector<std::vector<unsigned long long>> expected;
+         trace.clear();
+         ref.on_edge = [&](opt::bblock *from, opt::bblock *to){ ++trace[{from, to}]; };
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         ref.on_edge = {};
+
+         const opt::cfg_info cfg(pc);
+         const opt::loop_forest loops(cfg);
+         const opt::block_frequency freq(cfg, loops);
+         for (auto bb: cfg.rpo) {
+            if (!cfg.succs[bb->sn].empty()) {
+               double sum = 0;
+               for (auto succ: cfg.succs[bb->sn]) sum += freq.probability(bb, succ);
+               if (RSN_UNLIKELY(std::fabs(sum - 1) > 1e-9)) { fail("probabilities do not sum to 1"); goto next; }
+            }
+            if (RSN_UNLIKELY(!(freq.frequency(bb) >= 0)) || RSN_UNLIKELY(!std::isfinite(freq.frequency(bb)))) { fail("bad frequency"); goto next; }
+            if (RSN_UNLIKELY(opt::is<opt::insn_oops>(bb->rear())) && RSN_UNLIKELY(!freq.cold(bb))) { fail("oops BB not cold"); goto next; }
+            if (cfg.succs[bb->sn].size() == 2) {
+               const auto dest1 = cfg.succs[bb->sn][0], dest2 = cfg.succs[bb->sn][1];
+               const auto count1 = trace[{bb, dest1}], count2 = trace[{bb, dest2}];
+               branches += count1 + count2, first_hits += count1;
+               hits += freq.probability(bb, dest1) >= freq.probability(bb, dest2) ? count1 : count2;
+            }
+         }
+         {  const opt::edge_weights profile(trace.begin(), trace.end());
+            taken_orig += taken(profile);
+            for (const auto &edge: profile) transfers += edge.second;
+            opt::transform_block_layout(pc, freq.weights());
+            taken_static += taken(profile);
+            for (std::size_t sn = 0; sn < args.size(); ++sn) if (RSN_UNLIKELY(rsn::test::observe(ref, pc, args[sn]) != expected[sn])) {
+               fail("layout changed behavior");
+               goto next;
+            }
+            opt::transform_block_layout(pc, profile);
+            taken_profiled += taken(profile);
+         }
+      next:;
+      }
+      std::printf("%d bad of %d seeds x 4 kinds; the more probable direction taken by %.1f%% of %llu two-way branch executions (the first one "
+         "by %.1f%%); taken transfers %llu (original layout), %llu (static), %llu (profiled) of %llu\n", bad, count, 100.0 * hits / branches,
+         branches, 100.0 * first_hits / branches, taken_orig, taken_static, taken_profiled, transfers);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   void bench(int count) {
+      std::vector<rsn::lib::smart_ptr<opt::proc>> pcs;
+      std::size_t insns = 0;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         pcs.push_back(rsn::test::gen(rng, 200, 6, 2));
+         for (auto bb = pcs.back()->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) ++insns;
+      }
+      double total = 0;
+      for (const auto &pc: pcs) {
+         const opt::cfg_info cfg(pc);
+         const opt::loop_forest loops(cfg);
+         const auto start = std::chrono::steady_clock::now();
+         const opt::block_frequency freq(cfg, loops);
+         total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      }
+      std::printf("%d procedures, %zu insns: %.1f ms\n", count, insns, total);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoi(argv[2]) : 200), 0;
+   return check(argc > 1 ? std::atoi(argv[1]) : 500);
+}
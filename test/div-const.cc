@@ -0,0 +1,227 @@
+// test/div-const.cc -- check (and microbenchmark) of division and remainder by constants as strength-reduced by insn_binop::simplify
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/div-const.cc ir0.cc opt-simplify.cc opt-analysis.cc -o div-const
+   Running:
+      ./div-const        -- every 16-bit divisor against every 16-bit dividend (signed and unsigned), then random 64-bit divisors and
+                            dividends (around powers of two and uniform), all against the hardware division (a few minutes)
+      ./div-const quick  -- the 64-bit part only
+      ./div-const 32 [divisor...]
+                         -- every 32-bit dividend (zero-extended for udiv/urem, sign-extended for sdiv/srem) for each given divisor (by
+                            default 7, 10 and 641, each also negated for sdiv/srem) (about 8 minutes per divisor)
+      ./div-const bench  -- x / 7 and x / 10 by the hardware divider vs. the emitted multiply-high sequences (natively, ns per op)
+   Prints the number of checks, or the first mismatch (and exits with 1). */
+
+# include "opt.hh"
+
+# include <chrono>  // steady_clock
+# include <cstdio>  // printf
+# include <cstdlib> // exit, strtoll
+# include <cstring> // strcmp
+# include <random>  // mt19937_64
+# include <vector>  // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using opt::insn_binop;
+
+   // high halves of 128-bit products (the reference for evaluating umulh/smulh in the emitted sequences)
+   unsigned long long umulh(unsigned long long lhs, unsigned long long rhs) { return (unsigned __int128)lhs * rhs >> 64; }
+   unsigned long long smulh(unsigned long long lhs, unsigned long long rhs) { return (__int128)(long long)lhs * (long long)rhs >> 64; }
+
+   // the straight-line sequence simplify() emits for a division or remainder by a constant, decoded for fast evaluation
+   struct sequence {
+      struct op { int code; unsigned lhs, rhs, dest; };
+      std::vector<op> ops;
+      std::vector<unsigned long long> regs; // slot 0 is the dividend, and constants get preloaded slots
+      unsigned result;
+   };
+
+   sequence compile(decltype(insn_binop::_add) code, unsigned long long divisor) {
+      auto pc = opt::proc::make({1, 0});
+      auto x = opt::vreg::make(), q = opt::vreg::make();
+      auto bb = opt::bblock::make(pc);
+      opt::insn_entry::make(bb, {x});
+      opt::insn_binop::make(bb, code, x, opt::abs::make(divisor), q);
+      opt::insn_ret::make(bb, {q});
+      for (bool changed = true; changed;) {
+         changed = false;
+         for (auto in: rsn::lib::all(bb)) changed |= in->simplify();
+      }
+
+      sequence res; res.regs.push_back(0);
+      opt::number_vregs(pc);
+      std::vector<unsigned> slots;
+      const auto slot = [&](opt::operand *op)->unsigned{
+         if (opt::is<opt::abs>(op)) return res.regs.push_back(opt::as<opt::abs>(op)->val), res.regs.size() - 1;
+         const auto sn = opt::as<opt::vreg>(op)->sn;
+         if (sn >= slots.size()) slots.resize(sn + 1, -1);
+         if (slots[sn] == -1u) slots[sn] = res.regs.size(), res.regs.push_back(0);
+         return slots[sn];
+      };
+      slots.resize(x->sn + 1, -1), slots[x->sn] = 0;
+      for (auto in = bb->head()->next(); in; in = in->next())
+      if (opt::is<opt::insn_mov>(in))
+         res.ops.push_back({-1, slot(opt::as<opt::insn_mov>(in)->src()), 0, slot(opt::as<opt::insn_mov>(in)->dest())});
+      else if (opt::is<opt::insn_binop>(in)) {
+         const auto binop = opt::as<opt::insn_binop>(in);
+         res.ops.push_back({binop->op, slot(binop->lhs()), slot(binop->rhs()), slot(binop->dest())});
+      } else if (opt::is<opt::insn_ret>(in))
+         res.result = slot(opt::as<opt::insn_ret>(in)->results()[0]);
+      else
+         std::printf("unexpected insn\n"), std::exit(1);
+      for (const auto &op: res.ops) if (op.code == insn_binop::_udiv || op.code == insn_binop::_urem ||
+         op.code == insn_binop::_sdiv || op.code == insn_binop::_srem) std::printf("division by %lld left\n", (long long)divisor), std::exit(1);
+      return res;
+   }
+
+   unsigned long long run(sequence &seq, unsigned long long dividend) {
+      auto r = seq.regs.data();
+      r[0] = dividend;
+      for (const auto &op: seq.ops) {
+         const auto lhs = r[op.lhs], rhs = r[op.rhs];
+         switch (op.code) {
+         case -1:                  r[op.dest] = lhs; break;
+         case insn_binop::_add:    r[op.dest] = lhs + rhs; break;
+         case insn_binop::_sub:    r[op.dest] = lhs - rhs; break;
+         case insn_binop::_umul:
+         case insn_binop::_smul:   r[op.dest] = lhs * rhs; break;
+         case insn_binop::_and:    r[op.dest] = lhs & rhs; break;
+         case insn_binop::_or:     r[op.dest] = lhs | rhs; break;
+         case insn_binop::_xor:    r[op.dest] = lhs ^ rhs; break;
+         case insn_binop::_shl:    r[op.dest] = lhs << (rhs & 0x3F); break;
+         case insn_binop::_ushr:   r[op.dest] = lhs >> (rhs & 0x3F); break;
+         case insn_binop::_sshr:   r[op.dest] = (long long)lhs >> (rhs & 0x3F); break;
+         case insn_binop::_umulh:  r[op.dest] = umulh(lhs, rhs); break;
+         case insn_binop::_smulh:  r[op.dest] = smulh(lhs, rhs); break;
+         }
+      }
+      return r[seq.result];
+   }
+
+   unsigned long long divide(decltype(insn_binop::_add) code, unsigned long long lhs, unsigned long long rhs) {
+      switch (code) {
+      case insn_binop::_udiv: return lhs / rhs;
+      case insn_binop::_urem: return lhs % rhs;
+      case insn_binop::_sdiv: return (long long)lhs / (long long)rhs;
+      default:                return (long long)lhs % (long long)rhs;
+      }
+   }
+
+   const char *name(decltype(insn_binop::_add) code) {
+      return code == insn_binop::_udiv ? "udiv" : code == insn_binop::_urem ? "urem" : code == insn_binop::_sdiv ? "sdiv" : "srem";
+   }
+
+   unsigned long long checks = 0;
+   void check(decltype(insn_binop::_add) code, unsigned long long divisor, sequence &seq, unsigned long long dividend) {
+      if (RSN_LIKELY(run(seq, dividend) == divide(code, dividend, divisor))) return void(++checks);
+      std::printf("%s %lld, %lld: got %lld, expected %lld\n", name(code), (long long)dividend, (long long)divisor,
+         (long long)run(seq, dividend), (long long)divide(code, dividend, divisor));
+      std::exit(1);
+   }
+
+   constexpr decltype(insn_binop::_add) codes[] = {insn_binop::_udiv, insn_binop::_urem, insn_binop::_sdiv, insn_binop::_srem};
+   bool is_signed(decltype(insn_binop::_add) code) { return code == insn_binop::_sdiv || code == insn_binop::_srem; }
+
+   // Exhaustive 16-bit Check //////////////////////////////////////////////////////////////////////
+   void check_16bit() {
+      for (auto code: codes) {
+         const long long lo = is_signed(code) ? -0x8000 : 0, hi = is_signed(code) ? 0x8000 : 0x10000;
+         for (long long divisor = lo; divisor < hi; ++divisor) {
+            if (divisor == 0 || divisor == 1 || divisor == -1) continue; // not rewritten (-1: overflow still traps)
+            auto seq = compile(code, divisor);
+            for (long long dividend = lo; dividend < hi; ++dividend) check(code, divisor, seq, dividend);
+         }
+         std::printf("%s: 16-bit check passed\n", name(code));
+      }
+   }
+
+   // Random 64-bit Check //////////////////////////////////////////////////////////////////////////
+   void check_64bit() {
+      std::mt19937_64 rng(2021);
+      std::vector<unsigned long long> divisors, dividends;
+      for (int k = 2; k < 64; ++k) for (int delta = -3; delta <= 3; ++delta) divisors.push_back((1ull << k) + delta);
+      for (int count = 0; count < 2000; ++count) divisors.push_back(rng() >> rng() % 64);
+      for (auto divisor: std::vector<unsigned long long>(divisors)) divisors.push_back(-divisor);
+      for (int k = 0; k < 64; ++k) for (int delta = -2; delta <= 2; ++delta)
+         dividends.push_back((1ull << k) + delta), dividends.push_back(-(1ull << k) + delta);
+      for (auto code: codes) {
+         for (auto divisor: divisors) {
+            if (divisor <= 1 || divisor == -1ull || (!is_signed(code) && (long long)divisor < 0 && rng() % 2)) continue;
+            auto seq = compile(code, divisor);
+            for (auto dividend: dividends) check(code, divisor, seq, dividend);
+            for (int count = 0; count < 2000; ++count) check(code, divisor, seq, rng() >> rng() % 64);
+            for (int count = 0; count < 2000; ++count) check(code, divisor, seq, -(rng() >> rng() % 64));
+         }
+         std::printf("%s: 64-bit check passed\n", name(code));
+      }
+   }
+
+   // Exhaustive 32-bit Check (for Selected Divisors) ///////////////////////////////////////////////
+   void check_32bit(const std::vector<unsigned long long> &divisors) {
+      for (auto code: codes) for (auto divisor: divisors) {
+         if (!is_signed(code) && (long long)divisor < 0) continue;
+         auto seq = compile(code, divisor);
+         const long long lo = is_signed(code) ? -0x80000000ll : 0, hi = is_signed(code) ? 0x80000000ll : 0x100000000ll;
+         for (long long dividend = lo; dividend < hi; ++dividend) check(code, divisor, seq, dividend);
+         std::printf("%s by %lld: 32-bit check passed\n", name(code), (long long)divisor);
+      }
+   }
+
+   // Microbenchmark ///////////////////////////////////////////////////////////////////////////////
+   // the emitted sequence for an unsigned quotient is either umulh and ushr, or umulh, sub, ushr, add, and ushr (the add-back variant)
+   void bench(unsigned long long divisor) {
+      auto seq = compile(insn_binop::_udiv, divisor);
+      unsigned long long magic = 0, shift = 0; bool add_back = false;
+      for (const auto &op: seq.ops) {
+         if (op.code == insn_binop::_umulh) magic = seq.regs[op.rhs];
+         if (op.code == insn_binop::_sub) add_back = true;
+         if (op.code == insn_binop::_ushr) shift = seq.regs[op.rhs];
+      }
+      constexpr unsigned long long count = 300'000'000;
+      volatile unsigned long long opaque = divisor; const auto _divisor = opaque;
+      unsigned long long sum_div = 0, sum_mulh = 0;
+      const auto t0 = std::chrono::steady_clock::now();
+      for (unsigned long long x = 0; x < count; ++x) {
+         const auto y = x * 0x9E3779B97F4A7C15;
+         sum_div += y / _divisor; asm volatile ("" :: "r"(sum_div));
+      }
+      const auto t1 = std::chrono::steady_clock::now();
+      if (add_back) for (unsigned long long x = 0; x < count; ++x) {
+         const auto y = x * 0x9E3779B97F4A7C15, hi = umulh(y, magic);
+         sum_mulh += (((y - hi) >> 1) + hi) >> shift; asm volatile ("" :: "r"(sum_mulh));
+      } else for (unsigned long long x = 0; x < count; ++x) {
+         const auto y = x * 0x9E3779B97F4A7C15;
+         sum_mulh += umulh(y, magic) >> shift; asm volatile ("" :: "r"(sum_mulh));
+      }
+      const auto t2 = std::chrono::steady_clock::now();
+      std::printf("x / %llu: div %.2f ns/op, %s sequence %.2f ns/op%s\n", divisor, std::chrono::duration<double, std::nano>(t1 - t0).count() / count,
+         add_back ? "add-back" : "multiply-high", std::chrono::duration<double, std::nano>(t2 - t1).count() / count, sum_div == sum_mulh ? "" : " (MISMATCH)");
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(7), bench(10), 0;
+   if (argc > 1 && !std::strcmp(argv[1], "32")) {
+      std::vector<unsigned long long> divisors;
+      for (int arg = 2; arg < argc; ++arg) divisors.push_back(std::strtoll(argv[arg], {}, 0));
+      if (divisors.empty()) divisors = {7, 10, 641};
+      for (auto divisor: std::vector<unsigned long long>(divisors)) divisors.push_back(-divisor);
+      for (auto divisor: divisors) if (divisor == 0 || divisor == 1 || divisor == -1ull) return std::printf("divisor %lld is not rewritten\n", (long long)divisor), 1;
+      check_32bit(divisors);
+      return std::printf("%llu checks passed\n", checks), 0;
+   }
+   if (argc <= 1 || std::strcmp(argv[1], "quick")) check_16bit();
+   check_64bit();
+   std::printf("%llu checks passed\n", checks);
+}
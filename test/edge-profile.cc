@@ -0,0 +1,183 @@
+// test/edge-profile.cc -- check (and benchmark) of edge_profiler and transform_block_layout
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/edge-profile.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc interp.cc -o edge-profile
+   Running:
+      ./edge-profile [N]        -- N (2000 by default) seeds of random procedures of 2 kinds (arithmetic and switch_br, and memory accesses on
+                                   host buffers), each not in SSA form and in SSA form; each procedure is instrumented and run with 5 sets of
+                                   arguments by the tier-0 interpreter (interp.hh), and the imported edge counts must equal the edge trace of
+                                   the same runs by the reference interpreter, the results must be unchanged, and uninstrumentation must restore
+                                   the IR exactly; then the procedure is laid out by the profile, and its behavior must be unchanged
+      ./edge-profile bench [N]  -- the time for counter placement and instrumentation, profile import, and block layout, for N (200 by
+                                   default) random procedures of 200 BBs
+   Prints the number of mismatches, the counters and edges, and the taken transfers (to other than the next BB) before and after layout, or
+   the figures. */
+
+# include "interp.hh"
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <chrono>  // steady_clock
+# include <cstdio>  // printf
+# include <cstdlib> // atoi
+# include <cstring> // memset, strcmp
+# include <random>  // mt19937_64
+# include <vector>  // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+   using results = std::vector<unsigned long long>;
+
+   // the BBs and insns of a procedure with all their operands and jump targets, to tell whether the IR is restored
+   std::vector<const void *> fingerprint(opt::proc *pc) {
+      std::vector<const void *> res;
+      for (auto bb = pc->head(); bb; bb = bb->next()) {
+         res.push_back(bb);
+         for (auto in = bb->head(); in; in = in->next()) {
+            res.push_back(in);
+            for (const auto &input: in->inputs()) res.push_back(input);
+            for (const auto &output: in->outputs()) res.push_back(output);
+            for (auto target: in->targets()) res.push_back(target);
+         }
+      }
+      return res;
+   }
+
+   // dynamic transfers to other than the next BB
+   unsigned long long taken(const opt::edge_weights &weights) {
+      unsigned long long res = 0;
+      for (const auto &[edge, count]: weights) if (edge.first->next() != edge.second) res += count;
+      return res;
+   }
+
+   unsigned long long buf1[1024], buf2[1024]; // for the extern symbols of gen_mem (the second one is addressed at the middle)
+   std::vector<unsigned long long> counters;
+
+   void *resolve(const opt::rel_base *rb) {
+      return rb->id.first == 11 ? buf1 : rb->id.first == 22 ? buf2 + 512 : rb->id.first == 99 ? counters.data() : nullptr;
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count) {
+      int bad = 0;
+      unsigned long long edges = 0, counter_count = 0, taken_before = 0, taken_after = 0, transfers = 0;
+      const auto base = opt::rel_base::make({99, 9});
+      ref_interp ref;
+      opt::edge_weights trace;
+      opt::stats = {};
+      for (int seed = 0; seed < count; ++seed) for (int kind = 0; kind < 4; ++kind) {
+         std::mt19937_64 rng(seed);
+         const auto pc = kind < 2 ? rsn::test::gen(rng, 3 + seed % 8, 3 + seed % 3, 5) : rsn::test::gen_mem(rng, 3 + seed % 8, 3 + seed % 3, 6, true);
+         if (kind % 2) opt::transform_to_ssa(pc);
+         const auto fail = [&](const char *what){ std::printf("seed %d, kind %d: %s\n", seed, kind, what), ++bad; };
+
+         std::vector<results> args, expected;
+         trace.clear();
+         ref.on_edge = [&](opt::bblock *from, opt::bblock *to){ if (RSN_LIKELY(from->owner() == pc)) ++trace[{from, to}]; };
+         for (const auto &_args: std::vector<results>{{0, 0}, {1, 2}, {5, 3}, {7, 1}, {-1ull, 1ull << 63}}) {
+            const auto _trace = trace;
+            results res;
+            if (ref.run(pc, _args, res) == ref_interp::_done) args.push_back(_args), expected.push_back(res);
+               else trace = _trace; // counts are exact for completed runs only
+         }
+         ref.on_edge = {};
+
+         opt::edge_profiler prof(pc);
+         const auto before = fingerprint(pc);
+         {  const opt::cfg_info cfg(pc);
+            for (auto bb: cfg.rpo) edges += cfg.succs[bb->sn].size();
+         }
+         counter_count += prof.counters();
+         prof.instrument(base);
+         counters.assign(prof.counters() + 1, 0);
+         opt::interpreter interp(resolve);
+         for (std::size_t sn = 0; sn < args.size(); ++sn) {
+            std::memset(buf1, 0, sizeof buf1), std::memset(buf2, 0, sizeof buf2);
+            results res;
+            if (RSN_UNLIKELY(!interp.run(pc, args[sn], res)) || RSN_UNLIKELY(res != expected[sn])) {
+               fail("instrumented run differs");
+               goto next;
+            }
+         }
+         {  const auto weights = prof.import(counters.data());
+            for (const auto &[edge, count]: weights) if (RSN_UNLIKELY(count != (trace.count(edge) ? trace[edge] : 0))) {
+               fail("edge count mismatch");
+               goto next;
+            }
+            for (const auto &[edge, count]: trace) if (RSN_UNLIKELY(!weights.count(edge))) { fail("traced edge missing"); goto next; }
+            prof.uninstrument();
+            if (RSN_UNLIKELY(fingerprint(pc) != before)) { fail("IR not restored"); goto next; }
+
+            taken_before += taken(weights);
+            for (const auto &edge: weights) transfers += edge.second;
+            opt::transform_block_layout(pc, weights);
+            taken_after += taken(weights);
+            if (RSN_UNLIKELY(!opt::is<opt::insn_entry>(pc->head()->head()))) { fail("entry BB moved"); goto next; }
+            for (std::size_t sn = 0; sn < args.size(); ++sn) {
+               results res;
+               if (RSN_UNLIKELY(ref.run(pc, args[sn], res) != ref_interp::_done) || RSN_UNLIKELY(res != expected[sn])) {
+                  fail("layout changed behavior");
+                  goto next;
+               }
+            }
+         }
+      next:;
+      }
+      std::printf("%d bad of %d seeds x 4 kinds (%llu counters for %llu edges, %llu edges split); taken transfers %llu -> %llu of %llu\n", bad, count,
+         counter_count, edges, opt::stats.prof_split_edges, taken_before, taken_after, transfers);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   void bench(int count) {
+      std::vector<rsn::lib::smart_ptr<opt::proc>> pcs;
+      std::size_t insns = 0;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         pcs.push_back(rsn::test::gen(rng, 200, 6, 2));
+         for (auto bb = pcs.back()->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) ++insns;
+      }
+      const auto base = opt::rel_base::make({99, 9});
+      const auto ms = [](auto start){ return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+      double place = 0, import = 0, layout = 0;
+      opt::stats = {};
+      for (const auto &pc: pcs) {
+         auto start = std::chrono::steady_clock::now();
+         opt::edge_profiler prof(pc);
+         prof.instrument(base);
+         place += ms(start);
+         counters.assign(prof.counters() + 1, 0);
+         opt::interpreter interp(resolve);
+         for (const auto &args: std::vector<results>{{0, 0}, {1, 2}, {5, 3}}) {
+            results res;
+            interp.run(pc, args, res);
+         }
+         start = std::chrono::steady_clock::now();
+         const auto weights = prof.import(counters.data());
+         prof.uninstrument();
+         import += ms(start);
+         start = std::chrono::steady_clock::now();
+         opt::transform_block_layout(pc, weights);
+         layout += ms(start);
+      }
+      std::printf("%d procedures, %zu insns: placement and instrumentation %.1f ms, import %.1f ms, layout %.1f ms (%llu counters)\n", count, insns,
+         place, import, layout, opt::stats.prof_counters);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoi(argv[2]) : 200), 0;
+   return check(argc > 1 ? std::atoi(argv[1]) : 2000);
+}
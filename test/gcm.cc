@@ -0,0 +1,141 @@
+// test/gcm.cc -- check (and benchmark) of transform_gcm
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/gcm.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc interp.cc -o gcm
+   Running:
+      ./gcm [N]        -- N (2000 by default) random procedures of structured code (test/gen.hh), in SSA form after copy propagation and DCE,
+                          each run with 8 sets of arguments against the reference interpreter before and after GCM (which must move nothing
+                          when run again), by the tier-0 interpreter then, and after out-of-SSA translation; then 3000 random procedures of
+                          unstructured code (with division every other seed), the same way with 4 sets of arguments
+      ./gcm bench [N]  -- N (2 * 10^7 by default) iterations of a loop with a loop-invariant expression and a chain of 5 insns used only
+                          in a branch taken once in 1024 iterations, run by the tier-0 interpreter before and after GCM, best of 7
+   Prints the number of mismatches, the insns moved, and the insns executed, or the timings. */
+
+# include "interp.hh"
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <algorithm> // min
+# include <chrono>    // steady_clock
+# include <cstdio>    // printf
+# include <cstdlib>   // atoi, atoll
+# include <cstring>   // memset, strcmp
+# include <random>    // mt19937_64
+# include <vector>    // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count, bool structured) {
+      int bad = 0;
+      unsigned long long steps_before = 0, steps_after = 0;
+      ref_interp ref;
+      static unsigned long long buffer[4];
+      opt::interpreter interp([](const opt::rel_base *rb)->void *{ return rb == rsn::test::region_gen::buffer ? buffer : nullptr; });
+      const auto hoisted = opt::stats.gcm_hoisted, sunk = opt::stats.gcm_sunk;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = structured ? rsn::test::gen_regions(rng) : rsn::test::gen(rng, 7, 4, 5, seed % 2);
+         std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {7, 100}};
+         if (structured) args.insert(args.end(), {{-1ull, 12345}, {1ull << 63, 3}, {13, 29}, {2, 2}});
+         std::vector<std::vector<unsigned long long>> expected;
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         opt::transform_to_ssa(pc);
+         opt::transform_copy_propag(pc), opt::transform_dce(pc);
+         for (const auto &_args: args) rsn::test::observe(ref, pc, _args), steps_before += ref.steps;
+         opt::transform_gcm(pc);
+         if (RSN_UNLIKELY(opt::transform_gcm(pc))) {
+            std::printf("seed %d: GCM moved insns when run again\n", seed), ++bad;
+            continue;
+         }
+         const auto compare = [&](const char *when){
+            for (std::size_t sn = 0; sn < args.size(); ++sn) {
+               const auto observed = rsn::test::observe(ref, pc, args[sn]);
+               if (*when == 'i') steps_after += ref.steps;
+               if (RSN_UNLIKELY(observed != expected[sn])) return std::printf("seed %d: mismatch %s on arguments #%zu\n", seed, when, sn), ++bad, false;
+            }
+            return true;
+         };
+         const auto tier0 = [&]{
+            for (std::size_t sn = 0; sn < args.size(); ++sn) {
+               if (expected[sn].back() != ref_interp::_done) continue;
+               std::vector<unsigned long long> results;
+               std::memset(buffer, 0, sizeof buffer);
+               const bool ok = interp.run(pc, args[sn], results);
+               results.push_back(expected[sn][expected[sn].size() - 2]), results.push_back(ref_interp::_done); // (memory hashes are not comparable)
+               if (RSN_UNLIKELY(!ok) || RSN_UNLIKELY(results != expected[sn]))
+                  return std::printf("seed %d: tier-0 mismatch on arguments #%zu\n", seed, sn), ++bad, false;
+            }
+            return true;
+         };
+         if (compare("in SSA form") && tier0()) opt::transform_out_of_ssa(pc), compare("after out-of-SSA");
+      }
+      std::printf("%s: %d bad of %d (%llu insns hoisted, %llu sunk); insns executed %llu -> %llu\n", structured ? "structured" : "unstructured",
+         bad, count, opt::stats.gcm_hoisted - hoisted, opt::stats.gcm_sunk - sunk, steps_before, steps_after);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   double best(opt::proc *pc, unsigned long long n, unsigned long long &result) {
+      double res = 1e9;
+      for (int round = 0; round < 7; ++round) {
+         opt::interpreter interp;
+         std::vector<unsigned long long> results;
+         interp.run(pc, {1, 5}, results); // translation
+         const auto start = std::chrono::steady_clock::now();
+         interp.run(pc, {n, 12345}, results);
+         res = std::min(res, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()), result = results[0];
+      }
+      return res;
+   }
+
+   // for (i = 0; i < n; ++i) { k = a * C ^ a >> 7 (invariant); h = i * C2 ^ k; c = (h * 13 + (h >> 5)) ^ h << 3 (cold); r += h & 1023 ? 1 : c; }
+   void bench(unsigned long long n) {
+      const auto pc = opt::proc::make({1, 1});
+      const auto _n = opt::vreg::make(), a = opt::vreg::make(), r = opt::vreg::make(), i = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc), header = opt::bblock::make(pc), body = opt::bblock::make(pc), then = opt::bblock::make(pc),
+         _else = opt::bblock::make(pc), join = opt::bblock::make(pc), exit = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {_n, a});
+      opt::insn_mov::make(entry, opt::abs::make(0), r), opt::insn_mov::make(entry, opt::abs::make(0), i), opt::insn_jmp::make(entry, header);
+      opt::insn_br::make_bult(header, i, _n, body, exit);
+      const auto k1 = opt::vreg::make(), k2 = opt::vreg::make(), k = opt::vreg::make(), h1 = opt::vreg::make(), h = opt::vreg::make(),
+         c1 = opt::vreg::make(), c2 = opt::vreg::make(), c3 = opt::vreg::make(), c4 = opt::vreg::make(), c = opt::vreg::make(), m = opt::vreg::make();
+      opt::insn_binop::make_umul(body, a, opt::abs::make(0x9E3779B97F4A7C15), k1), opt::insn_binop::make_ushr(body, a, opt::abs::make(7), k2);
+      opt::insn_binop::make_xor(body, k1, k2, k);
+      opt::insn_binop::make_umul(body, i, opt::abs::make(0xD6E8FEB86659FD93), h1), opt::insn_binop::make_xor(body, h1, k, h);
+      opt::insn_binop::make_umul(body, h, opt::abs::make(13), c1), opt::insn_binop::make_ushr(body, h, opt::abs::make(5), c2);
+      opt::insn_binop::make_add(body, c1, c2, c3), opt::insn_binop::make_shl(body, h, opt::abs::make(3), c4), opt::insn_binop::make_xor(body, c3, c4, c);
+      opt::insn_binop::make_and(body, h, opt::abs::make(1023), m), opt::insn_br::make_beq(body, m, opt::abs::make(0), then, _else);
+      opt::insn_binop::make_add(then, r, c, r), opt::insn_jmp::make(then, join);
+      opt::insn_binop::make_add(_else, r, opt::abs::make(1), r), opt::insn_jmp::make(_else, join);
+      opt::insn_binop::make_add(join, i, opt::abs::make(1), i), opt::insn_jmp::make(join, header);
+      opt::insn_ret::make(exit, {r});
+      opt::transform_to_ssa(pc);
+      opt::transform_copy_propag(pc), opt::transform_dce(pc);
+      unsigned long long before, after;
+      const double before_ms = best(pc, n, before);
+      opt::transform_gcm(pc);
+      const double after_ms = best(pc, n, after);
+      std::printf("invariant + cold chain: %.1f ms -> %.1f ms (%.2fx), results %s\n", before_ms, after_ms, before_ms / after_ms,
+         before == after ? "agree" : "DIFFER");
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoll(argv[2]) : 20'000'000), 0;
+   const int res = check(argc > 1 ? std::atoi(argv[1]) : 2000, true);
+   return check(3000, false) || res;
+}
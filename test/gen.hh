@@ -0,0 +1,382 @@
+// test/gen.hh -- random procedure generators for the test drivers
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# ifndef RSN_INCLUDED_TEST_GEN
+# define RSN_INCLUDED_TEST_GEN
+
+# include <iterator> // size
+# include <random>   // mt19937_64
+# include <vector>   // vector
+
+# include "opt.hh"
+
+namespace rsn::test {
+
+   /* The first two generators produce unstructured CFGs (not in SSA form) over a few VRs, with two params and all VRs returned. Each BB decrements a
+      fuel counter first and leaves for the exit BB when it runs out, so every run terminates. */
+
+   // arithmetic (with division by arbitrary values if requested), br, and switch_br (with an index in range)
+   inline lib::smart_ptr<opt::proc> gen(std::mt19937_64 &rng, int bb_count = 6, int vr_count = 4, int insn_count = 4, bool with_div = false) {
+      static constexpr decltype(opt::insn_binop::_add) ops[] = {opt::insn_binop::_add, opt::insn_binop::_sub, opt::insn_binop::_umul,
+         opt::insn_binop::_and, opt::insn_binop::_or, opt::insn_binop::_xor, opt::insn_binop::_shl, opt::insn_binop::_ushr, opt::insn_binop::_sshr,
+         opt::insn_binop::_udiv, opt::insn_binop::_urem, opt::insn_binop::_sdiv, opt::insn_binop::_srem, opt::insn_binop::_smul};
+      static constexpr decltype(opt::insn_br::_beq) br_ops[] = {opt::insn_br::_beq, opt::insn_br::_bult, opt::insn_br::_bslt};
+      auto pc = opt::proc::make({rng(), rng()});
+      std::vector<lib::smart_ptr<opt::vreg>> vrs;
+      for (int sn = 0; sn < vr_count; ++sn) vrs.push_back(opt::vreg::make());
+      const auto fuel = opt::vreg::make();
+      std::vector<opt::bblock *> bbs;
+      for (int sn = 0; sn < bb_count; ++sn) bbs.push_back(opt::bblock::make(pc));
+      const auto exit = opt::bblock::make(pc);
+      opt::insn_entry::make(bbs[0], {vrs[0], vrs[1]});
+      for (int sn = 2; sn < vr_count; ++sn) opt::insn_mov::make(bbs[0], opt::abs::make(rng() % 5), vrs[sn]);
+      opt::insn_mov::make(bbs[0], opt::abs::make(20), fuel);
+      const auto operand = [&]()->lib::smart_ptr<opt::operand>{
+         if (rng() % 4 == 0) return opt::abs::make(rng() % 4 == 0 ? rng() : rng() % 9);
+         return vrs[rng() % vr_count];
+      };
+      for (int sn = 0; sn < bb_count; ++sn) {
+         auto bb = bbs[sn];
+         for (int count = rng() % (insn_count + 1); count; --count) if (rng() % 3 == 0)
+            opt::insn_mov::make(bb, operand(), vrs[rng() % vr_count]);
+         else {
+            auto op = ops[rng() % (with_div ? 14 : 9)];
+            if (!with_div && rng() % 5 == 0) op = opt::insn_binop::_smul;
+            opt::insn_binop::make(bb, op, operand(), operand(), vrs[rng() % vr_count]);
+         }
+         opt::insn_binop::make_sub(bb, fuel, opt::abs::make(1), fuel);
+         const auto body = opt::bblock::make(exit);
+         opt::insn_br::make_beq(bb, fuel, opt::abs::make(0), exit, body);
+         bb = body;
+         auto dest1 = bbs[1 + rng() % (bb_count - 1)], dest2 = bbs[1 + rng() % (bb_count - 1)];
+         if (rng() % 3 == 0) dest1 = exit;
+         if (sn + 1 < bb_count && rng() % 2) dest2 = bbs[sn + 1];
+         switch (rng() % 4) {
+         case 0:
+            opt::insn_jmp::make(bb, dest2);
+            break;
+         case 1:
+            opt::insn_br::make(bb, br_ops[rng() % 3], operand(), operand(), dest1, dest2);
+            break;
+         case 2:
+            {  std::vector<opt::bblock *> dests;
+               const int size = 1 + rng() % 4;
+               for (int count = 0; count < size; ++count) dests.push_back(rng() % 2 ? dest1 : bbs[1 + rng() % (bb_count - 1)]);
+               const auto index = opt::vreg::make();
+               opt::insn_binop::make_urem(bb, operand(), opt::abs::make(size), index), opt::insn_switch_br::make(bb, index, std::move(dests));
+            }
+            break;
+         default:
+            opt::insn_br::make(bb, opt::insn_br::_bult, vrs[rng() % vr_count], opt::abs::make(rng() % 8), dest2, dest1);
+         }
+      }
+      opt::insn_ret::make(exit, std::vector<lib::smart_ptr<opt::operand>>(vrs.begin(), vrs.end()));
+      return pc;
+   }
+
+   /* loads, stores, and pointer arithmetic over two extern symbols, an immutable data block (holding constants and a relocatable word),
+      absolute addresses, and pointer VRs; loads from the data block include unaligned and out-of-bounds ones; the return values also
+      include a running checksum of the loaded words. For host execution (interp.hh, with the extern symbols resolved into zeroed buffers with
+      1 KiB after the first one and 1 KiB around the second one), absolute addresses, out-of-bounds accesses, and relocatable words are
+      avoided. */
+   inline lib::smart_ptr<opt::proc> gen_mem(std::mt19937_64 &rng, int bb_count = 6, int vr_count = 4, int insn_count = 5, bool host = false) {
+      static const auto ext1 = opt::rel_base::make({11, 1}), ext2 = opt::rel_base::make({22, 2});
+      static const auto _table = opt::data::make({33, 3}, {opt::abs::make(5), opt::abs::make(7), opt::abs::make(-1ull), opt::abs::make(40),
+         opt::rel_disp::make(ext1, 8)});
+      static const auto host_table = opt::data::make({44, 4}, {opt::abs::make(5), opt::abs::make(7), opt::abs::make(-1ull), opt::abs::make(40),
+         opt::abs::make(0x123456789), opt::abs::make(3)});
+      opt::data *const table = host ? host_table : _table;
+      auto pc = opt::proc::make({rng(), rng()});
+      std::vector<lib::smart_ptr<opt::vreg>> vrs;
+      for (int sn = 0; sn < vr_count; ++sn) vrs.push_back(opt::vreg::make());
+      const auto ptr1 = opt::vreg::make(), ptr2 = opt::vreg::make(), fuel = opt::vreg::make(), sum = opt::vreg::make();
+      std::vector<opt::bblock *> bbs;
+      for (int sn = 0; sn < bb_count; ++sn) bbs.push_back(opt::bblock::make(pc));
+      const auto exit = opt::bblock::make(pc);
+      opt::insn_entry::make(bbs[0], {vrs[0], vrs[1]});
+      for (int sn = 2; sn < vr_count; ++sn) opt::insn_mov::make(bbs[0], opt::abs::make(rng() % 5), vrs[sn]);
+      opt::insn_mov::make(bbs[0], opt::abs::make(12), fuel), opt::insn_mov::make(bbs[0], opt::abs::make(0), sum);
+      opt::insn_binop::make_add(bbs[0], ext1, opt::abs::make(8 * (rng() % 4)), ptr1);
+      opt::insn_binop::make_add(bbs[0], ext2, opt::abs::make(8 * (rng() % 4)), ptr2);
+      const auto operand = [&]()->lib::smart_ptr<opt::operand>{
+         if (rng() % 4 == 0) return opt::abs::make(rng() % 9);
+         return vrs[rng() % vr_count];
+      };
+      const auto address = [&](opt::bblock *bb, bool for_load)->lib::smart_ptr<opt::operand>{
+         switch (rng() % (for_load ? 9 : 8)) {
+         case 0: return ext1;
+         case 1: return ext2;
+         case 2: return opt::rel_disp::make(ext1, 8 * (1 + rng() % 3));
+         case 3: return opt::rel_disp::make(rng() % 2 ? ext1 : ext2, 4);
+         case 4: if (host) return opt::rel_disp::make(ext2, 16); return opt::abs::make(0x1000 + 8 * (rng() % 2));
+         case 5: return ptr1;
+         case 6: return ptr2;
+         case 7:
+            {  const auto res = opt::vreg::make();
+               opt::insn_binop::make_add(bb, rng() % 2 ? ptr1 : ptr2, opt::abs::make(8 * (rng() % 3)), res);
+               return res;
+            }
+         default: // the data block (loads only)
+            switch (rng() % 6) {
+            case 0:  return table;
+            case 1:  return opt::rel_disp::make(table, 4);
+            case 2:  return opt::rel_disp::make(table, 32);
+            case 3:  return opt::rel_disp::make(table, 40);
+            default: return opt::rel_disp::make(table, 8 * (1 + rng() % 3));
+            }
+         }
+      };
+      for (int sn = 0; sn < bb_count; ++sn) {
+         auto bb = bbs[sn];
+         for (int count = rng() % (insn_count + 1); count; --count) switch (rng() % 6) {
+         case 0:
+            opt::insn_mov::make(bb, operand(), vrs[rng() % vr_count]);
+            break;
+         case 1:
+            opt::insn_binop::make(bb, rng() % 2 ? opt::insn_binop::_add : opt::insn_binop::_xor, operand(), operand(), vrs[rng() % vr_count]);
+            break;
+         case 2: case 3:
+            {  auto addr = address(bb, true);
+               if (opt::is<opt::vreg>(addr) && rng() % 2) {
+                  const auto _addr = opt::vreg::make();
+                  opt::insn_binop::make_add(bb, std::move(addr), opt::abs::make(8), _addr), addr = _addr;
+               }
+               const auto dest = vrs[rng() % vr_count];
+               opt::insn_load::make(bb, std::move(addr), dest);
+               opt::insn_binop::make_umul(bb, sum, opt::abs::make(31), sum), opt::insn_binop::make_add(bb, sum, dest, sum);
+            }
+            break;
+         case 4:
+            opt::insn_store::make(bb, rng() % 2 ? operand() : opt::abs::make(rng()), address(bb, false));
+            break;
+         default: // pointer bump
+            if (rng() % 2) opt::insn_binop::make_add(bb, ptr1, opt::abs::make(8), ptr1);
+            else opt::insn_binop::make_sub(bb, ptr2, opt::abs::make(8), ptr2);
+         }
+         opt::insn_binop::make_sub(bb, fuel, opt::abs::make(1), fuel);
+         const auto body = opt::bblock::make(exit);
+         opt::insn_br::make_beq(bb, fuel, opt::abs::make(0), exit, body);
+         bb = body;
+         auto dest1 = bbs[1 + rng() % (bb_count - 1)], dest2 = bbs[1 + rng() % (bb_count - 1)];
+         if (rng() % 3 == 0) dest1 = exit;
+         if (sn + 1 < bb_count && rng() % 2) dest2 = bbs[sn + 1];
+         if (rng() % 2) opt::insn_jmp::make(bb, dest2);
+         else opt::insn_br::make(bb, opt::insn_br::_bult, vrs[rng() % vr_count], opt::abs::make(rng() % 8), dest2, dest1);
+      }
+      std::vector<lib::smart_ptr<opt::operand>> results(vrs.begin(), vrs.end());
+      results.push_back(sum), opt::insn_ret::make(exit, std::move(results));
+      return pc;
+   }
+
+   /* one or two loops in sequence, each of them possibly with one nested in its body (up to depth 3), over four VRs with two params, all of
+      them returned; each loop is almost counted: an induction VR starts at a constant or a param and is stepped by add or sub of an abs (by
+      +-1, 2, 3, 5), and the header tests it (before or after the step) against a loop-invariant bound (masked to 0..31 or 0..3, or a
+      constant) by one of bne, bult, buge, and bule, either way around, so some loops run until the VR wraps around or never end. Loop bodies
+      are the header only, or the header and a body BB, or the header and a diamond, with random arithmetic and stores to an extern symbol.
+      With address_arith, headers also compute affine functions of the induction VR (scaled by mul or shl) into stores and VRs. */
+   inline lib::smart_ptr<opt::proc> gen_loops(std::mt19937_64 &rng, bool address_arith = false) {
+      static const auto ext = opt::rel_base::make({55, 5});
+      auto pc = opt::proc::make({rng(), rng()});
+      std::vector<lib::smart_ptr<opt::vreg>> vrs;
+      for (int sn = 0; sn < 4; ++sn) vrs.push_back(opt::vreg::make());
+      const auto operand = [&]()->lib::smart_ptr<opt::operand>{
+         if (rng() % 4 == 0) return opt::abs::make(rng() % 9);
+         return vrs[rng() % vrs.size()];
+      };
+      const auto stuff = [&](opt::bblock *bb, int count){
+         static constexpr decltype(opt::insn_binop::_add) ops[] = {opt::insn_binop::_add, opt::insn_binop::_sub, opt::insn_binop::_umul,
+            opt::insn_binop::_and, opt::insn_binop::_or, opt::insn_binop::_xor, opt::insn_binop::_shl, opt::insn_binop::_ushr};
+         for (; count; --count) if (rng() % 8 == 0)
+            opt::insn_store::make(bb, operand(), opt::rel_disp::make(ext, 8 * (rng() % 4)));
+         else
+            opt::insn_binop::make(bb, ops[rng() % std::size(ops)], operand(), operand(), vrs[rng() % vrs.size()]);
+      };
+      // a loop from bb to a new BB, which is returned
+      const auto loop = [&](auto &loop, opt::bblock *bb, int depth)->opt::bblock *{
+         static constexpr decltype(opt::insn_binop::_add) scale_ops[] = {opt::insn_binop::_umul, opt::insn_binop::_smul, opt::insn_binop::_shl};
+         static constexpr long long steps[] = {1, 1, 1, -1, -1, 2, 3, -2, 5, -3};
+         const auto iv = opt::vreg::make(), bound = opt::vreg::make(), test_iv = opt::vreg::make();
+         const long long step = steps[rng() % std::size(steps)];
+         opt::insn_mov::make(bb, rng() % 2 ? (lib::smart_ptr<opt::operand>)opt::abs::make(rng() % 20) : vrs[rng() % 2], iv);
+         opt::insn_binop::make_and(bb, vrs[rng() % vrs.size()], opt::abs::make(rng() % 2 ? 31 : 3), bound);
+         if (rng() % 3 == 0) opt::insn_mov::make(bb, opt::abs::make(rng() % 30), bound);
+         const auto header = opt::bblock::make(pc);
+         opt::insn_jmp::make(bb, header);
+         const int shape = rng() % 3; // 0: single BB, 1: header + body, 2: header + diamond
+         const auto exit = opt::bblock::make(pc);
+         opt::insn_mov::make(header, iv, test_iv);
+         stuff(header, rng() % 3);
+         if (address_arith) for (int count = rng() % 4; count; --count) {
+            const auto scaled = opt::vreg::make(), offset = opt::vreg::make();
+            lib::smart_ptr<opt::operand> base = rng() % 3 ? test_iv : vrs[rng() % vrs.size()];
+            if (rng() % 3 == 0) {
+               const auto _base = opt::vreg::make();
+               opt::insn_binop::make(header, rng() % 2 ? opt::insn_binop::_add : opt::insn_binop::_sub,
+                  rng() % 2 ? (lib::smart_ptr<opt::operand>)opt::abs::make(rng() % 50) : vrs[rng() % 2], std::move(base), _base), base = _base;
+            }
+            opt::insn_binop::make(header, scale_ops[rng() % std::size(scale_ops)], std::move(base),
+               opt::abs::make(rng() % 3 == 0 ? 8 : rng() % 2 ? 3 : rng() % 13), scaled);
+            opt::insn_binop::make(header, rng() % 2 ? opt::insn_binop::_add : opt::insn_binop::_xor, scaled,
+               rng() % 2 ? (lib::smart_ptr<opt::operand>)vrs[1] : opt::abs::make(rng() % 1000), offset);
+            if (rng() % 2) opt::insn_store::make(header, offset, opt::rel_disp::make(ext, 8 * (rng() % 4)));
+            else opt::insn_binop::make_add(header, vrs[rng() % vrs.size()], offset, vrs[rng() % vrs.size()]);
+         }
+         const auto stay = shape == 0 ? header : opt::bblock::make(pc);
+         const auto test = [&](opt::bblock *bb){
+            switch (rng() % 6) {
+            case 0:  opt::insn_br::make_bne(bb, test_iv, bound, stay, exit); break;
+            case 1:  opt::insn_br::make_bne(bb, bound, test_iv, stay, exit); break;
+            case 2:  opt::insn_br::make_bult(bb, test_iv, bound, stay, exit); break;
+            case 3:  opt::insn_br::make_bult(bb, bound, test_iv, stay, exit); break;
+            case 4:  opt::insn_br::make_buge(bb, test_iv, bound, stay, exit); break;
+            default: opt::insn_br::make_bule(bb, test_iv, bound, stay, exit);
+            }
+         };
+         const auto bump = [&](opt::bblock *bb){
+            if (rng() % 2) opt::insn_binop::make_add(bb, iv, opt::abs::make(step), iv);
+            else opt::insn_binop::make_sub(bb, iv, opt::abs::make(-step), iv);
+         };
+         if (shape == 0) return bump(header), test(header), exit;
+         test(header);
+         auto latch = stay;
+         stuff(latch, rng() % 4);
+         if (depth < 2 && rng() % 3 == 0) latch = loop(loop, latch, depth + 1);
+         if (shape == 2) {
+            const auto lhs = opt::bblock::make(pc), rhs = opt::bblock::make(pc), join = opt::bblock::make(pc);
+            opt::insn_br::make_bult(latch, operand(), operand(), lhs, rhs);
+            stuff(lhs, rng() % 3), stuff(rhs, rng() % 3);
+            opt::insn_jmp::make(lhs, join), opt::insn_jmp::make(rhs, join);
+            latch = join;
+         }
+         stuff(latch, rng() % 2), bump(latch);
+         if (!address_arith || rng() % 3 == 0) opt::insn_binop::make_add(latch, vrs[rng() % vrs.size()], iv, vrs[rng() % vrs.size()]);
+         opt::insn_jmp::make(latch, header);
+         return exit;
+      };
+      auto bb = opt::bblock::make(pc);
+      opt::insn_entry::make(bb, {vrs[0], vrs[1]});
+      opt::insn_mov::make(bb, opt::abs::make(1), vrs[2]), opt::insn_mov::make(bb, opt::abs::make(7), vrs[3]);
+      for (int count = 1 + rng() % 2; count; --count) bb = loop(loop, bb, 0);
+      opt::insn_ret::make(bb, std::vector<lib::smart_ptr<opt::operand>>(vrs.begin(), vrs.end()));
+      return pc;
+   }
+
+   /* structured code: sequences of if-then, if-then-else, bounded loops (of 0 to 4 trips), and diamonds with a return from one arm, nested up
+      to depth 3, over five VRs, with random arithmetic (division included now and then), loads from an immutable data block, and loads and
+      stores through an extern symbol; when dense, operands are only the first three VRs and the constants 1 and 2, and the arithmetic is
+      only add, sub, and umul, so that the same expressions recur */
+   class region_gen {
+   public: // construction
+      explicit region_gen(std::mt19937_64 &rng, bool dense = false) noexcept: rng(rng), dense(dense) {}
+   public: // generation
+      // fresh VRs, and the entry BB of pc defining them (two params, constants for the rest)
+      opt::bblock *entry(opt::proc *pc) {
+         vrs.clear();
+         for (int sn = 0; sn < 5; ++sn) vrs.push_back(opt::vreg::make());
+         const auto bb = opt::bblock::make(pc);
+         opt::insn_entry::make(bb, {vrs[0], vrs[1]});
+         for (int sn = 2; sn < 5; ++sn) opt::insn_mov::make(bb, opt::abs::make(rng() % 7), vrs[sn]);
+         return bb;
+      }
+      // a region starting at the end of bb (which must not be terminated); returns the BB where it ends (not terminated either)
+      opt::bblock *region(opt::proc *pc, opt::bblock *bb, int depth = 0) {
+         for (int count = 1 + rng() % 3; count; --count) {
+            stuff(bb, rng() % 3);
+            const int kind = depth > 2 ? 0 : rng() % 6;
+            if (kind == 0) continue;
+            if (kind <= 3) { // if-then or if-then-else
+               const auto then = opt::bblock::make(pc), _else = kind == 1 ? nullptr : opt::bblock::make(pc), join = opt::bblock::make(pc);
+               cond(bb, then, _else ? _else : join);
+               const auto arm = [&](opt::bblock *bb){
+                  if (rng() % 4) stuff(bb, rng() % 5); else bb = region(pc, bb, depth + 1);
+                  opt::insn_jmp::make(bb, join);
+               };
+               arm(then);
+               if (_else) arm(_else);
+               bb = join;
+            } else
+            if (kind == 4) { // a bounded loop
+               const auto trips = opt::vreg::make();
+               const auto header = opt::bblock::make(pc), body = opt::bblock::make(pc), exit = opt::bblock::make(pc);
+               opt::insn_mov::make(bb, opt::abs::make(rng() % 5), trips), opt::insn_jmp::make(bb, header);
+               opt::insn_br::make_bne(header, trips, opt::abs::make(0), body, exit);
+               opt::insn_binop::make_sub(body, trips, opt::abs::make(1), trips);
+               opt::insn_jmp::make(region(pc, body, depth + 1), header);
+               bb = exit;
+            } else { // a diamond with a return from one arm
+               const auto then = opt::bblock::make(pc), _else = opt::bblock::make(pc), join = opt::bblock::make(pc), ret = opt::bblock::make(pc);
+               cond(bb, then, _else);
+               stuff(then, 1), cond(then, join, ret), opt::insn_ret::make(ret, {vrs[0]});
+               stuff(_else, 2), opt::insn_jmp::make(_else, join);
+               bb = join;
+            }
+         }
+         return bb;
+      }
+      // return all VRs from bb
+      void ret(opt::bblock *bb) { opt::insn_ret::make(bb, std::vector<lib::smart_ptr<opt::operand>>(vrs.begin(), vrs.end())); }
+   public: // data
+      std::vector<lib::smart_ptr<opt::vreg>> vrs;
+      static inline const lib::smart_ptr<opt::data> table = opt::data::make({9, 9}, {opt::abs::make(3), opt::abs::make(14), opt::abs::make(25),
+         opt::abs::make(36)});
+      static inline const lib::smart_ptr<opt::rel_base> buffer = opt::rel_base::make({66, 6});
+   private: // implementation helpers
+      lib::smart_ptr<opt::operand> operand() {
+         if (dense) return rng() % 3 == 0 ? (lib::smart_ptr<opt::operand>)opt::abs::make(1 + rng() % 2) : vrs[rng() % 3];
+         if (rng() % 4 == 0) return opt::abs::make(rng() % 5 == 0 ? rng() : rng() % 9);
+         return vrs[rng() % vrs.size()];
+      }
+      void stuff(opt::bblock *bb, int count) {
+         static constexpr decltype(opt::insn_binop::_add) ops[] = {opt::insn_binop::_add, opt::insn_binop::_sub, opt::insn_binop::_umul,
+            opt::insn_binop::_and, opt::insn_binop::_or, opt::insn_binop::_xor, opt::insn_binop::_shl, opt::insn_binop::_ushr,
+            opt::insn_binop::_udiv, opt::insn_binop::_sdiv};
+         for (; count; --count) switch (rng() % 13) {
+         case 0:
+            opt::insn_store::make(bb, operand(), opt::rel_disp::make(buffer, 8 * (rng() % 4)));
+            break;
+         case 1:
+            opt::insn_load::make(bb, opt::rel_disp::make(table, 8 * (rng() % 4)), vrs[rng() % vrs.size()]);
+            break;
+         case 2:
+            opt::insn_mov::make(bb, operand(), vrs[rng() % vrs.size()]);
+            break;
+         case 3:
+            opt::insn_load::make(bb, opt::rel_disp::make(buffer, 8 * (rng() % 4)), vrs[rng() % vrs.size()]);
+            break;
+         default:
+            opt::insn_binop::make(bb, ops[dense ? rng() % 3 : rng() % (rng() % 4 ? 8 : 10)], operand(), operand(), vrs[rng() % vrs.size()]);
+         }
+      }
+      void cond(opt::bblock *bb, opt::bblock *dest1, opt::bblock *dest2) {
+         switch (rng() % 4) {
+         case 0:  opt::insn_br::make_beq(bb, operand(), operand(), dest1, dest2); break;
+         case 1:  opt::insn_br::make_bult(bb, operand(), operand(), dest1, dest2); break;
+         case 2:  opt::insn_br::make_bslt(bb, operand(), operand(), dest1, dest2); break;
+         default: opt::insn_br::make_bne(bb, vrs[rng() % vrs.size()], opt::abs::make(rng() % 3), dest1, dest2);
+         }
+      }
+   private: // internal representation
+      std::mt19937_64 &rng;
+      const bool dense;
+   };
+
+   inline lib::smart_ptr<opt::proc> gen_regions(std::mt19937_64 &rng, bool dense = false) {
+      region_gen gen(rng, dense);
+      auto pc = opt::proc::make({rng(), rng()});
+      gen.ret(gen.region(pc, gen.entry(pc)));
+      return pc;
+   }
+
+} // namespace rsn::test
+
+# endif // # ifndef RSN_INCLUDED_TEST_GEN
@@ -0,0 +1,141 @@
+// test/hot-cold-split.cc -- check (and benchmark) of transform_hot_cold_split
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/hot-cold-split.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc -o hot-cold-split
+   Running:
+      ./hot-cold-split [N]        -- a hand-built CFG (a BB with a store that leads only to a trap BB must become cold along with it), then
+                                     N (2000 by default) random procedures of unstructured code (test/gen.hh) with udiv/srem x, x insns
+                                     injected, every other one in SSA form, after insn simplification (which guards divisions with trap
+                                     BBs); each is run with 6 sets of arguments against the reference interpreter after the pass and after
+                                     block layout by static estimates, no hot BB may follow a cold one, and a second run of the pass must
+                                     change nothing
+      ./hot-cold-split bench [N]  -- the time for the pass in N (200 by default) such procedures of 200 BBs
+   Prints the number of failures, the oops BBs before and after, and the cold BBs, or the figures. */
+
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <chrono>  // steady_clock
+# include <cstdio>  // printf
+# include <cstdlib> // atoi
+# include <cstring> // strcmp
+# include <random>  // mt19937_64
+# include <vector>  // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   // a procedure from test/gen.hh with udiv/srem x, x insns injected into about half of its BBs (which traps for x = 0, or x = -2^63 for srem)
+   rsn::lib::smart_ptr<opt::proc> gen(std::mt19937_64 &rng, int bb_count, int vr_count, int insn_count) {
+      auto pc = rsn::test::gen(rng, bb_count, vr_count, insn_count, true);
+      std::vector<rsn::lib::smart_ptr<opt::vreg>> vrs;
+      for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) for (const auto &vr: in->outputs()) vrs.push_back(vr);
+      for (auto bb = pc->head(); bb; bb = bb->next()) if (rng() % 2 && bb->rear() != bb->head()) {
+         const auto x = vrs[rng() % vrs.size()];
+         opt::insn_binop::make(RSN_LIKELY(bb->rear()->prev()) ? bb->rear()->prev() : bb->rear(), rng() % 2 ? opt::insn_binop::_udiv : opt::insn_binop::_srem,
+            x, x, x);
+      }
+      return pc;
+   }
+
+   bool cold_last(opt::proc *pc) {
+      bool cold = false;
+      for (auto bb = pc->head(); bb; bb = bb->next()) if (RSN_UNLIKELY(cold && !bb->cold)) return false; else cold |= bb->cold;
+      return true;
+   }
+
+   // Hand-Built CFG ///////////////////////////////////////////////////////////////////////////////
+   int check_cfg() {
+      const auto pc = opt::proc::make({1, 1});
+      const auto x = opt::vreg::make(), y = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc), store = opt::bblock::make(pc), trap = opt::bblock::make(pc), exit = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {x}), opt::insn_binop::make_add(entry, x, opt::abs::make(1), y);
+      opt::insn_br::make_beq(entry, x, opt::abs::make(0), store, exit);
+      opt::insn_store::make(store, x, opt::abs::make(0x1000)), opt::insn_jmp::make(store, trap); // not a trap BB itself
+      opt::insn_binop::make_umul(trap, y, y, y), opt::insn_oops::make(trap);
+      opt::insn_ret::make(exit, {y});
+      opt::transform_hot_cold_split(pc);
+      const bool ok = pc->head() == entry && entry->next() == exit && exit->next() == store && store->next() == trap && !entry->cold && !exit->cold &&
+         store->cold && trap->cold && trap->head() == trap->rear();
+      std::printf("hand-built CFG: %s\n", ok ? "ok" : "FAILED");
+      return !ok;
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count) {
+      int bad = 0;
+      unsigned long long oops_before = 0, oops_after = 0, bblocks = 0, cold = 0;
+      ref_interp ref;
+      ref.max_steps = 100'000;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = gen(rng, 3 + seed % 8, 3 + seed % 3, 6);
+         if (seed % 2) opt::transform_to_ssa(pc);
+         opt::transform_insn_simplify(pc), opt::transform_cfg_gc(pc);
+         const std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {7, 1}, {-1ull, 1ull << 63}, {3, 0}};
+         std::vector<std::vector<unsigned long long>> expected;
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         const auto fail = [&](const char *what){ return std::printf("seed %d: %s\n", seed, what), ++bad, false; };
+         const auto compare = [&](const char *when){
+            for (std::size_t sn = 0; sn < args.size(); ++sn) if (RSN_UNLIKELY(rsn::test::observe(ref, pc, args[sn]) != expected[sn])) return fail(when);
+            return true;
+         };
+         const auto count_oops = [&]{
+            unsigned long long res = 0;
+            for (auto bb = pc->head(); bb; bb = bb->next()) res += opt::is<opt::insn_oops>(bb->rear());
+            return res;
+         };
+
+         oops_before += count_oops();
+         opt::transform_hot_cold_split(pc);
+         oops_after += count_oops();
+         for (auto bb = pc->head(); bb; bb = bb->next()) ++bblocks, cold += bb->cold;
+         if (!compare("mismatch after the pass")) continue;
+         if (RSN_UNLIKELY(!cold_last(pc))) { fail("a hot BB after a cold one"); continue; }
+         if (RSN_UNLIKELY(opt::transform_hot_cold_split(pc))) { fail("a second run changed the procedure"); continue; }
+         {  const opt::cfg_info cfg(pc);
+            const opt::loop_forest loops(cfg);
+            opt::transform_block_layout(pc, opt::block_frequency(cfg, loops).weights());
+         }
+         if (!compare("mismatch after block layout")) continue;
+         if (RSN_UNLIKELY(!cold_last(pc))) fail("a hot BB after a cold one after block layout");
+      }
+      std::printf("%d bad of %d; oops BBs %llu -> %llu; %llu of %llu BBs cold\n", bad, count, oops_before, oops_after, cold, bblocks);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   void bench(int count) {
+      std::vector<rsn::lib::smart_ptr<opt::proc>> pcs;
+      std::size_t insns = 0;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         pcs.push_back(gen(rng, 200, 6, 2));
+         opt::transform_insn_simplify(pcs.back()), opt::transform_cfg_gc(pcs.back());
+         for (auto bb = pcs.back()->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) ++insns;
+      }
+      opt::stats = {};
+      const auto start = std::chrono::steady_clock::now();
+      for (const auto &pc: pcs) opt::transform_hot_cold_split(pc);
+      std::printf("%d procedures, %zu insns: %.1f ms (%llu trap BBs merged, %llu BBs marked cold)\n", count, insns,
+         std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), opt::stats.cold_traps_merged, opt::stats.cold_bblocks);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoi(argv[2]) : 200), 0;
+   const int res = check_cfg();
+   return check(argc > 1 ? std::atoi(argv[1]) : 2000) || res;
+}
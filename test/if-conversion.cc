@@ -0,0 +1,146 @@
+// test/if-conversion.cc -- check (and benchmark) of transform_if_conversion
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/if-conversion.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc interp.cc -o if-conversion
+   Running:
+      ./if-conversion [N]        -- N (2000 by default) random procedures of structured code (test/gen.hh), in SSA form after copy propagation
+                                    and DCE, each run with 8 sets of arguments against the reference interpreter before and after 3 rounds of
+                                    if-conversion, cfg_merge, and copy propagation (with a higher misprediction cost and bigger arms for every
+                                    third seed) and simplification of the resulting selects, by the tier-0 interpreter then, and after
+                                    out-of-SSA translation
+      ./if-conversion bench [N]  -- N (3 * 10^7 by default) iterations of a loop with a diamond on a pseudo-random bit and of one with a
+                                    mostly predictable triangle (a running maximum), run by the tier-0 interpreter before and after
+                                    if-conversion (by the static estimate of branch probabilities), best of 5
+   Prints the number of mismatches, the conversions, and the branches executed, or the timings. */
+
+# include "interp.hh"
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <algorithm> // min
+# include <chrono>    // steady_clock
+# include <cstdio>    // printf
+# include <cstdlib>   // atoi, atoll
+# include <cstring>   // memset, strcmp
+# include <random>    // mt19937_64
+# include <vector>    // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count) {
+      int bad = 0;
+      unsigned long long branches_before = 0, branches_after = 0;
+      ref_interp ref;
+      static unsigned long long buffer[4];
+      opt::interpreter interp([](const opt::rel_base *rb)->void *{ return rb == rsn::test::region_gen::buffer ? buffer : nullptr; });
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = rsn::test::gen_regions(rng);
+         const std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {7, 100}, {-1ull, 12345}, {1ull << 63, 3}, {13, 29}, {2, 2}};
+         std::vector<std::vector<unsigned long long>> expected;
+         auto branches = ref.branches;
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         branches_before += ref.branches - branches;
+         opt::transform_to_ssa(pc);
+         opt::transform_copy_propag(pc), opt::transform_dce(pc);
+         opt::if_conversion_params params;
+         if (seed % 3 == 0) params.mispredict_cost = 40, params.max_arm_size = 8;
+         for (int round = 0; round < 3; ++round)
+            opt::transform_if_conversion(pc, params), opt::transform_cfg_merge(pc), opt::transform_copy_propag(pc);
+         for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in: rsn::lib::all(bb)) if (opt::is<opt::insn_select>(in)) in->simplify();
+         const auto compare = [&](const char *when){
+            for (std::size_t sn = 0; sn < args.size(); ++sn) if (RSN_UNLIKELY(rsn::test::observe(ref, pc, args[sn]) != expected[sn]))
+               return std::printf("seed %d: mismatch %s on arguments #%zu\n", seed, when, sn), ++bad, false;
+            return true;
+         };
+         branches = ref.branches;
+         if (!compare("in SSA form")) continue;
+         branches_after += ref.branches - branches;
+         const auto tier0 = [&]{
+            for (std::size_t sn = 0; sn < args.size(); ++sn) {
+               if (expected[sn].back() != ref_interp::_done) continue;
+               std::vector<unsigned long long> results;
+               std::memset(buffer, 0, sizeof buffer);
+               const bool ok = interp.run(pc, args[sn], results);
+               results.push_back(expected[sn][expected[sn].size() - 2]), results.push_back(ref_interp::_done); // (memory hashes are not comparable)
+               if (RSN_UNLIKELY(!ok) || RSN_UNLIKELY(results != expected[sn]))
+                  return std::printf("seed %d: tier-0 mismatch on arguments #%zu\n", seed, sn), ++bad, false;
+            }
+            return true;
+         };
+         if (tier0()) opt::transform_out_of_ssa(pc), compare("after out-of-SSA");
+      }
+      std::printf("%d bad of %d (%llu diamonds and triangles converted, %llu selects emitted); branches executed %llu -> %llu\n", bad, count,
+         opt::stats.if_converted, opt::stats.if_selects, branches_before, branches_after);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   double best(opt::proc *pc, unsigned long long n, unsigned long long &result) {
+      double res = 1e9;
+      for (int round = 0; round < 5; ++round) {
+         opt::interpreter interp;
+         std::vector<unsigned long long> results;
+         interp.run(pc, {1}, results); // translation
+         const auto start = std::chrono::steady_clock::now();
+         interp.run(pc, {n}, results);
+         res = std::min(res, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()), result = results[0];
+      }
+      return res;
+   }
+
+   void bench(unsigned long long n) {
+      for (int which = 0; which < 2; ++which) {
+         const auto pc = opt::proc::make({1, 1});
+         const auto a = opt::vreg::make(), r = opt::vreg::make(), i = opt::vreg::make(), hash = opt::vreg::make(), x = opt::vreg::make();
+         const auto entry = opt::bblock::make(pc), header = opt::bblock::make(pc), body = opt::bblock::make(pc), then = opt::bblock::make(pc),
+            _else = opt::bblock::make(pc), join = opt::bblock::make(pc), exit = opt::bblock::make(pc);
+         opt::insn_entry::make(entry, {a});
+         opt::insn_mov::make(entry, opt::abs::make(0), r), opt::insn_mov::make(entry, opt::abs::make(0), i), opt::insn_jmp::make(entry, header);
+         opt::insn_br::make_bult(header, i, a, body, exit);
+         opt::insn_binop::make_umul(body, i, opt::abs::make(0x9E3779B97F4A7C15), hash), opt::insn_binop::make_ushr(body, hash, opt::abs::make(60), x);
+         if (which == 0) { // a diamond on a pseudo-random bit: r += x or r -= 1
+            opt::insn_br::make_bult(body, x, opt::abs::make(8), then, _else);
+            opt::insn_binop::make_add(then, r, x, r), opt::insn_jmp::make(then, join);
+            opt::insn_binop::make_sub(_else, r, opt::abs::make(1), r), opt::insn_jmp::make(_else, join);
+         } else { // a triangle: r = max(r, x << 4), mostly predictable
+            const auto y = opt::vreg::make();
+            opt::insn_binop::make_shl(body, x, opt::abs::make(4), y);
+            opt::insn_br::make_bult(body, r, y, then, join);
+            opt::insn_mov::make(then, y, r), opt::insn_jmp::make(then, join);
+            opt::insn_jmp::make(_else, join);
+         }
+         opt::insn_binop::make_add(join, i, opt::abs::make(1), i), opt::insn_jmp::make(join, header);
+         opt::insn_ret::make(exit, {r});
+         opt::transform_cfg_gc(pc);
+         opt::transform_to_ssa(pc);
+         opt::transform_copy_propag(pc), opt::transform_dce(pc);
+         unsigned long long before, after;
+         const double before_ms = best(pc, n, before);
+         opt::transform_if_conversion(pc);
+         opt::transform_cfg_merge(pc), opt::transform_copy_propag(pc), opt::transform_dce(pc);
+         const double after_ms = best(pc, n, after);
+         std::printf("%-17s %.1f ms -> %.1f ms (%.2fx), results %s\n", which ? "max (triangle):" : "random diamond:", before_ms, after_ms,
+            before_ms / after_ms, before == after ? "agree" : "DIFFER");
+      }
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoll(argv[2]) : 30'000'000), 0;
+   return check(argc > 1 ? std::atoi(argv[1]) : 2000);
+}
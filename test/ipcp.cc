@@ -0,0 +1,322 @@
+// test/ipcp.cc -- check (and benchmark) of transform_ipcp
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/ipcp.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc interp.cc -o ipcp
+   Running:
+      ./ipcp [N]        -- hand-built cases (a param bound in place, call sites redirected to shared clones, a clone reused by a later run
+                           with the same cache, and the max_clones limit), then N (3000 by default) random programs of one to three callers
+                           of a procedure of structured code (test/gen.hh), now and then through a recursive wrapper, and with the address
+                           of the procedure escaping every fifth seed, each with the procedure internal or not and with the callers
+                           optimized at O2 afterwards or not; a second run of the pass must change nothing, a procedure that is not
+                           internal (or whose address escapes) must be intact, the clones must have distinct symbols, and the callers
+                           must agree with the reference interpreter on 6 sets of arguments
+      ./ipcp bench [N]  -- the median compile time (of 21) at O2 with inlining, without it, and with the pass before it, for a procedure
+                           calling another one four times with some constant arguments, and the time to run it for N (2 * 10^6 by
+                           default) iterations by the tier-0 interpreter (best of 5)
+   Prints the outcome of each case, the number of mismatches, and the params bound, clones made, and call sites redirected, or the
+   figures. */
+
+# include "interp.hh"
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <algorithm> // count, min, sort, unique
+# include <chrono>    // steady_clock
+# include <cstdio>    // printf
+# include <cstdlib>   // atoi, atoll
+# include <cstring>   // strcmp
+# include <random>    // mt19937_64
+# include <utility>   // pair
+# include <vector>    // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   std::size_t size(opt::proc *pc) {
+      std::size_t res = 0;
+      for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) ++res;
+      return res;
+   }
+
+   // the dests of the insn_call insns in the procedures, in order
+   std::vector<opt::proc *> dests(const std::vector<opt::proc *> &pcs) {
+      std::vector<opt::proc *> res;
+      for (auto pc: pcs) for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next())
+         if (opt::is<opt::insn_call>(in)) res.push_back(opt::as<opt::proc>(opt::as<opt::insn_call>(in)->dest()));
+      return res;
+   }
+
+   // Hand-Built Cases /////////////////////////////////////////////////////////////////////////////
+   int failures;
+
+   // f(x, k) = (x ^ k) * k + 1
+   rsn::lib::smart_ptr<opt::proc> make_callee() {
+      const auto pc = opt::proc::make({10, 0});
+      const auto x = opt::vreg::make(), k = opt::vreg::make(), y = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {x, k});
+      opt::insn_binop::make_xor(entry, x, k, y), opt::insn_binop::make_umul(entry, y, k, y), opt::insn_binop::make_add(entry, y, opt::abs::make(1), y);
+      opt::insn_ret::make(entry, {y});
+      return pc;
+   }
+
+   // g(a) = f(a, k1) + f(a, k2) + ... (with its own symbol)
+   rsn::lib::smart_ptr<opt::proc> make_caller(unsigned long long id, opt::proc *callee, const std::vector<unsigned long long> &ks) {
+      const auto pc = opt::proc::make({11, id});
+      const auto a = opt::vreg::make(), r = opt::vreg::make(), t = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {a}), opt::insn_mov::make(entry, opt::abs::make(0), r);
+      for (auto k: ks) opt::insn_call::make(entry, callee, {a, opt::abs::make(k)}, {t}), opt::insn_binop::make_add(entry, r, t, r);
+      opt::insn_ret::make(entry, {r});
+      return pc;
+   }
+
+   void report(const char *name, bool ok) { std::printf("%-44s %s\n", name, ok ? "ok" : "FAILED"), failures += !ok; }
+
+   // the results of the callers before the pass must be reproduced after it, and a second run must change nothing
+   bool run_pass(const std::vector<opt::proc *> &pcs, const std::vector<opt::proc *> &internal, opt::specialization_cache &cache,
+      const opt::ipcp_params &params = {}) {
+      ref_interp ref;
+      std::vector<std::vector<unsigned long long>> expected;
+      for (auto pc: pcs) for (unsigned long long a: {0, 3, 12345}) expected.push_back(rsn::test::observe(ref, pc, {a}));
+      if (!opt::transform_ipcp(pcs, internal, cache, params) || opt::transform_ipcp(pcs, internal, cache, params)) return false;
+      std::size_t sn = 0;
+      for (auto pc: pcs) for (unsigned long long a: {0, 3, 12345}) if (rsn::test::observe(ref, pc, {a}) != expected[sn++]) return false;
+      return true;
+   }
+
+   void cases() {
+      {  // all call sites of an internal callee agree on k
+         const auto f = make_callee(), g = make_caller(1, f, {5, 5});
+         opt::specialization_cache cache;
+         opt::stats = {};
+         const auto entry = f->head()->head();
+         bool ok = run_pass({g, f}, {f}, cache);
+         ok &= opt::stats.ipcp_bound == 1 && !opt::stats.ipcp_clones && dests({g}) == std::vector<opt::proc *>{f, f} &&
+            opt::is<opt::insn_mov>(entry->next()) && opt::is<opt::abs>(opt::as<opt::insn_mov>(entry->next())->src()) &&
+            opt::as<opt::abs>(opt::as<opt::insn_mov>(entry->next())->src())->val == 5;
+         report("param bound in place", ok);
+      }
+      {  // the same callee, not internal, called with k = 5, 7, and 5 again
+         const auto f = make_callee(), g = make_caller(1, f, {5, 7, 5});
+         const auto f_size = size(f);
+         opt::specialization_cache cache;
+         opt::stats = {};
+         bool ok = run_pass({g, f}, {}, cache);
+         const auto _dests = dests({g});
+         ok &= !opt::stats.ipcp_bound && opt::stats.ipcp_clones == 2 && opt::stats.ipcp_redirected == 3 && cache.size() == 2 && size(f) == f_size;
+         ok &= _dests[0] == _dests[2] && _dests[0] != _dests[1] && _dests[0] != f && _dests[1] != f && _dests[0]->id != _dests[1]->id &&
+            _dests[0]->id != f->id && _dests[1]->id != f->id;
+         report("call sites redirected to shared clones", ok);
+
+         // another program with the same cache
+         const auto h = make_caller(2, f, {7, 9});
+         opt::stats = {};
+         ok = run_pass({h, f}, {}, cache);
+         ok &= opt::stats.ipcp_clones == 1 && cache.size() == 3 && dests({h})[0] == _dests[1];
+         report("clone reused by a later run", ok);
+      }
+      {  // k = 1 to 6 with at most 4 clones
+         const auto f = make_callee(), g = make_caller(1, f, {1, 2, 3, 4, 5, 6});
+         opt::specialization_cache cache;
+         opt::ipcp_params params;
+         params.max_clones = 4;
+         opt::stats = {};
+         bool ok = run_pass({g, f}, {}, cache, params);
+         const auto _dests = dests({g});
+         ok &= opt::stats.ipcp_clones == 4 && cache.size() == 4 && std::count(_dests.begin(), _dests.end(), f) == 2;
+         report("max_clones limit", ok);
+      }
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   // a caller of callee with random constant and variable arguments, storing the address of callee first if requested
+   rsn::lib::smart_ptr<opt::proc> make_caller(std::mt19937_64 &rng, opt::proc *callee, bool escape) {
+      const auto pc = opt::proc::make({rng(), rng()});
+      const auto a = opt::vreg::make(), b = opt::vreg::make(), r = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {a, b}), opt::insn_mov::make(entry, opt::abs::make(0), r);
+      if (escape) opt::insn_store::make(entry, callee, opt::rel_disp::make(rsn::test::region_gen::buffer, 0));
+      for (int count = 1 + rng() % 3; count; --count) {
+         const auto arg = [&]()->rsn::lib::smart_ptr<opt::operand>{
+            switch (rng() % 4) {
+            case 0:  return a;
+            case 1:  return b;
+            default: return opt::abs::make(rng() % 3 * 4 + 1);
+            }
+         };
+         const auto t = opt::vreg::make();
+         const auto x = arg(), y = arg();
+         opt::insn_call::make(entry, callee, {x, y}, {t});
+         opt::insn_binop::make_umul(entry, r, opt::abs::make(31), r), opt::insn_binop::make_add(entry, r, t, r);
+      }
+      opt::insn_ret::make(entry, {r});
+      return pc;
+   }
+
+   // w(a, b) = b == 0 ? callee(a, c) : callee(w(a + 1, 0), 9)
+   rsn::lib::smart_ptr<opt::proc> make_wrapper(std::mt19937_64 &rng, opt::proc *callee) {
+      const auto pc = opt::proc::make({rng(), rng()});
+      const auto a = opt::vreg::make(), b = opt::vreg::make(), r = opt::vreg::make(), _r = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc), base = opt::bblock::make(pc), rec = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {a, b}), opt::insn_br::make_beq(entry, b, opt::abs::make(0), base, rec);
+      opt::insn_call::make(base, callee, {a, opt::abs::make(rng() % 3)}, {r}), opt::insn_ret::make(base, {r});
+      opt::insn_binop::make_add(rec, a, opt::abs::make(1), a), opt::insn_call::make(rec, pc, {a, opt::abs::make(0)}, {r});
+      opt::insn_call::make(rec, callee, {r, opt::abs::make(9)}, {_r}), opt::insn_ret::make(rec, {_r});
+      return pc;
+   }
+
+   int check(int count) {
+      int bad = 0, runs = 0;
+      ref_interp ref;
+      ref.max_steps = 200'000;
+      const std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {7, 100}, {-1ull, 12345}, {13, 29}};
+      opt::stats = {};
+      for (int seed = 0; seed < count; ++seed) for (int mode = 0; mode < 4; ++mode) {
+         std::mt19937_64 rng(seed);
+         const bool internal = mode & 1, optimize = mode & 2, escape = seed % 5 == 0;
+         const auto callee = opt::proc::make({rng(), rng()});
+         {  rsn::test::region_gen gen(rng);
+            const auto bb = gen.region(callee, gen.entry(callee));
+            opt::insn_ret::make(bb, {gen.vrs[0]});
+         }
+         if (seed % 3 == 0) opt::optimize(callee);
+         const auto wrapper = seed % 4 == 1 ? make_wrapper(rng, callee) : callee;
+         std::vector<rsn::lib::smart_ptr<opt::proc>> callers;
+         for (int sn = 1 + rng() % 3; sn; --sn) callers.push_back(make_caller(rng, wrapper, escape && sn == 1));
+         std::vector<opt::proc *> procs(callers.begin(), callers.end());
+         procs.push_back(callee);
+         if (wrapper != callee) procs.push_back(wrapper);
+         std::vector<opt::proc *> _internal;
+         if (internal) _internal.push_back(callee), _internal.push_back(wrapper);
+
+         std::vector<std::vector<unsigned long long>> expected, expected_callee;
+         for (const auto &caller: callers) for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, caller, _args));
+         for (const auto &_args: args) expected_callee.push_back(rsn::test::observe(ref, callee, _args));
+         const auto callee_size = size(callee);
+         const auto fail = [&](const char *what){ return std::printf("seed %d, mode %d: %s\n", seed, mode, what), ++bad, false; };
+         const auto verify = [&]{
+            opt::specialization_cache cache;
+            opt::transform_ipcp(procs, _internal, cache);
+            if (RSN_UNLIKELY(opt::transform_ipcp(procs, _internal, cache))) return fail("a second run changed the program");
+            if (!internal || escape) {
+               if (RSN_UNLIKELY(size(callee) != callee_size)) return fail("an external callee changed");
+               for (std::size_t sn = 0; sn < args.size(); ++sn) if (RSN_UNLIKELY(rsn::test::observe(ref, callee, args[sn]) != expected_callee[sn]))
+                  return fail("an external callee changed");
+            }
+            auto _dests = dests(std::vector<opt::proc *>(callers.begin(), callers.end()));
+            _dests.push_back(callee), std::sort(_dests.begin(), _dests.end()), _dests.erase(std::unique(_dests.begin(), _dests.end()), _dests.end());
+            for (auto it = _dests.begin(); it != _dests.end(); ++it) for (auto _it = it + 1; _it != _dests.end(); ++_it)
+               if (RSN_UNLIKELY((*it)->id == (*_it)->id)) return fail("clones with the same symbol");
+            if (optimize) {
+               for (auto pc: _dests) opt::optimize(pc, opt::O1);
+               for (const auto &caller: callers) opt::optimize(caller);
+            }
+            for (std::size_t sn = 0; sn < callers.size(); ++sn) for (std::size_t _sn = 0; _sn < args.size(); ++_sn) {
+               const auto &_expected = expected[sn * args.size() + _sn];
+               if (_expected.back() == ref_interp::_cut_off) continue;
+               if (RSN_UNLIKELY(rsn::test::observe(ref, callers[sn], args[_sn]) != _expected)) return fail("mismatch");
+            }
+            return true;
+         };
+         ++runs, verify();
+      }
+      std::printf("%d bad of %d runs; %llu params bound, %llu clones, %llu call sites redirected\n", bad, runs, opt::stats.ipcp_bound,
+         opt::stats.ipcp_clones, opt::stats.ipcp_redirected);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   // poly(n, k, m) = sum for i < n of (i / k) ^ (i * m) ^ (i % k)
+   rsn::lib::smart_ptr<opt::proc> make_poly() {
+      const auto pc = opt::proc::make({77, 0});
+      const auto n = opt::vreg::make(), k = opt::vreg::make(), m = opt::vreg::make(), r = opt::vreg::make(), i = opt::vreg::make(),
+         q = opt::vreg::make(), p = opt::vreg::make(), s = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc), header = opt::bblock::make(pc), body = opt::bblock::make(pc), exit = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {n, k, m}), opt::insn_mov::make(entry, opt::abs::make(0), r), opt::insn_mov::make(entry, opt::abs::make(0), i);
+      opt::insn_jmp::make(entry, header);
+      opt::insn_br::make_bult(header, i, n, body, exit);
+      opt::insn_binop::make_udiv(body, i, k, q), opt::insn_binop::make_umul(body, i, m, p), opt::insn_binop::make_urem(body, i, k, s);
+      opt::insn_binop::make_xor(body, q, p, q), opt::insn_binop::make_xor(body, q, s, q), opt::insn_binop::make_add(body, r, q, r);
+      opt::insn_binop::make_add(body, i, opt::abs::make(1), i), opt::insn_jmp::make(body, header);
+      opt::insn_ret::make(exit, {r});
+      return pc;
+   }
+
+   // main(n) = poly(n, 4, 3) + poly(n, 8, 3) + poly(n, 4, 3) + poly(n / 2, 4, 3) (the m arguments agree, and the k ones do not)
+   rsn::lib::smart_ptr<opt::proc> make_main(opt::proc *poly) {
+      const auto pc = opt::proc::make({78, 0});
+      const auto n = opt::vreg::make(), r = opt::vreg::make(), t = opt::vreg::make(), h = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {n}), opt::insn_mov::make(entry, opt::abs::make(0), r), opt::insn_binop::make_ushr(entry, n, opt::abs::make(1), h);
+      for (auto [x, k]: std::vector<std::pair<opt::vreg *, unsigned long long>>{{n, 4}, {n, 8}, {n, 4}, {h, 4}})
+         opt::insn_call::make(entry, poly, {x, opt::abs::make(k), opt::abs::make(3)}, {t}), opt::insn_binop::make_add(entry, r, t, r);
+      opt::insn_ret::make(entry, {r});
+      return pc;
+   }
+
+   std::vector<opt::proc *> unique_dests(opt::proc *pc) {
+      auto res = dests({pc});
+      std::sort(res.begin(), res.end()), res.erase(std::unique(res.begin(), res.end()), res.end());
+      return res;
+   }
+
+   void config(const char *title, bool inlining, bool ipcp, unsigned long long n) {
+      std::vector<double> compile_us;
+      rsn::lib::smart_ptr<opt::proc> pc;
+      std::size_t procs = 0, insns = 0;
+      for (int round = 0; round < 21; ++round) {
+         const auto poly = make_poly();
+         pc = make_main(poly);
+         opt::specialization_cache cache;
+         opt::opt_budget budget;
+         if (!inlining) budget.inline_depth = 0;
+         const auto start = std::chrono::steady_clock::now();
+         if (ipcp) opt::transform_ipcp({pc, poly}, {poly}, cache);
+         for (auto _pc: unique_dests(pc)) opt::optimize(_pc, opt::O2, budget);
+         opt::optimize(pc, opt::O2, budget);
+         compile_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+         const auto _dests = unique_dests(pc);
+         procs = 1 + _dests.size(), insns = size(pc);
+         for (auto _pc: _dests) insns += size(_pc);
+      }
+      std::sort(compile_us.begin(), compile_us.end());
+      double res = 1e9;
+      unsigned long long result = 0;
+      for (int round = 0; round < 5; ++round) {
+         opt::interpreter interp;
+         std::vector<unsigned long long> results;
+         interp.run(pc, {1}, results); // translation
+         const auto start = std::chrono::steady_clock::now();
+         interp.run(pc, {n}, results);
+         res = std::min(res, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()), result = results[0];
+      }
+      std::printf("%-24s compile %8.1f us, %zu procedures, %4zu insns, run %6.1f ms, result %016llx\n", title, compile_us[compile_us.size() / 2],
+         procs, insns, res, result);
+   }
+
+   void bench(unsigned long long n) {
+      config("O2 with inlining", true, false, n);
+      config("O2 without inlining", false, false, n);
+      config("IPCP + O2 w/o inlining", false, true, n);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoll(argv[2]) : 2'000'000), 0;
+   cases();
+   std::printf("%d failures\n", failures);
+   return check(argc > 1 ? std::atoi(argv[1]) : 3000) || failures;
+}
@@ -0,0 +1,116 @@
+// test/jump-threading.cc -- check (and benchmark) of transform_jump_threading
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/jump-threading.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc -o jump-threading
+   Running:
+      ./jump-threading [N]        -- N (10000 by default) random procedures of unstructured code (test/gen.hh, with division every other seed),
+                                     each run with 7 sets of arguments against the reference interpreter after each pass of 4 rounds of
+                                     cleanup (const and copy propagation, jump threading, cfg_gc, cfg_merge, DCE, and insn simplification), or
+                                     in SSA form every third seed (jump threading, cfg_gc, and cfg_merge only, then out-of-SSA translation);
+                                     phi insns must stay at the start of BBs
+      ./jump-threading bench [N]  -- the time for jump threading in N (200 by default) random procedures of 200 BBs in SSA form
+   Prints the number of mismatches, the threaded edges, and the insns executed before and after, or the figures. */
+
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <chrono>  // steady_clock
+# include <cstdio>  // printf
+# include <cstdlib> // atoi
+# include <cstring> // strcmp
+# include <random>  // mt19937_64
+# include <vector>  // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   bool phis_first(opt::proc *pc) {
+      for (auto bb = pc->head(); bb; bb = bb->next()) {
+         auto in = bb->head();
+         while (opt::is<opt::insn_phi>(in)) in = in->next();
+         for (; in; in = in->next()) if (RSN_UNLIKELY(opt::is<opt::insn_phi>(in))) return false;
+      }
+      return true;
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count) {
+      int bad = 0;
+      ref_interp ref;
+      unsigned long long steps_before = 0, steps_after = 0;
+      opt::stats = {};
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = rsn::test::gen(rng, 3 + seed % 6, 3 + seed % 4, 3, seed % 2);
+         const std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {-1ull, 7}, {100, 1ull << 63}, {2, 2}, {3, 1}};
+         std::vector<std::vector<unsigned long long>> expected;
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         const auto compare = [&](const char *when){
+            for (std::size_t sn = 0; sn < args.size(); ++sn) if (RSN_UNLIKELY(rsn::test::observe(ref, pc, args[sn]) != expected[sn]))
+               return std::printf("seed %d: mismatch after %s on arguments #%zu\n", seed, when, sn), ++bad, false;
+            if (RSN_UNLIKELY(!phis_first(pc))) return std::printf("seed %d: phi insns misplaced after %s\n", seed, when), ++bad, false;
+            return true;
+         };
+         const auto steps = [&]{
+            unsigned long long res = 0;
+            for (const auto &_args: args) rsn::test::observe(ref, pc, _args), res += ref.steps;
+            return res;
+         };
+         const bool ssa = seed % 3 == 0;
+         if (ssa) {
+            opt::transform_to_ssa(pc);
+            if (!compare("SSA construction")) continue;
+         }
+         steps_before += steps();
+         for (int round = 0; round < 4; ++round) {
+            if (!ssa && (opt::transform_const_propag(pc), !compare("const_propag"))) goto next;
+            if (!ssa && (opt::transform_copy_propag(pc), !compare("copy_propag"))) goto next;
+            if (opt::transform_jump_threading(pc), !compare("jump_threading")) goto next;
+            if (opt::transform_cfg_gc(pc), !compare("cfg_gc")) goto next;
+            if (opt::transform_cfg_merge(pc), !compare("cfg_merge")) goto next;
+            if (!ssa && (opt::transform_dce(pc), !compare("dce"))) goto next;
+            if (!ssa && (opt::transform_insn_simplify(pc), !compare("insn_simplify"))) goto next;
+         }
+         steps_after += steps();
+         if (ssa) opt::transform_out_of_ssa(pc), compare("out-of-SSA");
+      next:;
+      }
+      std::printf("%d bad of %d (%llu jumps forwarded, %llu branches threaded); insns executed %llu -> %llu\n", bad, count,
+         opt::stats.jt_forwarded, opt::stats.jt_branches, steps_before, steps_after);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   void bench(int count) {
+      std::vector<rsn::lib::smart_ptr<opt::proc>> pcs;
+      std::size_t insns = 0;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         pcs.push_back(rsn::test::gen(rng, 200, 6, 2));
+         opt::transform_to_ssa(pcs.back());
+         for (auto bb = pcs.back()->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) ++insns;
+      }
+      opt::stats = {};
+      const auto start = std::chrono::steady_clock::now();
+      for (const auto &pc: pcs) opt::transform_jump_threading(pc);
+      std::printf("%d procedures, %zu insns: %.1f ms (%llu jumps forwarded, %llu branches threaded)\n", count, insns,
+         std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), opt::stats.jt_forwarded, opt::stats.jt_branches);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoi(argv[2]) : 200), 0;
+   return check(argc > 1 ? std::atoi(argv[1]) : 10000);
+}
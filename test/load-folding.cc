@@ -0,0 +1,125 @@
+// test/load-folding.cc -- check (and table-driven benchmark) of folding loads from immutable data blocks
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/load-folding.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc -o load-folding
+   Running:
+      ./load-folding [N]  -- N (20000 by default) random memory procedures (aligned, unaligned, and out-of-bounds loads from a data block
+                             with a relocatable word, extern symbols, absolute addresses, and pointer VRs) run against the reference
+                             interpreter before and after constant and copy propagation, simplification, and DCE to a fixed point
+      ./load-folding bench -- an unrolled checksum over a 16-entry table plus a switch_br on a table entry, before and after the same loop
+                             (with jump threading, cfg_gc, and cfg_merge added)
+   Prints the number of mismatches and the loads folded, or the insn counts. */
+
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <cstdio>  // printf
+# include <cstdlib> // atoi
+# include <cstring> // strcmp
+# include <random>  // mt19937_64
+# include <vector>  // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   struct counts { unsigned long long insns, loads, data_loads; };
+   counts count(opt::proc *pc) {
+      counts res{};
+      for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) {
+         ++res.insns;
+         if (!opt::is<opt::insn_load>(in)) continue;
+         ++res.loads;
+         opt::operand *const src = opt::as<opt::insn_load>(in)->src();
+         res.data_loads += opt::is<opt::data>(src) || (opt::is<opt::rel_disp>(src) && opt::is<opt::data>(opt::as<opt::rel_disp>(src)->base));
+      }
+      return res;
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count) {
+      int bad = 0;
+      counts before{}, after{};
+      ref_interp ref;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = rsn::test::gen_mem(rng, 3 + seed % 6, 3 + seed % 3, 6);
+         const std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {7, 1}};
+         std::vector<std::vector<unsigned long long>> expected;
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         const auto _before = ::count(pc);
+         for (bool changed = true; changed;) {
+            changed = false;
+            changed |= opt::transform_const_propag(pc), changed |= opt::transform_copy_propag(pc),
+            changed |= opt::transform_insn_simplify(pc), changed |= opt::transform_dce(pc);
+         }
+         const auto _after = ::count(pc);
+         before.loads += _before.loads, before.data_loads += _before.data_loads, after.loads += _after.loads, after.data_loads += _after.data_loads;
+         for (std::size_t sn = 0; sn < args.size(); ++sn) if (RSN_UNLIKELY(rsn::test::observe(ref, pc, args[sn]) != expected[sn])) {
+            std::printf("seed %d: mismatch\n", seed), ++bad;
+            break;
+         }
+      }
+      std::printf("%d bad of %d; loads %llu -> %llu, of which from the data block at known addresses %llu -> %llu\n", bad, count,
+         before.loads, after.loads, before.data_loads, after.data_loads);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   void bench() {
+      std::vector<rsn::lib::smart_ptr<opt::imm>> values;
+      for (unsigned long long sn = 0; sn < 16; ++sn) values.push_back(opt::abs::make(sn * sn * 2654435761u % 97));
+      const auto table = opt::data::make({100, 1}, std::move(values));
+
+      const auto pc = opt::proc::make({1, 2});
+      const auto x = opt::vreg::make(), sum = opt::vreg::make(), addr = opt::vreg::make(), val = opt::vreg::make(), index = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc), dispatch = opt::bblock::make(pc);
+      std::vector<opt::bblock *> cases;
+      for (int sn = 0; sn < 4; ++sn) cases.push_back(opt::bblock::make(pc));
+      const auto join = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {x}), opt::insn_mov::make(entry, x, sum);
+      for (int sn = 0; sn < 16; ++sn) { // index = sn; addr = table + index * 8; val = *addr; sum = sum * 31 + val
+         opt::insn_mov::make(entry, opt::abs::make(sn), index);
+         opt::insn_binop::make_shl(entry, index, opt::abs::make(3), addr), opt::insn_binop::make_add(entry, table, addr, addr);
+         opt::insn_load::make(entry, addr, val);
+         opt::insn_binop::make_umul(entry, sum, opt::abs::make(31), sum), opt::insn_binop::make_add(entry, sum, val, sum);
+      }
+      opt::insn_jmp::make(entry, dispatch);
+      opt::insn_load::make(dispatch, opt::rel_disp::make(table, 8 * 5), val), opt::insn_binop::make_urem(dispatch, val, opt::abs::make(4), val);
+      opt::insn_switch_br::make(dispatch, val, cases);
+      for (int sn = 0; sn < 4; ++sn) opt::insn_binop::make_add(cases[sn], sum, opt::abs::make(sn), sum), opt::insn_jmp::make(cases[sn], join);
+      opt::insn_ret::make(join, {sum});
+
+      ref_interp ref;
+      std::vector<unsigned long long> results;
+      const auto report = [&](const char *when){
+         const auto counts = count(pc);
+         ref.run(pc, {7}, results);
+         std::printf("%s: %llu insns (%llu loads), %llu executed, result %llu\n", when, counts.insns, counts.loads, ref.steps, results[0]);
+      };
+      report("before");
+      for (bool changed = true; changed;) {
+         changed = false;
+         changed |= opt::transform_const_propag(pc), changed |= opt::transform_copy_propag(pc), changed |= opt::transform_dce(pc),
+         changed |= opt::transform_cfg_gc(pc), changed |= opt::transform_insn_simplify(pc), changed |= opt::transform_jump_threading(pc),
+         changed |= opt::transform_cfg_merge(pc);
+      }
+      report("after");
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(), 0;
+   return check(argc > 1 ? std::atoi(argv[1]) : 20000);
+}
@@ -0,0 +1,90 @@
+// test/load-store-elim.cc -- check (and benchmark) of transform_load_store_elim
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/load-store-elim.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc -o load-store-elim
+   Running:
+      ./load-store-elim [N]        -- N (20000 by default) random procedures with loads and stores (test/gen.hh) in SSA form, each run with
+                                      4 sets of arguments against the reference interpreter (results and the digest of written memory)
+                                      before and after the pass
+      ./load-store-elim bench [N]  -- the time for the pass in N (300 by default) random procedures of 60 BBs
+   Prints the number of mismatches, the pass statistics, and the static loads and stores before and after, or the figures. */
+
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <chrono>  // steady_clock
+# include <cstdio>  // printf
+# include <cstdlib> // atoi
+# include <cstring> // strcmp
+# include <random>  // mt19937_64
+# include <vector>  // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   void count_accesses(opt::proc *pc, unsigned long long &loads, unsigned long long &stores) {
+      for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next())
+         loads += opt::is<opt::insn_load>(in), stores += opt::is<opt::insn_store>(in);
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count) {
+      int bad = 0;
+      ref_interp ref;
+      unsigned long long loads_before = 0, stores_before = 0, loads_after = 0, stores_after = 0;
+      opt::stats = {};
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = rsn::test::gen_mem(rng, 3 + seed % 6, 3 + seed % 3, 6);
+         const std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {7, 1}};
+         std::vector<std::vector<unsigned long long>> expected;
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         opt::transform_to_ssa(pc);
+         count_accesses(pc, loads_before, stores_before);
+         opt::transform_load_store_elim(pc);
+         count_accesses(pc, loads_after, stores_after);
+         for (std::size_t sn = 0; sn < args.size(); ++sn) if (RSN_UNLIKELY(rsn::test::observe(ref, pc, args[sn]) != expected[sn])) {
+            std::printf("seed %d: mismatch on arguments #%zu\n", seed, sn), ++bad;
+            break;
+         }
+      }
+      std::printf("%d bad of %d (%llu loads forwarded, %llu redundant loads, %llu dead stores); static loads %llu -> %llu, stores %llu -> %llu\n",
+         bad, count, opt::stats.mem_forwarded, opt::stats.mem_redundant, opt::stats.mem_dead_stores, loads_before, loads_after, stores_before, stores_after);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   void bench(int count) {
+      std::vector<rsn::lib::smart_ptr<opt::proc>> pcs;
+      std::size_t insns = 0;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         pcs.push_back(rsn::test::gen_mem(rng, 60, 4, 8));
+         opt::transform_to_ssa(pcs.back());
+         for (auto bb = pcs.back()->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) ++insns;
+      }
+      opt::stats = {};
+      const auto start = std::chrono::steady_clock::now();
+      for (const auto &pc: pcs) opt::transform_load_store_elim(pc);
+      std::printf("%d procedures, %zu insns: %.1f ms (%llu loads forwarded, %llu redundant loads, %llu dead stores)\n", count, insns,
+         std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(),
+         opt::stats.mem_forwarded, opt::stats.mem_redundant, opt::stats.mem_dead_stores);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoi(argv[2]) : 300), 0;
+   return check(argc > 1 ? std::atoi(argv[1]) : 20000);
+}
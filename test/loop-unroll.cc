@@ -0,0 +1,123 @@
+// test/loop-unroll.cc -- check (and benchmark) of transform_loop_unroll
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/loop-unroll.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc interp.cc -o loop-unroll
+   Running:
+      ./loop-unroll [N]        -- N (2000 by default) random procedures with one or two (possibly nested) almost counted loops (test/gen.hh),
+                                  in SSA form after value ranges, copy propagation, and DCE, each run with 7 sets of arguments against the
+                                  reference interpreter before and after unrolling (with a smaller maximum factor for every third seed), and
+                                  after out-of-SSA translation; runs cut off before unrolling (loops that never end) are not compared
+      ./loop-unroll bench [N]  -- the iterative factorial loop of README.md and a sum of i * i for i < N (N is 10^8 by default), run by the
+                                  tier-0 interpreter before and after unrolling (followed by copy propagation and cfg_merge), best of 5
+   Prints the number of mismatches and the loops unrolled and peeled, or the timings. */
+
+# include "interp.hh"
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <algorithm> // min
+# include <chrono>    // steady_clock
+# include <cstdio>    // printf
+# include <cstdlib>   // atoi, atoll
+# include <cstring>   // strcmp
+# include <random>    // mt19937_64
+# include <vector>    // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count) {
+      int bad = 0;
+      unsigned long long steps_before = 0, steps_after = 0;
+      ref_interp interp;
+      interp.max_steps = 200000;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = rsn::test::gen_loops(rng);
+         const std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {7, 100}, {-1ull, 12345}, {1ull << 63, 3}, {13, 29}};
+         std::vector<std::vector<unsigned long long>> expected;
+         for (const auto &_args: args) {
+            expected.push_back(rsn::test::observe(interp, pc, _args));
+            if (expected.back().back() != ref_interp::_cut_off) steps_before += interp.steps;
+         }
+         opt::transform_to_ssa(pc);
+         opt::transform_value_ranges(pc), opt::transform_copy_propag(pc), opt::transform_dce(pc);
+         opt::loop_unroll_params params;
+         if (seed % 3 == 0) params.max_factor = 3 + seed % 4;
+         opt::transform_loop_unroll(pc, params);
+         const auto compare = [&](const char *when){
+            for (std::size_t sn = 0; sn < args.size(); ++sn) {
+               if (expected[sn].back() == ref_interp::_cut_off) continue;
+               const auto observed = rsn::test::observe(interp, pc, args[sn]);
+               if (*when == 'i') steps_after += interp.steps;
+               if (RSN_UNLIKELY(observed != expected[sn])) return std::printf("seed %d: mismatch %s on arguments #%zu\n", seed, when, sn), ++bad, false;
+            }
+            return true;
+         };
+         if (compare("in SSA form")) opt::transform_out_of_ssa(pc), compare("after out-of-SSA");
+      }
+      std::printf("%d bad of %d (%llu loops unrolled, %llu peeled); insns executed %llu -> %llu\n", bad, count,
+         opt::stats.loops_unrolled, opt::stats.loops_peeled, steps_before, steps_after);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   double best(opt::proc *pc, unsigned long long n, unsigned long long &result) {
+      double res = 1e9;
+      for (int round = 0; round < 5; ++round) {
+         opt::interpreter interp;
+         std::vector<unsigned long long> results;
+         interp.run(pc, {1}, results); // translation
+         const auto start = std::chrono::steady_clock::now();
+         interp.run(pc, {n}, results);
+         res = std::min(res, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()), result = results[0];
+      }
+      return res;
+   }
+
+   void bench(unsigned long long n) {
+      for (int which = 0; which < 2; ++which) {
+         const auto pc = opt::proc::make({1, 1});
+         const auto a = opt::vreg::make(), r = opt::vreg::make(), i = opt::vreg::make(), t = opt::vreg::make();
+         const auto entry = opt::bblock::make(pc), header = opt::bblock::make(pc), body = opt::bblock::make(pc), exit = opt::bblock::make(pc);
+         opt::insn_entry::make(entry, {a});
+         if (which == 0) { // factorial (README.md)
+            opt::insn_mov::make(entry, opt::abs::make(1), r), opt::insn_jmp::make(entry, header);
+            opt::insn_br::make_bne(header, a, opt::abs::make(0), body, exit);
+            opt::insn_binop::make_umul(body, r, a, r), opt::insn_binop::make_sub(body, a, opt::abs::make(1), a), opt::insn_jmp::make(body, header);
+         } else { // sum of i * i for i < n
+            opt::insn_mov::make(entry, opt::abs::make(0), r), opt::insn_mov::make(entry, opt::abs::make(0), i), opt::insn_jmp::make(entry, header);
+            opt::insn_br::make_bult(header, i, a, body, exit);
+            opt::insn_binop::make_umul(body, i, i, t), opt::insn_binop::make_add(body, r, t, r), opt::insn_binop::make_add(body, i, opt::abs::make(1), i);
+            opt::insn_jmp::make(body, header);
+         }
+         opt::insn_ret::make(exit, {r});
+         opt::transform_to_ssa(pc);
+         unsigned long long before, after;
+         const double before_ms = best(pc, n, before);
+         opt::transform_loop_unroll(pc);
+         opt::transform_copy_propag(pc), opt::transform_cfg_merge(pc), opt::transform_copy_propag(pc);
+         const double after_ms = best(pc, n, after);
+         std::printf("%-16s %.1f ms -> %.1f ms (%.2fx), results %s\n", which ? "sum of squares:" : "factorial:", before_ms, after_ms,
+            before_ms / after_ms, before == after ? "agree" : "DIFFER");
+      }
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoll(argv[2]) : 100'000'000), 0;
+   return check(argc > 1 ? std::atoi(argv[1]) : 2000);
+}
@@ -0,0 +1,144 @@
+// test/memory-ssa.cc -- check (and benchmark) of alias_oracle and memory_ssa
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/memory-ssa.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc -o memory-ssa
+   Running:
+      ./memory-ssa [N]        -- N (3000 by default) random procedures with loads and stores (test/gen.hh) in SSA form, each run with 4 sets of
+                                 arguments by the reference interpreter while checking every dynamic memory access:
+                                 - for a load, the last write to any of its bytes must not be newer than the execution of the clobbering
+                                   def reported by memory_ssa (the entry into the BB for a memory phi, and the start of the run for the
+                                   initial state), and a load without an access (immutable) must read bytes never written;
+                                 - against every earlier access in the same execution of its BB, a no_alias answer of alias_oracle::query
+                                   requires disjoint words and must_alias equal addresses;
+                                 - against the last execution of every other memory insn, likewise with same_instances false
+      ./memory-ssa bench [N]  -- the time to build the oracle and Memory SSA and to query the clobbering def of every load, for N (300 by
+                                 default) random procedures of 60 BBs
+   Prints the number of checks and failures, and the kinds of static clobbers, or the figures. */
+
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <chrono>        // steady_clock
+# include <cstdio>        // printf
+# include <cstdlib>       // atoi
+# include <cstring>       // strcmp
+# include <random>        // mt19937_64
+# include <unordered_map> // unordered_map
+# include <utility>       // pair
+# include <vector>        // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count) {
+      int bad_seeds = 0;
+      unsigned long long clobber_checks = 0, alias_checks = 0, bad = 0, def_clobbers = 0, phi_clobbers = 0, entry_clobbers = 0;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = rsn::test::gen_mem(rng, 3 + seed % 6, 3 + seed % 3, 5);
+         opt::transform_to_ssa(pc);
+         const opt::cfg_info cfg(pc);
+         const opt::alias_oracle oracle(pc);
+         opt::memory_ssa mssa(cfg, oracle);
+         for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next()) if (opt::is<opt::insn_load>(in) && mssa.of(in)) {
+            const auto clobber = mssa.clobbering_def(mssa.of(in));
+            ++(clobber->kind == clobber->_def ? def_clobbers : clobber->kind == clobber->_phi ? phi_clobbers : entry_clobbers);
+         }
+
+         const auto _bad = bad;
+         std::unordered_map<const void *, unsigned long long> last;       // the last execution of insns, and entry into BBs
+         std::unordered_map<unsigned long long, unsigned long long> writes; // the last write to bytes
+         std::unordered_map<const opt::insn *, unsigned long long> addrs;  // the address of the last execution of memory insns
+         std::vector<std::pair<opt::insn *, unsigned long long>> in_bb;    // memory accesses so far in the current execution of a BB
+         unsigned long long step = 0;
+         ref_interp ref;
+         ref.on_insn = [&](opt::insn *in, unsigned long long addr){
+            ++step;
+            if (RSN_UNLIKELY(in == in->owner()->head()) || opt::is<opt::insn_phi>(in->prev())) last[in->owner()] = step, in_bb.clear();
+            const auto address = [](opt::insn *in)->opt::operand *{
+               return opt::is<opt::insn_load>(in) ? (opt::operand *)opt::as<opt::insn_load>(in)->src() : (opt::operand *)opt::as<opt::insn_store>(in)->dest();
+            };
+            if (opt::is<opt::insn_load>(in)) {
+               unsigned long long written = 0; // the newest write to the loaded bytes (0 for none)
+               for (unsigned sn = 0; sn < 8; ++sn) if (const auto it = writes.find(addr + sn); it != writes.end() && it->second > written) written = it->second;
+               if (const auto acc = mssa.of(in)) {
+                  const auto clobber = mssa.clobbering_def(acc);
+                  const auto time = clobber->kind == clobber->_live_on_entry ? 0 : last[clobber->kind == clobber->_phi ? (void *)clobber->bb : clobber->in];
+                  ++clobber_checks;
+                  if (RSN_UNLIKELY(written > time)) ++bad, std::printf("seed %d: a write is newer than the clobbering def\n", seed);
+               } else {
+                  ++clobber_checks;
+                  if (RSN_UNLIKELY(written)) ++bad, std::printf("seed %d: an immutable load reads written bytes\n", seed);
+               }
+            }
+            if (opt::is<opt::insn_load>(in) || opt::is<opt::insn_store>(in)) {
+               const auto verify = [&](opt::insn *other, unsigned long long other_addr, bool same_instances){
+                  const auto res = oracle.query(address(in), address(other), same_instances);
+                  ++alias_checks;
+                  if (RSN_UNLIKELY(res == oracle.no_alias) && RSN_UNLIKELY(addr - other_addr + 7 < 15))
+                     ++bad, std::printf("seed %d: overlapping words deemed not to alias\n", seed);
+                  if (RSN_UNLIKELY(res == oracle.must_alias) && RSN_UNLIKELY(addr != other_addr))
+                     ++bad, std::printf("seed %d: distinct words deemed to alias\n", seed);
+               };
+               for (const auto &[other, other_addr]: in_bb) verify(other, other_addr, true);
+               for (const auto &[other, other_addr]: addrs) if (other != in) verify((opt::insn *)other, other_addr, false);
+               in_bb.emplace_back(in, addr), addrs[in] = addr;
+            }
+            if (opt::is<opt::insn_store>(in)) for (unsigned sn = 0; sn < 8; ++sn) writes[addr + sn] = step;
+            last[in] = step;
+         };
+         for (const auto &args: std::vector<std::vector<unsigned long long>>{{0, 0}, {1, 2}, {5, 3}, {7, 1}}) {
+            last.clear(), writes.clear(), addrs.clear(), in_bb.clear(), step = 0;
+            std::vector<unsigned long long> results;
+            ref.run(pc, args, results);
+         }
+         bad_seeds += bad != _bad;
+      }
+      std::printf("%d bad of %d (%llu clobber checks and %llu alias checks, %llu failed); static clobbers of loads: %llu defs, %llu phis, "
+         "%llu initial state\n", bad_seeds, count, clobber_checks, alias_checks, bad, def_clobbers, phi_clobbers, entry_clobbers);
+      return bad_seeds != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   void bench(int count) {
+      std::vector<rsn::lib::smart_ptr<opt::proc>> pcs;
+      std::size_t insns = 0, loads = 0;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         pcs.push_back(rsn::test::gen_mem(rng, 60, 4, 8));
+         opt::transform_to_ssa(pcs.back());
+         for (auto bb = pcs.back()->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) ++insns;
+      }
+      const auto start = std::chrono::steady_clock::now();
+      double build = 0;
+      for (const auto &pc: pcs) {
+         const auto t0 = std::chrono::steady_clock::now();
+         const opt::cfg_info cfg(pc);
+         const opt::alias_oracle oracle(pc);
+         opt::memory_ssa mssa(cfg, oracle);
+         build += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+         for (auto bb: cfg.rpo) for (auto in = bb->head(); in; in = in->next())
+            if (opt::is<opt::insn_load>(in) && mssa.of(in)) mssa.clobbering_def(mssa.of(in)), ++loads;
+      }
+      std::printf("%d procedures, %zu insns, %zu loads: %.1f ms total, %.1f ms of it building the oracle and Memory SSA\n", count, insns, loads,
+         std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), build);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoi(argv[2]) : 300), 0;
+   return check(argc > 1 ? std::atoi(argv[1]) : 3000);
+}
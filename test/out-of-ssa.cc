@@ -0,0 +1,131 @@
+// test/out-of-ssa.cc -- check (and benchmark) of transform_out_of_ssa
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/out-of-ssa.cc ir0.cc opt-analysis.cc opt-loops.cc opt-simplify.cc ssa.cc ssa-out.cc -o out-of-ssa
+   Running:
+      ./out-of-ssa [N]        -- N (40000 by default) random procedures of unstructured code (test/gen.hh, with division every other seed),
+                                 each run with 5 sets of arguments against the reference interpreter before and after SSA construction,
+                                 after copy propagation in SSA form (two seeds in three, so that phi-related VRs interfere), and after
+                                 out-of-SSA translation (which must leave no phi insns); then the iterative factorial, which must round-trip
+                                 without copies
+      ./out-of-ssa bench [N]  -- the time for SSA construction and out-of-SSA translation of N (500 by default) random procedures of 40 BBs
+   Prints the number of mismatches and the out-of-SSA statistics, or the figures. */
+
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <chrono>  // steady_clock
+# include <cstdio>  // printf
+# include <cstdlib> // atoi
+# include <cstring> // strcmp
+# include <random>  // mt19937_64
+# include <vector>  // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   // replace uses of the destinations of insn_mov with their sources (valid in SSA form only)
+   void copy_propag(opt::proc *pc) {
+      for (bool changed = true; changed;) {
+         changed = false;
+         for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) if (opt::is<opt::insn_mov>(in)) {
+            const auto mov = opt::as<opt::insn_mov>(in);
+            if (mov->src() == mov->dest()) continue;
+            for (auto bb2 = pc->head(); bb2; bb2 = bb2->next()) for (auto in2 = bb2->head(); in2; in2 = in2->next())
+            for (auto &input: in2->inputs()) if (input == mov->dest()) input = mov->src(), changed = true;
+         }
+      }
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count) {
+      int bad = 0;
+      ref_interp ref;
+      opt::stats = {};
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = rsn::test::gen(rng, 3 + seed % 6, 3 + seed % 4, 4, seed % 2);
+         const std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {-1ull, 7}, {100, 1ull << 63}};
+         std::vector<std::vector<unsigned long long>> expected;
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         const auto compare = [&](const char *when){
+            for (std::size_t sn = 0; sn < args.size(); ++sn) if (RSN_UNLIKELY(rsn::test::observe(ref, pc, args[sn]) != expected[sn]))
+               return std::printf("seed %d: mismatch %s on arguments #%zu\n", seed, when, sn), ++bad, false;
+            return true;
+         };
+         opt::transform_to_ssa(pc);
+         if (!compare("in SSA form")) continue;
+         if (seed % 3) {
+            copy_propag(pc);
+            if (!compare("after copy propagation")) continue;
+         }
+         opt::transform_out_of_ssa(pc);
+         for (auto bb = pc->head(); bb; bb = bb->next()) if (RSN_UNLIKELY(opt::is<opt::insn_phi>(bb->head()))) {
+            std::printf("seed %d: phi insns left\n", seed), ++bad;
+            goto next;
+         }
+         compare("after out-of-SSA");
+      next:;
+      }
+      std::printf("%d bad of %d (%llu edges split, %llu VRs coalesced, %llu copies inserted)\n", bad, count,
+         opt::stats.ssa_split_edges, opt::stats.ssa_coalesced, opt::stats.ssa_copies);
+      return bad != 0;
+   }
+
+   // the iterative factorial from main.cc (a loop with two loop-carried VRs)
+   int check_factorial() {
+      const auto pc = opt::proc::make({1, 1});
+      const auto n = opt::vreg::make(), res = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc), header = opt::bblock::make(pc), body = opt::bblock::make(pc), exit = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {n}), opt::insn_mov::make(entry, opt::abs::make(1), res), opt::insn_jmp::make(entry, header);
+      opt::insn_br::make_bne(header, n, opt::abs::make(0), body, exit);
+      opt::insn_binop::make_umul(body, res, n, res), opt::insn_binop::make_sub(body, n, opt::abs::make(1), n), opt::insn_jmp::make(body, header);
+      opt::insn_ret::make(exit, {res});
+      opt::transform_to_ssa(pc);
+      opt::stats = {};
+      opt::transform_out_of_ssa(pc);
+      ref_interp ref;
+      std::vector<unsigned long long> results;
+      const bool ok = ref.run(pc, {10}, results) == ref_interp::_done && results == std::vector<unsigned long long>{3628800};
+      std::printf("factorial: %s, %llu copies inserted\n", ok ? "10! = 3628800" : "MISMATCH", opt::stats.ssa_copies);
+      return !ok || opt::stats.ssa_copies;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   void bench(int count) {
+      std::vector<rsn::lib::smart_ptr<opt::proc>> pcs;
+      std::size_t insns = 0;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         pcs.push_back(rsn::test::gen(rng, 40, 8, 6));
+         for (auto bb = pcs.back()->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) ++insns;
+      }
+      opt::stats = {};
+      const auto t0 = std::chrono::steady_clock::now();
+      for (const auto &pc: pcs) opt::transform_to_ssa(pc);
+      const auto t1 = std::chrono::steady_clock::now();
+      for (const auto &pc: pcs) opt::transform_out_of_ssa(pc);
+      const auto t2 = std::chrono::steady_clock::now();
+      std::printf("%d procedures, %zu insns: SSA construction %.1f ms, out-of-SSA translation %.1f ms (%llu VRs coalesced, %llu copies inserted)\n",
+         count, insns, std::chrono::duration<double, std::milli>(t1 - t0).count(), std::chrono::duration<double, std::milli>(t2 - t1).count(),
+         opt::stats.ssa_coalesced, opt::stats.ssa_copies);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoi(argv[2]) : 500), 0;
+   const int res = check(argc > 1 ? std::atoi(argv[1]) : 40000);
+   return check_factorial() || res;
+}
@@ -0,0 +1,190 @@
+// test/pipeline.cc -- check (and benchmark) of the optimization tiers and compile-time budgets of optimize()
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/pipeline.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc interp.cc -o pipeline
+   Running:
+      ./pipeline [N]        -- N (500 by default) random procedures of structured code (test/gen.hh, with dense operands for every fourth
+                               seed) calling a random multi-exit procedure (itself optimized at O2 for every third seed), each optimized at
+                               O0, O1, and O2 with no budget and with three random work budgets (below 400, below 5000, and 20000 to 40000
+                               insns), and run with 8 sets of arguments against the reference interpreter before and after; the result must
+                               have no phis, and optimize() may report an exhausted budget only when given one
+      ./pipeline bench [N]  -- the median compile time (of 31) at each tier, with no budget and with a work budget of 1500 insns or a time
+                               budget of 30 us at O2, for a loop with a call to a small multi-exit helper (inlined at O2) run for N (2 * 10^7
+                               by default) iterations by the tier-0 interpreter (best of 5), and for a random procedure of 60 BBs (compile
+                               time only)
+   Prints the number of mismatches and the runs stopped by the budget, or the timings. */
+
+# include "interp.hh"
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <algorithm> // min, sort
+# include <chrono>    // steady_clock
+# include <cstdio>    // printf
+# include <cstdlib>   // atoi, atoll
+# include <cstring>   // strcmp
+# include <random>    // mt19937_64
+# include <vector>    // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   std::size_t size(opt::proc *pc) {
+      std::size_t res = 0;
+      for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) ++res;
+      return res;
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   // a caller of a multi-exit callee, with random regions around the call site (the result of the call is redefined now and then)
+   rsn::lib::smart_ptr<opt::proc> make_caller(std::mt19937_64 &rng, bool dense, bool optimize_callee) {
+      rsn::test::region_gen gen(rng, dense);
+      const auto callee = opt::proc::make({rng(), rng()});
+      const auto exit = gen.region(callee, gen.entry(callee)); // (before gen.vrs is read)
+      opt::insn_ret::make(exit, {gen.vrs[0]});
+      if (optimize_callee) opt::optimize(callee);
+      const auto pc = opt::proc::make({rng(), rng()});
+      auto bb = gen.region(pc, gen.entry(pc));
+      opt::insn_call::make(bb, callee, {gen.vrs[0], gen.vrs[2]}, {gen.vrs[3]});
+      if (rng() % 2) opt::insn_binop::make_add(bb, gen.vrs[3], gen.vrs[1], gen.vrs[3]);
+      gen.ret(gen.region(pc, bb));
+      return pc;
+   }
+
+   int check(int count) {
+      int bad = 0, runs = 0, stops = 0;
+      ref_interp ref;
+      ref.max_steps = 200000;
+      const std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {7, 100}, {-1ull, 12345}, {1ull << 63, 3}, {13, 29}, {2, 2}};
+      for (int seed = 0; seed < count; ++seed) for (int level = opt::O0; level <= opt::O2; ++level) for (int kind = 0; kind < 4; ++kind) {
+         opt::opt_budget budget;
+         std::mt19937_64 rng(seed * 7 + kind);
+         if (kind == 1) budget.work = rng() % 400; else
+         if (kind == 2) budget.work = rng() % 5000; else
+         if (kind == 3) budget.work = 20000 + rng() % 20000;
+         rng.seed(seed);
+         const auto pc = make_caller(rng, seed % 4 == 0, seed % 3 == 0);
+         std::vector<std::vector<unsigned long long>> expected;
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         const bool finished = opt::optimize(pc, (opt::opt_level)level, budget);
+         ++runs, stops += !finished;
+         const auto verify = [&]{
+            if (RSN_UNLIKELY(!finished) && !kind) return std::printf("seed %d, level O%d: the budget got exhausted without one\n", seed, level), false;
+            for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) if (RSN_UNLIKELY(opt::is<opt::insn_phi>(in)))
+               return std::printf("seed %d, level O%d, budget #%d: phis left\n", seed, level, kind), false;
+            for (std::size_t sn = 0; sn < args.size(); ++sn) {
+               if (expected[sn].back() == ref_interp::_cut_off) continue;
+               if (RSN_UNLIKELY(rsn::test::observe(ref, pc, args[sn]) != expected[sn]))
+                  return std::printf("seed %d, level O%d, budget #%d: mismatch on arguments #%zu\n", seed, level, kind, sn), false;
+            }
+            return true;
+         };
+         bad += !verify();
+      }
+      std::printf("%d bad of %d runs (%d stopped by the budget)\n", bad, runs, stops);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   // x if x is even, x >> 1 otherwise
+   rsn::lib::smart_ptr<opt::proc> make_helper() {
+      const auto pc = opt::proc::make({99, 0});
+      const auto x = opt::vreg::make(), y = opt::vreg::make(), z = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc), even = opt::bblock::make(pc), odd = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {x});
+      opt::insn_binop::make_and(entry, x, opt::abs::make(1), y), opt::insn_br::make_beq(entry, y, opt::abs::make(0), even, odd);
+      opt::insn_ret::make(even, {x});
+      opt::insn_binop::make_ushr(odd, x, opt::abs::make(1), z), opt::insn_ret::make(odd, {z});
+      return pc;
+   }
+
+   // r = sum for i < n of (i & k ? helper(h) + buf[0] : 1) + (h >> 3) + buf[0], where h = i * C ^ a and k = 3 (recomputed as k * 1),
+   // storing r to buf[1] on each iteration
+   rsn::lib::smart_ptr<opt::proc> make_kernel(opt::proc *helper) {
+      const auto pc = opt::proc::make({1, 0});
+      const auto n = opt::vreg::make(), a = opt::vreg::make(), buf = opt::vreg::make(), buf8 = opt::vreg::make(), r = opt::vreg::make(),
+         i = opt::vreg::make(), k = opt::vreg::make(), m = opt::vreg::make(), h = opt::vreg::make(), c = opt::vreg::make(), w = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc), header = opt::bblock::make(pc), body = opt::bblock::make(pc), then = opt::bblock::make(pc),
+         _else = opt::bblock::make(pc), join = opt::bblock::make(pc), exit = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {n, a, buf}), opt::insn_binop::make_add(entry, buf, opt::abs::make(8), buf8);
+      opt::insn_mov::make(entry, opt::abs::make(0), r), opt::insn_mov::make(entry, opt::abs::make(0), i), opt::insn_mov::make(entry, opt::abs::make(3), k);
+      opt::insn_jmp::make(entry, header);
+      opt::insn_br::make_bult(header, i, n, body, exit);
+      opt::insn_binop::make_and(body, i, k, m), opt::insn_br::make_beq(body, m, opt::abs::make(0), _else, then);
+      opt::insn_binop::make_umul(then, i, opt::abs::make(0x9E3779B97F4A7C15), h), opt::insn_binop::make_xor(then, h, a, h);
+      opt::insn_call::make(then, helper, {h}, {c}), opt::insn_binop::make_add(then, r, c, r);
+      opt::insn_load::make(then, buf, w), opt::insn_binop::make_add(then, r, w, r), opt::insn_jmp::make(then, join);
+      opt::insn_binop::make_add(_else, r, opt::abs::make(1), r), opt::insn_jmp::make(_else, join);
+      opt::insn_binop::make_umul(join, i, opt::abs::make(0x9E3779B97F4A7C15), h), opt::insn_binop::make_xor(join, h, a, h);
+      opt::insn_binop::make_ushr(join, h, opt::abs::make(3), h), opt::insn_binop::make_add(join, r, h, r);
+      opt::insn_load::make(join, buf, w), opt::insn_binop::make_add(join, r, w, r);
+      opt::insn_binop::make_umul(join, k, opt::abs::make(1), k), opt::insn_store::make(join, r, buf8);
+      opt::insn_binop::make_add(join, i, opt::abs::make(1), i), opt::insn_jmp::make(join, header);
+      opt::insn_ret::make(exit, {r});
+      return pc;
+   }
+
+   // level < 0: not optimized
+   template<typename Make> void tier(const char *title, int level, const opt::opt_budget &budget, const char *budget_title, Make make,
+      unsigned long long n) {
+      std::vector<double> compile_us;
+      int stops = 0;
+      std::size_t insns = 0;
+      for (int round = 0; round < 31; ++round) {
+         const auto pc = make();
+         const auto start = std::chrono::steady_clock::now();
+         if (level >= 0) stops += !opt::optimize(pc, (opt::opt_level)level, budget);
+         compile_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+         insns = size(pc);
+      }
+      std::sort(compile_us.begin(), compile_us.end());
+      std::printf("%-7s %-4s %-10s compile %9.1f us, stops %2d of 31, %4zu insns", title, level < 0 ? "none" : level == opt::O0 ? "O0" :
+         level == opt::O1 ? "O1" : "O2", budget_title, compile_us[compile_us.size() / 2], stops, insns);
+      if (n) {
+         const auto pc = make();
+         if (level >= 0) opt::optimize(pc, (opt::opt_level)level, budget);
+         static unsigned long long buffer[2] = {7};
+         double res = 1e9;
+         unsigned long long result = 0;
+         for (int round = 0; round < 5; ++round) {
+            opt::interpreter interp;
+            std::vector<unsigned long long> results;
+            interp.run(pc, {1, 12345, (unsigned long long)buffer}, results); // translation
+            const auto start = std::chrono::steady_clock::now();
+            interp.run(pc, {n, 12345, (unsigned long long)buffer}, results);
+            res = std::min(res, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()), result = results[0];
+         }
+         std::printf(", run %7.1f ms, result %016llx", res, result);
+      }
+      std::printf("\n");
+   }
+
+   void bench(unsigned long long n) {
+      const auto helper = make_helper();
+      const auto kernel = [&]{ return make_kernel(helper); };
+      const auto random = []{ std::mt19937_64 rng(42); return rsn::test::gen(rng, 60, 8, 8); };
+      opt::opt_budget none, work, time;
+      work.work = 1500, time.time = std::chrono::microseconds(30);
+      for (int level = -1; level <= opt::O2; ++level) tier("kernel", level, none, "", kernel, n);
+      tier("kernel", opt::O2, work, "work=1500", kernel, n), tier("kernel", opt::O2, time, "time=30us", kernel, n);
+      for (int level = -1; level <= opt::O2; ++level) tier("random", level, none, "", random, 0);
+      tier("random", opt::O2, work, "work=1500", random, 0), tier("random", opt::O2, time, "time=30us", random, 0);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoll(argv[2]) : 20'000'000), 0;
+   return check(argc > 1 ? std::atoi(argv[1]) : 500);
+}
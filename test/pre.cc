@@ -0,0 +1,172 @@
+// test/pre.cc -- check (and benchmark) of transform_pre
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/pre.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc interp.cc -o pre
+   Running:
+      ./pre [N]        -- N (2000 by default) random procedures of structured code (test/gen.hh), then N ones of dense structured code (where
+                          expressions recur), in SSA form after copy propagation and DCE, each run with 8 sets of arguments against the
+                          reference interpreter before and after PRE (with copy propagation and DCE, to a fixed point within 8 rounds), by
+                          the tier-0 interpreter then, and after out-of-SSA translation; then 3000 random procedures of unstructured code
+                          (with division every other seed), the same way with 4 sets of arguments
+      ./pre bench [N]  -- a loop where the hot arm of a diamond computes (i * C) ^ a and loads a word, and the join recomputes both: binops
+                          and loads evaluated for N = 1000 by the reference interpreter, and the time for N (2 * 10^7 by default) iterations
+                          by the tier-0 interpreter in SSA form and after out-of-SSA translation, before and after PRE, best of 7
+   Prints the number of mismatches, the PRE statistics, and the evaluations, or the figures. */
+
+# include "interp.hh"
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <algorithm> // min
+# include <chrono>    // steady_clock
+# include <cstdio>    // printf
+# include <cstdlib>   // atoi, atoll
+# include <cstring>   // memset, strcmp
+# include <random>    // mt19937_64
+# include <vector>    // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   enum kind { _structured, _dense, _unstructured };
+   int check(int count, kind kind) {
+      static const char *const names[] = {"structured", "dense", "unstructured"};
+      int bad = 0;
+      unsigned long long evals_before = 0, evals_after = 0;
+      ref_interp ref;
+      static unsigned long long buffer[4];
+      opt::interpreter interp([](const opt::rel_base *rb)->void *{ return rb == rsn::test::region_gen::buffer ? buffer : nullptr; });
+      const auto inserted = opt::stats.pre_inserted, deleted = opt::stats.pre_deleted, translated = opt::stats.pre_translated;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = kind == _unstructured ? rsn::test::gen(rng, 7, 4, 5, seed % 2) : rsn::test::gen_regions(rng, kind == _dense);
+         std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {7, 100}};
+         if (kind != _unstructured) args.insert(args.end(), {{-1ull, 12345}, {1ull << 63, 3}, {13, 29}, {2, 2}});
+         std::vector<std::vector<unsigned long long>> expected;
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         opt::transform_to_ssa(pc);
+         opt::transform_copy_propag(pc), opt::transform_dce(pc);
+         auto evals = ref.evals;
+         for (const auto &_args: args) rsn::test::observe(ref, pc, _args);
+         evals_before += ref.evals - evals;
+         int round = 0;
+         for (; round < 8 && opt::transform_pre(pc); ++round) opt::transform_copy_propag(pc), opt::transform_dce(pc);
+         if (RSN_UNLIKELY(round == 8)) {
+            std::printf("seed %d: no fixed point within 8 rounds\n", seed), ++bad;
+            continue;
+         }
+         const auto compare = [&](const char *when){
+            for (std::size_t sn = 0; sn < args.size(); ++sn) if (RSN_UNLIKELY(rsn::test::observe(ref, pc, args[sn]) != expected[sn]))
+               return std::printf("seed %d: mismatch %s on arguments #%zu\n", seed, when, sn), ++bad, false;
+            return true;
+         };
+         const auto tier0 = [&]{
+            for (std::size_t sn = 0; sn < args.size(); ++sn) {
+               if (expected[sn].back() != ref_interp::_done) continue;
+               std::vector<unsigned long long> results;
+               std::memset(buffer, 0, sizeof buffer);
+               const bool ok = interp.run(pc, args[sn], results);
+               results.push_back(expected[sn][expected[sn].size() - 2]), results.push_back(ref_interp::_done); // (memory hashes are not comparable)
+               if (RSN_UNLIKELY(!ok) || RSN_UNLIKELY(results != expected[sn]))
+                  return std::printf("seed %d: tier-0 mismatch on arguments #%zu\n", seed, sn), ++bad, false;
+            }
+            return true;
+         };
+         evals = ref.evals;
+         if (!compare("in SSA form")) continue;
+         evals_after += ref.evals - evals;
+         if (tier0()) opt::transform_out_of_ssa(pc), compare("after out-of-SSA");
+      }
+      std::printf("%s: %d bad of %d (%llu evaluations inserted, %llu deleted, %llu binops translated into phi insns); binops and loads "
+         "evaluated %llu -> %llu\n", names[kind], bad, count, opt::stats.pre_inserted - inserted, opt::stats.pre_deleted - deleted,
+         opt::stats.pre_translated - translated, evals_before, evals_after);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   unsigned long long host[2] = {7, 0};
+
+   double best(opt::proc *pc, unsigned long long n, unsigned long long &result) {
+      double res = 1e9;
+      for (int round = 0; round < 7; ++round) {
+         opt::interpreter interp;
+         std::vector<unsigned long long> results;
+         interp.run(pc, {1, 5, (unsigned long long)host}, results); // translation
+         const auto start = std::chrono::steady_clock::now();
+         interp.run(pc, {n, 12345, (unsigned long long)host}, results);
+         res = std::min(res, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()), result = results[0];
+      }
+      return res;
+   }
+
+   // for (i = 0; i < n; ++i) { if (i & 3) r += (i * C) ^ a, r += buf[0]; else r += 1; r += ((i * C) ^ a) >> 3; r += buf[0]; buf[1] = r; }
+   rsn::lib::smart_ptr<opt::proc> make(unsigned long long id) {
+      const auto pc = opt::proc::make({id, 1});
+      const auto n = opt::vreg::make(), a = opt::vreg::make(), buf = opt::vreg::make(), buf1 = opt::vreg::make(), r = opt::vreg::make(),
+         i = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc), header = opt::bblock::make(pc), body = opt::bblock::make(pc), then = opt::bblock::make(pc),
+         _else = opt::bblock::make(pc), join = opt::bblock::make(pc), exit = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {n, a, buf}), opt::insn_binop::make_add(entry, buf, opt::abs::make(8), buf1);
+      opt::insn_mov::make(entry, opt::abs::make(0), r), opt::insn_mov::make(entry, opt::abs::make(0), i), opt::insn_jmp::make(entry, header);
+      opt::insn_br::make_bult(header, i, n, body, exit);
+      const auto m = opt::vreg::make(), p = opt::vreg::make(), q = opt::vreg::make(), w = opt::vreg::make(), p2 = opt::vreg::make(),
+         q2 = opt::vreg::make(), s = opt::vreg::make(), u = opt::vreg::make();
+      opt::insn_binop::make_and(body, i, opt::abs::make(3), m), opt::insn_br::make_beq(body, m, opt::abs::make(0), _else, then);
+      opt::insn_binop::make_umul(then, i, opt::abs::make(0x9E3779B97F4A7C15), p), opt::insn_binop::make_xor(then, p, a, q);
+      opt::insn_binop::make_add(then, r, q, r), opt::insn_load::make(then, buf, w), opt::insn_binop::make_add(then, r, w, r);
+      opt::insn_jmp::make(then, join);
+      opt::insn_binop::make_add(_else, r, opt::abs::make(1), r), opt::insn_jmp::make(_else, join);
+      opt::insn_binop::make_umul(join, i, opt::abs::make(0x9E3779B97F4A7C15), p2), opt::insn_binop::make_xor(join, p2, a, q2);
+      opt::insn_binop::make_ushr(join, q2, opt::abs::make(3), u), opt::insn_binop::make_add(join, r, u, r);
+      opt::insn_load::make(join, buf, s), opt::insn_binop::make_add(join, r, s, r), opt::insn_store::make(join, r, buf1);
+      opt::insn_binop::make_add(join, i, opt::abs::make(1), i), opt::insn_jmp::make(join, header);
+      opt::insn_ret::make(exit, {r});
+      opt::transform_to_ssa(pc);
+      opt::transform_copy_propag(pc), opt::transform_dce(pc), opt::transform_gcm(pc);
+      return pc;
+   }
+
+   void bench(unsigned long long n) {
+      const auto pc = make(1), baseline = make(2);
+      ref_interp ref;
+      std::vector<unsigned long long> results;
+      const auto evals = [&]{
+         const auto evals = ref.evals;
+         ref.run(pc, {1000, 12345, 1ull << 20}, results);
+         std::printf(" %llu binops and loads evaluated (%llu insns)", ref.evals - evals, ref.steps);
+      };
+      unsigned long long before, after, _before, _after;
+      std::printf("n = 1000, before PRE:"), evals(), std::printf("\n");
+      const double before_ms = best(pc, n, before);
+      opt::transform_pre(pc);
+      opt::transform_copy_propag(pc), opt::transform_dce(pc);
+      std::printf("n = 1000, after PRE: "), evals(), std::printf("\n");
+      const double after_ms = best(pc, n, after);
+      opt::transform_out_of_ssa(baseline), opt::transform_out_of_ssa(pc);
+      const double _before_ms = best(baseline, n, _before), _after_ms = best(pc, n, _after);
+      std::printf("in SSA form:      %.1f ms -> %.1f ms (%.2fx), results %s\n", before_ms, after_ms, before_ms / after_ms,
+         before == after ? "agree" : "DIFFER");
+      std::printf("after out-of-SSA: %.1f ms -> %.1f ms (%.2fx), results %s\n", _before_ms, _after_ms, _before_ms / _after_ms,
+         _before == _after && _before == before ? "agree" : "DIFFER");
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoll(argv[2]) : 20'000'000), 0;
+   const int count = argc > 1 ? std::atoi(argv[1]) : 2000;
+   const int res = check(count, _structured) | check(count, _dense);
+   return check(3000, _unstructured) || res;
+}
@@ -0,0 +1,102 @@
+// test/reassociation.cc -- check (and benchmark) of transform_reassociation
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/reassociation.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc -o reassociation
+   Running:
+      ./reassociation [N]        -- N (3000 by default) random procedures of unstructured code (test/gen.hh) in SSA form, brought to a fixed
+                                    point by copy propagation and DCE, then by the same with reassociation; the latter must reach a fixed
+                                    point too (a further run of the pass changes nothing), and the results must agree with the reference
+                                    interpreter on 5 sets of arguments
+      ./reassociation bench [N]  -- the time for one run of the pass in N (200 by default) random procedures of 200 BBs in SSA form
+   Prints the number of mismatches, the binop insns left without and with reassociation, and the trees rewritten, or the figures. */
+
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <chrono>  // steady_clock
+# include <cstdio>  // printf
+# include <cstdlib> // atoi
+# include <cstring> // strcmp
+# include <random>  // mt19937_64
+# include <vector>  // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   unsigned long long count_binops(opt::proc *pc) {
+      unsigned long long res = 0;
+      for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) res += opt::is<opt::insn_binop>(in);
+      return res;
+   }
+
+   void cleanup(opt::proc *pc, bool reassociation) {
+      for (bool changed = true; changed;) {
+         changed = false;
+         changed |= opt::transform_copy_propag(pc), changed |= opt::transform_dce(pc);
+         if (reassociation) changed |= opt::transform_reassociation(pc);
+      }
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count) {
+      int bad = 0;
+      unsigned long long binops_before = 0, binops_after = 0;
+      ref_interp ref;
+      opt::stats = {};
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = rsn::test::gen(rng, 3 + seed % 6, 3 + seed % 3, 8);
+         const std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {7, 1}, {-1ull, 12345}};
+         std::vector<std::vector<unsigned long long>> expected;
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         opt::transform_to_ssa(pc);
+         cleanup(pc, false), binops_before += count_binops(pc);
+         cleanup(pc, true), binops_after += count_binops(pc);
+         if (RSN_UNLIKELY(opt::transform_reassociation(pc))) {
+            std::printf("seed %d: no fixed point\n", seed), ++bad;
+            continue;
+         }
+         for (std::size_t sn = 0; sn < args.size(); ++sn) if (RSN_UNLIKELY(rsn::test::observe(ref, pc, args[sn]) != expected[sn])) {
+            std::printf("seed %d: mismatch on arguments #%zu\n", seed, sn), ++bad;
+            break;
+         }
+      }
+      std::printf("%d bad of %d; binops after cleanup %llu, after cleanup with reassociation %llu (%llu trees rewritten)\n", bad, count,
+         binops_before, binops_after, opt::stats.reassoc_trees);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   void bench(int count) {
+      std::vector<rsn::lib::smart_ptr<opt::proc>> pcs;
+      std::size_t insns = 0;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         pcs.push_back(rsn::test::gen(rng, 200, 6, 8));
+         opt::transform_to_ssa(pcs.back());
+         for (auto bb = pcs.back()->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) ++insns;
+      }
+      opt::stats = {};
+      const auto start = std::chrono::steady_clock::now();
+      for (const auto &pc: pcs) opt::transform_reassociation(pc);
+      std::printf("%d procedures, %zu insns: %.1f ms (%llu trees rewritten)\n", count, insns,
+         std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), opt::stats.reassoc_trees);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoi(argv[2]) : 200), 0;
+   return check(argc > 1 ? std::atoi(argv[1]) : 3000);
+}
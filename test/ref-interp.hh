@@ -0,0 +1,282 @@
+// test/ref-interp.hh -- reference interpreter for the test drivers (straightforward rather than fast, and independent of interp.cc)
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+
+# ifndef RSN_INCLUDED_TEST_REF_INTERP
+# define RSN_INCLUDED_TEST_REF_INTERP
+
+# include <functional>    // function
+# include <map>           // map
+# include <unordered_map> // unordered_map
+# include <utility>       // pair
+# include <vector>        // vector
+
+# include "opt.hh"
+
+namespace rsn::test {
+
+   /* Execution follows the IR semantics (x86 semantics for shift counts, and a trap on division by zero or overflow, insn_oops, and a
+      switch_br index out of range). Memory is a sparse byte map: each symbol is placed at its own 4 GiB boundary on first reference
+      (for as long as the ref_interp lives, so that addresses agree between runs of the program before and after a transformation),
+      data blocks are initialized on first reference during a run, and other addresses (including absolute ones) read as zero unless
+      written. Memory is cleared at the start of each run. A run exceeding max_steps insns is cut off. Vector VRs hold byte strings (read as
+      scalars by their low 8 bytes), and scalar operands of insn_vbinop are broadcast to all lanes. */
+   class ref_interp {
+   public: // execution
+      enum outcome { _done, _trapped, _cut_off };
+      outcome run(opt::proc *pc, const std::vector<unsigned long long> &args, std::vector<unsigned long long> &results) {
+         memory.clear(), initialized.clear(), steps = 0;
+         return execute(pc, args, results);
+      }
+      // digest of the bytes the last run has written (not counting data block initialization)
+      unsigned long long memory_hash() const noexcept {
+         unsigned long long res = 0xCBF29CE484222325;
+         for (const auto &[addr, byte]: memory) if (byte.second) res = (res ^ addr ^ (unsigned long long)byte.first << 56) * 0x100000001B3;
+         return res;
+      }
+   public: // limits and statistics (the counters accumulate over runs)
+      unsigned long long max_steps = 100'000'000;
+      unsigned long long steps{};    // insns executed by the last run (not counting phi insns)
+      unsigned long long branches{}; // insn_br executed
+      unsigned long long switches{}; // insn_switch_br executed
+      unsigned long long evals{};    // insn_binop, insn_load executed
+   public: // instrumentation
+      // called before each insn other than phi insns is executed, with the address accessed by loads and stores (0 otherwise)
+      std::function<void(opt::insn *, unsigned long long addr)> on_insn;
+      // called on each transfer of control between BBs (of the procedure being run or of a callee)
+      std::function<void(opt::bblock *from, opt::bblock *to)> on_edge;
+   private: // internal representation
+      std::map<unsigned long long, std::pair<unsigned char, bool>> memory;           // byte and whether written by the program
+      std::map<decltype(opt::rel_base::id), unsigned long long> addresses;          // of symbols
+      std::unordered_map<unsigned long long, opt::proc *> procs;                     // by their addresses
+      std::map<decltype(opt::rel_base::id), bool> initialized;                      // data blocks initialized during the run
+      unsigned depth{};
+      struct value {
+         unsigned long long scalar;
+         std::vector<unsigned char> bytes; // for vectors
+      };
+   private: // implementation helpers
+      unsigned long long address(opt::rel_base *rb) {
+         const auto [it, inserted] = addresses.try_emplace(rb->id, (addresses.size() + 1) << 32);
+         if (opt::is<opt::proc>(rb)) procs[it->second] = opt::as<opt::proc>(rb);
+         if (opt::is<opt::data>(rb) && !initialized[rb->id]) {
+            initialized[rb->id] = true;
+            const auto &values = opt::as<opt::data>(rb)->values;
+            for (std::size_t sn = 0; sn < values.size(); ++sn) {
+               unsigned long long val = 0;
+               if (opt::is<opt::abs>(values[sn])) val = opt::as<opt::abs>(values[sn])->val; else
+               if (opt::is<opt::rel_base>(values[sn])) val = address(opt::as<opt::rel_base>(values[sn])); else
+               if (opt::is<opt::rel_disp>(values[sn])) val = address(opt::as<opt::rel_disp>(values[sn])->base) + opt::as<opt::rel_disp>(values[sn])->add;
+               for (unsigned sn2 = 0; sn2 < 8; ++sn2) memory[it->second + sn * 8 + sn2] = {(unsigned char)(val >> sn2 * 8), false};
+            }
+         }
+         return it->second;
+      }
+      unsigned char read(unsigned long long addr) const noexcept {
+         const auto it = memory.find(addr);
+         return it == memory.end() ? 0 : it->second.first;
+      }
+      outcome execute(opt::proc *pc, const std::vector<unsigned long long> &args, std::vector<unsigned long long> &results) {
+         if (RSN_UNLIKELY(!pc->head()) || RSN_UNLIKELY(depth >= 1000)) return _trapped;
+         struct guard { unsigned &depth; guard(unsigned &depth): depth(++depth) {} ~guard() { --depth; } } _guard(depth);
+         opt::cfg_info cfg(pc);
+         std::unordered_map<const opt::operand *, value> regs;
+         const auto scalar = [&](opt::operand *op)->unsigned long long{
+            if (opt::is<opt::abs>(op)) return opt::as<opt::abs>(op)->val;
+            if (opt::is<opt::rel_base>(op)) return address(opt::as<opt::rel_base>(op));
+            if (opt::is<opt::rel_disp>(op)) return address(opt::as<opt::rel_disp>(op)->base) + opt::as<opt::rel_disp>(op)->add;
+            return regs[op].scalar;
+         };
+         const auto set = [&](opt::operand *vr, unsigned long long val){ regs[vr] = {val, {}}; };
+         const auto set_vector = [&](opt::operand *vr, std::vector<unsigned char> bytes){
+            unsigned long long val = 0;
+            for (std::size_t sn = 0; sn < 8 && sn < bytes.size(); ++sn) val |= (unsigned long long)bytes[sn] << sn * 8;
+            regs[vr] = {val, std::move(bytes)};
+         };
+         const auto compare = [](auto op, unsigned long long lhs, unsigned long long rhs) noexcept{
+            return op == 0 ? lhs == rhs : op == 1 ? lhs < rhs : (long long)lhs < (long long)rhs; // _eq/_beq, _ult/_bult, _slt/_bslt
+         };
+
+         opt::bblock *bb = pc->head(), *pred{};
+         for (;;) {
+            auto in = bb->head();
+            if (pred) { // phi insns take their arguments simultaneously
+               if (RSN_UNLIKELY(on_edge)) on_edge(pred, bb);
+               const auto sn = cfg.pred_index(bb, pred);
+               std::vector<std::pair<opt::operand *, value>> copies;
+               for (; opt::is<opt::insn_phi>(in); in = in->next()) {
+                  const auto arg = opt::as<opt::insn_phi>(in)->args()[sn];
+                  copies.emplace_back(opt::as<opt::insn_phi>(in)->dest(), opt::is<opt::vreg>(arg) ? regs[arg] : value{scalar(arg), {}});
+               }
+               for (auto &copy: copies) regs[copy.first] = std::move(copy.second);
+            }
+            for (;; in = in->next()) {
+               if (RSN_UNLIKELY(!in) || RSN_UNLIKELY(opt::is<opt::insn_phi>(in))) return _trapped; // malformed
+               if (RSN_UNLIKELY(++steps > max_steps)) return _cut_off;
+               if (RSN_UNLIKELY(on_insn)) on_insn(in, opt::is<opt::insn_load>(in) ? scalar(opt::as<opt::insn_load>(in)->src()) :
+                  opt::is<opt::insn_store>(in) ? scalar(opt::as<opt::insn_store>(in)->dest()) :
+                  opt::is<opt::insn_vload>(in) ? scalar(opt::as<opt::insn_vload>(in)->src()) :
+                  opt::is<opt::insn_vstore>(in) ? scalar(opt::as<opt::insn_vstore>(in)->dest()) : 0);
+               if (opt::is<opt::insn_entry>(in)) {
+                  if (RSN_UNLIKELY(args.size() != opt::as<opt::insn_entry>(in)->params().size())) return _trapped;
+                  for (std::size_t sn = 0; sn < args.size(); ++sn) set(opt::as<opt::insn_entry>(in)->params()[sn], args[sn]);
+               } else
+               if (opt::is<opt::insn_mov>(in)) {
+                  const auto mov = opt::as<opt::insn_mov>(in);
+                  if (opt::is<opt::vreg>(mov->src())) regs[mov->dest()] = value(regs[mov->src()]); else set(mov->dest(), scalar(mov->src()));
+               } else
+               if (opt::is<opt::insn_load>(in)) {
+                  ++evals;
+                  const auto addr = scalar(opt::as<opt::insn_load>(in)->src());
+                  unsigned long long val = 0;
+                  for (unsigned sn = 0; sn < 8; ++sn) val |= (unsigned long long)read(addr + sn) << sn * 8;
+                  set(opt::as<opt::insn_load>(in)->dest(), val);
+               } else
+               if (opt::is<opt::insn_store>(in)) {
+                  const auto addr = scalar(opt::as<opt::insn_store>(in)->dest()), val = scalar(opt::as<opt::insn_store>(in)->src());
+                  for (unsigned sn = 0; sn < 8; ++sn) memory[addr + sn] = {(unsigned char)(val >> sn * 8), true};
+               } else
+               if (opt::is<opt::insn_binop>(in)) {
+                  ++evals;
+                  const auto binop = opt::as<opt::insn_binop>(in);
+                  const auto lhs = scalar(binop->lhs()), rhs = scalar(binop->rhs());
+                  unsigned long long res;
+                  switch (binop->op) {
+                  case opt::insn_binop::_add:   res = lhs + rhs; break;
+                  case opt::insn_binop::_sub:   res = lhs - rhs; break;
+                  case opt::insn_binop::_umul:
+                  case opt::insn_binop::_smul:  res = lhs * rhs; break;
+                  case opt::insn_binop::_udiv:  if (RSN_UNLIKELY(!rhs)) return _trapped; res = lhs / rhs; break;
+                  case opt::insn_binop::_urem:  if (RSN_UNLIKELY(!rhs)) return _trapped; res = lhs % rhs; break;
+                  case opt::insn_binop::_sdiv:
+                     if (RSN_UNLIKELY(!rhs) || RSN_UNLIKELY(rhs == -1ull && lhs == 1ull << 63)) return _trapped;
+                     res = (long long)lhs / (long long)rhs; break;
+                  case opt::insn_binop::_srem:
+                     if (RSN_UNLIKELY(!rhs) || RSN_UNLIKELY(rhs == -1ull && lhs == 1ull << 63)) return _trapped;
+                     res = (long long)lhs % (long long)rhs; break;
+                  case opt::insn_binop::_and:   res = lhs & rhs; break;
+                  case opt::insn_binop::_or:    res = lhs | rhs; break;
+                  case opt::insn_binop::_xor:   res = lhs ^ rhs; break;
+                  case opt::insn_binop::_shl:   res = lhs << (rhs & 0x3F); break;
+                  case opt::insn_binop::_ushr:  res = lhs >> (rhs & 0x3F); break;
+                  case opt::insn_binop::_sshr:  res = (long long)lhs >> (rhs & 0x3F); break;
+                  case opt::insn_binop::_umulh: res = (unsigned __int128)lhs * rhs >> 64; break;
+                  default:                      res = (__int128)(long long)lhs * (long long)rhs >> 64; break; // _smulh
+                  }
+                  set(binop->dest(), res);
+               } else
+               if (opt::is<opt::insn_select>(in)) {
+                  const auto select = opt::as<opt::insn_select>(in);
+                  set(select->dest(), compare(select->op, scalar(select->lhs()), scalar(select->rhs())) ? scalar(select->val1()) : scalar(select->val2()));
+               } else
+               if (opt::is<opt::insn_vload>(in)) {
+                  const auto vload = opt::as<opt::insn_vload>(in);
+                  const auto addr = scalar(vload->src());
+                  std::vector<unsigned char> bytes(vload->lanes * vload->width);
+                  for (std::size_t sn = 0; sn < bytes.size(); ++sn) bytes[sn] = read(addr + sn);
+                  set_vector(vload->dest(), std::move(bytes));
+               } else
+               if (opt::is<opt::insn_vstore>(in)) {
+                  const auto vstore = opt::as<opt::insn_vstore>(in);
+                  const auto addr = scalar(vstore->dest());
+                  auto bytes = opt::is<opt::vreg>(vstore->src()) ? regs[vstore->src()].bytes : std::vector<unsigned char>{};
+                  bytes.resize(vstore->lanes * vstore->width);
+                  for (std::size_t sn = 0; sn < bytes.size(); ++sn) memory[addr + sn] = {bytes[sn], true};
+               } else
+               if (opt::is<opt::insn_vbinop>(in)) {
+                  const auto vbinop = opt::as<opt::insn_vbinop>(in);
+                  const unsigned width = vbinop->width, bits = width * 8;
+                  const auto lane = [&](opt::operand *op, unsigned sn)->unsigned long long{
+                     unsigned long long res = 0;
+                     if (opt::is<opt::vreg>(op) && !regs[op].bytes.empty()) {
+                        for (unsigned sn2 = 0; sn2 < width; ++sn2)
+                           res |= (unsigned long long)(sn * width + sn2 < regs[op].bytes.size() ? regs[op].bytes[sn * width + sn2] : 0) << sn2 * 8;
+                     } else
+                        res = scalar(op);
+                     return bits == 64 ? res : res & ((1ull << bits) - 1);
+                  };
+                  std::vector<unsigned char> bytes(vbinop->lanes * width);
+                  for (unsigned sn = 0; sn < vbinop->lanes; ++sn) {
+                     const auto lhs = lane(vbinop->lhs(), sn), rhs = lane(vbinop->rhs(), sn);
+                     const auto slhs = bits == 64 ? (long long)lhs : (long long)(lhs << (64 - bits)) >> (64 - bits);
+                     unsigned long long res;
+                     switch (vbinop->op) {
+                     case opt::insn_binop::_add:  res = lhs + rhs; break;
+                     case opt::insn_binop::_sub:  res = lhs - rhs; break;
+                     case opt::insn_binop::_umul:
+                     case opt::insn_binop::_smul: res = lhs * rhs; break;
+                     case opt::insn_binop::_and:  res = lhs & rhs; break;
+                     case opt::insn_binop::_or:   res = lhs | rhs; break;
+                     case opt::insn_binop::_xor:  res = lhs ^ rhs; break;
+                     case opt::insn_binop::_shl:  res = lhs << (rhs & (bits - 1)); break;
+                     case opt::insn_binop::_ushr: res = lhs >> (rhs & (bits - 1)); break;
+                     case opt::insn_binop::_sshr: res = slhs >> (rhs & (bits - 1)); break;
+                     default:                     return _trapped; // unsupported lanewise
+                     }
+                     for (unsigned sn2 = 0; sn2 < width; ++sn2) bytes[sn * width + sn2] = res >> sn2 * 8;
+                  }
+                  set_vector(vbinop->dest(), std::move(bytes));
+               } else
+               if (opt::is<opt::insn_call>(in)) {
+                  const auto call = opt::as<opt::insn_call>(in);
+                  opt::proc *callee;
+                  if (opt::is<opt::proc>(call->dest())) callee = opt::as<opt::proc>(call->dest()); else {
+                     const auto it = procs.find(scalar(call->dest()));
+                     if (RSN_UNLIKELY(it == procs.end())) return _trapped;
+                     callee = it->second;
+                  }
+                  std::vector<unsigned long long> _args, _results;
+                  for (const auto &param: call->params()) _args.push_back(scalar(param));
+                  if (const auto res = execute(callee, _args, _results); RSN_UNLIKELY(res != _done)) return res;
+                  if (RSN_UNLIKELY(_results.size() != call->results().size())) return _trapped;
+                  for (std::size_t sn = 0; sn < _results.size(); ++sn) set(call->results()[sn], _results[sn]);
+               } else
+               if (opt::is<opt::insn_ret>(in)) {
+                  results.clear();
+                  for (const auto &result: opt::as<opt::insn_ret>(in)->results()) results.push_back(scalar(result));
+                  return _done;
+               } else
+               if (opt::is<opt::insn_jmp>(in)) {
+                  pred = bb, bb = opt::as<opt::insn_jmp>(in)->dest();
+                  break;
+               } else
+               if (opt::is<opt::insn_br>(in)) {
+                  ++branches;
+                  const auto br = opt::as<opt::insn_br>(in);
+                  pred = bb, bb = compare(br->op, scalar(br->lhs()), scalar(br->rhs())) ? br->dest1() : br->dest2();
+                  break;
+               } else
+               if (opt::is<opt::insn_switch_br>(in)) {
+                  ++switches;
+                  const auto switch_br = opt::as<opt::insn_switch_br>(in);
+                  const auto index = scalar(switch_br->index());
+                  if (RSN_UNLIKELY(index >= switch_br->dests().size())) return _trapped;
+                  pred = bb, bb = switch_br->dests()[index];
+                  break;
+               } else
+                  return _trapped; // insn_oops, or unknown
+            }
+         }
+      }
+   };
+
+   // what a run is observed to produce (the results and the digest of written memory, then the outcome) for comparison between runs
+   inline std::vector<unsigned long long> observe(ref_interp &interp, opt::proc *pc, const std::vector<unsigned long long> &args) {
+      std::vector<unsigned long long> res;
+      const auto outcome = interp.run(pc, args, res);
+      if (outcome == ref_interp::_done) res.push_back(interp.memory_hash()); else res.clear();
+      return res.push_back(outcome), res;
+   }
+
+} // namespace rsn::test
+
+# endif // # ifndef RSN_INCLUDED_TEST_REF_INTERP
@@ -0,0 +1,158 @@
+// test/simplify-rules.cc -- digest (and throughput) of the binop peephole rules of insn_binop::simplify
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/simplify-rules.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc -o simplify-rules
+   Running:
+      ./simplify-rules [N]    -- a structural digest of the results of simplify() (to a fixed point, up to 8 rounds) over N (200000 by default)
+                                 random binops with operands of every kind (VRs, interesting constants, symbols, a data block, and rel_disp
+                                 operands, also equal ones), for comparing implementations of the rules (built from different revisions)
+      ./simplify-rules bench  -- the time of a rewriting pass (one simplify() per insn) over 200000 fresh random binops (one per BB), and of a
+                                 pass over the insns left at a fixed point (where all matches fail), best of 5 and 15 runs respectively
+   Prints the digest, or the timings. */
+
+# include "opt.hh"
+
+# include <algorithm>     // min
+# include <chrono>        // steady_clock
+# include <cstdio>        // printf
+# include <cstdlib>       // atoi
+# include <cstring>       // strcmp
+# include <iterator>      // size
+# include <random>        // mt19937_64
+# include <typeinfo>      // typeid
+# include <unordered_map> // unordered_map
+# include <vector>        // vector
+
+namespace {
+   namespace opt = rsn::opt;
+
+   // Digest ///////////////////////////////////////////////////////////////////////////////////////
+   void digest(int count) {
+      std::mt19937_64 rng(7);
+      std::vector<rsn::lib::smart_ptr<opt::vreg>> vrs;
+      for (int sn = 0; sn < 4; ++sn) vrs.push_back(opt::vreg::make());
+      const auto ext1 = opt::rel_base::make({11, 1}), ext2 = opt::rel_base::make({22, 2});
+      const auto block = opt::data::make({33, 3}, {opt::abs::make(1)});
+      static constexpr unsigned long long vals[] = {0, 1, 2, 3, 4, 7, 8, 63, 64, 65, 100, -1ull, -2ull, -8ull, 1ull << 63, (1ull << 63) - 1, 0x5555};
+      const auto operand = [&]()->rsn::lib::smart_ptr<opt::operand>{
+         switch (rng() % 6) {
+         case 0: case 1: return vrs[rng() % vrs.size()];
+         case 2: case 3: return opt::abs::make(vals[rng() % std::size(vals)]);
+         case 4:         return rng() % 3 == 0 ? (rsn::lib::smart_ptr<opt::operand>)block : rng() % 2 ? ext1 : ext2;
+         default:        return opt::rel_disp::make(rng() % 2 ? ext1 : ext2, 8 * (1 + rng() % 2));
+         }
+      };
+
+      unsigned long long res = 0xCBF29CE484222325;
+      const auto mix = [&](unsigned long long val) noexcept{ res = (res ^ val) * 0x100000001B3; };
+      std::unordered_map<const void *, unsigned long long> ids; // VRs and BBs in the order of appearance
+      const auto id = [&](const void *ptr){ return ids.emplace(ptr, ids.size()).first->second; };
+      for (int count_ = 0; count_ < count; ++count_) {
+         const auto pc = opt::proc::make({1, 1});
+         const auto bb = opt::bblock::make(pc);
+         ids.clear();
+         const auto lhs = operand();
+         const auto rhs = rng() % 4 == 0 ? lhs : rng() % 4 == 0 && opt::is<opt::rel_disp>(lhs) ?
+            opt::rel_disp::make(opt::as<opt::rel_disp>(lhs)->base, opt::as<opt::rel_disp>(lhs)->add) : operand();
+         opt::insn_binop::make(bb, (decltype(opt::insn_binop::_add))(rng() % 16), lhs, rhs, vrs[0]), opt::insn_ret::make(bb, {vrs[0]});
+         for (int round = 0; round < 8; ++round) {
+            bool changed{};
+            for (auto _bb = pc->head(); _bb; _bb = _bb->next()) for (auto in: rsn::lib::all(_bb)) if (opt::is<opt::insn_binop>(in)) changed |= in->simplify();
+            mix(changed);
+            if (!changed) break;
+         }
+         for (auto _bb = pc->head(); _bb; _bb = _bb->next()) {
+            mix(0xBB), mix(id(_bb));
+            for (auto in = _bb->head(); in; in = in->next()) {
+               mix(typeid(*in).hash_code());
+               if (opt::is<opt::insn_binop>(in)) mix(opt::as<opt::insn_binop>(in)->op);
+               if (opt::is<opt::insn_br>(in)) mix(opt::as<opt::insn_br>(in)->op);
+               const auto emit = [&](opt::operand *op){
+                  if (opt::is<opt::abs>(op)) mix(1), mix(opt::as<opt::abs>(op)->val); else
+                  if (opt::is<opt::rel_disp>(op)) mix(2), mix(opt::as<opt::rel_disp>(op)->base->id.first), mix(opt::as<opt::rel_disp>(op)->add); else
+                  if (opt::is<opt::rel_base>(op)) mix(3), mix(opt::as<opt::rel_base>(op)->id.first); else
+                     mix(4), mix(id(op));
+               };
+               for (const auto &input: in->inputs()) emit(input);
+               for (const auto &output: in->outputs()) emit(output);
+               for (const auto &target: in->targets()) mix(id(target));
+            }
+         }
+      }
+      std::printf("digest %016llx\n", res);
+   }
+
+   // Throughput ///////////////////////////////////////////////////////////////////////////////////
+   void bench() {
+      constexpr int count = 200000;
+      std::mt19937_64 rng(42);
+      const auto pc = opt::proc::make({1, 1});
+      std::vector<rsn::lib::smart_ptr<opt::vreg>> vrs;
+      for (int sn = 0; sn < 64; ++sn) vrs.push_back(opt::vreg::make());
+      const auto ext1 = opt::rel_base::make({11, 1}), ext2 = opt::rel_base::make({22, 2});
+      const auto operand = [&]()->rsn::lib::smart_ptr<opt::operand>{
+         switch (rng() % 8) {
+         case 0: case 1: case 2: case 3: return vrs[rng() % vrs.size()];
+         case 4:  return opt::abs::make(rng() % 4);
+         case 5:  return opt::abs::make(rng() % 2 ? rng() : rng() % 100);
+         case 6:  return rng() % 2 ? ext1 : ext2;
+         default: return opt::rel_disp::make(rng() % 2 ? ext1 : ext2, 8 * (1 + rng() % 3));
+         }
+      };
+      const auto fresh = [&]{ // one binop per BB (so that rewrites splitting BBs are cheap)
+         while (pc->head()) pc->head()->eliminate();
+         for (int sn = 0; sn < count; ++sn) {
+            const auto lhs = operand(), rhs = rng() % 10 == 0 ? lhs : operand();
+            const auto bb = opt::bblock::make(pc);
+            opt::insn_binop::make(bb, (decltype(opt::insn_binop::_add))(rng() % 16), lhs, rhs, vrs[rng() % vrs.size()]), opt::insn_ret::make(bb, {});
+         }
+      };
+      const auto binops = [&]{
+         std::vector<opt::insn *> res;
+         for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) if (opt::is<opt::insn_binop>(in)) res.push_back(in);
+         return res;
+      };
+      const auto seconds = [](auto start){ return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+
+      double rewrite_ms = 1e9; unsigned long long rewritten = 0;
+      for (int round = 0; round < 5; ++round) {
+         fresh();
+         const auto fresh_binops = binops();
+         rewritten = 0;
+         const auto start = std::chrono::steady_clock::now();
+         for (auto in: fresh_binops) rewritten += in->simplify();
+         rewrite_ms = std::min(rewrite_ms, seconds(start));
+      }
+      fresh();
+      for (bool changed = true; changed;) {
+         changed = false;
+         for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in: rsn::lib::all(bb)) if (opt::is<opt::insn_binop>(in)) changed |= in->simplify();
+      }
+      const auto residue = binops();
+      double fail_ms = 1e9;
+      for (int round = 0; round < 15; ++round) {
+         bool changed{};
+         const auto start = std::chrono::steady_clock::now();
+         for (auto in: residue) changed |= in->simplify();
+         fail_ms = std::min(fail_ms, seconds(start));
+         if (changed) return void(std::printf("not a fixed point\n"));
+      }
+      std::printf("rewriting pass: %d insns (%llu rewritten) in %.2f ms; failing matches: %zu insns in %.2f ms\n",
+         count, rewritten, rewrite_ms, residue.size(), fail_ms);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(), 0;
+   digest(argc > 1 ? std::atoi(argv[1]) : 200000);
+}
@@ -0,0 +1,333 @@
+// test/slp-vectorization.cc -- check (and benchmark) of transform_slp_vectorization and the vector insns
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/slp-vectorization.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc interp.cc -o slp-vectorization
+   Running:
+      ./slp-vectorization [N]        -- N (5000 by default) random unrolled kernels: groups of 2 to 5 stores of isomorphic expression trees
+                                        (over loads from data blocks and extern buffers, constants, and params, with lanes perturbed now and
+                                        then, stores shuffled, aliasing loads and stores interleaved, and intermediate values escaping) to
+                                        adjacent words of an extern buffer, by rel_disp or a pointer VR, in SSA form, each run with 6 sets
+                                        of arguments against the reference interpreter before and after vectorization (for SSE2, AVX2, or
+                                        with all costs at one), by the tier-0 interpreter then, and after out-of-SSA translation; then 3000
+                                        random vbinop insns (of every element width and lane count) by the tier-0 interpreter against the
+                                        reference one, and whether lanewise division is taken as speculatable
+      ./slp-vectorization bench [N]  -- N (10^7 by default) iterations of four 8-word state updates, run by the tier-0 interpreter before and
+                                        after vectorization for SSE2 and AVX2, best of 5
+   Prints the number of mismatches and the procedures vectorized, or the timings. */
+
+# include "interp.hh"
+# include "opt.hh"
+# include "test/ref-interp.hh"
+
+# include <algorithm> // min, shuffle
+# include <chrono>    // steady_clock
+# include <cstdio>    // printf
+# include <cstdlib>   // atoi, atoll
+# include <cstring>   // memset, strcmp
+# include <random>    // mt19937_64
+# include <utility>   // swap
+# include <vector>    // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   constexpr decltype(opt::insn_binop::_add) ops[] = {opt::insn_binop::_add, opt::insn_binop::_sub, opt::insn_binop::_umul, opt::insn_binop::_smul,
+      opt::insn_binop::_and, opt::insn_binop::_or, opt::insn_binop::_xor, opt::insn_binop::_shl, opt::insn_binop::_ushr, opt::insn_binop::_sshr,
+      opt::insn_binop::_udiv};
+
+   constexpr int buffer_size = 16; // in words
+   unsigned long long buffers[2][buffer_size];
+   const auto resolver = [](const opt::rel_base *rb)->void *{ return rb->id.first == 101 ? buffers[0] : rb->id.first == 102 ? buffers[1] : nullptr; };
+
+   class kernel_gen {
+   public:
+      explicit kernel_gen(std::mt19937_64 &rng) noexcept: rng(rng) {
+         for (unsigned long long sn = 0; sn < 3; ++sn) {
+            std::vector<rsn::lib::smart_ptr<opt::imm>> values;
+            for (unsigned long long sn2 = 0; sn2 < 12; ++sn2) values.push_back(opt::abs::make(sn2 * 0x1234567 + sn * 77 + 5));
+            blocks.push_back(opt::data::make({sn + 1, 9}, std::move(values)));
+         }
+         for (unsigned long long sn = 0; sn < 2; ++sn) buffers.push_back(opt::rel_base::make({101 + sn, 1}));
+      }
+   public:
+      rsn::lib::smart_ptr<opt::proc> make() {
+         const auto pc = opt::proc::make({rng(), rng()});
+         const auto bb = opt::bblock::make(pc);
+         const auto x = opt::vreg::make(), y = opt::vreg::make();
+         opt::insn_entry::make(bb, {x, y});
+         sources.assign(blocks.begin(), blocks.end()), sources.insert(sources.end(), buffers.begin(), buffers.end());
+         dests.assign(buffers.begin(), buffers.end());
+         escaping.clear();
+         for (int count = 0; count < 2; ++count) { // pointer VRs
+            const auto ptr = opt::vreg::make();
+            opt::insn_binop::make_add(bb, blocks[rng() % blocks.size()], opt::abs::make(8 * (rng() % 4)), ptr), sources.push_back(ptr);
+            const auto _ptr = opt::vreg::make();
+            opt::insn_binop::make_add(bb, buffers[rng() % buffers.size()], opt::abs::make(8 * (rng() % 4)), _ptr);
+            sources.push_back(_ptr), dests.push_back(_ptr);
+         }
+         for (int group = 1 + rng() % 3; group; --group) {
+            const int lanes = rng() % 4 ? 4 : 2 + rng() % 4;
+            const auto tree = shape(0);
+            opt::operand *const dest = dests[rng() % dests.size()];
+            const int offset = 8 * (rng() % 6);
+            std::vector<int> order(lanes);
+            for (int lane = 0; lane < lanes; ++lane) order[lane] = lane;
+            if (rng() % 3 == 0) std::shuffle(order.begin(), order.end(), rng);
+            for (int lane: order) {
+               const auto val = emit(bb, tree, lane, rng() % 2 ? x : y);
+               opt::insn_store::make(bb, val, address(bb, dest, offset + 8 * lane));
+               if (rng() % 15 == 0) {
+                  const auto res = opt::vreg::make();
+                  opt::insn_load::make(bb, sources[rng() % sources.size()], res), escaping.push_back(res);
+               }
+               if (rng() % 15 == 0) opt::insn_store::make(bb, x, dests[rng() % dests.size()]);
+            }
+         }
+         std::vector<rsn::lib::smart_ptr<opt::operand>> results{x};
+         results.insert(results.end(), escaping.begin(), escaping.end());
+         for (auto buffer: buffers) for (int sn = 0; sn < buffer_size; ++sn) {
+            const auto res = opt::vreg::make();
+            opt::insn_load::make(bb, address(bb, buffer, 8 * sn), res), results.push_back(res);
+         }
+         opt::insn_ret::make(bb, std::move(results));
+         return pc;
+      }
+   private:
+      struct node { int kind, op, source, offset; unsigned long long val; std::vector<node> kids; }; // kind: 0 load, 1 abs, 2 param, 3-4 binop
+      node shape(int depth) {
+         node res{};
+         res.kind = depth > 2 ? rng() % 3 : rng() % 5;
+         res.op = rng() % (rng() % 8 ? 10 : 11), res.source = rng() % sources.size(), res.offset = 8 * (rng() % 4);
+         res.val = rng() % 3 ? rng() % 70 : rng();
+         if (res.kind >= 3) res.kids = {shape(depth + 1), shape(depth + 1)};
+         return res;
+      }
+      rsn::lib::smart_ptr<opt::operand> address(opt::bblock *bb, opt::operand *base, int offset) {
+         if (!offset) return base;
+         if (!opt::is<opt::vreg>(base)) return opt::rel_disp::make(opt::as<opt::rel_base>(base), offset);
+         const auto res = opt::vreg::make();
+         return opt::insn_binop::make_add(bb, base, opt::abs::make(offset), res), res;
+      }
+      rsn::lib::smart_ptr<opt::operand> emit(opt::bblock *bb, const node &tree, int lane, opt::vreg *param) {
+         const bool perturbed = rng() % 60 == 0;
+         switch (tree.kind) {
+         case 0:
+            {  const auto res = opt::vreg::make();
+               opt::insn_load::make(bb, address(bb, sources[tree.source], tree.offset + 8 * lane + (perturbed ? 8 : 0)), res);
+               if (rng() % 20 == 0) escaping.push_back(res);
+               return res;
+            }
+         case 1:
+            return opt::abs::make(perturbed ? tree.val + lane : tree.val);
+         case 2:
+            return param;
+         default:
+            {  auto lhs = emit(bb, tree.kids[0], lane, param), rhs = emit(bb, tree.kids[1], lane, param);
+               if (rng() % 8 == 0) std::swap(lhs, rhs);
+               const auto res = opt::vreg::make();
+               opt::insn_binop::make(bb, ops[perturbed ? (tree.op + 1) % 10 : tree.op], std::move(lhs), std::move(rhs), res);
+               if (rng() % 20 == 0) escaping.push_back(res);
+               return res;
+            }
+         }
+      }
+   private:
+      std::mt19937_64 &rng;
+      std::vector<rsn::lib::smart_ptr<opt::data>> blocks;            // immutable (loads only)
+      std::vector<rsn::lib::smart_ptr<opt::rel_base>> buffers;       // extern symbols
+      std::vector<rsn::lib::smart_ptr<opt::operand>> sources, dests; // address roots for loads and stores (including pointer VRs)
+      std::vector<rsn::lib::smart_ptr<opt::vreg>> escaping;          // values returned besides the contents of the buffers
+   };
+
+   int check(int count) {
+      int bad = 0, vectorized = 0;
+      ref_interp ref;
+      opt::interpreter interp(resolver);
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = kernel_gen(rng).make();
+         const std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {7, 100}, {-1ull, 12345}, {1ull << 63, 3}};
+         std::vector<std::vector<unsigned long long>> expected;
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         opt::transform_to_ssa(pc);
+         opt::transform_copy_propag(pc), opt::transform_dce(pc);
+         const auto groups = opt::stats.slp_groups;
+         opt::transform_slp_vectorization(pc, seed % 2 ? opt::slp_avx2 : seed % 4 ? opt::slp_sse2 : opt::slp_params{4, 1, 1, 1, 1, 1});
+         vectorized += opt::stats.slp_groups != groups;
+         opt::transform_dce(pc);
+         const auto compare = [&](const char *when){
+            for (std::size_t sn = 0; sn < args.size(); ++sn) if (RSN_UNLIKELY(rsn::test::observe(ref, pc, args[sn]) != expected[sn]))
+               return std::printf("seed %d: mismatch %s on arguments #%zu\n", seed, when, sn), ++bad, false;
+            return true;
+         };
+         const auto tier0 = [&]{
+            for (std::size_t sn = 0; sn < args.size(); ++sn) {
+               if (expected[sn].back() != ref_interp::_done) continue;
+               std::vector<unsigned long long> results;
+               std::memset(buffers, 0, sizeof buffers);
+               const bool ok = interp.run(pc, args[sn], results);
+               results.push_back(expected[sn][expected[sn].size() - 2]), results.push_back(ref_interp::_done); // (memory hashes are not comparable)
+               if (RSN_UNLIKELY(!ok) || RSN_UNLIKELY(results != expected[sn]))
+                  return std::printf("seed %d: tier-0 mismatch on arguments #%zu\n", seed, sn), ++bad, false;
+            }
+            return true;
+         };
+         if (compare("after vectorization") && tier0()) opt::transform_out_of_ssa(pc), compare("after out-of-SSA");
+      }
+      std::printf("%d bad of %d (%d procedures vectorized, %llu groups, %llu vector insns)\n", bad, count, vectorized,
+         opt::stats.slp_groups, opt::stats.slp_insns);
+      return bad != 0;
+   }
+
+   // random vbinop insns of every element width and lane count (up to 64 bytes) over unaligned vloads from a data block
+   int check_lanes(int count) {
+      int bad = 0, runs = 0;
+      std::mt19937_64 rng(1);
+      ref_interp ref;
+      opt::interpreter interp(resolver);
+      for (int sn = 0; sn < count; ++sn) {
+         std::vector<rsn::lib::smart_ptr<opt::imm>> values;
+         for (int sn2 = 0; sn2 < 8; ++sn2) values.push_back(opt::abs::make(rng() % 3 ? rng() : rng() % 70));
+         const auto block = opt::data::make({1, (unsigned long long)sn}, std::move(values));
+         const unsigned width = 1u << rng() % 4, lanes = (rng() % 4 + 1) * 8 / width * (rng() % 2 + 1) / 2 + 1;
+         if (lanes * width > 64) continue;
+         const auto pc = opt::proc::make({7, (unsigned long long)sn});
+         const auto bb = opt::bblock::make(pc);
+         const auto param = opt::vreg::make(), lhs = opt::vreg::make(), _rhs = opt::vreg::make(), res = opt::vreg::make();
+         opt::insn_entry::make(bb, {param});
+         opt::insn_vload::make(bb, lanes, width, block, lhs), opt::insn_vload::make(bb, lanes, width, opt::rel_disp::make(block, 1 + rng() % 7), _rhs);
+         const auto rhs = rng() % 3 == 0 ? (rsn::lib::smart_ptr<opt::operand>)param : rng() % 2 ? (rsn::lib::smart_ptr<opt::operand>)opt::abs::make(rng()) :
+            _rhs;
+         opt::insn_vbinop::make(bb, ops[rng() % 10], lanes, width, rng() % 5 ? (rsn::lib::smart_ptr<opt::operand>)lhs : param, rhs, res);
+         const auto buffer = opt::rel_base::make({101, 1});
+         opt::insn_vstore::make(bb, lanes, width, res, opt::rel_disp::make(buffer, rng() % 8));
+         std::vector<rsn::lib::smart_ptr<opt::operand>> results;
+         for (int sn2 = 0; sn2 < 9; ++sn2) {
+            const auto word = opt::vreg::make();
+            opt::insn_load::make(bb, opt::rel_disp::make(buffer, 8 * sn2), word), results.push_back(word);
+         }
+         opt::insn_ret::make(bb, std::move(results));
+         const unsigned long long arg = rng();
+         std::vector<unsigned long long> expected, got;
+         ++runs;
+         std::memset(buffers, 0, sizeof buffers);
+         if (RSN_LIKELY(ref.run(pc, {arg}, expected) == ref_interp::_done) && RSN_LIKELY(interp.run(pc, {arg}, got)) && RSN_LIKELY(got == expected)) continue;
+         std::printf("vbinop %d: tier-0 mismatch\n", sn), ++bad;
+      }
+      for (auto op: {opt::insn_binop::_udiv, opt::insn_binop::_urem, opt::insn_binop::_sdiv, opt::insn_binop::_srem}) {
+         const auto pc = opt::proc::make({8, 1});
+         const auto bb = opt::bblock::make(pc);
+         const auto lhs = opt::vreg::make(), rhs = opt::vreg::make(), res = opt::vreg::make();
+         opt::insn_entry::make(bb, {lhs, rhs});
+         if (RSN_UNLIKELY(opt::speculatable(opt::insn_vbinop::make(bb, op, 2, 8, lhs, rhs, res))))
+            std::printf("lanewise division (op %d) taken as speculatable\n", (int)op), ++bad;
+         opt::insn_ret::make(bb, {});
+      }
+      std::printf("%d bad of %d vbinop runs (and 4 speculatable() queries)\n", bad, runs);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   unsigned long long state[1024];
+
+   double best(opt::proc *pc, unsigned long long n, unsigned long long &result) {
+      double res = 1e9;
+      for (int round = 0; round < 5; ++round) {
+         opt::interpreter interp([](const opt::rel_base *)->void *{ return state; });
+         std::vector<unsigned long long> results;
+         for (unsigned long long sn = 0; sn < 1024; ++sn) state[sn] = sn * 0x9E3779B97F4A7C15;
+         interp.run(pc, {1}, results); // translation
+         for (unsigned long long sn = 0; sn < 1024; ++sn) state[sn] = sn * 0x9E3779B97F4A7C15;
+         const auto start = std::chrono::steady_clock::now();
+         interp.run(pc, {n}, results);
+         res = std::min(res, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()), result = results[0];
+      }
+      return res;
+   }
+
+   /* kernels 0 to 2: for (j = 0; j < n; ++j) for (k = 0; k < 8; ++k) s[k] = f(s[k], t[k]) (s is an extern buffer, and t a data block, addressed
+      by rel_disp); kernel 3: for (j = 0; j < n; ++j) { p = s + (j * 64 & 8191); for (k = 0; k < 8; ++k) p[k] = (p[k] ^ n) + (p[k] >> 7) } */
+   rsn::lib::smart_ptr<opt::proc> make_kernel(int kernel, unsigned long long id) {
+      std::vector<rsn::lib::smart_ptr<opt::imm>> values;
+      for (unsigned long long sn = 0; sn < 8; ++sn) values.push_back(opt::abs::make(sn * 77 + 1));
+      const auto s = opt::rel_base::make({11, id});
+      const auto t = opt::data::make({12, id}, std::move(values));
+      const auto pc = opt::proc::make({1, id});
+      const auto n = opt::vreg::make(), j = opt::vreg::make(), sum = opt::vreg::make(), ptr = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc), header = opt::bblock::make(pc), body = opt::bblock::make(pc), exit = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {n}), opt::insn_mov::make(entry, opt::abs::make(0), j), opt::insn_jmp::make(entry, header);
+      opt::insn_br::make_bult(header, j, n, body, exit);
+      if (kernel == 3) {
+         const auto scaled = opt::vreg::make(), offset = opt::vreg::make();
+         opt::insn_binop::make_shl(body, j, opt::abs::make(6), scaled), opt::insn_binop::make_and(body, scaled, opt::abs::make(8191), offset);
+         opt::insn_binop::make_add(body, s, offset, ptr);
+      }
+      for (int k = 0; k < 8; ++k) {
+         const auto x = opt::vreg::make(), y = opt::vreg::make(), r = opt::vreg::make(), u = opt::vreg::make(), w = opt::vreg::make();
+         rsn::lib::smart_ptr<opt::operand> addr = opt::rel_disp::make(s, 8 * k);
+         if (kernel == 3) {
+            const auto _addr = opt::vreg::make();
+            opt::insn_binop::make_add(body, ptr, opt::abs::make(8 * k), _addr), addr = _addr;
+         }
+         opt::insn_load::make(body, addr, x);
+         if (kernel != 3) opt::insn_load::make(body, opt::rel_disp::make(t, 8 * k), y);
+         switch (kernel) {
+         case 0:
+            opt::insn_binop::make_add(body, x, y, u), opt::insn_binop::make_ushr(body, x, opt::abs::make(3), w), opt::insn_binop::make_xor(body, u, w, r);
+            break;
+         case 1:
+            opt::insn_binop::make_and(body, x, opt::abs::make(0xFFFF), u), opt::insn_binop::make_or(body, u, y, r);
+            break;
+         case 2:
+            opt::insn_binop::make_umul(body, x, y, u), opt::insn_binop::make_add(body, u, n, r);
+            break;
+         default:
+            opt::insn_binop::make_xor(body, x, n, u), opt::insn_binop::make_ushr(body, x, opt::abs::make(7), w), opt::insn_binop::make_add(body, u, w, r);
+         }
+         opt::insn_store::make(body, r, addr);
+      }
+      opt::insn_binop::make_add(body, j, opt::abs::make(1), j), opt::insn_jmp::make(body, header);
+      opt::insn_mov::make(exit, opt::abs::make(0), sum);
+      for (int k = 0; k < 64; ++k) {
+         const auto x = opt::vreg::make();
+         opt::insn_load::make(exit, opt::rel_disp::make(s, 8 * k), x), opt::insn_binop::make_add(exit, sum, x, sum);
+      }
+      opt::insn_ret::make(exit, {sum});
+      opt::transform_to_ssa(pc);
+      opt::transform_copy_propag(pc), opt::transform_dce(pc);
+      return pc;
+   }
+
+   void bench(unsigned long long n) {
+      static const char *const names[] = {"(s + t) ^ (s >> 3)", "(s & 0xFFFF) | t", "s * t + n", "(p ^ n) + (p >> 7)"};
+      unsigned long long id = 0;
+      for (int kernel = 0; kernel < 4; ++kernel) for (int target = 0; target < 2; ++target) {
+         const auto pc = make_kernel(kernel, ++id);
+         unsigned long long before, after;
+         const double before_ms = best(pc, n, before);
+         const auto groups = opt::stats.slp_groups;
+         opt::transform_slp_vectorization(pc, target ? opt::slp_avx2 : opt::slp_sse2);
+         const double after_ms = best(pc, n, after);
+         std::printf("%-20s %s: %llu groups, %.1f ms -> %.1f ms (%.2fx), results %s\n", names[kernel], target ? "avx2" : "sse2",
+            opt::stats.slp_groups - groups, before_ms, after_ms, before_ms / after_ms, before == after ? "agree" : "DIFFER");
+      }
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoll(argv[2]) : 10'000'000), 0;
+   const int res = check(argc > 1 ? std::atoi(argv[1]) : 5000);
+   return check_lanes(3000) || res;
+}
@@ -0,0 +1,167 @@
+// test/ssa-updater.cc -- check (and benchmark) of ssa_updater and the SSA repair after inlining
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/ssa-updater.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc -o ssa-updater
+   Running:
+      ./ssa-updater [N]        -- N (2000 by default) random procedures of structured code (test/gen.hh) brought to SSA form by the updater
+                                  alone (each VR in turn gets fresh VRs for its definitions, and its uses are rewritten, every other time
+                                  from a use list collected beforehand), then N procedures that call a callee in SSA form (with one or more
+                                  returns) and get it inlined, with the caller in SSA form and not; every VR must have a single definition
+                                  afterwards (save for the caller not in SSA form), and the results must agree with the reference
+                                  interpreter on 8 sets of arguments
+      ./ssa-updater bench [N]  -- the time for SSA construction by the updater and by transform_to_ssa in N (200 by default) random procedures
+                                  of unstructured code (test/gen.hh) of 200 BBs
+   Prints the number of mismatches, the phi insns placed by the updater and by transform_to_ssa, and the callees with several returns, or
+   the figures. */
+
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <chrono>  // steady_clock
+# include <cstdio>  // printf
+# include <cstdlib> // atoi
+# include <cstring> // strcmp
+# include <random>  // mt19937_64
+# include <utility> // pair
+# include <vector>  // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   unsigned long long count_phis(opt::proc *pc) {
+      unsigned long long res = 0;
+      for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in && opt::is<opt::insn_phi>(in); in = in->next()) ++res;
+      return res;
+   }
+
+   bool single_defs(opt::proc *pc) {
+      std::vector<signed char> defined(opt::number_vregs(pc));
+      for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next())
+      for (const auto &output: in->outputs()) if (RSN_UNLIKELY(defined[output->sn])) return false; else defined[output->sn] = true;
+      return true;
+   }
+
+   // SSA construction by the updater alone (VR by VR), with the uses collected beforehand if requested
+   void to_ssa(opt::proc *pc, bool use_list) {
+      std::vector<rsn::lib::smart_ptr<opt::vreg>> vars;
+      {  std::vector<signed char> seen(opt::number_vregs(pc));
+         for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next())
+         for (const auto &output: in->outputs()) if (!seen[output->sn]) seen[output->sn] = true, vars.push_back(output);
+      }
+      opt::ssa_updater up(pc);
+      for (const auto &var: vars) {
+         up.reset();
+         std::vector<std::pair<opt::insn *, rsn::lib::smart_ptr<opt::operand> *>> uses;
+         if (use_list) for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next())
+            for (auto &input: in->inputs()) if (input == var) uses.emplace_back(in, &input);
+         for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next())
+         for (auto &output: in->outputs()) if (output == var) {
+            const auto val = opt::vreg::make();
+            output = val, up.add_def(bb, val);
+         }
+         if (use_list) up.rewrite_uses(uses); else up.rewrite_uses(var);
+      }
+   }
+
+   // a caller of callee from test/gen.hh (a region, the call, possibly another definition of its result, and another region)
+   rsn::lib::smart_ptr<opt::proc> gen_caller(std::mt19937_64 &rng, opt::proc *callee) {
+      rsn::test::region_gen gen(rng);
+      auto pc = opt::proc::make({rng(), rng()});
+      auto bb = gen.region(pc, gen.entry(pc));
+      opt::insn_call::make(bb, callee, {gen.vrs[0], gen.vrs[2]}, {gen.vrs[3]});
+      if (rng() % 2) opt::insn_binop::make_add(bb, gen.vrs[3], gen.vrs[1], gen.vrs[3]);
+      gen.ret(gen.region(pc, bb));
+      return pc;
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count) {
+      int bad = 0, multiple = 0;
+      unsigned long long phis = 0, phis_ssa = 0;
+      ref_interp ref;
+      ref.max_steps = 200'000;
+      const std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {7, 100}, {-1ull, 12345}, {1ull << 63, 3}, {13, 29}, {2, 2}};
+      const auto compare = [&](int seed, opt::proc *pc, const std::vector<std::vector<unsigned long long>> &expected, const char *what){
+         for (std::size_t sn = 0; sn < args.size(); ++sn) if (RSN_UNLIKELY(rsn::test::observe(ref, pc, args[sn]) != expected[sn]))
+            return std::printf("seed %d: %s, mismatch on arguments #%zu\n", seed, what, sn), ++bad, false;
+         return true;
+      };
+
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = rsn::test::gen_regions(rng);
+         {  std::mt19937_64 rng(seed);
+            const auto pc = rsn::test::gen_regions(rng);
+            opt::transform_to_ssa(pc), phis_ssa += count_phis(pc);
+         }
+         std::vector<std::vector<unsigned long long>> expected;
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         to_ssa(pc, seed % 2), phis += count_phis(pc);
+         if (RSN_UNLIKELY(!single_defs(pc))) { std::printf("seed %d: a VR defined twice after SSA construction\n", seed), ++bad; continue; }
+         compare(seed, pc, expected, "SSA construction");
+      }
+      for (int seed = 0; seed < count; ++seed) for (bool ssa: {false, true}) {
+         std::mt19937_64 rng(seed);
+         const auto callee = opt::proc::make({rng(), rng()});
+         {  rsn::test::region_gen gen(rng);
+            const auto bb = gen.region(callee, gen.entry(callee));
+            opt::insn_ret::make(bb, {gen.vrs[0]});
+         }
+         int rets = 0;
+         for (auto bb = callee->head(); bb; bb = bb->next()) rets += opt::is<opt::insn_ret>(bb->rear());
+         opt::transform_to_ssa(callee), opt::transform_copy_propag(callee), opt::transform_dce(callee);
+         const auto pc = gen_caller(rng, callee);
+         std::vector<std::vector<unsigned long long>> expected;
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         if (ssa) opt::transform_to_ssa(pc), opt::transform_copy_propag(pc), opt::transform_dce(pc);
+         opt::insn *call = {};
+         for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) if (opt::is<opt::insn_call>(in)) call = in;
+         if (!call) continue; // removed as dead
+         multiple += ssa && rets > 1;
+         call->simplify();
+         if (RSN_UNLIKELY(ssa && !single_defs(pc))) { std::printf("seed %d: a VR defined twice after inlining\n", seed), ++bad; continue; }
+         compare(seed, pc, expected, ssa ? "inlining in SSA form" : "inlining not in SSA form");
+      }
+      std::printf("%d bad of %d + 2 x %d; %llu phi insns placed by the updater (%llu by transform_to_ssa); %d callees with several returns\n",
+         bad, count, count, phis, phis_ssa, multiple);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   void bench(int count) {
+      const auto ms = [](auto start){ return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+      double updater = 0, ssa = 0;
+      std::size_t insns = 0;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = rsn::test::gen(rng, 200, 6, 8);
+         for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) ++insns;
+         auto start = std::chrono::steady_clock::now();
+         to_ssa(pc, false);
+         updater += ms(start);
+         rng.seed(seed);
+         const auto _pc = rsn::test::gen(rng, 200, 6, 8);
+         start = std::chrono::steady_clock::now();
+         opt::transform_to_ssa(_pc);
+         ssa += ms(start);
+      }
+      std::printf("%d procedures, %zu insns: the updater %.1f ms, transform_to_ssa %.1f ms\n", count, insns, updater, ssa);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoi(argv[2]) : 200), 0;
+   return check(argc > 1 ? std::atoi(argv[1]) : 2000);
+}
@@ -0,0 +1,147 @@
+// test/switch-lowering.cc -- check (and comparison of lowering strategies) of transform_switch_lowering
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/switch-lowering.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc -o switch-lowering
+   Running:
+      ./switch-lowering [N]  -- N (20000 by default) random switch_br insns over an entry param (with 1 to 300 entries, dense, skewed, or
+                                in runs, in SSA form or not, and with default or table-friendly costs), each run with in- and out-of-range
+                                indices against the reference interpreter before and after lowering (and after out-of-SSA translation)
+      ./switch-lowering bench -- insn_br and insn_switch_br executed per dispatch before and after lowering (average over the in-range
+                                indices, and worst case) for typical shapes, and lowering time for large random switches
+   Prints the number of mismatches, or the per-shape figures. */
+
+# include "opt.hh"
+# include "test/ref-interp.hh"
+
+# include <algorithm> // max
+# include <chrono>    // steady_clock
+# include <cstdio>    // printf
+# include <cstdlib>   // atoi
+# include <cstring>   // strcmp
+# include <random>    // mt19937_64
+# include <vector>    // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   // switch_br on the entry param, with targets (selected by the pattern) adding distinct constants to an accumulator
+   rsn::lib::smart_ptr<opt::proc> make_switch(const std::vector<unsigned> &pattern, unsigned targets, unsigned long long id) {
+      auto pc = opt::proc::make({id, 1});
+      auto x = opt::vreg::make(), acc = opt::vreg::make();
+      auto entry = opt::bblock::make(pc);
+      std::vector<opt::bblock *> bbs;
+      for (unsigned sn = 0; sn < targets; ++sn) bbs.push_back(opt::bblock::make(pc));
+      auto join = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {x}), opt::insn_mov::make(entry, opt::abs::make(7), acc);
+      std::vector<opt::bblock *> dests;
+      for (auto sn: pattern) dests.push_back(bbs[sn]);
+      opt::insn_switch_br::make(entry, x, std::move(dests));
+      for (unsigned sn = 0; sn < targets; ++sn)
+         opt::insn_binop::make_add(bbs[sn], acc, opt::abs::make(100 * sn + 1), acc), opt::insn_jmp::make(bbs[sn], join);
+      opt::insn_ret::make(join, {acc});
+      return pc;
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count) {
+      int bad = 0;
+      ref_interp interp;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const unsigned targets = 1 + rng() % 6, size = 1 + rng() % (rng() % 2 ? 10 : 300), mode = rng() % 3;
+         std::vector<unsigned> pattern;
+         for (unsigned sn = 0; sn < size; ++sn) switch (mode) {
+         case 0:  pattern.push_back(rng() % targets); break;                                        // dense
+         case 1:  pattern.push_back(rng() % 8 ? 0 : rng() % targets); break;                        // skewed
+         default: pattern.push_back(!pattern.empty() && rng() % 5 ? pattern.back() : rng() % targets); // in runs
+         }
+         const auto pc = make_switch(pattern, targets, rng());
+         std::vector<unsigned long long> indices{-1ull, 1ull << 63, 64, 65};
+         for (unsigned sn = 0; sn < size + 3; ++sn) indices.push_back(sn);
+         std::vector<std::vector<unsigned long long>> expected;
+         for (auto index: indices) expected.push_back(rsn::test::observe(interp, pc, {index}));
+
+         opt::switch_lowering_params params;
+         if (seed % 5 == 0) params.min_table_cases = 2, params.jump_table_cost = 2;
+         if (seed % 2) opt::transform_to_ssa(pc);
+         opt::transform_switch_lowering(pc, params);
+         const auto compare = [&](const char *when){
+            for (std::size_t sn = 0; sn < indices.size(); ++sn) if (RSN_UNLIKELY(rsn::test::observe(interp, pc, {indices[sn]}) != expected[sn]))
+               return std::printf("seed %d: mismatch %s at index %lld\n", seed, when, (long long)indices[sn]), ++bad, false;
+            return true;
+         };
+         if (!compare("after lowering")) continue;
+         if (seed % 2) opt::transform_out_of_ssa(pc), compare("after out-of-SSA");
+      }
+      std::printf("%d bad of %d (%llu tables, %llu bit tests, %llu branches emitted)\n", bad, count,
+         opt::stats.sw_tables, opt::stats.sw_bit_tests, opt::stats.sw_branches);
+      return bad != 0;
+   }
+
+   // Comparison of Lowering Strategies ////////////////////////////////////////////////////////////
+   void bench(const char *name, const std::vector<unsigned> &pattern, unsigned targets) {
+      const auto pc = make_switch(pattern, targets, 2);
+      ref_interp interp;
+      const auto measure = [&](const char *when){
+         unsigned long long branches = 0, switches = 0, steps = 0, worst = 0;
+         std::vector<unsigned long long> results;
+         for (unsigned long long sn = 0; sn < pattern.size(); ++sn) {
+            const auto _branches = interp.branches, _switches = interp.switches;
+            interp.run(pc, {sn}, results), steps += interp.steps;
+            branches += interp.branches - _branches, switches += interp.switches - _switches;
+            worst = std::max(worst, interp.branches - _branches + interp.switches - _switches);
+         }
+         std::printf("  %s: %.2f br + %.2f switch_br (worst %llu), %.2f insns", when,
+            (double)branches / pattern.size(), (double)switches / pattern.size(), worst, (double)steps / pattern.size());
+      };
+      std::printf("%-30s", name), measure("before"), opt::transform_switch_lowering(pc), measure("after"), std::printf("\n");
+   }
+
+   void bench() {
+      std::vector<unsigned> pattern;
+      for (unsigned sn = 0; sn < 16; ++sn) pattern.push_back(sn);
+      bench("dense, 16 targets", pattern, 16);
+      pattern.clear();
+      for (unsigned sn = 0; sn < 3; ++sn) pattern.push_back(sn);
+      bench("dense, 3 targets", pattern, 3);
+      pattern.clear();
+      for (unsigned sn = 0; sn < 40; ++sn) pattern.push_back(sn % 3 == 0 ? 1 : sn % 7 == 0 ? 2 : 0);
+      bench("40 entries, 3 targets", pattern, 3);
+      pattern.clear();
+      for (unsigned sn = 0; sn < 4001; ++sn) pattern.push_back(sn == 1 ? 1 : sn == 5 ? 2 : sn == 100 ? 3 : sn == 1000 ? 4 : sn == 4000 ? 5 : 0);
+      bench("sparse, 5 cases in 4001", pattern, 6);
+      pattern.clear();
+      for (unsigned sn = 0; sn < 1000; ++sn) pattern.push_back(sn >= 500 && sn < 520 ? 1 + (sn - 500) % 10 : 0);
+      bench("sparse + dense cluster", pattern, 11);
+      pattern.clear();
+      for (unsigned sn = 0; sn < 256; ++sn) pattern.push_back(sn / 32);
+      bench("256 entries in 8 runs", pattern, 8);
+
+      std::mt19937_64 rng(1);
+      for (unsigned size: {1000, 10000, 100000}) {
+         std::vector<unsigned> pattern;
+         for (unsigned sn = 0; sn < size; ++sn) pattern.push_back(rng() % 3 ? 0 : rng() % 50);
+         const auto pc = make_switch(pattern, 50, 3);
+         const auto start = std::chrono::steady_clock::now();
+         opt::transform_switch_lowering(pc);
+         std::printf("lowering %u random entries (50 targets): %.1f ms\n", size,
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+      }
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(), 0;
+   return check(argc > 1 ? std::atoi(argv[1]) : 20000);
+}
@@ -0,0 +1,163 @@
+// test/tail-recursion.cc -- check (and benchmark) of transform_tail_recursion
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/tail-recursion.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc interp.cc -o tail-recursion
+   Running:
+      ./tail-recursion [N]        -- N (1000 by default) random procedures of unstructured code (test/gen.hh) given a depth parameter and a
+                                     recursive exit (a self call while the depth is non-zero: 3 of 4 in tail position, some with the
+                                     arguments swapped, and the rest with the result used after the call), in SSA form; the pass must
+                                     convert exactly the tail calls, and the results must agree with the reference interpreter on 6 sets of
+                                     shallow arguments, in SSA form and after out-of-SSA translation, both by the reference interpreter and by
+                                     the tier-0 interpreter (interp.hh); each converted procedure is then run 20000 levels deep (beyond the
+                                     call nesting of the tier-0 interpreter) by both interpreters, and the results must agree again
+      ./tail-recursion bench [N]  -- the time for the pass in N (200 by default) such procedures of 200 BBs, and for running them 5000 levels
+                                     deep by the tier-0 interpreter before and after the pass
+   Prints the number of mismatches, the procedures converted, and those that complete the deep run by the tier-0 interpreter before and
+   after the pass, or the figures. */
+
+# include "interp.hh"
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <chrono>  // steady_clock
+# include <cstdio>  // printf
+# include <cstdlib> // atoi
+# include <cstring> // strcmp
+# include <random>  // mt19937_64
+# include <vector>  // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+   using results = std::vector<unsigned long long>;
+
+   /* a procedure from test/gen.hh with an extra (depth) parameter, whose exit BB returns if the depth is zero, or calls the procedure itself
+      with the depth decremented; tail is 0 for a self call whose result is used, 1 for a tail call, and 2 for a tail call with the first two
+      arguments swapped */
+   rsn::lib::smart_ptr<opt::proc> gen(std::mt19937_64 &rng, int bb_count, int vr_count, int insn_count, int tail) {
+      auto pc = rsn::test::gen(rng, bb_count, vr_count, insn_count, true);
+      const auto entry = opt::as<opt::insn_entry>(pc->head()->head());
+      const auto ret = opt::as<opt::insn_ret>(pc->rear()->rear());
+      const auto depth = opt::vreg::make();
+      {  std::vector<rsn::lib::smart_ptr<opt::vreg>> params(entry->params().begin(), entry->params().end());
+         params.push_back(depth);
+         opt::insn_entry::make(entry, std::move(params)), entry->eliminate();
+      }
+      const std::vector<rsn::lib::smart_ptr<opt::operand>> res(ret->results().begin(), ret->results().end());
+      const auto exit = pc->rear(), base = opt::bblock::make(pc), rec = opt::bblock::make(pc);
+      ret->eliminate(), opt::insn_br::make_beq(exit, depth, opt::abs::make(0), base, rec);
+      opt::insn_ret::make(base, res);
+
+      const auto _depth = opt::vreg::make();
+      opt::insn_binop::make_sub(rec, depth, opt::abs::make(1), _depth);
+      std::vector<rsn::lib::smart_ptr<opt::operand>> args{tail == 2 ? res[1] : res[0], tail == 2 ? res[0] : res[1], _depth};
+      if (rng() % 2) {
+         const auto sum = opt::vreg::make();
+         opt::insn_binop::make_add(rec, args[0], res.back(), sum), args[0] = sum;
+      }
+      std::vector<rsn::lib::smart_ptr<opt::vreg>> outs;
+      for (std::size_t sn = 0; sn < res.size(); ++sn) outs.push_back(opt::vreg::make());
+      opt::insn_call::make(rec, pc, std::move(args), outs);
+      std::vector<rsn::lib::smart_ptr<opt::operand>> results(outs.begin(), outs.end());
+      if (!tail) {
+         const auto _res = opt::vreg::make();
+         opt::insn_binop::make_xor(rec, outs[0], opt::abs::make(7), _res), results[0] = _res;
+      }
+      opt::insn_ret::make(rec, std::move(results));
+      return pc;
+   }
+
+   results run(opt::proc *pc, const results &args) {
+      opt::interpreter interp;
+      results res;
+      if (!interp.run(pc, args, res)) res.clear(), res.push_back(-1ull); // a trap
+      return res;
+   }
+   results run(ref_interp &ref, opt::proc *pc, const results &args) {
+      results res;
+      if (const auto outcome = ref.run(pc, args, res); outcome != ref_interp::_done)
+         res.clear(), res.push_back(outcome == ref_interp::_trapped ? -1ull : -2ull); // a trap, or cut off
+      return res;
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count) {
+      int bad = 0, converted = 0, deep_before = 0, deep_after = 0;
+      ref_interp ref;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         const int tail = rng() % 4 ? 1 + rng() % 2 : 0;
+         const auto pc = gen(rng, 3 + seed % 5, 3 + seed % 3, 6, tail);
+         const std::vector<results> args{{0, 0, 0}, {1, 2, 1}, {5, 3, 7}, {7, 1, 30}, {-1ull, 12345, 3}, {1ull << 63, 3, 100}};
+         std::vector<results> expected;
+         for (const auto &_args: args) expected.push_back(run(ref, pc, _args));
+         const results deep{1, 2, 20'000};
+         const auto fail = [&](const char *what){ return std::printf("seed %d: %s\n", seed, what), ++bad, false; };
+         const auto compare = [&](const char *when){
+            for (std::size_t sn = 0; sn < args.size(); ++sn)
+               if (RSN_UNLIKELY(run(ref, pc, args[sn]) != expected[sn]) || RSN_UNLIKELY(run(pc, args[sn]) != expected[sn])) return fail(when);
+            return true;
+         };
+
+         opt::transform_to_ssa(pc);
+         const auto before = run(pc, deep);
+         if (RSN_UNLIKELY(opt::transform_tail_recursion(pc) != (tail != 0))) { fail("tail calls not converted exactly"); continue; }
+         if (!compare("mismatch in SSA form")) continue;
+         opt::transform_out_of_ssa(pc);
+         if (!compare("mismatch after out-of-SSA translation")) continue;
+         if (!tail) continue;
+         ++converted, deep_before += before.size() != 1;
+         const auto after = run(pc, deep);
+         if (RSN_UNLIKELY(after != run(ref, pc, deep))) { fail("mismatch in the deep run"); continue; }
+         deep_after += after.size() != 1;
+      }
+      std::printf("%d bad of %d; %d converted, of them %d -> %d complete 20000 levels deep on the tier-0 interpreter\n", bad, count, converted,
+         deep_before, deep_after);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   void bench(int count) {
+      std::vector<rsn::lib::smart_ptr<opt::proc>> pcs;
+      std::size_t insns = 0;
+      for (int seed = 0; seed < count; ++seed) {
+         std::mt19937_64 rng(seed);
+         pcs.push_back(gen(rng, 200, 6, 2, 1 + seed % 2));
+         opt::transform_to_ssa(pcs.back());
+         for (auto bb = pcs.back()->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) ++insns;
+      }
+      const auto ms = [](auto start){ return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+      const results deep{1, 2, 5000};
+      double pass = 0, before = 0, after = 0;
+      opt::stats = {};
+      for (const auto &pc: pcs) {
+         auto start = std::chrono::steady_clock::now();
+         run(pc, deep);
+         before += ms(start);
+         start = std::chrono::steady_clock::now();
+         opt::transform_tail_recursion(pc);
+         pass += ms(start);
+         start = std::chrono::steady_clock::now();
+         run(pc, deep);
+         after += ms(start);
+      }
+      std::printf("%d procedures, %zu insns: the pass %.1f ms (%llu tail calls); 5000 levels deep %.1f ms -> %.1f ms\n", count, insns, pass,
+         opt::stats.tail_calls, before, after);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoi(argv[2]) : 200), 0;
+   return check(argc > 1 ? std::atoi(argv[1]) : 1000);
+}
@@ -0,0 +1,222 @@
+// test/tier0.cc -- check (and benchmark) of the tier-0 interpreter (interp.hh)
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/tier0.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc interp.cc -o tier0
+   For an ASan run, add -fsanitize=address, and run with ASAN_OPTIONS=detect_leaks=0 (self-recursive procedures are reference cycles) and
+   a larger host stack (ulimit -s 65536), as the frames of instrumented code are too big for 10000 nested calls on the default one.
+   Running:
+      ./tier0 [N]        -- hand-written cases (phi copy cycles, recursion, calls through a vtable, and every trap case), then N (3000 by
+                            default) seeds of random procedures of 4 kinds (arithmetic with division and switch_br, and memory accesses on host
+                            buffers, each not in SSA form and in SSA form), each run with 5 sets of arguments against the reference interpreter
+      ./tier0 bench [N]  -- the iterative factorial loop of README.md with the argument N (10^8 by default) by the threaded interpreter, by a
+                            naive walk over the IR lists (with is<> dispatch and VR values indexed by vreg::sn), and by the reference
+                            interpreter (hash-map based), in million insns per second, not in SSA form and in SSA form
+   Prints the number of failures and mismatches, or the throughput figures. */
+
+# include "interp.hh"
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <chrono>  // steady_clock
+# include <cstdio>  // printf
+# include <cstdlib> // atoi, atoll
+# include <cstring> // memset, strcmp
+# include <random>  // mt19937_64
+# include <vector>  // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using opt::interpreter;
+   using rsn::test::ref_interp;
+   using results = std::vector<unsigned long long>;
+
+   // Hand-Written Cases ///////////////////////////////////////////////////////////////////////////
+   int failures = 0;
+   void expect(const char *name, bool ok) { std::printf("%-44s %s\n", name, ok ? "ok" : "FAILED"), failures += !ok; }
+
+   void cases() {
+      interpreter interp;
+      results res;
+      {  // (a, b, c) = (b, c, a) n times by phi insns (a copy cycle), and the loop counter
+         const auto pc = opt::proc::make({1, 1});
+         const auto n = opt::vreg::make(), a0 = opt::vreg::make(), b0 = opt::vreg::make(), a = opt::vreg::make(), b = opt::vreg::make(),
+            c = opt::vreg::make(), i = opt::vreg::make(), i1 = opt::vreg::make();
+         const auto entry = opt::bblock::make(pc), loop = opt::bblock::make(pc), exit = opt::bblock::make(pc);
+         opt::insn_entry::make(entry, {n, a0, b0}), opt::insn_jmp::make(entry, loop);
+         opt::insn_phi::make(loop, {a0, b}, a), opt::insn_phi::make(loop, {b0, c}, b), opt::insn_phi::make(loop, {opt::abs::make(100), a}, c);
+         opt::insn_phi::make(loop, {opt::abs::make(0), i1}, i);
+         opt::insn_binop::make_add(loop, i, opt::abs::make(1), i1), opt::insn_br::make_bult(loop, i, n, loop, exit);
+         opt::insn_ret::make(exit, {a, b, c});
+         bool ok = true;
+         for (unsigned long long count = 0; count < 7; ++count) {
+            results expected{1, 2, 100};
+            for (unsigned long long sn = 0; sn < count; ++sn) expected = {expected[1], expected[2], expected[0]};
+            ok &= interp.run(pc, {count, 1, 2}, res) && res == expected;
+         }
+         expect("phi copy cycle", ok);
+      }
+      const auto fact = opt::proc::make({2, 2});
+      {  const auto n = opt::vreg::make(), m = opt::vreg::make(), r = opt::vreg::make(), p = opt::vreg::make();
+         const auto entry = opt::bblock::make(fact), rec = opt::bblock::make(fact), base = opt::bblock::make(fact);
+         opt::insn_entry::make(entry, {n}), opt::insn_br::make_beq(entry, n, opt::abs::make(0), base, rec);
+         opt::insn_binop::make_sub(rec, n, opt::abs::make(1), m), opt::insn_call::make(rec, fact, {m}, {r});
+         opt::insn_binop::make_umul(rec, r, n, p), opt::insn_ret::make(rec, {p});
+         opt::insn_ret::make(base, {opt::abs::make(1)});
+         expect("recursive factorial", interp.run(fact, {20}, res) && res == results{2432902008176640000});
+      }
+      {  const auto vtable = opt::data::make({3, 3}, {opt::abs::make(0), fact});
+         const auto pc = opt::proc::make({4, 4});
+         const auto x = opt::vreg::make(), f = opt::vreg::make(), r = opt::vreg::make();
+         const auto entry = opt::bblock::make(pc);
+         opt::insn_entry::make(entry, {x}), opt::insn_load::make(entry, opt::rel_disp::make(vtable, 8), f);
+         opt::insn_call::make(entry, f, {x}, {r}), opt::insn_ret::make(entry, {r});
+         expect("call through a vtable", interp.run(pc, {5}, res) && res == results{120});
+         const auto pc2 = opt::proc::make({5, 5});
+         const auto entry2 = opt::bblock::make(pc2);
+         opt::insn_entry::make(entry2, {x}), opt::insn_call::make(entry2, fact, {x, x}, {r}), opt::insn_ret::make(entry2, {r});
+         expect("argument count mismatch traps", !interp.run(pc2, {5}, res));
+      }
+      {  const auto ext = opt::rel_base::make({7, 7});
+         const auto pc = opt::proc::make({8, 8});
+         const auto x = opt::vreg::make(), y = opt::vreg::make();
+         const auto entry = opt::bblock::make(pc), bb1 = opt::bblock::make(pc), bb2 = opt::bblock::make(pc);
+         opt::insn_entry::make(entry, {x}), opt::insn_br::make_beq(entry, x, opt::abs::make(0), bb1, bb2);
+         opt::insn_load::make(bb1, ext, y), opt::insn_ret::make(bb1, {y}), opt::insn_ret::make(bb2, {x});
+         expect("unresolved symbol traps only when used", interp.run(pc, {3}, res) && res == results{3} && !interp.run(pc, {0}, res));
+         static unsigned long long word = 42;
+         interpreter interp2([](const opt::rel_base *rb)->void *{ return rb->id.first == 7 ? &word : nullptr; });
+         expect("resolved extern symbol", interp2.run(pc, {0}, res) && res == results{42});
+      }
+      {  const auto pc = opt::proc::make({9, 9});
+         const auto x = opt::vreg::make(), y = opt::vreg::make(), z = opt::vreg::make();
+         const auto entry = opt::bblock::make(pc), bb1 = opt::bblock::make(pc), bb2 = opt::bblock::make(pc);
+         opt::insn_entry::make(entry, {x, y}), opt::insn_binop::make_sdiv(entry, x, y, z), opt::insn_switch_br::make(entry, z, {bb1, bb2});
+         opt::insn_ret::make(bb1, {opt::abs::make(10)}), opt::insn_ret::make(bb2, {opt::abs::make(11)});
+         expect("sdiv and switch_br", interp.run(pc, {2, 2}, res) && res == results{11} && interp.run(pc, {0, 5}, res) && res == results{10});
+         expect("division by zero traps", !interp.run(pc, {1, 0}, res));
+         expect("signed division overflow traps", !interp.run(pc, {1ull << 63, -1ull}, res));
+         expect("switch_br index out of range traps", !interp.run(pc, {9, 3}, res));
+      }
+      {  const auto pc = opt::proc::make({10, 10});
+         const auto x = opt::vreg::make(), r = opt::vreg::make();
+         const auto entry = opt::bblock::make(pc);
+         opt::insn_entry::make(entry, {x}), opt::insn_call::make(entry, pc, {x}, {r}), opt::insn_ret::make(entry, {r});
+         expect("unbounded recursion traps", !interp.run(pc, {1}, res));
+         const auto pc2 = opt::proc::make({11, 11});
+         const auto entry2 = opt::bblock::make(pc2);
+         opt::insn_entry::make(entry2, {x}), opt::insn_oops::make(entry2);
+         expect("oops traps", !interp.run(pc2, {1}, res));
+      }
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   unsigned long long buf1[1024], buf2[1024]; // for the extern symbols of gen_mem (the second one is addressed at the middle)
+
+   int check(int count) {
+      int bad = 0;
+      unsigned long long runs = 0;
+      const auto resolver = [](const opt::rel_base *rb)->void *{ return rb->id.first == 11 ? buf1 : rb->id.first == 22 ? buf2 + 512 : nullptr; };
+      ref_interp ref;
+      for (int seed = 0; seed < count; ++seed) for (int kind = 0; kind < 4; ++kind) {
+         std::mt19937_64 rng(seed);
+         const auto pc = kind < 2 ? rsn::test::gen(rng, 3 + seed % 6, 3 + seed % 3, 5, true) : rsn::test::gen_mem(rng, 3 + seed % 6, 3 + seed % 3, 6, true);
+         if (kind % 2) opt::transform_to_ssa(pc);
+         interpreter interp(resolver);
+         for (const auto &args: std::vector<results>{{0, 0}, {1, 2}, {5, 3}, {7, 1}, {-1ull, 1ull << 63}}) {
+            results expected, got;
+            const bool ref_ok = ref.run(pc, args, expected) == ref_interp::_done;
+            std::memset(buf1, 0, sizeof buf1), std::memset(buf2, 0, sizeof buf2);
+            const bool ok = interp.run(pc, args, got);
+            ++runs;
+            if (RSN_LIKELY(ok == ref_ok) && RSN_LIKELY(!ok || got == expected)) continue;
+            std::printf("seed %d, kind %d: mismatch (reference %s, tier-0 %s)\n", seed, kind, ref_ok ? "done" : "trapped", ok ? "done" : "trapped"), ++bad;
+            break;
+         }
+      }
+      std::printf("%d bad of %d seeds x 4 kinds (%llu runs)\n", bad, count, runs);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   // naive interpreter: a walk over the IR lists with is<> dispatch, and VR values in a vector indexed by vreg::sn (only the insns of the
+   // factorial loop, not in SSA form)
+   unsigned long long walk(opt::proc *pc, unsigned long long arg, unsigned long long &steps) {
+      std::vector<unsigned long long> regs(opt::number_vregs(pc));
+      const auto val = [&](opt::operand *op) noexcept{ return opt::is<opt::vreg>(op) ? regs[opt::as<opt::vreg>(op)->sn] : opt::as<opt::abs>(op)->val; };
+      for (auto bb = pc->head();;) for (auto in = bb->head(); in; in = in->next()) {
+         ++steps;
+         if (opt::is<opt::insn_entry>(in)) regs[opt::as<opt::insn_entry>(in)->params()[0]->sn] = arg; else
+         if (opt::is<opt::insn_mov>(in)) regs[opt::as<opt::insn_mov>(in)->dest()->sn] = val(opt::as<opt::insn_mov>(in)->src()); else
+         if (opt::is<opt::insn_binop>(in)) {
+            const auto binop = opt::as<opt::insn_binop>(in);
+            const auto lhs = val(binop->lhs()), rhs = val(binop->rhs());
+            regs[binop->dest()->sn] = binop->op == opt::insn_binop::_umul ? lhs * rhs : binop->op == opt::insn_binop::_sub ? lhs - rhs : lhs + rhs;
+         } else
+         if (opt::is<opt::insn_jmp>(in)) {
+            bb = opt::as<opt::insn_jmp>(in)->dest();
+            break;
+         } else
+         if (opt::is<opt::insn_br>(in)) {
+            const auto br = opt::as<opt::insn_br>(in);
+            bb = val(br->lhs()) == val(br->rhs()) ? br->dest1() : br->dest2();
+            break;
+         } else
+            return val(opt::as<opt::insn_ret>(in)->results()[0]);
+      }
+   }
+
+   void bench(unsigned long long n) {
+      const auto pc = opt::proc::make({1, 0}); // iterative factorial (as in README.md)
+      const auto r_arg = opt::vreg::make(), r_res = opt::vreg::make();
+      const auto b0 = opt::bblock::make(pc), b1 = opt::bblock::make(pc), b2 = opt::bblock::make(pc), b3 = opt::bblock::make(pc);
+      opt::insn_entry::make(b0, {r_arg}), opt::insn_mov::make(b0, opt::abs::make(1), r_res), opt::insn_jmp::make(b0, b1);
+      opt::insn_br::make_bne(b1, r_arg, opt::abs::make(0), b2, b3);
+      opt::insn_binop::make_umul(b2, r_res, r_arg, r_res), opt::insn_binop::make_sub(b2, r_arg, opt::abs::make(1), r_arg), opt::insn_jmp::make(b2, b1);
+      opt::insn_ret::make(b3, {r_res});
+      const auto seconds = [](auto start){ return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+      const auto insns = 4 * n + 4; // 4 insns per iteration (the jmp in the entry BB is elided by the threaded interpreter)
+
+      for (bool ssa: {false, true}) {
+         if (ssa) opt::transform_to_ssa(pc);
+         interpreter interp;
+         results res, expected;
+         bool agree = true;
+         interp.run(pc, {1}, res); // decode
+         auto start = std::chrono::steady_clock::now();
+         interp.run(pc, {n}, res);
+         std::printf("%s: threaded %.0f M insns/s", ssa ? "SSA form" : "non-SSA ", insns / seconds(start) / 1e6);
+         if (!ssa) {
+            unsigned long long steps = 0;
+            start = std::chrono::steady_clock::now();
+            expected = {walk(pc, n / 10, steps)};
+            std::printf(", list walk %.0f M insns/s", steps / seconds(start) / 1e6);
+            agree &= interp.run(pc, {n / 10}, res) && res == expected;
+         }
+         ref_interp ref;
+         ref.max_steps = -1;
+         start = std::chrono::steady_clock::now();
+         ref.run(pc, {n / 100}, expected);
+         std::printf(", reference %.0f M insns/s", ref.steps / seconds(start) / 1e6);
+         agree &= interp.run(pc, {n / 100}, res) && res == expected;
+         std::printf("%s\n", agree ? "" : " (MISMATCH)");
+      }
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoll(argv[2]) : 100'000'000), 0;
+   cases();
+   std::printf("%d failures\n", failures);
+   return check(argc > 1 ? std::atoi(argv[1]) : 3000) || failures;
+}
@@ -0,0 +1,167 @@
+// test/value-ranges.cc -- check (and benchmark) of value_ranges and transform_value_ranges
+
+/*    Copyright (C) 2020, 2021 Alexey Protasov (AKA Alex or rusini)
+
+   This is free software: you can redistribute it and/or modify it under the terms of the version 3 of the GNU General Public License
+   as published by the Free Software Foundation (and only version 3).
+
+   This software is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along with this software.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Building (from the root of the repository):
+      c++ -std=c++17 -O2 -I. test/value-ranges.cc ir0.cc opt-*.cc ssa.cc ssa-out.cc -o value-ranges
+   Running:
+      ./value-ranges [N]        -- hand-built cases (a decided bult, and/or masks that change nothing, urem and udiv by a divisor greater than
+                                   the dividend, and the oops guard of x / x for x known to be non-zero, which must go away), then N (3000 by
+                                   default) random procedures of unstructured code (test/gen.hh, with division every other seed) in SSA form,
+                                   brought to a fixed point by the pass, copy propagation, DCE, and cfg_gc, each run with 6 sets of
+                                   arguments against the reference interpreter
+      ./value-ranges bench [N]  -- the time for one run of the pass in N (200 by default) random procedures of 200 BBs in SSA form
+   Prints the outcome of each case, the number of mismatches, the conditional branches before and after, and the pass statistics, or the
+   figures. */
+
+# include "opt.hh"
+# include "test/gen.hh"
+# include "test/ref-interp.hh"
+
+# include <chrono>     // steady_clock
+# include <cstdio>     // printf
+# include <cstdlib>    // atoi
+# include <cstring>    // strcmp
+# include <functional> // function
+# include <random>     // mt19937_64
+# include <vector>     // vector
+
+namespace {
+   namespace opt = rsn::opt;
+   using rsn::test::ref_interp;
+
+   void cleanup(opt::proc *pc) {
+      for (int round = 0; round < 20; ++round) {
+         bool changed = opt::transform_value_ranges(pc);
+         changed |= opt::transform_copy_propag(pc), changed |= opt::transform_dce(pc), changed |= opt::transform_cfg_gc(pc);
+         if (!changed) break;
+      }
+   }
+
+   unsigned long long count(opt::proc *pc, const std::function<bool(opt::insn *)> &pred) {
+      unsigned long long res = 0;
+      for (auto bb = pc->head(); bb; bb = bb->next()) for (auto in = bb->head(); in; in = in->next()) res += pred(in);
+      return res;
+   }
+   bool is_binop(opt::insn *in, decltype(opt::insn_binop::op) op) { return opt::is<opt::insn_binop>(in) && opt::as<opt::insn_binop>(in)->op == op; }
+
+   // Hand-Built Cases /////////////////////////////////////////////////////////////////////////////
+   int failures;
+
+   // entry(a); x = a op1 c1; y = x op2 c2; ret y (with c2 to be found redundant or y constant)
+   void check_binop(const char *name, decltype(opt::insn_binop::op) op1, unsigned long long c1, decltype(opt::insn_binop::op) op2,
+      unsigned long long c2) {
+      const auto pc = opt::proc::make({1, 1});
+      const auto a = opt::vreg::make(), x = opt::vreg::make(), y = opt::vreg::make();
+      const auto entry = opt::bblock::make(pc);
+      opt::insn_entry::make(entry, {a});
+      opt::insn_binop::make(entry, op1, a, opt::abs::make(c1), x), opt::insn_binop::make(entry, op2, x, opt::abs::make(c2), y);
+      opt::insn_ret::make(entry, {y});
+      ref_interp ref;
+      const std::vector<std::vector<unsigned long long>> args{{0}, {1}, {0x1234}, {-1ull}};
+      std::vector<std::vector<unsigned long long>> expected;
+      for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+      const auto before = count(pc, [&](opt::insn *in){ return is_binop(in, op2); });
+      cleanup(pc);
+      bool ok = count(pc, [&](opt::insn *in){ return is_binop(in, op2); }) == before - 1;
+      for (std::size_t sn = 0; sn < args.size(); ++sn) ok &= rsn::test::observe(ref, pc, args[sn]) == expected[sn];
+      std::printf("%-44s %s\n", name, ok ? "ok" : "FAILED"), failures += !ok;
+   }
+
+   void cases() {
+      check_binop("redundant and mask", opt::insn_binop::_and, 0xFF, opt::insn_binop::_and, 0x1FF);
+      check_binop("redundant or mask", opt::insn_binop::_or, 0x10, opt::insn_binop::_or, 0x10);
+      check_binop("urem by a divisor above the dividend", opt::insn_binop::_and, 0xFF, opt::insn_binop::_urem, 1000);
+      check_binop("udiv by a divisor above the dividend", opt::insn_binop::_and, 0xFF, opt::insn_binop::_udiv, 1000);
+      {  // entry(a); x = a & 15; bult x, 16 to L1, L2; L1: ret 1; L2: ret 2
+         const auto pc = opt::proc::make({2, 2});
+         const auto a = opt::vreg::make(), x = opt::vreg::make();
+         const auto entry = opt::bblock::make(pc), bb1 = opt::bblock::make(pc), bb2 = opt::bblock::make(pc);
+         opt::insn_entry::make(entry, {a}), opt::insn_binop::make_and(entry, a, opt::abs::make(15), x);
+         opt::insn_br::make_bult(entry, x, opt::abs::make(16), bb1, bb2);
+         opt::insn_ret::make(bb1, {opt::abs::make(1)}), opt::insn_ret::make(bb2, {opt::abs::make(2)});
+         cleanup(pc);
+         ref_interp ref;
+         std::vector<unsigned long long> res;
+         const bool ok = !count(pc, [](opt::insn *in){ return opt::is<opt::insn_br>(in); }) && ref.run(pc, {-1ull}, res) == ref_interp::_done &&
+            res.front() == 1;
+         std::printf("%-44s %s\n", "decided bult", ok ? "ok" : "FAILED"), failures += !ok;
+      }
+      {  // entry(a); x = a | 1; y = x / x (guarded by insn simplification); ret y
+         const auto pc = opt::proc::make({3, 3});
+         const auto a = opt::vreg::make(), x = opt::vreg::make(), y = opt::vreg::make();
+         const auto entry = opt::bblock::make(pc);
+         opt::insn_entry::make(entry, {a}), opt::insn_binop::make_or(entry, a, opt::abs::make(1), x), opt::insn_binop::make_udiv(entry, x, x, y);
+         opt::insn_ret::make(entry, {y});
+         opt::transform_insn_simplify(pc);
+         const auto oops_count = [](opt::insn *in){ return opt::is<opt::insn_oops>(in); };
+         const bool guarded = count(pc, oops_count) == 1;
+         cleanup(pc);
+         ref_interp ref;
+         std::vector<unsigned long long> res;
+         const bool ok = guarded && !count(pc, oops_count) && !count(pc, [](opt::insn *in){ return opt::is<opt::insn_br>(in); }) &&
+            ref.run(pc, {6}, res) == ref_interp::_done && res.front() == 1;
+         std::printf("%-44s %s\n", "oops guard of x / x for x | 1 removed", ok ? "ok" : "FAILED"), failures += !ok;
+      }
+   }
+
+   // Random Check /////////////////////////////////////////////////////////////////////////////////
+   int check(int count_) {
+      int bad = 0;
+      unsigned long long branches_before = 0, branches_after = 0;
+      ref_interp ref;
+      const auto branch = [](opt::insn *in){ return opt::is<opt::insn_br>(in); };
+      opt::stats = {};
+      for (int seed = 0; seed < count_; ++seed) {
+         std::mt19937_64 rng(seed);
+         const auto pc = rsn::test::gen(rng, 3 + seed % 6, 3 + seed % 3, 8, seed % 2);
+         const std::vector<std::vector<unsigned long long>> args{{0, 0}, {1, 2}, {5, 3}, {7, 1}, {-1ull, 12345}, {1ull << 63, 3}};
+         std::vector<std::vector<unsigned long long>> expected;
+         for (const auto &_args: args) expected.push_back(rsn::test::observe(ref, pc, _args));
+         opt::transform_to_ssa(pc);
+         for (bool changed = true; changed;) changed = false, changed |= opt::transform_copy_propag(pc), changed |= opt::transform_dce(pc);
+         branches_before += count(pc, branch);
+         cleanup(pc);
+         branches_after += count(pc, branch);
+         for (std::size_t sn = 0; sn < args.size(); ++sn) if (RSN_UNLIKELY(rsn::test::observe(ref, pc, args[sn]) != expected[sn])) {
+            std::printf("seed %d: mismatch on arguments #%zu\n", seed, sn), ++bad;
+            break;
+         }
+      }
+      std::printf("%d bad of %d; conditional branches %llu -> %llu (%llu decided, %llu operands made constant, %llu insns found redundant)\n",
+         bad, count_, branches_before, branches_after, opt::stats.vr_branches, opt::stats.vr_consts, opt::stats.vr_insns);
+      return bad != 0;
+   }
+
+   // Benchmark ////////////////////////////////////////////////////////////////////////////////////
+   void bench(int count_) {
+      std::vector<rsn::lib::smart_ptr<opt::proc>> pcs;
+      std::size_t insns = 0;
+      for (int seed = 0; seed < count_; ++seed) {
+         std::mt19937_64 rng(seed);
+         pcs.push_back(rsn::test::gen(rng, 200, 6, 8));
+         opt::transform_to_ssa(pcs.back());
+         insns += count(pcs.back(), [](opt::insn *){ return true; });
+      }
+      opt::stats = {};
+      const auto start = std::chrono::steady_clock::now();
+      for (const auto &pc: pcs) opt::transform_value_ranges(pc);
+      std::printf("%d procedures, %zu insns: %.1f ms (%llu branches decided)\n", count_, insns,
+         std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), opt::stats.vr_branches);
+   }
+}
+
+int main(int argc, char *argv[]) {
+   if (argc > 1 && !std::strcmp(argv[1], "bench")) return bench(argc > 2 ? std::atoi(argv[2]) : 200), 0;
+   cases();
+   std::printf("%d failures\n", failures);
+   return check(argc > 1 ? std::atoi(argv[1]) : 3000) || failures;
+}